@@ -0,0 +1,139 @@
+/*
+Copyright (C) 2017-2019 Topological Manifold
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "file.h"
+
+#include "com/error.h"
+#include "com/print.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Запись и чтение значений, как они находятся в памяти.
+// Массивы и строки записываются как количество элементов и затем сами элементы.
+
+class BinaryWriter
+{
+        CFile m_file;
+        const std::string m_file_name;
+
+        void write(const void* data, size_t size)
+        {
+                if (size > 0 && std::fwrite(data, size, 1, m_file) != 1)
+                {
+                        error("Failed to write to file " + m_file_name);
+                }
+        }
+
+public:
+        explicit BinaryWriter(const std::string& file_name) : m_file(file_name, "wb"), m_file_name(file_name)
+        {
+        }
+
+        template <typename T>
+        void write(const T& v)
+        {
+                static_assert(std::is_trivially_copyable_v<T>);
+
+                write(&v, sizeof(T));
+        }
+
+        template <typename T>
+        void write(const std::vector<T>& v)
+        {
+                static_assert(std::is_trivially_copyable_v<T>);
+
+                write<unsigned long long>(v.size());
+                write(v.data(), v.size() * sizeof(T));
+        }
+
+        void write(const std::string& s)
+        {
+                write<unsigned long long>(s.size());
+                write(s.data(), s.size());
+        }
+};
+
+class BinaryReader
+{
+        const unsigned char* const m_data;
+        const unsigned long long m_size;
+        unsigned long long m_pos = 0;
+
+        void read(void* data, unsigned long long size)
+        {
+                if (size > m_size - m_pos)
+                {
+                        error("Unexpected end of binary file");
+                }
+                if (size > 0)
+                {
+                        std::memcpy(data, m_data + m_pos, size);
+                        m_pos += size;
+                }
+        }
+
+        unsigned long long read_count(unsigned long long element_size)
+        {
+                unsigned long long count = read<unsigned long long>();
+                if (count > (m_size - m_pos) / element_size)
+                {
+                        error("Binary file element count " + to_string(count) + " is out of range");
+                }
+                return count;
+        }
+
+public:
+        BinaryReader(const unsigned char* data, unsigned long long size) : m_data(data), m_size(size)
+        {
+        }
+
+        template <typename T>
+        T read()
+        {
+                static_assert(std::is_trivially_copyable_v<T>);
+
+                T v;
+                read(&v, sizeof(T));
+                return v;
+        }
+
+        template <typename T>
+        void read(std::vector<T>* v)
+        {
+                static_assert(std::is_trivially_copyable_v<T>);
+
+                v->resize(read_count(sizeof(T)));
+                read(v->data(), v->size() * sizeof(T));
+        }
+
+        void read(std::string* s)
+        {
+                s->resize(read_count(1));
+                read(s->data(), s->size());
+        }
+
+        bool at_end() const
+        {
+                return m_pos == m_size;
+        }
+};
@@ -0,0 +1,142 @@
+/*
+Copyright (C) 2017-2019 Topological Manifold
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "file_map.h"
+
+#include "com/error.h"
+
+#if defined(__linux__)
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+FileMap::FileMap(const std::string& file_name)
+{
+        int fd = open(file_name.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+                error("Failed to open file " + file_name);
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0)
+        {
+                close(fd);
+                error("Failed to get size of file " + file_name);
+        }
+
+        m_size = st.st_size;
+
+        if (m_size == 0)
+        {
+                close(fd);
+                m_data = nullptr;
+                return;
+        }
+
+        void* p = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        // Отображение остаётся действительным после закрытия файла
+        close(fd);
+
+        if (p == MAP_FAILED)
+        {
+                error("Failed to map file " + file_name);
+        }
+
+        madvise(p, m_size, MADV_SEQUENTIAL);
+
+        m_data = static_cast<const unsigned char*>(p);
+}
+
+FileMap::~FileMap()
+{
+        if (m_data)
+        {
+                munmap(const_cast<unsigned char*>(m_data), m_size);
+        }
+}
+
+#elif defined(_WIN32)
+
+#include <windows.h>
+
+FileMap::FileMap(const std::string& file_name)
+{
+        m_file = nullptr;
+        m_mapping = nullptr;
+        m_data = nullptr;
+
+        HANDLE file = CreateFileA(file_name.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                  FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+                error("Failed to open file " + file_name);
+        }
+
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size))
+        {
+                CloseHandle(file);
+                error("Failed to get size of file " + file_name);
+        }
+
+        m_size = size.QuadPart;
+
+        if (m_size == 0)
+        {
+                CloseHandle(file);
+                return;
+        }
+
+        HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping)
+        {
+                CloseHandle(file);
+                error("Failed to create mapping of file " + file_name);
+        }
+
+        void* p = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if (!p)
+        {
+                CloseHandle(mapping);
+                CloseHandle(file);
+                error("Failed to map file " + file_name);
+        }
+
+        m_file = file;
+        m_mapping = mapping;
+        m_data = static_cast<const unsigned char*>(p);
+}
+
+FileMap::~FileMap()
+{
+        if (m_data)
+        {
+                UnmapViewOfFile(m_data);
+                CloseHandle(m_mapping);
+                CloseHandle(m_file);
+        }
+}
+
+#else
+
+#error This operating system is not supported
+
+#endif
@@ -0,0 +1,51 @@
+/*
+Copyright (C) 2017-2019 Topological Manifold
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <string>
+
+// Отображение всего файла в память только для чтения
+class FileMap final
+{
+        const unsigned char* m_data;
+        unsigned long long m_size;
+
+#if defined(_WIN32)
+        void* m_file;
+        void* m_mapping;
+#endif
+
+public:
+        explicit FileMap(const std::string& file_name);
+        ~FileMap();
+
+        const unsigned char* data() const
+        {
+                return m_data;
+        }
+
+        unsigned long long size() const
+        {
+                return m_size;
+        }
+
+        FileMap(const FileMap&) = delete;
+        FileMap& operator=(const FileMap&) = delete;
+        FileMap(FileMap&&) = delete;
+        FileMap& operator=(FileMap&&) = delete;
+};
@@ -17,6 +17,10 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "file_sys.h"
 
+#include "com/print.h"
+
+#include <atomic>
+
 #if 0
 
 std::string file_base_name(const std::string& file_name)
@@ -39,11 +43,14 @@ std::string temp_directory()
 #if defined(__linux__)
 
 #include <cstdio>
+#include <sys/stat.h>
+#include <unistd.h>
 
 constexpr const char separators[] = "/";
 
 #elif defined(_WIN32)
 
+#include <sys/stat.h>
 #include <windows.h>
 
 constexpr const char separators[] = "\\/";
@@ -94,4 +101,84 @@ std::string temp_directory()
 #endif
 }
 
+bool file_size_and_time(const std::string& file_name, unsigned long long* size, long long* time)
+{
+#if defined(__linux__)
+
+        struct stat st;
+        if (stat(file_name.c_str(), &st) != 0)
+        {
+                return false;
+        }
+        *size = st.st_size;
+        *time = static_cast<long long>(st.st_mtim.tv_sec) * 1'000'000'000 + st.st_mtim.tv_nsec;
+        return true;
+
+#elif defined(_WIN32)
+
+        struct _stat64 st;
+        if (_stat64(file_name.c_str(), &st) != 0)
+        {
+                return false;
+        }
+        *size = st.st_size;
+        *time = st.st_mtime;
+        return true;
+
+#endif
+}
+
+std::string unique_file_name(const std::string& file_name)
+{
+        static std::atomic_ullong counter{0};
+
+#if defined(__linux__)
+        const unsigned long long process_id = getpid();
+#elif defined(_WIN32)
+        const unsigned long long process_id = GetCurrentProcessId();
+#endif
+
+        return file_name + "." + to_string(process_id) + "." + to_string(counter++);
+}
+
+bool create_directory(const std::string& directory)
+{
+#if defined(__linux__)
+
+        return mkdir(directory.c_str(), 0700) == 0;
+
+#elif defined(_WIN32)
+
+        return CreateDirectoryA(directory.c_str(), nullptr) != 0;
+
+#endif
+}
+
+bool remove_directory(const std::string& directory)
+{
+#if defined(__linux__)
+
+        return rmdir(directory.c_str()) == 0;
+
+#elif defined(_WIN32)
+
+        return RemoveDirectoryA(directory.c_str()) != 0;
+
+#endif
+}
+
+bool replace_file(const std::string& from, const std::string& to)
+{
+#if defined(__linux__)
+
+        // Существующий файл заменяется атомарно
+        return std::rename(from.c_str(), to.c_str()) == 0;
+
+#elif defined(_WIN32)
+
+        return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+
+#endif
+}
+
 #endif
@@ -24,3 +24,18 @@ std::string file_extension(const std::string& file_name);
 std::string file_parent_path(const std::string& file_name);
 
 std::string temp_directory();
+
+// Размер файла и время его последнего изменения. Если файла нет, то false.
+bool file_size_and_time(const std::string& file_name, unsigned long long* size, long long* time);
+
+// Имя файла в той же папке, что и file_name, отличающееся от имён,
+// полученных этой функцией в других потоках и процессах
+std::string unique_file_name(const std::string& file_name);
+
+// Создание папки и удаление пустой папки. Если ошибка, то false.
+bool create_directory(const std::string& directory);
+bool remove_directory(const std::string& directory);
+
+// Переименование файла from в to с заменой существующего файла to.
+// При ошибке файл to остаётся прежним. Если ошибка, то false.
+bool replace_file(const std::string& from, const std::string& to);
@@ -0,0 +1,103 @@
+/*
+Copyright (C) 2017-2019 Topological Manifold
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "process.h"
+
+#include "error.h"
+#include "print.h"
+
+#if defined(__linux__)
+
+#include <cerrno>
+#include <cstring>
+#include <spawn.h>
+#include <sys/wait.h>
+
+extern char** environ;
+
+namespace
+{
+// Путь к исполняемому файлу этой программы
+constexpr const char PROGRAM_FILE[] = "/proc/self/exe";
+
+void kill_processes(const std::vector<pid_t>& pids)
+{
+        for (pid_t pid : pids)
+        {
+                kill(pid, SIGKILL);
+                waitpid(pid, nullptr, 0);
+        }
+}
+}
+
+std::vector<int> run_program_copies(const std::vector<std::vector<std::string>>& arguments)
+{
+        std::vector<pid_t> pids;
+
+        for (const std::vector<std::string>& args : arguments)
+        {
+                std::vector<char*> argv;
+                argv.push_back(const_cast<char*>(PROGRAM_FILE));
+                for (const std::string& s : args)
+                {
+                        argv.push_back(const_cast<char*>(s.c_str()));
+                }
+                argv.push_back(nullptr);
+
+                pid_t pid;
+                int result = posix_spawn(&pid, PROGRAM_FILE, nullptr, nullptr, argv.data(), environ);
+                if (result != 0)
+                {
+                        kill_processes(pids);
+                        error("Failed to start process: " + std::string(std::strerror(result)));
+                }
+                pids.push_back(pid);
+        }
+
+        std::vector<int> exit_codes;
+
+        for (size_t i = 0; i < pids.size(); ++i)
+        {
+                int status;
+                pid_t result;
+                do
+                {
+                        result = waitpid(pids[i], &status, 0);
+                } while (result == -1 && errno == EINTR);
+
+                if (result == -1)
+                {
+                        // Процессы, которые ещё не закончились, не должны остаться работать
+                        const int error_number = errno;
+                        kill_processes(std::vector<pid_t>(pids.cbegin() + i, pids.cend()));
+                        error("Failed to wait for process " + to_string(pids[i]) + ": " + std::strerror(error_number));
+                }
+
+                exit_codes.push_back(WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+        }
+
+        return exit_codes;
+}
+
+#else
+
+std::vector<int> run_program_copies(const std::vector<std::vector<std::string>>&)
+{
+        error("Running program copies is not supported on this operating system");
+}
+
+#endif
@@ -0,0 +1,26 @@
+/*
+Copyright (C) 2017-2019 Topological Manifold
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Запуск этой же программы в отдельных процессах с заданными аргументами
+// и ожидание завершения всех процессов. Возвращаются коды завершения
+// процессов, или -1, если процесс завершился не через выход из программы.
+std::vector<int> run_program_copies(const std::vector<std::vector<std::string>>& arguments);
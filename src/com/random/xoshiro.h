@@ -0,0 +1,106 @@
+/*
+Copyright (C) 2017-2019 Topological Manifold
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ David Blackman, Sebastiano Vigna.
+ Scrambled Linear Pseudorandom Number Generators.
+ ACM Transactions on Mathematical Software, 47 (2021), 36:1-36:32.
+
+ Guy L. Steele Jr., Doug Lea, Christine H. Flood.
+ Fast splittable pseudorandom number generators.
+ OOPSLA 2014.
+*/
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <limits>
+
+inline uint64_t splitmix64(uint64_t* state)
+{
+        uint64_t z = (*state += 0x9e3779b97f4a7c15u);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9u;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebu;
+        return z ^ (z >> 31);
+}
+
+// Перемешивание 64-битного числа с добавлением значения,
+// например, для получения начального числа по нескольким значениям
+inline uint64_t hash_combine_64(uint64_t hash, uint64_t value)
+{
+        uint64_t state = hash ^ value;
+        return splitmix64(&state);
+}
+
+// Генератор xoshiro256**. Состояние 32 байта, 64 бита на вызов,
+// поэтому для double из std::uniform_real_distribution достаточно одного вызова.
+class Xoshiro256StarStar
+{
+        std::array<uint64_t, 4> m_state;
+
+        static uint64_t rotl(uint64_t x, int k)
+        {
+                return (x << k) | (x >> (64 - k));
+        }
+
+public:
+        using result_type = uint64_t;
+
+        static constexpr result_type min()
+        {
+                return std::numeric_limits<result_type>::min();
+        }
+
+        static constexpr result_type max()
+        {
+                return std::numeric_limits<result_type>::max();
+        }
+
+        explicit Xoshiro256StarStar(uint64_t seed_value)
+        {
+                seed(seed_value);
+        }
+
+        // Состояние заполняется генератором splitmix64, поэтому
+        // близкие начальные числа дают несвязанные последовательности
+        void seed(uint64_t seed_value)
+        {
+                for (uint64_t& s : m_state)
+                {
+                        s = splitmix64(&seed_value);
+                }
+        }
+
+        result_type operator()()
+        {
+                const uint64_t result = rotl(m_state[1] * 5, 7) * 9;
+
+                const uint64_t t = m_state[1] << 17;
+
+                m_state[2] ^= m_state[0];
+                m_state[3] ^= m_state[1];
+                m_state[1] ^= m_state[2];
+                m_state[0] ^= m_state[3];
+
+                m_state[2] ^= t;
+
+                m_state[3] = rotl(m_state[3], 45);
+
+                return result;
+        }
+};
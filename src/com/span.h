@@ -55,6 +55,16 @@ public:
                 return m_pointer;
         }
 
+        constexpr T* begin() const noexcept
+        {
+                return m_pointer;
+        }
+
+        constexpr T* end() const noexcept
+        {
+                return m_pointer + m_size;
+        }
+
         constexpr size_t size() const noexcept
         {
                 return m_size;
@@ -96,6 +96,65 @@ public:
         }
 };
 
+// Очередь ограниченного размера для передачи данных от одного потока другому.
+// При заполненной очереди добавление ждёт, при пустой очереди ждёт извлечение.
+template <typename T>
+class ThreadBoundedQueue
+{
+        std::mutex m_mutex;
+        std::condition_variable m_cv_push, m_cv_pop;
+        std::queue<T> m_queue;
+        const size_t m_max_size;
+        bool m_closed = false;
+
+public:
+        ThreadBoundedQueue(size_t max_size) : m_max_size(std::max(size_t(1), max_size))
+        {
+        }
+
+        // Возвращается false, если очередь закрыта
+        bool push(T&& value)
+        {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_cv_push.wait(lock, [this] { return m_closed || m_queue.size() < m_max_size; });
+                if (m_closed)
+                {
+                        return false;
+                }
+                m_queue.push(std::move(value));
+                lock.unlock();
+                m_cv_pop.notify_one();
+                return true;
+        }
+
+        // Возвращается пустое значение, если очередь закрыта и в ней нет элементов
+        std::optional<T> pop()
+        {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_cv_pop.wait(lock, [this] { return m_closed || !m_queue.empty(); });
+                if (m_queue.empty())
+                {
+                        return std::optional<T>();
+                }
+                std::optional value(std::move(m_queue.front()));
+                m_queue.pop();
+                lock.unlock();
+                m_cv_push.notify_one();
+                return value;
+        }
+
+        // После закрытия добавления не выполняются, а оставшиеся элементы можно извлечь
+        void close()
+        {
+                {
+                        std::lock_guard lg(m_mutex);
+                        m_closed = true;
+                }
+                m_cv_push.notify_all();
+                m_cv_pop.notify_all();
+        }
+};
+
 class ThreadBarrier
 {
         std::mutex m_mutex;
@@ -35,7 +35,7 @@ namespace
 std::atomic_int global_call_counter = 0;
 }
 
-Initialization::Initialization()
+Initialization::Initialization(InitializationType type) : m_type(type)
 {
         if (++global_call_counter != 1)
         {
@@ -46,6 +46,11 @@ Initialization::Initialization()
 
         reset_time();
 
+        if (m_type == InitializationType::Headless)
+        {
+                return;
+        }
+
 #if defined(__linux__)
 
         xlib_init();
@@ -63,7 +68,10 @@ Initialization::Initialization()
 
 Initialization::~Initialization()
 {
-        vulkan_window_terminate();
+        if (m_type == InitializationType::Window)
+        {
+                vulkan_window_terminate();
+        }
 
         log_exit();
 }
@@ -17,9 +17,20 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #pragma once
 
-struct Initialization
+// Без оконной системы инициализируются только общие части программы,
+// например, для рисования без окон на компьютерах без дисплея
+enum class InitializationType
 {
-        Initialization();
+        Window,
+        Headless
+};
+
+class Initialization
+{
+        InitializationType m_type;
+
+public:
+        explicit Initialization(InitializationType type);
         ~Initialization();
 
         Initialization(const Initialization&) = delete;
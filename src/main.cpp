@@ -19,6 +19,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "com/error.h"
 #include "init/init.h"
+#include "painter/batch/batch_render.h"
 #include "ui/application.h"
 
 #include <exception>
@@ -29,7 +30,14 @@ int main(int argc, char* argv[])
         {
                 try
                 {
-                        Initialization init;
+                        if (batch_render_command_line(argc, argv))
+                        {
+                                Initialization init(InitializationType::Headless);
+
+                                return batch_render(argc, argv);
+                        }
+
+                        Initialization init(InitializationType::Window);
 
                         return application(argc, argv);
                 }
@@ -57,7 +65,7 @@ int main(int argc, char* argv[])
 
 int main()
 {
-        Initialization init;
+        Initialization init(InitializationType::Window);
 }
 
 #endif
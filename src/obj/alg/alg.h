@@ -225,6 +225,84 @@ std::vector<Vector<N, float>> unique_point_vertices(const Obj<N>* obj)
         return obj_alg_implementation::to_vector(vertices);
 }
 
+// Проверка индексов грани при заданных количествах вершин, нормалей
+// и текстурных координат
+template <size_t N>
+void check_facet_indices(const typename Obj<N>::Facet& facet, int vertex_count, int normal_count, int texcoord_count)
+{
+        for (unsigned i = 0; i < N; ++i)
+        {
+                if (facet.vertices[i] < 0 || facet.vertices[i] >= vertex_count)
+                {
+                        error("Vertex index " + to_string(facet.vertices[i]) + " is out of bounds [0, " +
+                              to_string(vertex_count) + ")");
+                }
+
+                if (facet.has_texcoord)
+                {
+                        if (facet.texcoords[i] < 0 || facet.texcoords[i] >= texcoord_count)
+                        {
+                                error("Texture coordinate index " + to_string(facet.texcoords[i]) +
+                                      " is out of bounds [0, " + to_string(texcoord_count) + ")");
+                        }
+                }
+                else
+                {
+                        if (facet.texcoords[i] != -1)
+                        {
+                                error("No texture but texture coordinate index is not set to -1");
+                        }
+                }
+
+                if (facet.has_normal)
+                {
+                        if (facet.normals[i] < 0 || facet.normals[i] >= normal_count)
+                        {
+                                error("Normal index " + to_string(facet.normals[i]) + " is out of bounds [0, " +
+                                      to_string(normal_count) + ")");
+                        }
+                }
+                else
+                {
+                        if (facet.normals[i] != -1)
+                        {
+                                error("No normals but normal coordinate index is not set to -1");
+                        }
+                }
+        }
+}
+
+// Для трёхмерных объектов. Грань не является треугольником,
+// если все её вершины находятся на одной прямой.
+template <size_t N>
+bool facet_dimension_is_correct(const std::vector<Vector<N, float>>& vertices, const std::array<int, N>& indices)
+{
+        static_assert(N == 3);
+
+        Vector<3, double> e0 = to_vector<double>(vertices[indices[1]] - vertices[indices[0]]);
+        Vector<3, double> e1 = to_vector<double>(vertices[indices[2]] - vertices[indices[0]]);
+
+        // Перебрать все возможные определители 2x2.
+        // Здесь достаточно просто сравнить с 0.
+
+        if (e0[1] * e1[2] - e0[2] * e1[1] != 0)
+        {
+                return true;
+        }
+
+        if (e0[0] * e1[2] - e0[2] * e1[0] != 0)
+        {
+                return true;
+        }
+
+        if (e0[0] * e1[1] - e0[1] * e1[0] != 0)
+        {
+                return true;
+        }
+
+        return false;
+}
+
 template <size_t N, typename T>
 void center_and_length(const std::vector<Vector<N, T>>& vertices, const std::vector<typename Obj<N>::Facet>& facets,
                        Vector<N, T>* center, T* length)
@@ -0,0 +1,468 @@
+/*
+Copyright (C) 2017-2019 Topological Manifold
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+Формат файла
+
+  Заголовок
+    сигнатура, версия, размерность, размеры типов элементов
+  Ключ
+    размер, время изменения и выборочный хеш файла OBJ,
+    имена, размеры и времена изменения файлов материалов и изображений
+  Данные
+    центр и длина объекта,
+    массивы вершин, нормалей, текстурных координат, граней, точек и отрезков
+    без преобразований, как они находятся в памяти,
+    материалы, изображения в sRGB.
+
+  Каждый массив записывается как количество элементов и затем сами элементы.
+*/
+
+#include "file_binary.h"
+
+#include "com/error.h"
+#include "com/file/binary.h"
+#include "com/file/file_map.h"
+#include "com/file/file_sys.h"
+#include "com/log.h"
+#include "com/print.h"
+#include "com/time.h"
+
+#include <array>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <optional>
+#include <string_view>
+#include <type_traits>
+
+constexpr std::array<char, 8> OBJB_SIGNATURE = {'O', 'B', 'J', 'B', 'I', 'N', 'A', 'R'};
+constexpr unsigned OBJB_VERSION = 1;
+constexpr const char OBJB_EXTENSION[] = "objb";
+
+// Для хеша берутся блоки такого размера в начале и в конце файла,
+// так как хеш всего файла считался бы сравнимое с разбором файла время.
+constexpr long long OBJB_HASH_BLOCK_SIZE = 1 << 20;
+
+namespace
+{
+struct FileKey
+{
+        std::string name;
+        unsigned long long size;
+        long long time;
+};
+
+std::vector<std::string> cache_file_names(const std::string& file_name)
+{
+        // Вначале рядом с файлом, а если там нельзя создать файл, то во временной директории
+        return {file_name + "." + OBJB_EXTENSION, temp_directory() + "/" + to_string(std::hash<std::string>()(file_name)) +
+                                                          "_" + file_base_name(file_name) + "." + OBJB_EXTENSION};
+}
+
+unsigned long long sampled_file_hash(const std::string& file_name, unsigned long long size)
+{
+        std::ifstream f(file_name, std::ios_base::binary);
+
+        if (!f)
+        {
+                error("Failed to open file " + file_name);
+        }
+
+        std::string data;
+
+        if (size <= 2 * OBJB_HASH_BLOCK_SIZE)
+        {
+                data.resize(size);
+                f.read(data.data(), size);
+        }
+        else
+        {
+                data.resize(2 * OBJB_HASH_BLOCK_SIZE);
+                f.read(data.data(), OBJB_HASH_BLOCK_SIZE);
+                f.seekg(size - OBJB_HASH_BLOCK_SIZE, f.beg);
+                f.read(data.data() + OBJB_HASH_BLOCK_SIZE, OBJB_HASH_BLOCK_SIZE);
+        }
+
+        if (!f)
+        {
+                error("Failed to read file " + file_name);
+        }
+
+        return std::hash<std::string_view>()(data);
+}
+
+template <size_t N>
+void write_header(BinaryWriter* writer)
+{
+        writer->write(OBJB_SIGNATURE);
+        writer->write(OBJB_VERSION);
+        writer->write<unsigned>(N);
+        writer->write<unsigned>(sizeof(Vector<N, float>));
+        writer->write<unsigned>(sizeof(Vector<N - 1, float>));
+        writer->write<unsigned>(sizeof(typename Obj<N>::Facet));
+        writer->write<unsigned>(sizeof(typename Obj<N>::Point));
+        writer->write<unsigned>(sizeof(typename Obj<N>::Line));
+}
+
+template <size_t N>
+bool read_header(BinaryReader* reader)
+{
+        return reader->read<std::array<char, 8>>() == OBJB_SIGNATURE && reader->read<unsigned>() == OBJB_VERSION &&
+               reader->read<unsigned>() == N && reader->read<unsigned>() == sizeof(Vector<N, float>) &&
+               reader->read<unsigned>() == sizeof(Vector<N - 1, float>) &&
+               reader->read<unsigned>() == sizeof(typename Obj<N>::Facet) &&
+               reader->read<unsigned>() == sizeof(typename Obj<N>::Point) &&
+               reader->read<unsigned>() == sizeof(typename Obj<N>::Line);
+}
+
+void write_key(const FileKey& source, unsigned long long source_hash, const std::vector<FileKey>& dependencies,
+               BinaryWriter* writer)
+{
+        writer->write(source.size);
+        writer->write(source.time);
+        writer->write(source_hash);
+
+        writer->write<unsigned long long>(dependencies.size());
+        for (const FileKey& key : dependencies)
+        {
+                writer->write(key.name);
+                writer->write(key.size);
+                writer->write(key.time);
+        }
+}
+
+bool read_and_check_key(const FileKey& source, std::optional<unsigned long long>* source_hash, BinaryReader* reader)
+{
+        unsigned long long size = reader->read<unsigned long long>();
+        long long time = reader->read<long long>();
+        unsigned long long hash = reader->read<unsigned long long>();
+
+        if (size != source.size || time != source.time)
+        {
+                return false;
+        }
+
+        if (!*source_hash)
+        {
+                *source_hash = sampled_file_hash(source.name, source.size);
+        }
+        if (hash != **source_hash)
+        {
+                return false;
+        }
+
+        unsigned long long dependency_count = reader->read<unsigned long long>();
+        std::string name;
+        for (unsigned long long i = 0; i < dependency_count; ++i)
+        {
+                reader->read(&name);
+                size = reader->read<unsigned long long>();
+                time = reader->read<long long>();
+
+                unsigned long long file_size;
+                long long file_time;
+                if (!file_size_and_time(name, &file_size, &file_time) || file_size != size || file_time != time)
+                {
+                        return false;
+                }
+        }
+
+        return true;
+}
+
+template <size_t N>
+void write_obj(const Obj<N>& obj, BinaryWriter* writer)
+{
+        writer->write(obj.center());
+        writer->write(obj.length());
+
+        writer->write(obj.vertices());
+        writer->write(obj.normals());
+        writer->write(obj.texcoords());
+        writer->write(obj.facets());
+        writer->write(obj.points());
+        writer->write(obj.lines());
+
+        writer->write<unsigned long long>(obj.materials().size());
+        for (const typename Obj<N>::Material& m : obj.materials())
+        {
+                writer->write(m.name);
+                writer->write(m.Ka.data());
+                writer->write(m.Kd.data());
+                writer->write(m.Ks.data());
+                writer->write(m.Ns);
+                writer->write(m.map_Ka);
+                writer->write(m.map_Kd);
+                writer->write(m.map_Ks);
+        }
+
+        writer->write<unsigned long long>(obj.images().size());
+        for (const typename Obj<N>::Image& image : obj.images())
+        {
+                writer->write(image.size);
+                writer->write(image.srgba_pixels);
+        }
+}
+
+template <size_t N>
+class BinaryObj final : public Obj<N>
+{
+        using typename Obj<N>::Facet;
+        using typename Obj<N>::Point;
+        using typename Obj<N>::Line;
+        using typename Obj<N>::Material;
+        using typename Obj<N>::Image;
+
+        std::vector<Vector<N, float>> m_vertices;
+        std::vector<Vector<N, float>> m_normals;
+        std::vector<Vector<N - 1, float>> m_texcoords;
+        std::vector<Facet> m_facets;
+        std::vector<Point> m_points;
+        std::vector<Line> m_lines;
+        std::vector<Material> m_materials;
+        std::vector<Image> m_images;
+        Vector<N, float> m_center;
+        float m_length;
+
+        void read_obj(BinaryReader* reader);
+
+        const std::vector<Vector<N, float>>& vertices() const override
+        {
+                return m_vertices;
+        }
+        const std::vector<Vector<N, float>>& normals() const override
+        {
+                return m_normals;
+        }
+        const std::vector<Vector<N - 1, float>>& texcoords() const override
+        {
+                return m_texcoords;
+        }
+        const std::vector<Facet>& facets() const override
+        {
+                return m_facets;
+        }
+        const std::vector<Point>& points() const override
+        {
+                return m_points;
+        }
+        const std::vector<Line>& lines() const override
+        {
+                return m_lines;
+        }
+        const std::vector<Material>& materials() const override
+        {
+                return m_materials;
+        }
+        const std::vector<Image>& images() const override
+        {
+                return m_images;
+        }
+        Vector<N, float> center() const override
+        {
+                return m_center;
+        }
+        float length() const override
+        {
+                return m_length;
+        }
+
+public:
+        explicit BinaryObj(BinaryReader* reader);
+};
+
+template <size_t N>
+void BinaryObj<N>::read_obj(BinaryReader* reader)
+{
+        m_center = reader->read<Vector<N, float>>();
+        m_length = reader->read<float>();
+
+        reader->read(&m_vertices);
+        reader->read(&m_normals);
+        reader->read(&m_texcoords);
+        reader->read(&m_facets);
+        reader->read(&m_points);
+        reader->read(&m_lines);
+
+        m_materials.resize(reader->read<unsigned long long>());
+        for (Material& m : m_materials)
+        {
+                reader->read(&m.name);
+                m.Ka.data() = reader->read<Vector<3, Color::DataType>>();
+                m.Kd.data() = reader->read<Vector<3, Color::DataType>>();
+                m.Ks.data() = reader->read<Vector<3, Color::DataType>>();
+                m.Ns = reader->read<float>();
+                m.map_Ka = reader->read<int>();
+                m.map_Kd = reader->read<int>();
+                m.map_Ks = reader->read<int>();
+        }
+
+        m_images.resize(reader->read<unsigned long long>());
+        for (Image& image : m_images)
+        {
+                image.size = reader->read<std::array<int, N - 1>>();
+                reader->read(&image.srgba_pixels);
+        }
+
+        if (!reader->at_end())
+        {
+                error("Binary OBJ file has extra data");
+        }
+}
+
+template <size_t N>
+BinaryObj<N>::BinaryObj(BinaryReader* reader)
+{
+        read_obj(reader);
+}
+}
+
+template <size_t N>
+std::unique_ptr<Obj<N>> load_obj_from_binary_cache(const std::string& file_name)
+{
+        FileKey source;
+        source.name = file_name;
+        if (!file_size_and_time(source.name, &source.size, &source.time))
+        {
+                return nullptr;
+        }
+
+        std::optional<unsigned long long> source_hash;
+
+        for (const std::string& cache_name : cache_file_names(file_name))
+        {
+                unsigned long long size;
+                long long time;
+                if (!file_size_and_time(cache_name, &size, &time))
+                {
+                        continue;
+                }
+
+                try
+                {
+                        double start_time = time_in_seconds();
+
+                        FileMap file_map(cache_name);
+                        BinaryReader reader(file_map.data(), file_map.size());
+
+                        if (!read_header<N>(&reader) || !read_and_check_key(source, &source_hash, &reader))
+                        {
+                                continue;
+                        }
+
+                        std::unique_ptr<Obj<N>> obj = std::make_unique<BinaryObj<N>>(&reader);
+
+                        LOG("OBJ-" + to_string(N) + " loaded from cache " + cache_name + ", " +
+                            to_string_fixed(time_in_seconds() - start_time, 5) + " s");
+
+                        return obj;
+                }
+                catch (std::exception& e)
+                {
+                        LOG("Error reading OBJ cache file " + cache_name + ": " + e.what());
+                }
+        }
+
+        return nullptr;
+}
+
+template <size_t N>
+void save_obj_to_binary_cache(const std::string& file_name, const std::vector<std::string>& dependencies,
+                              const Obj<N>& obj) noexcept
+{
+        try
+        {
+                double start_time = time_in_seconds();
+
+                FileKey source;
+                source.name = file_name;
+                if (!file_size_and_time(source.name, &source.size, &source.time))
+                {
+                        error("Failed to get size and time of file " + file_name);
+                }
+                unsigned long long source_hash = sampled_file_hash(source.name, source.size);
+
+                std::vector<FileKey> dependency_keys(dependencies.size());
+                for (size_t i = 0; i < dependencies.size(); ++i)
+                {
+                        dependency_keys[i].name = dependencies[i];
+                        if (!file_size_and_time(dependencies[i], &dependency_keys[i].size, &dependency_keys[i].time))
+                        {
+                                error("Failed to get size and time of file " + dependencies[i]);
+                        }
+                }
+
+                std::string error_message;
+
+                for (const std::string& cache_name : cache_file_names(file_name))
+                {
+                        // Запись во временный файл с уникальным именем и затем замена файла кэша,
+                        // чтобы при ошибках записи или одновременной загрузке не было неполного файла.
+                        const std::string tmp_name = unique_file_name(cache_name);
+
+                        try
+                        {
+                                {
+                                        BinaryWriter writer(tmp_name);
+                                        write_header<N>(&writer);
+                                        write_key(source, source_hash, dependency_keys, &writer);
+                                        write_obj(obj, &writer);
+                                }
+
+                                if (!replace_file(tmp_name, cache_name))
+                                {
+                                        error("Failed to rename file " + tmp_name + " to " + cache_name);
+                                }
+
+                                LOG("OBJ-" + to_string(N) + " cache saved to " + cache_name + ", " +
+                                    to_string_fixed(time_in_seconds() - start_time, 5) + " s");
+
+                                return;
+                        }
+                        catch (std::exception& e)
+                        {
+                                std::remove(tmp_name.c_str());
+                                error_message += (error_message.empty() ? "" : "\n") + std::string(e.what());
+                        }
+                }
+
+                error(error_message);
+        }
+        catch (std::exception& e)
+        {
+                LOG("Error saving OBJ cache for " + file_name + ": " + e.what());
+        }
+        catch (...)
+        {
+                LOG("Error saving OBJ cache for " + file_name);
+        }
+}
+
+template std::unique_ptr<Obj<3>> load_obj_from_binary_cache(const std::string& file_name);
+template std::unique_ptr<Obj<4>> load_obj_from_binary_cache(const std::string& file_name);
+template std::unique_ptr<Obj<5>> load_obj_from_binary_cache(const std::string& file_name);
+template std::unique_ptr<Obj<6>> load_obj_from_binary_cache(const std::string& file_name);
+
+template void save_obj_to_binary_cache(const std::string& file_name, const std::vector<std::string>& dependencies,
+                                       const Obj<3>& obj) noexcept;
+template void save_obj_to_binary_cache(const std::string& file_name, const std::vector<std::string>& dependencies,
+                                       const Obj<4>& obj) noexcept;
+template void save_obj_to_binary_cache(const std::string& file_name, const std::vector<std::string>& dependencies,
+                                       const Obj<5>& obj) noexcept;
+template void save_obj_to_binary_cache(const std::string& file_name, const std::vector<std::string>& dependencies,
+                                       const Obj<6>& obj) noexcept;
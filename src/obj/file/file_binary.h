@@ -0,0 +1,35 @@
+/*
+Copyright (C) 2017-2019 Topological Manifold
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "obj/obj.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// Двоичный кэш файлов OBJ.
+// Кэш действителен, если не изменились размер, время изменения и выборочный хеш
+// файла OBJ, а также размеры и времена изменения файлов материалов и изображений.
+
+template <size_t N>
+std::unique_ptr<Obj<N>> load_obj_from_binary_cache(const std::string& file_name);
+
+template <size_t N>
+void save_obj_to_binary_cache(const std::string& file_name, const std::vector<std::string>& dependencies,
+                              const Obj<N>& obj) noexcept;
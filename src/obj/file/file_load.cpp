@@ -17,6 +17,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "file_load.h"
 
+#include "file_binary.h"
 #include "obj_file.h"
 
 #include "com/error.h"
@@ -28,6 +29,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "com/string/ascii.h"
 #include "com/string/str.h"
 #include "com/thread.h"
+#include "com/thread_pool.h"
 #include "com/time.h"
 #include "com/type/limit.h"
 #include "com/type/name.h"
@@ -38,6 +40,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <iterator>
 #include <map>
 #include <set>
 #include <string>
@@ -215,9 +218,9 @@ typename Obj<N>::Image read_image_from_file(const std::string& file_name)
         }
 }
 
-template <size_t N>
-void load_image(const std::string& dir_name, const std::string& image_name, std::map<std::string, int>* image_index,
-                std::vector<typename Obj<N>::Image>* images, int* index)
+// Изображения только регистрируются, а читаются они после чтения всех библиотек
+void add_image(const std::string& dir_name, const std::string& image_name, std::map<std::string, int>* image_index,
+               std::vector<std::string>* image_files, int* index)
 {
         std::string file_name = trim(image_name);
 
@@ -239,9 +242,41 @@ void load_image(const std::string& dir_name, const std::string& image_name, std:
                 return;
         };
 
-        images->push_back(read_image_from_file<N>(file_name));
-        *index = images->size() - 1;
-        image_index->emplace(file_name, *index);
+        image_files->push_back(file_name);
+        *index = image_files->size() - 1;
+        image_index->emplace(std::move(file_name), *index);
+}
+
+// Параллельное чтение изображений
+template <size_t N>
+std::vector<typename Obj<N>::Image> read_images(const std::vector<std::string>& image_files, ProgressRatio* progress)
+{
+        std::vector<typename Obj<N>::Image> images(image_files.size());
+
+        if (image_files.empty())
+        {
+                return images;
+        }
+
+        progress->set(0);
+
+        std::atomic_size_t next_image = 0;
+        AtomicCounter<int> image_count = 0;
+
+        ThreadPool thread_pool(std::min<int>(hardware_concurrency(), image_files.size()));
+
+        thread_pool.run([&](unsigned, unsigned) {
+                size_t i;
+                while ((i = next_image++) < image_files.size())
+                {
+                        images[i] = read_image_from_file<N>(image_files[i]);
+
+                        ++image_count;
+                        progress->set(image_count, image_files.size());
+                }
+        });
+
+        return images;
 }
 
 // Между begin и end находится уже проверенное целое число в формате DDDDD без знака
@@ -685,54 +720,26 @@ void split_line(T* data, const std::vector<long long>& line_begin, long long lin
         (*data)[*second_e] = 0; // символ комментария '#' или символ '\n'
 }
 
-template <size_t N>
-bool facet_dimension_is_correct(const std::vector<Vector<N, float>>& vertices, const std::array<int, N>& indices)
+// Непрерывный диапазон строк потока [first, last). Данные потока во втором
+// этапе записываются по смещениям, равным суммам количеств предыдущих потоков.
+void thread_line_range(unsigned thread_num, unsigned thread_count, long long line_count, long long* first, long long* last)
 {
-        static_assert(N == 3);
-
-        Vector<3, double> e0 = to_vector<double>(vertices[indices[1]] - vertices[indices[0]]);
-        Vector<3, double> e1 = to_vector<double>(vertices[indices[2]] - vertices[indices[0]]);
-
-        // Перебрать все возможные определители 2x2.
-        // Здесь достаточно просто сравнить с 0.
-
-        if (e0[1] * e1[2] - e0[2] * e1[1] != 0)
-        {
-                return true;
-        }
-
-        if (e0[0] * e1[2] - e0[2] * e1[0] != 0)
-        {
-                return true;
-        }
-
-        if (e0[0] * e1[1] - e0[1] * e1[0] != 0)
-        {
-                return true;
-        }
-
-        return false;
+        *first = line_count * thread_num / thread_count;
+        *last = line_count * (thread_num + 1) / thread_count;
 }
 
+// Чтение файла OBJ частями по строкам. Каждая часть читается параллельно,
+// и её вершины, нормали, текстурные координаты и грани передаются дальше
+// до чтения следующей части.
 template <size_t N>
-class FileObj final : public Obj<N>
+class FileObjReader final
 {
-        using typename Obj<N>::Facet;
-        using typename Obj<N>::Point;
-        using typename Obj<N>::Line;
-        using typename Obj<N>::Material;
-        using typename Obj<N>::Image;
+        using Facet = typename Obj<N>::Facet;
+        using Material = typename Obj<N>::Material;
+        using Image = typename Obj<N>::Image;
 
-        std::vector<Vector<N, float>> m_vertices;
-        std::vector<Vector<N, float>> m_normals;
-        std::vector<Vector<N - 1, float>> m_texcoords;
-        std::vector<Facet> m_facets;
-        std::vector<Point> m_points;
-        std::vector<Line> m_lines;
-        std::vector<Material> m_materials;
-        std::vector<Image> m_images;
-        Vector<N, float> m_center;
-        float m_length;
+        // Количество строк в одной части файла
+        static constexpr long long CHUNK_LINE_COUNT = 1 << 18;
 
         enum class ObjLineType
         {
@@ -753,6 +760,7 @@ class FileObj final : public Obj<N>
                 long long second_e;
                 std::array<Facet, MAX_FACETS_PER_LINE<N>> facets;
                 int facet_count;
+                int material; // для usemtl, заполняется при последовательном проходе
                 Vector<N, float> v;
         };
 
@@ -772,201 +780,87 @@ class FileObj final : public Obj<N>
                 }
         };
 
-        void check_facet_indices() const;
+        std::vector<Material> m_materials;
+        std::vector<Image> m_images;
+        std::map<std::string, int> m_material_index;
+        std::vector<std::string> m_library_names;
+        std::set<std::string> m_unique_library_names;
 
-        bool remove_facets_with_incorrect_dimension();
+        // Прочитанные файлы материалов и изображений
+        std::vector<std::string> m_dependencies;
 
-        static void read_obj_stage_one(unsigned thread_num, unsigned thread_count, std::vector<Counters>* counters,
-                                       std::vector<char>* data_ptr, std::vector<long long>* line_begin,
-                                       std::vector<ObjLine>* line_prop, ProgressRatio* progress);
+        // Количества во всех предыдущих частях файла и текущий материал
+        Counters m_counters;
+        int m_mtl_index = -1;
 
-        void read_obj_stage_two(const Counters& counters, std::vector<char>* data_ptr, std::vector<ObjLine>* line_prop,
-                                ProgressRatio* progress, std::map<std::string, int>* material_index,
-                                std::vector<std::string>* library_names);
+        std::vector<Vector<N, float>> m_chunk_vertices;
+        std::vector<Vector<N, float>> m_chunk_normals;
+        std::vector<Vector<N - 1, float>> m_chunk_texcoords;
+        std::vector<Facet> m_chunk_facets;
 
-        Counters sum_counters(const std::vector<Counters>& counters);
+        static void read_obj_stage_one(unsigned thread_num, unsigned thread_count, long long chunk_first, long long chunk_last,
+                                       std::vector<Counters>* counters, std::vector<std::vector<long long>>* mtl_lines,
+                                       std::vector<char>* data_ptr, const std::vector<long long>& line_begin,
+                                       std::vector<ObjLine>* line_prop);
 
-        void read_obj_thread(unsigned thread_num, unsigned thread_count, std::vector<Counters>* counters, ThreadBarrier* barrier,
-                             std::atomic_bool* error_found, std::vector<char>* data_ptr, std::vector<long long>* line_begin,
-                             std::vector<ObjLine>* line_prop, ProgressRatio* progress, std::map<std::string, int>* material_index,
-                             std::vector<std::string>* library_names);
+        void read_obj_materials(long long chunk_first, const std::vector<Counters>& counters,
+                                const std::vector<std::vector<long long>>& mtl_lines, const std::vector<char>& data,
+                                std::vector<ObjLine>* line_prop, std::vector<Counters>* offsets,
+                                std::vector<int>* thread_materials);
 
-        void read_obj(const std::string& file_name, ProgressRatio* progress, std::map<std::string, int>* material_index,
-                      std::vector<std::string>* library_names);
+        void read_obj_stage_two(unsigned thread_num, unsigned thread_count, long long chunk_first, long long chunk_last,
+                                const std::vector<Counters>& offsets, const std::vector<int>& thread_materials,
+                                std::vector<ObjLine>* line_prop);
 
         void read_lib(const std::string& dir_name, const std::string& file_name, ProgressRatio* progress,
-                      std::map<std::string, int>* material_index, std::map<std::string, int>* image_index);
+                      std::map<std::string, int>* image_index, std::vector<std::string>* image_files);
 
-        void read_libs(const std::string& dir_name, ProgressRatio* progress, std::map<std::string, int>* material_index,
-                       const std::vector<std::string>& library_names);
+public:
+        // Для каждой части файла вызывается geometry(vertices, normals, texcoords, facets)
+        template <typename Geometry>
+        void read_obj(const std::string& file_name, ProgressRatio* progress, const Geometry& geometry);
 
-        void read_obj_and_mtl(const std::string& file_name, ProgressRatio* progress);
+        void read_libs(const std::string& dir_name, ProgressRatio* progress);
 
-        const std::vector<Vector<N, float>>& vertices() const override
-        {
-                return m_vertices;
-        }
-        const std::vector<Vector<N, float>>& normals() const override
-        {
-                return m_normals;
-        }
-        const std::vector<Vector<N - 1, float>>& texcoords() const override
-        {
-                return m_texcoords;
-        }
-        const std::vector<Facet>& facets() const override
-        {
-                return m_facets;
-        }
-        const std::vector<Point>& points() const override
-        {
-                return m_points;
-        }
-        const std::vector<Line>& lines() const override
-        {
-                return m_lines;
-        }
-        const std::vector<Material>& materials() const override
+        std::vector<Material>& materials()
         {
                 return m_materials;
         }
-        const std::vector<Image>& images() const override
+        std::vector<Image>& images()
         {
                 return m_images;
         }
-        Vector<N, float> center() const override
-        {
-                return m_center;
-        }
-        float length() const override
+        std::vector<std::string>& dependencies()
         {
-                return m_length;
+                return m_dependencies;
         }
-
-public:
-        FileObj(const std::string& file_name, ProgressRatio* progress);
 };
 
 template <size_t N>
-void FileObj<N>::check_facet_indices() const
-{
-        int vertex_count = m_vertices.size();
-        int texcoord_count = m_texcoords.size();
-        int normal_count = m_normals.size();
-
-        for (const Facet& facet : m_facets)
-        {
-                for (unsigned i = 0; i < N; ++i)
-                {
-                        if (facet.vertices[i] < 0 || facet.vertices[i] >= vertex_count)
-                        {
-                                error("Vertex index " + to_string(facet.vertices[i]) + " is out of bounds [0, " +
-                                      to_string(vertex_count) + ")");
-                        }
-
-                        if (facet.has_texcoord)
-                        {
-                                if (facet.texcoords[i] < 0 || facet.texcoords[i] >= texcoord_count)
-                                {
-                                        error("Texture coordinate index " + to_string(facet.texcoords[i]) +
-                                              " is out of bounds [0, " + to_string(texcoord_count) + ")");
-                                }
-                        }
-                        else
-                        {
-                                if (facet.texcoords[i] != -1)
-                                {
-                                        error("No texture but texture coordinate index is not set to -1");
-                                }
-                        }
-
-                        if (facet.has_normal)
-                        {
-                                if (facet.normals[i] < 0 || facet.normals[i] >= normal_count)
-                                {
-                                        error("Normal index " + to_string(facet.normals[i]) + " is out of bounds [0, " +
-                                              to_string(normal_count) + ")");
-                                }
-                        }
-                        else
-                        {
-                                if (facet.normals[i] != -1)
-                                {
-                                        error("No normals but normal coordinate index is not set to -1");
-                                }
-                        }
-                }
-        }
-}
-
-template <size_t N>
-bool FileObj<N>::remove_facets_with_incorrect_dimension()
-{
-        if constexpr (N != 3)
-        {
-                return false;
-        }
-        else
-        {
-                std::vector<bool> wrong_facets(m_facets.size(), false);
-
-                int wrong_facet_count = 0;
-
-                for (size_t i = 0; i < m_facets.size(); ++i)
-                {
-                        if (!facet_dimension_is_correct(m_vertices, m_facets[i].vertices))
-                        {
-                                wrong_facets[i] = true;
-                                ++wrong_facet_count;
-                        }
-                }
-
-                if (wrong_facet_count == 0)
-                {
-                        return false;
-                }
-
-                std::vector<Facet> facets;
-                facets.reserve(m_facets.size() - wrong_facet_count);
-
-                for (size_t i = 0; i < m_facets.size(); ++i)
-                {
-                        if (!wrong_facets[i])
-                        {
-                                facets.push_back(m_facets[i]);
-                        }
-                }
-
-                m_facets = std::move(facets);
-
-                return true;
-        }
-}
-
-template <size_t N>
-void FileObj<N>::read_obj_stage_one(unsigned thread_num, unsigned thread_count, std::vector<Counters>* counters,
-                                    std::vector<char>* data_ptr, std::vector<long long>* line_begin,
-                                    std::vector<ObjLine>* line_prop, ProgressRatio* progress)
+void FileObjReader<N>::read_obj_stage_one(unsigned thread_num, unsigned thread_count, long long chunk_first,
+                                          long long chunk_last, std::vector<Counters>* counters,
+                                          std::vector<std::vector<long long>>* mtl_lines, std::vector<char>* data_ptr,
+                                          const std::vector<long long>& line_begin, std::vector<ObjLine>* line_prop)
 {
         ASSERT(counters->size() == thread_count);
+        ASSERT(mtl_lines->size() == thread_count);
 
         std::vector<char>& data = *data_ptr;
-        const long long line_count = line_begin->size();
-        const double line_count_reciprocal = 1.0 / line_begin->size();
 
-        for (long long line_num = thread_num; line_num < line_count; line_num += thread_count)
-        {
-                if ((line_num & 0xfff) == 0xfff)
-                {
-                        progress->set(line_num * line_count_reciprocal);
-                }
+        (*counters)[thread_num] = Counters();
+        (*mtl_lines)[thread_num].clear();
+
+        long long line_first, line_last;
+        thread_line_range(thread_num, thread_count, chunk_last - chunk_first, &line_first, &line_last);
 
+        for (long long line_num = chunk_first + line_first; line_num < chunk_first + line_last; ++line_num)
+        {
                 ObjLine lp;
 
                 const char* first;
                 const char* second;
 
-                split_line(&data, *line_begin, line_num, &first, &second, &lp.second_b, &lp.second_e);
+                split_line(&data, line_begin, line_num, &first, &second, &lp.second_b, &lp.second_e);
 
                 try
                 {
@@ -1005,15 +899,19 @@ void FileObj<N>::read_obj_stage_one(unsigned thread_num, unsigned thread_count,
                                 lp.type = ObjLineType::f;
                                 read_facets<N>(data, lp.second_b, lp.second_e, &lp.facets, &lp.facet_count);
 
-                                ++((*counters)[thread_num].facet);
+                                (*counters)[thread_num].facet += lp.facet_count;
                         }
                         else if (str_equal(first, OBJ_usemtl))
                         {
                                 lp.type = ObjLineType::usemtl;
+
+                                (*mtl_lines)[thread_num].push_back(line_num);
                         }
                         else if (str_equal(first, OBJ_mtllib))
                         {
                                 lp.type = ObjLineType::mtllib;
+
+                                (*mtl_lines)[thread_num].push_back(line_num);
                         }
                         else if (!*first)
                         {
@@ -1033,7 +931,7 @@ void FileObj<N>::read_obj_stage_one(unsigned thread_num, unsigned thread_count,
                         error("Line " + to_string(line_num) + ": " + first + " " + second + "\n" + "Unknown error");
                 }
 
-                (*line_prop)[line_num] = lp;
+                (*line_prop)[line_num - chunk_first] = lp;
         }
 }
 
@@ -1061,42 +959,101 @@ void correct_indices(typename Obj<N>::Facet* facet, int vertices_size, int texco
         }
 }
 
+// Последовательный проход только по строкам usemtl и mtllib.
+// Определяются номера материалов, материалы в начале диапазонов строк потоков,
+// смещения данных потоков в массивах части файла, и выделяется память для них.
 template <size_t N>
-void FileObj<N>::read_obj_stage_two(const Counters& counters, std::vector<char>* data_ptr, std::vector<ObjLine>* line_prop,
-                                    ProgressRatio* progress, std::map<std::string, int>* material_index,
-                                    std::vector<std::string>* library_names)
+void FileObjReader<N>::read_obj_materials(long long chunk_first, const std::vector<Counters>& counters,
+                                          const std::vector<std::vector<long long>>& mtl_lines, const std::vector<char>& data,
+                                          std::vector<ObjLine>* line_prop, std::vector<Counters>* offsets,
+                                          std::vector<int>* thread_materials)
 {
-        m_vertices.reserve(counters.vertex);
-        m_texcoords.reserve(counters.texcoord);
-        m_normals.reserve(counters.normal);
-        m_facets.reserve(counters.facet);
+        ASSERT(counters.size() == mtl_lines.size());
+
+        const unsigned thread_count = counters.size();
 
-        const std::vector<char>& data = *data_ptr;
-        const long long line_count = line_prop->size();
-        const double line_count_reciprocal = 1.0 / line_prop->size();
+        offsets->resize(thread_count);
+        thread_materials->resize(thread_count);
 
-        int mtl_index = -1;
+        Counters sum;
         std::string mtl_name;
-        std::set<std::string> unique_library_names;
 
-        for (long long line_num = 0; line_num < line_count; ++line_num)
+        for (unsigned thread_num = 0; thread_num < thread_count; ++thread_num)
         {
-                if ((line_num & 0xfff) == 0xfff)
+                (*offsets)[thread_num] = sum;
+                sum += counters[thread_num];
+
+                (*thread_materials)[thread_num] = m_mtl_index;
+
+                for (long long line_num : mtl_lines[thread_num])
                 {
-                        progress->set(line_num * line_count_reciprocal);
+                        ObjLine& lp = (*line_prop)[line_num - chunk_first];
+
+                        switch (lp.type)
+                        {
+                        case ObjLineType::usemtl:
+                        {
+                                read_name("material", data, lp.second_b, lp.second_e, &mtl_name);
+                                auto iter = m_material_index.find(mtl_name);
+                                if (iter != m_material_index.end())
+                                {
+                                        m_mtl_index = iter->second;
+                                }
+                                else
+                                {
+                                        Material mtl;
+                                        mtl.name = mtl_name;
+                                        m_materials.push_back(std::move(mtl));
+                                        m_material_index.emplace(std::move(mtl_name), m_materials.size() - 1);
+                                        m_mtl_index = m_materials.size() - 1;
+                                }
+                                lp.material = m_mtl_index;
+                                break;
+                        }
+                        case ObjLineType::mtllib:
+                                read_library_names(data, lp.second_b, lp.second_e, &m_library_names, &m_unique_library_names);
+                                break;
+                        default:
+                                error_fatal("Not a material line in the material line list");
+                        }
                 }
+        }
+
+        m_chunk_vertices.resize(sum.vertex);
+        m_chunk_texcoords.resize(sum.texcoord);
+        m_chunk_normals.resize(sum.normal);
+        m_chunk_facets.resize(sum.facet);
+}
+
+template <size_t N>
+void FileObjReader<N>::read_obj_stage_two(unsigned thread_num, unsigned thread_count, long long chunk_first, long long chunk_last,
+                                          const std::vector<Counters>& offsets, const std::vector<int>& thread_materials,
+                                          std::vector<ObjLine>* line_prop)
+{
+        ASSERT(offsets.size() == thread_count);
+        ASSERT(thread_materials.size() == thread_count);
 
+        long long line_first, line_last;
+        thread_line_range(thread_num, thread_count, chunk_last - chunk_first, &line_first, &line_last);
+
+        int vertex = offsets[thread_num].vertex;
+        int texcoord = offsets[thread_num].texcoord;
+        int normal = offsets[thread_num].normal;
+        int facet = offsets[thread_num].facet;
+        int mtl_index = thread_materials[thread_num];
+
+        for (long long line_num = line_first; line_num < line_last; ++line_num)
+        {
                 ObjLine& lp = (*line_prop)[line_num];
 
                 switch (lp.type)
                 {
                 case ObjLineType::v:
-                        m_vertices.push_back(lp.v);
+                        m_chunk_vertices[vertex++] = lp.v;
                         break;
                 case ObjLineType::vt:
                 {
-                        m_texcoords.resize(m_texcoords.size() + 1);
-                        Vector<N - 1, float>& new_vector = m_texcoords[m_texcoords.size() - 1];
+                        Vector<N - 1, float>& new_vector = m_chunk_texcoords[texcoord++];
                         for (unsigned i = 0; i < N - 1; ++i)
                         {
                                 new_vector[i] = lp.v[i];
@@ -1104,36 +1061,21 @@ void FileObj<N>::read_obj_stage_two(const Counters& counters, std::vector<char>*
                         break;
                 }
                 case ObjLineType::vn:
-                        m_normals.push_back(lp.v);
+                        m_chunk_normals[normal++] = lp.v;
                         break;
                 case ObjLineType::f:
                         for (int i = 0; i < lp.facet_count; ++i)
                         {
                                 lp.facets[i].material = mtl_index;
-                                correct_indices<N>(&lp.facets[i], m_vertices.size(), m_texcoords.size(), m_normals.size());
-                                m_facets.push_back(std::move(lp.facets[i]));
+                                correct_indices<N>(&lp.facets[i], m_counters.vertex + vertex, m_counters.texcoord + texcoord,
+                                                   m_counters.normal + normal);
+                                m_chunk_facets[facet++] = std::move(lp.facets[i]);
                         }
                         break;
                 case ObjLineType::usemtl:
-                {
-                        read_name("material", data, lp.second_b, lp.second_e, &mtl_name);
-                        auto iter = material_index->find(mtl_name);
-                        if (iter != material_index->end())
-                        {
-                                mtl_index = iter->second;
-                        }
-                        else
-                        {
-                                typename Obj<N>::Material mtl;
-                                mtl.name = mtl_name;
-                                m_materials.push_back(std::move(mtl));
-                                material_index->emplace(std::move(mtl_name), m_materials.size() - 1);
-                                mtl_index = m_materials.size() - 1;
-                        }
+                        mtl_index = lp.material;
                         break;
-                }
                 case ObjLineType::mtllib:
-                        read_library_names(data, lp.second_b, lp.second_e, library_names, &unique_library_names);
                         break;
                 case ObjLineType::None:
                         break;
@@ -1144,56 +1086,65 @@ void FileObj<N>::read_obj_stage_two(const Counters& counters, std::vector<char>*
 }
 
 template <size_t N>
-typename FileObj<N>::Counters FileObj<N>::sum_counters(const std::vector<Counters>& counters)
+template <typename Geometry>
+void FileObjReader<N>::read_obj(const std::string& file_name, ProgressRatio* progress, const Geometry& geometry)
 {
-        Counters sum;
-        for (const Counters& c : counters)
-        {
-                sum += c;
-        }
-        return sum;
-}
+        std::vector<char> data;
+        std::vector<long long> line_begin;
 
-template <size_t N>
-void FileObj<N>::read_obj_thread(unsigned thread_num, unsigned thread_count, std::vector<Counters>* counters,
-                                 ThreadBarrier* barrier, std::atomic_bool* error_found, std::vector<char>* data_ptr,
-                                 std::vector<long long>* line_begin, std::vector<ObjLine>* line_prop, ProgressRatio* progress,
-                                 std::map<std::string, int>* material_index, std::vector<std::string>* library_names)
-{
-        // параллельно
+        read_file_lines(file_name, &data, &line_begin);
 
-        try
-        {
-                read_obj_stage_one(thread_num, thread_count, counters, data_ptr, line_begin, line_prop, progress);
-        }
-        catch (...)
-        {
-                error_found->store(true); // нет исключений
-                barrier->wait();
-                throw;
-        }
-        barrier->wait();
-        if (*error_found)
-        {
-                return;
-        }
+        const long long line_count = line_begin.size();
+        const double line_count_reciprocal = 1.0 / line_count;
+
+        ThreadPool thread_pool(hardware_concurrency());
+        const unsigned thread_count = thread_pool.thread_count();
+
+        std::vector<ObjLine> line_prop(std::min(line_count, CHUNK_LINE_COUNT));
+        std::vector<Counters> counters(thread_count);
+        std::vector<std::vector<long long>> mtl_lines(thread_count);
+        std::vector<Counters> offsets;
+        std::vector<int> thread_materials;
 
-        if (thread_num != 0)
+        for (long long chunk_first = 0; chunk_first < line_count; chunk_first += CHUNK_LINE_COUNT)
         {
-                return;
-        }
+                const long long chunk_last = std::min(chunk_first + CHUNK_LINE_COUNT, line_count);
 
-        //последовательно
+                progress->set(chunk_first * line_count_reciprocal);
 
-        line_begin->clear();
-        line_begin->shrink_to_fit();
+                // параллельно
+                thread_pool.run([&](unsigned thread_num, unsigned thread_count_) {
+                        read_obj_stage_one(thread_num, thread_count_, chunk_first, chunk_last, &counters, &mtl_lines, &data,
+                                           line_begin, &line_prop);
+                });
+
+                // последовательно
+                read_obj_materials(chunk_first, counters, mtl_lines, data, &line_prop, &offsets, &thread_materials);
+
+                // параллельно
+                thread_pool.run([&](unsigned thread_num, unsigned thread_count_) {
+                        read_obj_stage_two(thread_num, thread_count_, chunk_first, chunk_last, offsets, thread_materials,
+                                           &line_prop);
+                });
+
+                m_counters.vertex += m_chunk_vertices.size();
+                m_counters.texcoord += m_chunk_texcoords.size();
+                m_counters.normal += m_chunk_normals.size();
+                m_counters.facet += m_chunk_facets.size();
+
+                geometry(std::move(m_chunk_vertices), std::move(m_chunk_normals), std::move(m_chunk_texcoords),
+                         std::move(m_chunk_facets));
 
-        read_obj_stage_two(sum_counters(*counters), data_ptr, line_prop, progress, material_index, library_names);
+                m_chunk_vertices.clear();
+                m_chunk_normals.clear();
+                m_chunk_texcoords.clear();
+                m_chunk_facets.clear();
+        }
 }
 
 template <size_t N>
-void FileObj<N>::read_lib(const std::string& dir_name, const std::string& file_name, ProgressRatio* progress,
-                          std::map<std::string, int>* material_index, std::map<std::string, int>* image_index)
+void FileObjReader<N>::read_lib(const std::string& dir_name, const std::string& file_name, ProgressRatio* progress,
+                                std::map<std::string, int>* image_index, std::vector<std::string>* image_files)
 {
         std::vector<char> data;
         std::vector<long long> line_begin;
@@ -1204,7 +1155,7 @@ void FileObj<N>::read_lib(const std::string& dir_name, const std::string& file_n
 
         const std::string lib_dir = file_parent_path(lib_name);
 
-        FileObj::Material* mtl = nullptr;
+        Material* mtl = nullptr;
         std::string name;
 
         const long long line_count = line_begin.size();
@@ -1232,7 +1183,7 @@ void FileObj<N>::read_lib(const std::string& dir_name, const std::string& file_n
                         }
                         else if (str_equal(first, MTL_newmtl))
                         {
-                                if (material_index->size() == 0)
+                                if (m_material_index.size() == 0)
                                 {
                                         // все материалы найдены
                                         break;
@@ -1240,11 +1191,11 @@ void FileObj<N>::read_lib(const std::string& dir_name, const std::string& file_n
 
                                 read_name("material", data, second_b, second_e, &name);
 
-                                auto iter = material_index->find(name);
-                                if (iter != material_index->end())
+                                auto iter = m_material_index.find(name);
+                                if (iter != m_material_index.end())
                                 {
                                         mtl = &(m_materials[iter->second]);
-                                        material_index->erase(name);
+                                        m_material_index.erase(name);
                                 }
                                 else
                                 {
@@ -1316,7 +1267,7 @@ void FileObj<N>::read_lib(const std::string& dir_name, const std::string& file_n
                                 }
 
                                 read_name("file", data, second_b, second_e, &name);
-                                load_image<N>(lib_dir, name, image_index, &m_images, &mtl->map_Ka);
+                                add_image(lib_dir, name, image_index, image_files, &mtl->map_Ka);
                         }
                         else if (str_equal(first, MTL_map_Kd))
                         {
@@ -1326,7 +1277,7 @@ void FileObj<N>::read_lib(const std::string& dir_name, const std::string& file_n
                                 }
 
                                 read_name("file", data, second_b, second_e, &name);
-                                load_image<N>(lib_dir, name, image_index, &m_images, &mtl->map_Kd);
+                                add_image(lib_dir, name, image_index, image_files, &mtl->map_Kd);
                         }
                         else if (str_equal(first, MTL_map_Ks))
                         {
@@ -1336,7 +1287,7 @@ void FileObj<N>::read_lib(const std::string& dir_name, const std::string& file_n
                                 }
 
                                 read_name("file", data, second_b, second_e, &name);
-                                load_image<N>(lib_dir, name, image_index, &m_images, &mtl->map_Ks);
+                                add_image(lib_dir, name, image_index, image_files, &mtl->map_Ks);
                         }
                 }
                 catch (std::exception& e)
@@ -1353,50 +1304,192 @@ void FileObj<N>::read_lib(const std::string& dir_name, const std::string& file_n
 }
 
 template <size_t N>
-void FileObj<N>::read_libs(const std::string& dir_name, ProgressRatio* progress, std::map<std::string, int>* material_index,
-                           const std::vector<std::string>& library_names)
+void FileObjReader<N>::read_libs(const std::string& dir_name, ProgressRatio* progress)
 {
         std::map<std::string, int> image_index;
+        std::vector<std::string> image_files;
 
-        for (size_t i = 0; (i < library_names.size()) && (material_index->size() > 0); ++i)
+        for (size_t i = 0; (i < m_library_names.size()) && (m_material_index.size() > 0); ++i)
         {
-                read_lib(dir_name, library_names[i], progress, material_index, &image_index);
+                read_lib(dir_name, m_library_names[i], progress, &image_index, &image_files);
+
+                m_dependencies.push_back(dir_name + "/" + m_library_names[i]);
         }
 
-        if (material_index->size() != 0)
+        for (const auto& [image_file_name, index] : image_index)
         {
-                error("Materials not found in libraries: " + map_keys_to_string(*material_index));
+                m_dependencies.push_back(image_file_name);
         }
 
+        if (m_material_index.size() != 0)
+        {
+                error("Materials not found in libraries: " + map_keys_to_string(m_material_index));
+        }
+
+        m_images = read_images<N>(image_files, progress);
+
         m_materials.shrink_to_fit();
-        m_images.shrink_to_fit();
+}
+
+// Объединение частей файла с выделением памяти один раз по сумме размеров частей
+template <typename T>
+void join(std::vector<std::vector<T>>&& parts, std::vector<T>* dst)
+{
+        if (parts.size() == 1)
+        {
+                *dst = std::move(parts[0]);
+                return;
+        }
+
+        size_t size = 0;
+        for (const std::vector<T>& part : parts)
+        {
+                size += part.size();
+        }
+
+        dst->clear();
+        dst->reserve(size);
+        for (std::vector<T>& part : parts)
+        {
+                dst->insert(dst->end(), std::make_move_iterator(part.begin()), std::make_move_iterator(part.end()));
+                part = std::vector<T>();
+        }
 }
 
 template <size_t N>
-void FileObj<N>::read_obj(const std::string& file_name, ProgressRatio* progress, std::map<std::string, int>* material_index,
-                          std::vector<std::string>* library_names)
+class FileObj final : public Obj<N>
 {
-        const int thread_count = hardware_concurrency();
+        using typename Obj<N>::Facet;
+        using typename Obj<N>::Point;
+        using typename Obj<N>::Line;
+        using typename Obj<N>::Material;
+        using typename Obj<N>::Image;
 
-        std::vector<char> data;
-        std::vector<long long> line_begin;
+        std::vector<Vector<N, float>> m_vertices;
+        std::vector<Vector<N, float>> m_normals;
+        std::vector<Vector<N - 1, float>> m_texcoords;
+        std::vector<Facet> m_facets;
+        std::vector<Point> m_points;
+        std::vector<Line> m_lines;
+        std::vector<Material> m_materials;
+        std::vector<Image> m_images;
+        Vector<N, float> m_center;
+        float m_length;
 
-        read_file_lines(file_name, &data, &line_begin);
+        // Прочитанные файлы материалов и изображений
+        std::vector<std::string> m_dependencies;
 
-        std::vector<ObjLine> line_prop(line_begin.size());
-        ThreadBarrier barrier(thread_count);
-        std::atomic_bool error_found{false};
-        std::vector<Counters> counters(thread_count);
+        void check_facet_indices() const;
 
-        ThreadsWithCatch threads(thread_count);
-        for (int i = 0; i < thread_count; ++i)
+        bool remove_facets_with_incorrect_dimension();
+
+        void read_obj_and_mtl(const std::string& file_name, ProgressRatio* progress);
+
+        const std::vector<Vector<N, float>>& vertices() const override
         {
-                threads.add([&, i]() {
-                        read_obj_thread(i, thread_count, &counters, &barrier, &error_found, &data, &line_begin, &line_prop,
-                                        progress, material_index, library_names);
-                });
+                return m_vertices;
+        }
+        const std::vector<Vector<N, float>>& normals() const override
+        {
+                return m_normals;
+        }
+        const std::vector<Vector<N - 1, float>>& texcoords() const override
+        {
+                return m_texcoords;
+        }
+        const std::vector<Facet>& facets() const override
+        {
+                return m_facets;
+        }
+        const std::vector<Point>& points() const override
+        {
+                return m_points;
+        }
+        const std::vector<Line>& lines() const override
+        {
+                return m_lines;
+        }
+        const std::vector<Material>& materials() const override
+        {
+                return m_materials;
+        }
+        const std::vector<Image>& images() const override
+        {
+                return m_images;
+        }
+        Vector<N, float> center() const override
+        {
+                return m_center;
+        }
+        float length() const override
+        {
+                return m_length;
+        }
+
+public:
+        FileObj(const std::string& file_name, ProgressRatio* progress);
+
+        const std::vector<std::string>& dependencies() const
+        {
+                return m_dependencies;
+        }
+};
+
+template <size_t N>
+void FileObj<N>::check_facet_indices() const
+{
+        int vertex_count = m_vertices.size();
+        int texcoord_count = m_texcoords.size();
+        int normal_count = m_normals.size();
+
+        for (const Facet& facet : m_facets)
+        {
+                ::check_facet_indices<N>(facet, vertex_count, normal_count, texcoord_count);
+        }
+}
+
+template <size_t N>
+bool FileObj<N>::remove_facets_with_incorrect_dimension()
+{
+        if constexpr (N != 3)
+        {
+                return false;
+        }
+        else
+        {
+                std::vector<bool> wrong_facets(m_facets.size(), false);
+
+                int wrong_facet_count = 0;
+
+                for (size_t i = 0; i < m_facets.size(); ++i)
+                {
+                        if (!facet_dimension_is_correct(m_vertices, m_facets[i].vertices))
+                        {
+                                wrong_facets[i] = true;
+                                ++wrong_facet_count;
+                        }
+                }
+
+                if (wrong_facet_count == 0)
+                {
+                        return false;
+                }
+
+                std::vector<Facet> facets;
+                facets.reserve(m_facets.size() - wrong_facet_count);
+
+                for (size_t i = 0; i < m_facets.size(); ++i)
+                {
+                        if (!wrong_facets[i])
+                        {
+                                facets.push_back(m_facets[i]);
+                        }
+                }
+
+                m_facets = std::move(facets);
+
+                return true;
         }
-        threads.join();
 }
 
 template <size_t N>
@@ -1404,10 +1497,26 @@ void FileObj<N>::read_obj_and_mtl(const std::string& file_name, ProgressRatio* p
 {
         progress->set_undefined();
 
-        std::map<std::string, int> material_index;
-        std::vector<std::string> library_names;
+        FileObjReader<N> reader;
+
+        std::vector<std::vector<Vector<N, float>>> vertices;
+        std::vector<std::vector<Vector<N, float>>> normals;
+        std::vector<std::vector<Vector<N - 1, float>>> texcoords;
+        std::vector<std::vector<Facet>> facets;
 
-        read_obj(file_name, progress, &material_index, &library_names);
+        reader.read_obj(file_name, progress,
+                        [&](std::vector<Vector<N, float>>&& chunk_vertices, std::vector<Vector<N, float>>&& chunk_normals,
+                            std::vector<Vector<N - 1, float>>&& chunk_texcoords, std::vector<Facet>&& chunk_facets) {
+                                vertices.push_back(std::move(chunk_vertices));
+                                normals.push_back(std::move(chunk_normals));
+                                texcoords.push_back(std::move(chunk_texcoords));
+                                facets.push_back(std::move(chunk_facets));
+                        });
+
+        join(std::move(vertices), &m_vertices);
+        join(std::move(normals), &m_normals);
+        join(std::move(texcoords), &m_texcoords);
+        join(std::move(facets), &m_facets);
 
         if (m_facets.size() == 0)
         {
@@ -1427,7 +1536,11 @@ void FileObj<N>::read_obj_and_mtl(const std::string& file_name, ProgressRatio* p
                 center_and_length(m_vertices, m_facets, &m_center, &m_length);
         }
 
-        read_libs(file_parent_path(file_name), progress, &material_index, library_names);
+        reader.read_libs(file_parent_path(file_name), progress);
+
+        m_materials = std::move(reader.materials());
+        m_images = std::move(reader.images());
+        m_dependencies = std::move(reader.dependencies());
 }
 
 template <size_t N>
@@ -1440,6 +1553,48 @@ FileObj<N>::FileObj(const std::string& file_name, ProgressRatio* progress)
         LOG(obj_type_name(N) + " loaded, " + to_string_fixed(time_in_seconds() - start_time, 5) + " s");
 }
 
+// Кэш .objb здесь не записывается. Для записи нужен весь объект в памяти,
+// а части файла сразу передаются потребителю и не хранятся.
+template <size_t N>
+void read_obj_stream(const std::string& file_name, ProgressRatio* progress, ObjConsumer<N>* consumer)
+{
+        double start_time = time_in_seconds();
+
+        progress->set_undefined();
+
+        FileObjReader<N> reader;
+
+        bool facets_found = false;
+
+        reader.read_obj(file_name, progress,
+                        [&](std::vector<Vector<N, float>>&& vertices, std::vector<Vector<N, float>>&& normals,
+                            std::vector<Vector<N - 1, float>>&& texcoords, std::vector<typename Obj<N>::Facet>&& facets) {
+                                facets_found = facets_found || !facets.empty();
+                                consumer->obj_geometry(std::move(vertices), std::move(normals), std::move(texcoords),
+                                                       std::move(facets));
+                        });
+
+        if (!facets_found)
+        {
+                error("No facets found in OBJ file");
+        }
+
+        reader.read_libs(file_parent_path(file_name), progress);
+
+        consumer->obj_materials(std::move(reader.materials()), std::move(reader.images()));
+
+        LOG(obj_type_name(N) + " streamed, " + to_string_fixed(time_in_seconds() - start_time, 5) + " s");
+}
+
+// Объект из двоичного кэша передаётся одной частью
+template <size_t N>
+void obj_to_consumer(const Obj<N>& obj, ObjConsumer<N>* consumer)
+{
+        consumer->obj_geometry(std::vector(obj.vertices()), std::vector(obj.normals()), std::vector(obj.texcoords()),
+                               std::vector(obj.facets()));
+        consumer->obj_materials(std::vector(obj.materials()), std::vector(obj.images()));
+}
+
 // Чтение вершин из текстового файла. Одна вершина на строку. Координаты через пробел.
 // x0 x1 x2 x3 ...
 // x0 x1 x2 x3 ...
@@ -1619,7 +1774,15 @@ std::unique_ptr<Obj<N>> load_obj_from_file(const std::string& file_name, Progres
         switch (obj_file_type)
         {
         case ObjFileType::Obj:
-                return std::make_unique<FileObj<N>>(file_name, progress);
+        {
+                if (std::unique_ptr<Obj<N>> obj = load_obj_from_binary_cache<N>(file_name))
+                {
+                        return obj;
+                }
+                std::unique_ptr<FileObj<N>> obj = std::make_unique<FileObj<N>>(file_name, progress);
+                save_obj_to_binary_cache(file_name, obj->dependencies(), *obj);
+                return obj;
+        }
         case ObjFileType::Txt:
                 return std::make_unique<FileTxt<N>>(file_name, progress);
         }
@@ -1627,7 +1790,40 @@ std::unique_ptr<Obj<N>> load_obj_from_file(const std::string& file_name, Progres
         error_fatal("Unknown obj file type");
 }
 
+template <size_t N>
+void load_obj_from_file(const std::string& file_name, ProgressRatio* progress, ObjConsumer<N>* consumer)
+{
+        auto [obj_dimension, obj_file_type] = obj_file_dimension_and_type(file_name);
+
+        if (obj_dimension != static_cast<int>(N))
+        {
+                error("Requested OBJ file dimension " + to_string(N) + ", detected OBJ file dimension " +
+                      to_string(obj_dimension) + ", file " + file_name);
+        }
+
+        switch (obj_file_type)
+        {
+        case ObjFileType::Obj:
+                if (std::unique_ptr<Obj<N>> obj = load_obj_from_binary_cache<N>(file_name))
+                {
+                        obj_to_consumer(*obj, consumer);
+                        return;
+                }
+                read_obj_stream(file_name, progress, consumer);
+                return;
+        case ObjFileType::Txt:
+                error("Streaming load of TXT files is not supported, file " + file_name);
+        }
+
+        error_fatal("Unknown obj file type");
+}
+
 template std::unique_ptr<Obj<3>> load_obj_from_file(const std::string& file_name, ProgressRatio* progress);
 template std::unique_ptr<Obj<4>> load_obj_from_file(const std::string& file_name, ProgressRatio* progress);
 template std::unique_ptr<Obj<5>> load_obj_from_file(const std::string& file_name, ProgressRatio* progress);
 template std::unique_ptr<Obj<6>> load_obj_from_file(const std::string& file_name, ProgressRatio* progress);
+
+template void load_obj_from_file(const std::string& file_name, ProgressRatio* progress, ObjConsumer<3>* consumer);
+template void load_obj_from_file(const std::string& file_name, ProgressRatio* progress, ObjConsumer<4>* consumer);
+template void load_obj_from_file(const std::string& file_name, ProgressRatio* progress, ObjConsumer<5>* consumer);
+template void load_obj_from_file(const std::string& file_name, ProgressRatio* progress, ObjConsumer<6>* consumer);
@@ -25,3 +25,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 template <size_t N>
 std::unique_ptr<Obj<N>> load_obj_from_file(const std::string& file_name, ProgressRatio* progress);
+
+// Данные передаются частями по мере чтения файла, без создания объекта Obj
+template <size_t N>
+void load_obj_from_file(const std::string& file_name, ProgressRatio* progress, ObjConsumer<N>* consumer);
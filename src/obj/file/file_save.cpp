@@ -19,15 +19,27 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "obj_file.h"
 
+#include "com/error.h"
 #include "com/file/file.h"
 #include "com/file/file_sys.h"
 #include "com/log.h"
+#include "com/math.h"
 #include "com/print.h"
 #include "com/string/str.h"
+#include "com/thread.h"
 #include "com/time.h"
 #include "com/type/limit.h"
 #include "obj/alg/alg.h"
 
+#include <array>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
 constexpr const char OBJ_comment_and_space[] = "# ";
 constexpr const char OBJ_v[] = "v";
 constexpr const char OBJ_vn[] = "vn";
@@ -63,74 +75,228 @@ void write_comment(const CFile& file, const std::string_view& comment)
         fprintf(file, "%s", str.c_str());
 }
 
-template <size_t N, typename T>
-void write_vector(const CFile& file, const Vector<N, T>& vector)
+// Количество элементов, форматируемых одним потоком за один проход
+constexpr long long FORMAT_BLOCK_SIZE = 1 << 16;
+
+// Элементы форматируются в строки параллельно частями, а затем строки
+// записываются в файл по порядку немногими большими вызовами fwrite.
+template <typename Format>
+void write_elements(const CFile& file, long long count, const Format& format)
+{
+        const long long thread_count = std::min<long long>(hardware_concurrency(),
+                                                           (count + FORMAT_BLOCK_SIZE - 1) / FORMAT_BLOCK_SIZE);
+
+        if (thread_count <= 0)
+        {
+                return;
+        }
+
+        std::vector<std::string> buffers(thread_count);
+
+        for (long long pass_begin = 0; pass_begin < count; pass_begin += thread_count * FORMAT_BLOCK_SIZE)
+        {
+                const auto format_block = [&](long long thread_num) {
+                        const long long begin = pass_begin + thread_num * FORMAT_BLOCK_SIZE;
+                        const long long end = std::min(begin + FORMAT_BLOCK_SIZE, count);
+                        std::string& buffer = buffers[thread_num];
+                        buffer.clear();
+                        for (long long i = begin; i < end; ++i)
+                        {
+                                format(i, &buffer);
+                        }
+                };
+
+                if (thread_count == 1)
+                {
+                        format_block(0);
+                }
+                else
+                {
+                        ThreadsWithCatch threads(thread_count);
+                        for (long long i = 0; i < thread_count; ++i)
+                        {
+                                threads.add([&, i]() { format_block(i); });
+                        }
+                        threads.join();
+                }
+
+                for (const std::string& buffer : buffers)
+                {
+                        if (!buffer.empty() && fwrite(buffer.data(), buffer.size(), 1, file) != 1)
+                        {
+                                error("Error writing to OBJ file");
+                        }
+                }
+        }
+}
+
+void write_string(const char* str, std::string* s)
+{
+        s->append(str);
+}
+
+void write_integer(long v, std::string* s)
+{
+        std::array<char, limits<long>::digits10 + 2> buffer;
+        std::to_chars_result r = std::to_chars(buffer.data(), buffer.data() + buffer.size(), v);
+        ASSERT(r.ec == std::errc());
+        s->append(buffer.data(), r.ptr);
+}
+
+// Число |v| * 10^9, округлённое к ближайшему целому, а при равенстве расстояний
+// к чётному, как это делает printf. Вычисление точное в целых числах, так как
+// мантисса float имеет 24 бита, а 10^9 < 2^30.
+unsigned long long float_abs_to_integer_scaled(float v, unsigned long long scale)
+{
+        static_assert(limits<float>::digits == 24 && sizeof(float) == sizeof(std::uint32_t));
+
+        std::uint32_t bits;
+        std::memcpy(&bits, &v, sizeof(float));
+
+        const std::uint32_t exponent_bits = (bits >> 23) & 0xff;
+        const std::uint32_t fraction_bits = bits & 0x7f'ffff;
+
+        // |v| = mantissa * 2^exponent
+        const unsigned long long mantissa = (exponent_bits != 0) ? (fraction_bits | 0x80'0000) : fraction_bits;
+        const int exponent = (exponent_bits != 0) ? static_cast<int>(exponent_bits) - 150 : -149;
+
+        const unsigned long long numerator = mantissa * scale;
+
+        if (exponent >= 0)
+        {
+                return numerator << exponent;
+        }
+
+        const int shift = -exponent;
+        if (shift >= 64)
+        {
+                return 0;
+        }
+
+        unsigned long long q = numerator >> shift;
+        const unsigned long long r = numerator & ((1ull << shift) - 1);
+        const unsigned long long half = 1ull << (shift - 1);
+        if (r > half || (r == half && (q & 1) != 0))
+        {
+                ++q;
+        }
+        return q;
+}
+
+// Такой же результат, как у std::snprintf с форматом " %12.9f", но без printf
+void write_float(float v, std::string* s)
 {
         static_assert(limits<float>::max_digits10 <= 9);
-        static_assert(limits<double>::max_digits10 <= 17);
-        static_assert(std::is_same_v<T, float> || std::is_same_v<T, double>);
 
-        constexpr const char* format = (std::is_same_v<T, float>) ? " %12.9f" : " %20.17f";
+        constexpr int WIDTH = 12;
+        constexpr int PRECISION = 9;
+        constexpr unsigned long long SCALE = 1'000'000'000;
+        constexpr float MAX = 1e9;
+
+        if (!is_finite(v) || !(std::abs(v) < MAX))
+        {
+                std::array<char, 100> buffer;
+                int count = std::snprintf(buffer.data(), buffer.size(), " %12.9f", v);
+                if (count < 0 || count >= static_cast<int>(buffer.size()))
+                {
+                        error("Error formatting floating point number");
+                }
+                s->append(buffer.data(), count);
+                return;
+        }
+
+        unsigned long long n = float_abs_to_integer_scaled(v, SCALE);
+        unsigned long long integer_part = n / SCALE;
+        unsigned long long fraction_part = n % SCALE;
+
+        // Знак, 10 цифр целой части, точка, 9 цифр дробной части
+        std::array<char, 1 + 10 + 1 + PRECISION> buffer;
+        char* const end = buffer.data() + buffer.size();
 
+        char* p = end;
+        for (int i = 0; i < PRECISION; ++i)
+        {
+                *--p = '0' + fraction_part % 10;
+                fraction_part /= 10;
+        }
+        *--p = '.';
+        do
+        {
+                *--p = '0' + integer_part % 10;
+                integer_part /= 10;
+        } while (integer_part > 0);
+        if (std::signbit(v))
+        {
+                *--p = '-';
+        }
+
+        s->append(1 + std::max<long long>(0, WIDTH - (end - p)), ' ');
+        s->append(p, end);
+}
+
+template <size_t N>
+void write_vector(const Vector<N, float>& vector, std::string* s)
+{
         for (unsigned i = 0; i < N; ++i)
         {
-                fprintf(file, format, vector[i]);
+                write_float(vector[i], s);
         }
 }
 
 template <size_t N>
-void write_vertex(const CFile& file, const Vector<N, float>& vertex)
+void write_vertex(const Vector<N, float>& vertex, std::string* s)
 {
-        fprintf(file, "%s", OBJ_v);
-        write_vector(file, vertex);
-        fprintf(file, "\n");
+        write_string(OBJ_v, s);
+        write_vector(vertex, s);
+        *s += '\n';
 }
 
 template <size_t N>
-void write_normal(const CFile& file, const Vector<N, float>& normal)
+void write_normal(const Vector<N, float>& normal, std::string* s)
 {
-        fprintf(file, "%s", OBJ_vn);
-        write_vector(file, normal);
-        fprintf(file, "\n");
+        write_string(OBJ_vn, s);
+        write_vector(normal, s);
+        *s += '\n';
 }
 
 template <size_t N>
-void write_face(const CFile& file, const std::array<int, N>& vertices)
+void write_face(const std::array<int, N>& vertices, std::string* s)
 {
-        fprintf(file, "%s", OBJ_f);
+        write_string(OBJ_f, s);
         for (unsigned i = 0; i < N; ++i)
         {
                 // В файлах OBJ номера начинаются с 1
-                long v = vertices[i] + 1;
-                fprintf(file, " %ld", v);
+                *s += ' ';
+                write_integer(vertices[i] + 1l, s);
         }
-        fprintf(file, "\n");
+        *s += '\n';
 }
 
 template <size_t N>
-void write_face(const CFile& file, const std::array<int, N>& vertices, const std::array<int, N>& normals)
+void write_face(const std::array<int, N>& vertices, const std::array<int, N>& normals, std::string* s)
 {
-        fprintf(file, "%s", OBJ_f);
+        write_string(OBJ_f, s);
         for (unsigned i = 0; i < N; ++i)
         {
                 // В файлах OBJ номера начинаются с 1
-                long v = vertices[i] + 1;
-                long n = normals[i] + 1;
-                fprintf(file, " %ld//%ld", v, n);
+                *s += ' ';
+                write_integer(vertices[i] + 1l, s);
+                *s += "//";
+                write_integer(normals[i] + 1l, s);
         }
-        fprintf(file, "\n");
+        *s += '\n';
 }
 
-void write_line(const CFile& file, const std::array<int, 2>& vertices)
+void write_line(const std::array<int, 2>& vertices, std::string* s)
 {
-        fprintf(file, "%s", OBJ_l);
+        write_string(OBJ_l, s);
         for (unsigned i = 0; i < 2; ++i)
         {
                 // В файлах OBJ номера начинаются с 1
-                long v = vertices[i] + 1;
-                fprintf(file, " %ld", v);
+                *s += ' ';
+                write_integer(vertices[i] + 1l, s);
         }
-        fprintf(file, "\n");
+        *s += '\n';
 }
 
 // Запись вершин с приведением координат вершин к интервалу [-1, 1] с сохранением пропорций
@@ -169,20 +335,18 @@ void write_vertices(const CFile& file, const Obj<N>* obj)
         float scale_factor = 2 / max_delta;
         Vector<N, float> center = min + 0.5f * delta;
 
-        for (const Vector<N, float>& v : obj->vertices())
-        {
-                Vector<N, float> vertex = (v - center) * scale_factor;
+        write_elements(file, obj->vertices().size(), [&](long long i, std::string* s) {
+                Vector<N, float> vertex = (obj->vertices()[i] - center) * scale_factor;
 
-                write_vertex(file, vertex);
-        }
+                write_vertex(vertex, s);
+        });
 }
 
 template <size_t N>
 void write_normals(const CFile& file, const Obj<N>* obj)
 {
-        for (const Vector<N, float>& vn : obj->normals())
-        {
-                Vector<N, double> normal = to_vector<double>(vn);
+        write_elements(file, obj->normals().size(), [&](long long i, std::string* s) {
+                Vector<N, double> normal = to_vector<double>(obj->normals()[i]);
                 double len = length(normal);
 
                 if (len == 0)
@@ -192,8 +356,8 @@ void write_normals(const CFile& file, const Obj<N>* obj)
 
                 normal /= len;
 
-                write_normal(file, to_vector<float>(normal));
-        }
+                write_normal(to_vector<float>(normal), s);
+        });
 }
 
 template <size_t N>
@@ -206,15 +370,16 @@ void write_facets(const CFile& file, const Obj<N>* obj)
         // попытаться определить правильное направление по векторам вершин,
         // если у вершин они заданы.
 
-        for (const typename Obj<N>::Facet& f : obj->facets())
-        {
+        write_elements(file, obj->facets().size(), [&](long long i, std::string* s) {
+                const typename Obj<N>::Facet& f = obj->facets()[i];
+
                 if (!f.has_normal)
                 {
-                        write_face(file, f.vertices);
+                        write_face(f.vertices, s);
                 }
                 else if constexpr (N != 3)
                 {
-                        write_face(file, f.vertices, f.normals);
+                        write_face(f.vertices, f.normals, s);
                 }
                 else
                 {
@@ -239,18 +404,16 @@ void write_facets(const CFile& file, const Obj<N>* obj)
                                 std::swap(n[1], n[2]);
                         }
 
-                        write_face(file, v, n);
+                        write_face(v, n, s);
                 }
-        }
+        });
 }
 
 template <size_t N>
 void write_lines(const CFile& file, const Obj<N>* obj)
 {
-        for (const typename Obj<N>::Line& l : obj->lines())
-        {
-                write_line(file, l.vertices);
-        }
+        write_elements(file, obj->lines().size(),
+                       [&](long long i, std::string* s) { write_line(obj->lines()[i].vertices, s); });
 }
 
 std::string obj_type_name(size_t N)
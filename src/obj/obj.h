@@ -80,3 +80,23 @@ struct Obj
         virtual Vector<N, float> center() const = 0;
         virtual float length() const = 0;
 };
+
+// Получение данных объекта частями по мере их чтения
+template <size_t N>
+struct ObjConsumer
+{
+protected:
+        virtual ~ObjConsumer() = default;
+
+public:
+        // Индексы в гранях абсолютные и начинаются с 0. Грани могут ссылаться
+        // на вершины, нормали и текстурные координаты из следующих частей.
+        // Индексы и вырожденность граней при чтении не проверяются.
+        virtual void obj_geometry(std::vector<Vector<N, float>>&& vertices, std::vector<Vector<N, float>>&& normals,
+                                  std::vector<Vector<N - 1, float>>&& texcoords,
+                                  std::vector<typename Obj<N>::Facet>&& facets) = 0;
+
+        // Вызывается один раз после всех частей геометрии
+        virtual void obj_materials(std::vector<typename Obj<N>::Material>&& materials,
+                                   std::vector<typename Obj<N>::Image>&& images) = 0;
+};
@@ -0,0 +1,755 @@
+/*
+Copyright (C) 2017-2019 Topological Manifold
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "batch_render.h"
+
+#include "com/error.h"
+#include "com/file/file_sys.h"
+#include "com/log.h"
+#include "com/print.h"
+#include "com/process.h"
+#include "com/thread.h"
+#include "com/time.h"
+#include "com/type/limit.h"
+#include "obj/alg/alg.h"
+#include "obj/create/convex_hull.h"
+#include "obj/file/file_load.h"
+#include "obj/file/obj_file.h"
+#include "painter/checkpoint/checkpoint.h"
+#include "painter/image/painter_images.h"
+#include "painter/paintbrushes/tile_paintbrush.h"
+#include "painter/painter.h"
+#include "painter/scenes/cornell_box.h"
+#include "painter/scenes/single_object.h"
+#include "painter/shapes/mesh.h"
+#include "painter/visible_projectors.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace
+{
+constexpr Srgb8 BACKGROUND_COLOR(50, 100, 150);
+constexpr Srgb8 DEFAULT_COLOR(150, 170, 150);
+constexpr Color::DataType DIFFUSE = 1;
+
+constexpr double CORNELL_BOX_OBJECT_SIZE = 1;
+constexpr int TILE_SIZE = 16;
+constexpr bool SMOOTH_NORMAL = true;
+constexpr double DEFAULT_CHECKPOINT_INTERVAL = 600;
+
+constexpr const char RENDER_OPTION[] = "--render";
+
+struct Options
+{
+        std::string file_name;
+        bool cornell_box = false;
+        int min_size = 50;
+        int max_size = 500;
+        int width = 500;
+        int height = 500;
+        int samples_per_pixel = 25;
+        int pass_count = 1;
+        int thread_count = hardware_concurrency();
+        unsigned long long random_seed = 0;
+        PaintTracing tracing = PaintTracing::Packets;
+        PaintSampler sampler = PaintSampler::Sobol;
+        PaintSampling sampling = PaintSampling::Uniform;
+        PaintLightSampling light_sampling = PaintLightSampling::OneLight;
+        // Без значения параллельная проекция для одного объекта
+        // и перспективная проекция для Cornell box
+        std::optional<ProjectorType> projector;
+        std::string output_directory = temp_directory();
+        PaintCheckpointOptions checkpoint;
+
+        // Рисование части экрана с номером region_index из region_count частей
+        int region_index = 0;
+        int region_count = 0;
+
+        // Рисование частей экрана в worker_count процессах, которым
+        // передаются аргументы worker_arguments и номера частей
+        int worker_count = 0;
+        std::vector<std::string> worker_arguments;
+};
+
+std::string usage()
+{
+        return "Usage:\n"
+               "--render FILE.obj\n"
+               "  [--cornell-box] [--width N] [--height N] (3D only)\n"
+               "  [--min-size N] [--max-size N]\n"
+               "  [--samples N] [--passes N] [--threads N] [--seed N]\n"
+               "  [--projector parallel|perspective|spherical]\n"
+               "  [--sampler stratified|latin|sobol|halton] [--sampling uniform|adaptive]\n"
+               "  [--light-sampling all|one] [--tracing rays|packets|wavefront]\n"
+               "  [--output DIRECTORY]\n"
+               "  [--checkpoint FILE] [--checkpoint-interval SECONDS] [--resume FILE]\n"
+               "  [--workers N | --region-index I --region-count N]";
+}
+
+int parse_positive_int(const std::string& option, const std::string& value)
+{
+        const char* begin = value.c_str();
+        char* end;
+        errno = 0;
+        const long v = std::strtol(begin, &end, 10);
+        if (errno != 0 || end == begin || *end != '\0' || v < 1 || v > limits<int>::max())
+        {
+                error("Option " + option + " value \"" + value + "\" is not a positive integer");
+        }
+        return v;
+}
+
+unsigned long long parse_unsigned_long_long(const std::string& option, const std::string& value)
+{
+        const char* begin = value.c_str();
+        char* end;
+        errno = 0;
+        const unsigned long long v = std::strtoull(begin, &end, 10);
+        if (errno != 0 || end == begin || *end != '\0' || value[0] == '-')
+        {
+                error("Option " + option + " value \"" + value + "\" is not a non-negative integer");
+        }
+        return v;
+}
+
+PaintTracing parse_tracing(const std::string& option, const std::string& value)
+{
+        if (value == "rays")
+        {
+                return PaintTracing::Rays;
+        }
+        if (value == "packets")
+        {
+                return PaintTracing::Packets;
+        }
+        if (value == "wavefront")
+        {
+                return PaintTracing::Wavefront;
+        }
+        error("Option " + option + " value \"" + value + "\" is not rays, packets or wavefront");
+}
+
+PaintSampler parse_sampler(const std::string& option, const std::string& value)
+{
+        if (value == "stratified")
+        {
+                return PaintSampler::StratifiedJittered;
+        }
+        if (value == "latin")
+        {
+                return PaintSampler::LatinHypercube;
+        }
+        if (value == "sobol")
+        {
+                return PaintSampler::Sobol;
+        }
+        if (value == "halton")
+        {
+                return PaintSampler::Halton;
+        }
+        error("Option " + option + " value \"" + value + "\" is not stratified, latin, sobol or halton");
+}
+
+PaintSampling parse_sampling(const std::string& option, const std::string& value)
+{
+        if (value == "uniform")
+        {
+                return PaintSampling::Uniform;
+        }
+        if (value == "adaptive")
+        {
+                return PaintSampling::Adaptive;
+        }
+        error("Option " + option + " value \"" + value + "\" is not uniform or adaptive");
+}
+
+PaintLightSampling parse_light_sampling(const std::string& option, const std::string& value)
+{
+        if (value == "all")
+        {
+                return PaintLightSampling::AllLights;
+        }
+        if (value == "one")
+        {
+                return PaintLightSampling::OneLight;
+        }
+        error("Option " + option + " value \"" + value + "\" is not all or one");
+}
+
+ProjectorType parse_projector(const std::string& option, const std::string& value)
+{
+        if (value == "parallel")
+        {
+                return ProjectorType::Parallel;
+        }
+        if (value == "perspective")
+        {
+                return ProjectorType::Perspective;
+        }
+        if (value == "spherical")
+        {
+                return ProjectorType::Spherical;
+        }
+        error("Option " + option + " value \"" + value + "\" is not parallel, perspective or spherical");
+}
+
+Options parse_options(int argc, char* argv[])
+{
+        Options options;
+        options.checkpoint.save_interval = DEFAULT_CHECKPOINT_INTERVAL;
+
+        for (int i = 1; i < argc; ++i)
+        {
+                const std::string option = argv[i];
+
+                if (option == "--cornell-box")
+                {
+                        options.cornell_box = true;
+                        options.worker_arguments.push_back(option);
+                        continue;
+                }
+
+                if (i + 1 >= argc)
+                {
+                        error("No value for option " + option + "\n" + usage());
+                }
+                const std::string value = argv[++i];
+
+                if (option != "--workers" && option != "--threads" && option != "--checkpoint")
+                {
+                        options.worker_arguments.push_back(option);
+                        options.worker_arguments.push_back(value);
+                }
+
+                if (option == RENDER_OPTION)
+                {
+                        options.file_name = value;
+                }
+                else if (option == "--width")
+                {
+                        options.width = parse_positive_int(option, value);
+                }
+                else if (option == "--height")
+                {
+                        options.height = parse_positive_int(option, value);
+                }
+                else if (option == "--min-size")
+                {
+                        options.min_size = parse_positive_int(option, value);
+                }
+                else if (option == "--max-size")
+                {
+                        options.max_size = parse_positive_int(option, value);
+                }
+                else if (option == "--samples")
+                {
+                        options.samples_per_pixel = parse_positive_int(option, value);
+                }
+                else if (option == "--passes")
+                {
+                        options.pass_count = parse_positive_int(option, value);
+                }
+                else if (option == "--threads")
+                {
+                        options.thread_count = parse_positive_int(option, value);
+                }
+                else if (option == "--seed")
+                {
+                        options.random_seed = parse_unsigned_long_long(option, value);
+                }
+                else if (option == "--tracing")
+                {
+                        options.tracing = parse_tracing(option, value);
+                }
+                else if (option == "--sampler")
+                {
+                        options.sampler = parse_sampler(option, value);
+                }
+                else if (option == "--sampling")
+                {
+                        options.sampling = parse_sampling(option, value);
+                }
+                else if (option == "--light-sampling")
+                {
+                        options.light_sampling = parse_light_sampling(option, value);
+                }
+                else if (option == "--projector")
+                {
+                        options.projector = parse_projector(option, value);
+                }
+                else if (option == "--output")
+                {
+                        options.output_directory = value;
+                }
+                else if (option == "--checkpoint")
+                {
+                        options.checkpoint.save_file_name = value;
+                }
+                else if (option == "--checkpoint-interval")
+                {
+                        options.checkpoint.save_interval = parse_positive_int(option, value);
+                }
+                else if (option == "--resume")
+                {
+                        options.checkpoint.resume_file_name = value;
+                }
+                else if (option == "--region-index")
+                {
+                        options.region_index =
+                                std::min<unsigned long long>(parse_unsigned_long_long(option, value), limits<int>::max());
+                }
+                else if (option == "--region-count")
+                {
+                        options.region_count = parse_positive_int(option, value);
+                }
+                else if (option == "--workers")
+                {
+                        options.worker_count = parse_positive_int(option, value);
+                }
+                else
+                {
+                        error("Unknown option " + option + "\n" + usage());
+                }
+        }
+
+        if (options.file_name.empty())
+        {
+                error("No file name for option " + std::string(RENDER_OPTION) + "\n" + usage());
+        }
+
+        if (options.region_count > 0)
+        {
+                if (options.region_index >= options.region_count)
+                {
+                        error("Region index " + to_string(options.region_index) + " is out of region count " +
+                              to_string(options.region_count));
+                }
+                if (options.checkpoint.save_file_name.empty())
+                {
+                        error("No checkpoint file for the region");
+                }
+        }
+
+        if (options.worker_count > 0 && (options.region_count > 0 || !options.checkpoint.resume_file_name.empty()))
+        {
+                error("Workers can not be used with regions or resume");
+        }
+
+        return options;
+}
+
+long long per_second(long long count, double duration)
+{
+        return (duration > 0) ? std::llround(count / duration) : 0;
+}
+
+// Кисть с выводом в журнал скорости рисования после каждого прохода.
+// Функция next_pass вызывается одним потоком, когда остальные потоки
+// закончили проход, поэтому данные предыдущего прохода без блокировки.
+template <size_t N>
+class BatchPaintbrush final : public Paintbrush<N>
+{
+        TilePaintbrush<N> m_paintbrush;
+
+        long long m_pass_number = 0;
+        long long m_ray_count = 0;
+        long long m_sample_count = 0;
+
+        void log_pass_statistics()
+        {
+                long long pass_count, pixel_count, ray_count, sample_count, converged_pixel_count;
+                double pass_duration;
+                m_paintbrush.statistics(&pass_count, &pixel_count, &ray_count, &sample_count, &converged_pixel_count,
+                                        &pass_duration);
+
+                const long long pass_ray_count = ray_count - m_ray_count;
+                const long long pass_sample_count = sample_count - m_sample_count;
+
+                ++m_pass_number;
+                m_ray_count = ray_count;
+                m_sample_count = sample_count;
+
+                LOG("Pass " + to_string(m_pass_number) + ", " + to_string_fixed(pass_duration, 3) + " s, " +
+                    to_string_digit_groups(per_second(pass_ray_count, pass_duration)) + " rays/s, " +
+                    to_string_digit_groups(per_second(pass_sample_count, pass_duration)) + " samples/s");
+        }
+
+public:
+        BatchPaintbrush(const std::array<int, N>& screen_size, const std::array<int, N>& region_min,
+                        const std::array<int, N>& region_max, int tile_size, int max_pass_count)
+                : m_paintbrush(screen_size, region_min, region_max, tile_size, max_pass_count)
+        {
+        }
+
+        const std::array<int, N>& screen_size() const noexcept override
+        {
+                return m_paintbrush.screen_size();
+        }
+
+        void first_pass() noexcept override
+        {
+                m_paintbrush.first_pass();
+        }
+
+        bool next_pixel(int previous_pixel_ray_count, int previous_pixel_sample_count,
+                        std::array<int_least16_t, N>* pixel) noexcept override
+        {
+                return m_paintbrush.next_pixel(previous_pixel_ray_count, previous_pixel_sample_count, pixel);
+        }
+
+        bool next_pass() noexcept override
+        {
+                const bool next = m_paintbrush.next_pass();
+
+                try
+                {
+                        log_pass_statistics();
+                }
+                catch (...)
+                {
+                        error_fatal("Exception in batch paintbrush next pass");
+                }
+
+                return next;
+        }
+
+        void pixel_converged(const std::array<int_least16_t, N>& pixel) noexcept override
+        {
+                m_paintbrush.pixel_converged(pixel);
+        }
+
+        void statistics(long long* pass_count, long long* pixel_count, long long* ray_count, long long* sample_count,
+                        long long* converged_pixel_count, double* previous_pass_duration) const noexcept override
+        {
+                m_paintbrush.statistics(pass_count, pixel_count, ray_count, sample_count, converged_pixel_count,
+                                        previous_pass_duration);
+        }
+};
+
+// Для файлов с точками без граней, как в окне программы,
+// рисуется выпуклая оболочка точек
+template <size_t N>
+std::unique_ptr<const Obj<N>> load_obj_with_facets(const std::string& file_name, ProgressRatio* progress)
+{
+        std::unique_ptr<const Obj<N>> obj = load_obj_from_file<N>(file_name, progress);
+
+        if (obj->facets().size() > 0)
+        {
+                return obj;
+        }
+
+        if (obj->points().size() == 0)
+        {
+                error("No facets and points found in file " + file_name);
+        }
+
+        LOG("Creating convex hull...");
+        return create_convex_hull_for_obj(obj.get(), progress);
+}
+
+template <size_t N, typename T>
+std::unique_ptr<const PaintObjects<N, T>> create_scene(const Options& options)
+{
+        ProgressRatio progress(nullptr);
+
+        if (options.cornell_box)
+        {
+                if constexpr (N == 3 && std::is_same_v<T, double>)
+                {
+                        LOG("Loading obj from file...");
+                        std::unique_ptr<const Obj<3>> obj = load_obj_with_facets<3>(options.file_name, &progress);
+
+                        LOG("Creating mesh...");
+                        std::shared_ptr<const Mesh<3, double>> mesh = std::make_shared<const Mesh<3, double>>(
+                                obj.get(), model_vertex_matrix(*obj, CORNELL_BOX_OBJECT_SIZE, vec3(0)), options.thread_count,
+                                &progress, default_mesh_acceleration<3>());
+
+                        return cornell_box_scene(options.width, options.height, mesh, CORNELL_BOX_OBJECT_SIZE, DEFAULT_COLOR,
+                                                 DIFFUSE, vec3(0, 0, -1), vec3(0, 1, 0),
+                                                 options.projector.value_or(ProjectorType::Perspective));
+                }
+                else
+                {
+                        error("Cornell box is only for 3D objects");
+                }
+        }
+
+        constexpr Matrix<N + 1, N + 1, T> matrix(1);
+
+        std::shared_ptr<const Mesh<N, T>> mesh;
+
+        switch (std::get<1>(obj_file_dimension_and_type(options.file_name)))
+        {
+        case ObjFileType::Obj:
+                LOG("Loading obj from file and creating mesh...");
+                mesh = std::make_shared<const Mesh<N, T>>(
+                        [&](ObjConsumer<N>* consumer) { load_obj_from_file<N>(options.file_name, &progress, consumer); },
+                        matrix, options.thread_count, &progress, default_mesh_acceleration<N>());
+                break;
+        case ObjFileType::Txt:
+        {
+                LOG("Loading obj from file...");
+                std::unique_ptr<const Obj<N>> obj = load_obj_with_facets<N>(options.file_name, &progress);
+                LOG("Creating mesh...");
+                mesh = std::make_shared<const Mesh<N, T>>(obj.get(), matrix, options.thread_count, &progress,
+                                                          default_mesh_acceleration<N>());
+                break;
+        }
+        }
+
+        return single_object_scene(BACKGROUND_COLOR, DEFAULT_COLOR, DIFFUSE, options.min_size, options.max_size,
+                                   options.projector.value_or(ProjectorType::Parallel), mesh);
+}
+
+// Часть экрана по последнему измерению
+template <size_t N>
+void screen_region(const std::array<int, N>& screen_size, int region_index, int region_count, std::array<int, N>* min,
+                   std::array<int, N>* max)
+{
+        const int size = screen_size[N - 1];
+
+        if (region_count > size)
+        {
+                error("Region count " + to_string(region_count) + " is greater than the screen size " + to_string(size) +
+                      " in the last dimension");
+        }
+
+        *min = {};
+        *max = screen_size;
+        (*min)[N - 1] = static_cast<long long>(size) * region_index / region_count;
+        (*max)[N - 1] = static_cast<long long>(size) * (region_index + 1) / region_count;
+}
+
+// Части экрана рисуются в отдельных процессах этой программы, затем суммы
+// пикселей частей объединяются. Случайные числа пикселя в проходе зависят
+// только от начального числа, прохода и пикселя, поэтому изображение такое же,
+// как при рисовании в одном процессе.
+template <size_t N>
+void render_by_workers(const Options& options)
+{
+        const int worker_count = options.worker_count;
+        const int thread_count = std::max(1, options.thread_count / worker_count);
+
+        std::vector<std::string> file_names;
+        std::vector<std::vector<std::string>> arguments;
+        for (int i = 0; i < worker_count; ++i)
+        {
+                // Уникальные имена, чтобы одновременные запуски не смешивали суммы пикселей
+                file_names.push_back(
+                        unique_file_name(options.output_directory + "/painter_region_" + to_string(i) + ".checkpoint"));
+
+                arguments.push_back(options.worker_arguments);
+                arguments.back().insert(arguments.back().end(),
+                                        {"--threads", to_string(thread_count), "--region-index", to_string(i),
+                                         "--region-count", to_string(worker_count), "--checkpoint", file_names.back()});
+        }
+
+        const auto remove_files = [&]() {
+                for (const std::string& file_name : file_names)
+                {
+                        std::remove(file_name.c_str());
+                }
+        };
+
+        LOG("Painting in " + to_string(worker_count) + " processes, " + to_string(thread_count) + " threads each...");
+        double start_time = time_in_seconds();
+        double duration;
+
+        std::vector<PaintCheckpoint<N>> checkpoints;
+        try
+        {
+                std::vector<int> exit_codes = run_program_copies(arguments);
+                duration = time_in_seconds() - start_time;
+
+                for (int i = 0; i < worker_count; ++i)
+                {
+                        if (exit_codes[i] != EXIT_SUCCESS)
+                        {
+                                error("Painting process " + to_string(i) + " failed, exit code " + to_string(exit_codes[i]));
+                        }
+                }
+
+                for (const std::string& file_name : file_names)
+                {
+                        checkpoints.push_back(load_paint_checkpoint<N>(file_name));
+                }
+        }
+        catch (...)
+        {
+                remove_files();
+                throw;
+        }
+        remove_files();
+
+        PaintCheckpoint<N> checkpoint = merge_paint_checkpoint_regions(std::move(checkpoints));
+
+        long long sample_count = 0;
+        for (const PaintPixelSum& p : checkpoint.pixels)
+        {
+                sample_count += p.sample_count;
+        }
+
+        LOG("Painted, " + to_string_fixed(duration, 3) + " s, " +
+            to_string(checkpoint.pass_end - checkpoint.pass_begin) + " passes, " +
+            to_string_digit_groups(sample_count) + " samples, " +
+            to_string_digit_groups(per_second(sample_count, duration)) + " samples/s");
+
+        if (!options.checkpoint.save_file_name.empty())
+        {
+                save_paint_checkpoint(options.checkpoint.save_file_name, checkpoint);
+        }
+
+        PainterImages<N> images(checkpoint.screen_size);
+        std::vector<PainterPixel<N>> colors;
+        paint_checkpoint_colors(checkpoint.screen_size, checkpoint.pixels, &colors);
+        images.painter_pixels_after(colors);
+
+        LOG("Writing screen images to " + options.output_directory + "...");
+        images.write_to_files(options.output_directory);
+
+        LOG("Done");
+}
+
+template <size_t N, typename T>
+void render(const Options& options)
+{
+        if (options.worker_count > 0)
+        {
+                render_by_workers<N - 1>(options);
+                return;
+        }
+
+        std::unique_ptr<const PaintObjects<N, T>> paint_objects = create_scene<N, T>(options);
+
+        const std::array<int, N - 1>& screen_size = paint_objects->projector().screen_size();
+
+        std::array<int, N - 1> region_min = {};
+        std::array<int, N - 1> region_max = screen_size;
+        if (options.region_count > 0)
+        {
+                screen_region(screen_size, options.region_index, options.region_count, &region_min, &region_max);
+                LOG("Region " + to_string(region_min) + " - " + to_string(region_max));
+        }
+
+        PainterImages<N - 1> images(screen_size);
+
+        BatchPaintbrush<N - 1> paintbrush(screen_size, region_min, region_max, TILE_SIZE, options.pass_count);
+
+        std::atomic_bool stop = false;
+
+        LOG("Painting...");
+        double start_time = time_in_seconds();
+        paint(&images, options.samples_per_pixel, *paint_objects, &paintbrush, options.thread_count, &stop, SMOOTH_NORMAL,
+              options.tracing, options.sampler, options.sampling, options.light_sampling, options.random_seed,
+              options.checkpoint);
+        double duration = time_in_seconds() - start_time;
+
+        std::string error_message = images.error_message();
+        if (!error_message.empty())
+        {
+                error(error_message);
+        }
+
+        long long pass_count, pixel_count, ray_count, sample_count, converged_pixel_count;
+        double previous_pass_duration;
+        paintbrush.statistics(&pass_count, &pixel_count, &ray_count, &sample_count, &converged_pixel_count,
+                              &previous_pass_duration);
+
+        LOG("Painted, " + to_string_fixed(duration, 3) + " s, " + to_string(pass_count) + " passes, " +
+            to_string_digit_groups(ray_count) + " rays, " + to_string_digit_groups(per_second(ray_count, duration)) +
+            " rays/s, " + to_string_digit_groups(sample_count) + " samples, " +
+            to_string_digit_groups(per_second(sample_count, duration)) + " samples/s");
+
+        if (options.region_count == 0)
+        {
+                LOG("Writing screen images to " + options.output_directory + "...");
+                images.write_to_files(options.output_directory);
+        }
+
+        LOG("Done");
+}
+
+void render(const Options& options)
+{
+        int dimension = std::get<0>(obj_file_dimension_and_type(options.file_name));
+
+        switch (dimension)
+        {
+        case 3:
+                render<3, double>(options);
+                return;
+        case 4:
+                render<4, double>(options);
+                return;
+        case 5:
+                render<5, double>(options);
+                return;
+        case 6:
+                render<6, double>(options);
+                return;
+        }
+        error("Batch render dimension " + to_string(dimension) + " is not supported, min = 3, max = 6");
+}
+}
+
+bool batch_render_command_line(int argc, char* argv[])
+{
+        for (int i = 1; i < argc; ++i)
+        {
+                if (std::string(argv[i]) == RENDER_OPTION)
+                {
+                        return true;
+                }
+        }
+        return false;
+}
+
+int batch_render(int argc, char* argv[]) noexcept
+{
+        try
+        {
+                try
+                {
+                        render(parse_options(argc, argv));
+
+                        return EXIT_SUCCESS;
+                }
+                catch (std::exception& e)
+                {
+                        LOG(std::string("Batch render error\n") + e.what());
+                }
+                catch (...)
+                {
+                        LOG("Unknown batch render error");
+                }
+
+                return EXIT_FAILURE;
+        }
+        catch (...)
+        {
+                error_fatal("Exception in batch render exception handlers");
+        }
+}
@@ -0,0 +1,166 @@
+/*
+Copyright (C) 2017-2019 Topological Manifold
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "test_batch_render.h"
+
+#include "com/error.h"
+#include "com/file/file_sys.h"
+#include "com/log.h"
+#include "com/print.h"
+#include "com/vec.h"
+#include "obj/create/facets.h"
+#include "obj/file/file_save.h"
+#include "painter/batch/batch_render.h"
+#include "painter/checkpoint/checkpoint.h"
+
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+namespace
+{
+std::string save_octahedron(const std::string& file_name)
+{
+        std::vector<Vector<3, float>> points;
+        for (unsigned i = 0; i < 3; ++i)
+        {
+                Vector<3, float> v(0);
+                v[i] = 1;
+                points.push_back(v);
+                points.push_back(-v);
+        }
+
+        std::vector<std::array<int, 3>> facets;
+        for (int x : {0, 1})
+        {
+                for (int y : {2, 3})
+                {
+                        for (int z : {4, 5})
+                        {
+                                facets.push_back({x, y, z});
+                        }
+                }
+        }
+
+        return save_obj_geometry_to_file(create_obj_for_facets(points, facets).get(), file_name, "Batch render test");
+}
+
+PaintCheckpoint<2> batch_render_to_checkpoint(std::vector<std::string> arguments, const std::string& checkpoint_file_name)
+{
+        arguments.insert(arguments.end(), {"--checkpoint", checkpoint_file_name});
+
+        std::vector<char*> argv;
+        argv.push_back(const_cast<char*>("batch_render"));
+        for (std::string& argument : arguments)
+        {
+                argv.push_back(argument.data());
+        }
+        argv.push_back(nullptr);
+
+        if (batch_render(argv.size() - 1, argv.data()) != EXIT_SUCCESS)
+        {
+                error("Batch render failed");
+        }
+
+        PaintCheckpoint<2> checkpoint = load_paint_checkpoint<2>(checkpoint_file_name);
+        std::remove(checkpoint_file_name.c_str());
+        return checkpoint;
+}
+
+bool equal(const PaintPixelSum& a, const PaintPixelSum& b)
+{
+        return a.color_sum.data() == b.color_sum.data() && a.luminance_square_sum == b.luminance_square_sum &&
+               a.sample_count == b.sample_count;
+}
+}
+
+// Рисование частей экрана в отдельных процессах должно давать
+// такие же суммы пикселей, как рисование в одном процессе
+void test_batch_render_workers()
+{
+        // Отдельная папка для каждого запуска, так как имена файлов изображений постоянные
+        const std::string directory = unique_file_name(temp_directory() + "/test_batch_render");
+        if (!create_directory(directory))
+        {
+                error("Failed to create directory " + directory);
+        }
+
+        const std::string single_file_name = directory + "/single.checkpoint";
+        const std::string workers_file_name = directory + "/workers.checkpoint";
+        std::string obj_file_name;
+
+        const auto remove_files = [&]() {
+                if (!obj_file_name.empty())
+                {
+                        std::remove(obj_file_name.c_str());
+                        std::remove((obj_file_name + ".objb").c_str());
+                }
+                std::remove(single_file_name.c_str());
+                std::remove(workers_file_name.c_str());
+                // Изображение единственного двумерного экрана
+                std::remove((directory + "/painter_1.ppm").c_str());
+                remove_directory(directory);
+        };
+
+        PaintCheckpoint<2> single;
+        PaintCheckpoint<2> workers;
+        try
+        {
+                obj_file_name = save_octahedron(directory + "/octahedron");
+
+                const std::vector<std::string> arguments = {
+                        "--render",  obj_file_name, "--min-size",  "20",          "--max-size", "30",     "--samples",
+                        "4",         "--passes",    "2",           "--seed",      "123",        "--threads", "2",
+                        "--tracing", "rays",        "--projector", "perspective", "--sampler",  "halton", "--output",
+                        directory};
+
+                LOG("Batch render in one process...");
+                single = batch_render_to_checkpoint(arguments, single_file_name);
+
+                LOG("Batch render in worker processes...");
+                std::vector<std::string> worker_arguments = arguments;
+                worker_arguments.insert(worker_arguments.end(), {"--workers", "2"});
+                workers = batch_render_to_checkpoint(worker_arguments, workers_file_name);
+        }
+        catch (...)
+        {
+                remove_files();
+                throw;
+        }
+        remove_files();
+
+        if (single.screen_size != workers.screen_size || single.random_seed != workers.random_seed ||
+            single.pass_begin != workers.pass_begin || single.pass_end != workers.pass_end ||
+            single.pixels.size() != workers.pixels.size())
+        {
+                error("Batch render checkpoints are different, passes [" + to_string(single.pass_begin) + ", " +
+                      to_string(single.pass_end) + ") and [" + to_string(workers.pass_begin) + ", " +
+                      to_string(workers.pass_end) + ")");
+        }
+
+        for (size_t i = 0; i < single.pixels.size(); ++i)
+        {
+                if (!equal(single.pixels[i], workers.pixels[i]))
+                {
+                        error("Batch render pixels " + to_string(i) + " are different");
+                }
+        }
+
+        LOG("Test batch render workers passed");
+}
@@ -0,0 +1,409 @@
+/*
+Copyright (C) 2017-2019 Topological Manifold
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+Формат файла
+
+  Заголовок
+    сигнатура, версия, размерность экрана, размеры типов элементов
+  Данные
+    размеры экрана, начальное число случайных чисел,
+    начальный и конечный номера проходов,
+    массив сумм пикселей, как он находится в памяти.
+*/
+
+#include "checkpoint.h"
+
+#include "com/alg.h"
+#include "com/error.h"
+#include "com/file/binary.h"
+#include "com/file/file_map.h"
+#include "com/file/file_sys.h"
+#include "com/log.h"
+#include "com/print.h"
+#include "com/time.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <exception>
+#include <type_traits>
+
+constexpr std::array<char, 8> CHECKPOINT_SIGNATURE = {'P', 'A', 'I', 'N', 'T', 'C', 'K', 'P'};
+constexpr unsigned CHECKPOINT_VERSION = 1;
+
+static_assert(std::is_trivially_copyable_v<PaintPixelSum>);
+
+namespace
+{
+template <size_t N>
+void write_header(BinaryWriter* writer)
+{
+        writer->write(CHECKPOINT_SIGNATURE);
+        writer->write(CHECKPOINT_VERSION);
+        writer->write<unsigned>(N);
+        writer->write<unsigned>(sizeof(Color::DataType));
+        writer->write<unsigned>(sizeof(PaintPixelSum));
+}
+
+template <size_t N>
+bool read_header(BinaryReader* reader)
+{
+        return reader->read<std::array<char, 8>>() == CHECKPOINT_SIGNATURE &&
+               reader->read<unsigned>() == CHECKPOINT_VERSION && reader->read<unsigned>() == N &&
+               reader->read<unsigned>() == sizeof(Color::DataType) && reader->read<unsigned>() == sizeof(PaintPixelSum);
+}
+
+template <size_t N>
+void check_checkpoint(const PaintCheckpoint<N>& checkpoint)
+{
+        for (unsigned i = 0; i < N; ++i)
+        {
+                if (checkpoint.screen_size[i] < 1)
+                {
+                        error("Paint checkpoint screen size " + to_string(checkpoint.screen_size) + " is not positive");
+                }
+        }
+
+        if (!(checkpoint.pass_begin >= 0 && checkpoint.pass_begin <= checkpoint.pass_end))
+        {
+                error("Error paint checkpoint passes [" + to_string(checkpoint.pass_begin) + ", " +
+                      to_string(checkpoint.pass_end) + ")");
+        }
+
+        if (static_cast<long long>(checkpoint.pixels.size()) != multiply_all<long long>(checkpoint.screen_size))
+        {
+                error("Paint checkpoint pixel count " + to_string(checkpoint.pixels.size()) +
+                      " is not equal to screen size " + to_string(checkpoint.screen_size));
+        }
+}
+}
+
+template <size_t N>
+void save_paint_checkpoint(const std::string& file_name, const PaintCheckpoint<N>& checkpoint)
+{
+        check_checkpoint(checkpoint);
+
+        // Запись во временный файл с уникальным именем и затем замена файла,
+        // чтобы при ошибках записи или остановке программы остался предыдущий полный файл.
+        const std::string tmp_name = unique_file_name(file_name);
+
+        try
+        {
+                {
+                        BinaryWriter writer(tmp_name);
+                        write_header<N>(&writer);
+                        writer.write(checkpoint.screen_size);
+                        writer.write(checkpoint.random_seed);
+                        writer.write(checkpoint.pass_begin);
+                        writer.write(checkpoint.pass_end);
+                        writer.write(checkpoint.pixels);
+                }
+
+                if (!replace_file(tmp_name, file_name))
+                {
+                        error("Failed to rename file " + tmp_name + " to " + file_name);
+                }
+        }
+        catch (...)
+        {
+                std::remove(tmp_name.c_str());
+                throw;
+        }
+}
+
+template <size_t N>
+PaintCheckpoint<N> load_paint_checkpoint(const std::string& file_name)
+{
+        FileMap file_map(file_name);
+        BinaryReader reader(file_map.data(), file_map.size());
+
+        if (!read_header<N>(&reader))
+        {
+                error("File " + file_name + " is not a paint checkpoint file for screen dimension " + to_string(N));
+        }
+
+        PaintCheckpoint<N> checkpoint;
+
+        checkpoint.screen_size = reader.read<std::array<int, N>>();
+        checkpoint.random_seed = reader.read<unsigned long long>();
+        checkpoint.pass_begin = reader.read<long long>();
+        checkpoint.pass_end = reader.read<long long>();
+        reader.read(&checkpoint.pixels);
+
+        if (!reader.at_end())
+        {
+                error("Paint checkpoint file " + file_name + " has extra data");
+        }
+
+        check_checkpoint(checkpoint);
+
+        return checkpoint;
+}
+
+template <size_t N>
+PaintCheckpoint<N> merge_paint_checkpoints(std::vector<PaintCheckpoint<N>>&& checkpoints)
+{
+        if (checkpoints.empty())
+        {
+                error("No paint checkpoints to merge");
+        }
+
+        for (const PaintCheckpoint<N>& checkpoint : checkpoints)
+        {
+                check_checkpoint(checkpoint);
+        }
+
+        std::sort(checkpoints.begin(), checkpoints.end(),
+                  [](const PaintCheckpoint<N>& a, const PaintCheckpoint<N>& b) { return a.pass_begin < b.pass_begin; });
+
+        PaintCheckpoint<N> result = std::move(checkpoints[0]);
+
+        for (unsigned i = 1; i < checkpoints.size(); ++i)
+        {
+                const PaintCheckpoint<N>& checkpoint = checkpoints[i];
+
+                if (checkpoint.screen_size != result.screen_size)
+                {
+                        error("Paint checkpoint screen sizes are different: " + to_string(result.screen_size) + " and " +
+                              to_string(checkpoint.screen_size));
+                }
+                if (checkpoint.random_seed != result.random_seed)
+                {
+                        error("Paint checkpoint random seeds are different: " + to_string(result.random_seed) + " and " +
+                              to_string(checkpoint.random_seed));
+                }
+                if (checkpoint.pass_begin != result.pass_end)
+                {
+                        error("Paint checkpoint passes are not contiguous: [" + to_string(result.pass_begin) + ", " +
+                              to_string(result.pass_end) + ") and [" + to_string(checkpoint.pass_begin) + ", " +
+                              to_string(checkpoint.pass_end) + ")");
+                }
+
+                for (size_t p = 0; p < result.pixels.size(); ++p)
+                {
+                        PaintPixelSum& sum = result.pixels[p];
+                        sum.color_sum += checkpoint.pixels[p].color_sum;
+                        sum.luminance_square_sum += checkpoint.pixels[p].luminance_square_sum;
+                        sum.sample_count += checkpoint.pixels[p].sample_count;
+                }
+
+                result.pass_end = checkpoint.pass_end;
+        }
+
+        return result;
+}
+
+template <size_t N>
+PaintCheckpoint<N> merge_paint_checkpoint_regions(std::vector<PaintCheckpoint<N>>&& checkpoints)
+{
+        if (checkpoints.empty())
+        {
+                error("No paint checkpoints to merge");
+        }
+
+        for (const PaintCheckpoint<N>& checkpoint : checkpoints)
+        {
+                check_checkpoint(checkpoint);
+        }
+
+        PaintCheckpoint<N> result = std::move(checkpoints[0]);
+
+        for (unsigned i = 1; i < checkpoints.size(); ++i)
+        {
+                const PaintCheckpoint<N>& checkpoint = checkpoints[i];
+
+                if (checkpoint.screen_size != result.screen_size)
+                {
+                        error("Paint checkpoint screen sizes are different: " + to_string(result.screen_size) + " and " +
+                              to_string(checkpoint.screen_size));
+                }
+                if (checkpoint.random_seed != result.random_seed)
+                {
+                        error("Paint checkpoint random seeds are different: " + to_string(result.random_seed) + " and " +
+                              to_string(checkpoint.random_seed));
+                }
+                if (checkpoint.pass_begin != result.pass_begin || checkpoint.pass_end != result.pass_end)
+                {
+                        error("Paint checkpoint passes are different: [" + to_string(result.pass_begin) + ", " +
+                              to_string(result.pass_end) + ") and [" + to_string(checkpoint.pass_begin) + ", " +
+                              to_string(checkpoint.pass_end) + ")");
+                }
+
+                for (size_t p = 0; p < result.pixels.size(); ++p)
+                {
+                        if (checkpoint.pixels[p].sample_count == 0)
+                        {
+                                continue;
+                        }
+                        if (result.pixels[p].sample_count != 0)
+                        {
+                                error("Paint checkpoint regions overlap at pixel " + to_string(p));
+                        }
+                        result.pixels[p] = checkpoint.pixels[p];
+                }
+        }
+
+        return result;
+}
+
+template <size_t N>
+void paint_checkpoint_colors(const std::array<int, N>& screen_size, const std::vector<PaintPixelSum>& pixels,
+                             std::vector<PainterPixel<N>>* colors)
+{
+        ASSERT(static_cast<long long>(pixels.size()) == multiply_all<long long>(screen_size));
+
+        colors->clear();
+
+        std::array<int_least16_t, N> pixel{};
+        for (const PaintPixelSum& p : pixels)
+        {
+                if (p.sample_count > 0)
+                {
+                        colors->push_back({pixel, p.color_sum / p.sample_count});
+                }
+
+                // Первое измерение меняется быстрее всех, как в GlobalIndex
+                for (unsigned i = 0; i < N; ++i)
+                {
+                        if (++pixel[i] < screen_size[i])
+                        {
+                                break;
+                        }
+                        pixel[i] = 0;
+                }
+        }
+}
+
+template <size_t N>
+PaintCheckpointWriter<N>::PaintCheckpointWriter(const std::string& file_name, double interval)
+        : m_file_name(file_name), m_interval(interval), m_last_write_time(time_in_seconds())
+{
+        if (m_file_name.empty())
+        {
+                error("No paint checkpoint file name");
+        }
+        if (!(m_interval >= 0))
+        {
+                error("Error paint checkpoint interval " + to_string(m_interval));
+        }
+
+        m_thread = std::thread([this]() noexcept { write_thread(); });
+}
+
+template <size_t N>
+PaintCheckpointWriter<N>::~PaintCheckpointWriter()
+{
+        {
+                std::lock_guard lg(m_mutex);
+                m_exit = true;
+        }
+        m_cv.notify_one();
+
+        m_thread.join();
+}
+
+template <size_t N>
+bool PaintCheckpointWriter<N>::interval_elapsed() const
+{
+        return time_in_seconds() - m_last_write_time >= m_interval;
+}
+
+template <size_t N>
+void PaintCheckpointWriter<N>::write(PaintCheckpoint<N>&& checkpoint)
+{
+        m_last_write_time = time_in_seconds();
+
+        {
+                std::lock_guard lg(m_mutex);
+                m_checkpoint = std::move(checkpoint);
+        }
+        m_cv.notify_one();
+}
+
+template <size_t N>
+void PaintCheckpointWriter<N>::write_thread() noexcept
+{
+        try
+        {
+                while (true)
+                {
+                        std::optional<PaintCheckpoint<N>> checkpoint;
+                        {
+                                std::unique_lock lock(m_mutex);
+                                m_cv.wait(lock, [this]() { return m_checkpoint || m_exit; });
+                                if (!m_checkpoint)
+                                {
+                                        return;
+                                }
+                                checkpoint.swap(m_checkpoint);
+                        }
+
+                        try
+                        {
+                                double start_time = time_in_seconds();
+
+                                save_paint_checkpoint(m_file_name, *checkpoint);
+
+                                LOG("Paint checkpoint saved to " + m_file_name + ", passes [" +
+                                    to_string(checkpoint->pass_begin) + ", " + to_string(checkpoint->pass_end) + "), " +
+                                    to_string_fixed(time_in_seconds() - start_time, 5) + " s");
+                        }
+                        catch (std::exception& e)
+                        {
+                                LOG("Error saving paint checkpoint to " + m_file_name + ": " + e.what());
+                        }
+                }
+        }
+        catch (...)
+        {
+                error_fatal("Exception in paint checkpoint writer thread");
+        }
+}
+
+template void save_paint_checkpoint(const std::string& file_name, const PaintCheckpoint<2>& checkpoint);
+template void save_paint_checkpoint(const std::string& file_name, const PaintCheckpoint<3>& checkpoint);
+template void save_paint_checkpoint(const std::string& file_name, const PaintCheckpoint<4>& checkpoint);
+template void save_paint_checkpoint(const std::string& file_name, const PaintCheckpoint<5>& checkpoint);
+
+template PaintCheckpoint<2> load_paint_checkpoint(const std::string& file_name);
+template PaintCheckpoint<3> load_paint_checkpoint(const std::string& file_name);
+template PaintCheckpoint<4> load_paint_checkpoint(const std::string& file_name);
+template PaintCheckpoint<5> load_paint_checkpoint(const std::string& file_name);
+
+template PaintCheckpoint<2> merge_paint_checkpoints(std::vector<PaintCheckpoint<2>>&& checkpoints);
+template PaintCheckpoint<3> merge_paint_checkpoints(std::vector<PaintCheckpoint<3>>&& checkpoints);
+template PaintCheckpoint<4> merge_paint_checkpoints(std::vector<PaintCheckpoint<4>>&& checkpoints);
+template PaintCheckpoint<5> merge_paint_checkpoints(std::vector<PaintCheckpoint<5>>&& checkpoints);
+
+template PaintCheckpoint<2> merge_paint_checkpoint_regions(std::vector<PaintCheckpoint<2>>&& checkpoints);
+template PaintCheckpoint<3> merge_paint_checkpoint_regions(std::vector<PaintCheckpoint<3>>&& checkpoints);
+template PaintCheckpoint<4> merge_paint_checkpoint_regions(std::vector<PaintCheckpoint<4>>&& checkpoints);
+template PaintCheckpoint<5> merge_paint_checkpoint_regions(std::vector<PaintCheckpoint<5>>&& checkpoints);
+
+template void paint_checkpoint_colors(const std::array<int, 2>& screen_size, const std::vector<PaintPixelSum>& pixels,
+                                      std::vector<PainterPixel<2>>* colors);
+template void paint_checkpoint_colors(const std::array<int, 3>& screen_size, const std::vector<PaintPixelSum>& pixels,
+                                      std::vector<PainterPixel<3>>* colors);
+template void paint_checkpoint_colors(const std::array<int, 4>& screen_size, const std::vector<PaintPixelSum>& pixels,
+                                      std::vector<PainterPixel<4>>* colors);
+template void paint_checkpoint_colors(const std::array<int, 5>& screen_size, const std::vector<PaintPixelSum>& pixels,
+                                      std::vector<PainterPixel<5>>* colors);
+
+template class PaintCheckpointWriter<2>;
+template class PaintCheckpointWriter<3>;
+template class PaintCheckpointWriter<4>;
+template class PaintCheckpointWriter<5>;
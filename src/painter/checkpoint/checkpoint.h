@@ -0,0 +1,109 @@
+/*
+Copyright (C) 2017-2019 Topological Manifold
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "com/color/color.h"
+#include "painter/painter.h"
+
+#include <array>
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Суммы цветов точек, квадратов яркостей точек и количество точек пикселя
+struct PaintPixelSum
+{
+        Color color_sum{0};
+        Color::DataType luminance_square_sum = 0;
+        int sample_count = 0;
+};
+
+// Суммы пикселей экрана размерности N после проходов с номерами
+// от pass_begin до pass_end, не включая pass_end. Случайные числа
+// пикселя в проходе определяются по random_seed, номеру прохода
+// и пикселю, поэтому можно продолжить рисование со следующего прохода
+// или объединить результаты соседних диапазонов проходов, нарисованных
+// на разных компьютерах.
+template <size_t N>
+struct PaintCheckpoint
+{
+        std::array<int, N> screen_size;
+        unsigned long long random_seed;
+        long long pass_begin;
+        long long pass_end;
+        std::vector<PaintPixelSum> pixels;
+};
+
+template <size_t N>
+void save_paint_checkpoint(const std::string& file_name, const PaintCheckpoint<N>& checkpoint);
+
+template <size_t N>
+PaintCheckpoint<N> load_paint_checkpoint(const std::string& file_name);
+
+// Диапазоны проходов должны следовать друг за другом без пропусков
+template <size_t N>
+PaintCheckpoint<N> merge_paint_checkpoints(std::vector<PaintCheckpoint<N>>&& checkpoints);
+
+// Объединение частей экрана, нарисованных отдельно за одни и те же проходы.
+// Каждый пиксель должен иметь точки не больше чем в одной части.
+template <size_t N>
+PaintCheckpoint<N> merge_paint_checkpoint_regions(std::vector<PaintCheckpoint<N>>&& checkpoints);
+
+// Цвета пикселей, для которых есть точки
+template <size_t N>
+void paint_checkpoint_colors(const std::array<int, N>& screen_size, const std::vector<PaintPixelSum>& pixels,
+                             std::vector<PainterPixel<N>>* colors);
+
+// Запись в отдельном потоке, чтобы потоки рисования не ждали записи в файл.
+// Если предыдущая запись ещё не закончилась, то ожидающие записи данные
+// заменяются новыми. Ошибки записи выводятся в журнал.
+template <size_t N>
+class PaintCheckpointWriter
+{
+        const std::string m_file_name;
+        const double m_interval;
+        double m_last_write_time;
+
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        std::optional<PaintCheckpoint<N>> m_checkpoint;
+        bool m_exit = false;
+
+        std::thread m_thread;
+
+        void write_thread() noexcept;
+
+public:
+        // Минимальное время в секундах между записями
+        PaintCheckpointWriter(const std::string& file_name, double interval);
+
+        // Ожидание записи последних переданных данных
+        ~PaintCheckpointWriter();
+
+        bool interval_elapsed() const;
+
+        void write(PaintCheckpoint<N>&& checkpoint);
+
+        PaintCheckpointWriter(const PaintCheckpointWriter&) = delete;
+        PaintCheckpointWriter& operator=(const PaintCheckpointWriter&) = delete;
+        PaintCheckpointWriter(PaintCheckpointWriter&&) = delete;
+        PaintCheckpointWriter& operator=(PaintCheckpointWriter&&) = delete;
+};
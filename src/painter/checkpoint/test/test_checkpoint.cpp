@@ -0,0 +1,339 @@
+/*
+Copyright (C) 2017-2019 Topological Manifold
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "test_checkpoint.h"
+
+#include "com/alg.h"
+#include "com/error.h"
+#include "com/file/file_sys.h"
+#include "com/log.h"
+#include "com/print.h"
+#include "com/random/engine.h"
+#include "com/thread.h"
+#include "painter/checkpoint/checkpoint.h"
+#include "painter/image/painter_images.h"
+#include "painter/paintbrushes/tile_paintbrush.h"
+#include "painter/painter.h"
+#include "painter/scenes/single_object.h"
+#include "painter/shapes/test/sphere_mesh.h"
+#include "painter/visible_paintbrush.h"
+
+#include <atomic>
+#include <cstdio>
+#include <random>
+
+namespace
+{
+template <size_t N, typename RandomEngine>
+PaintCheckpoint<N> random_checkpoint(RandomEngine& engine, const std::array<int, N>& screen_size,
+                                     unsigned long long random_seed, long long pass_begin, long long pass_end)
+{
+        std::uniform_real_distribution<Color::DataType> urd(0, 10);
+        std::uniform_int_distribution<int> uid(1, 100);
+
+        PaintCheckpoint<N> checkpoint;
+        checkpoint.screen_size = screen_size;
+        checkpoint.random_seed = random_seed;
+        checkpoint.pass_begin = pass_begin;
+        checkpoint.pass_end = pass_end;
+        checkpoint.pixels.resize(multiply_all<long long>(screen_size));
+        for (PaintPixelSum& p : checkpoint.pixels)
+        {
+                p.color_sum = Color(Vector<3, Color::DataType>(urd(engine), urd(engine), urd(engine)));
+                p.luminance_square_sum = urd(engine);
+                p.sample_count = uid(engine);
+        }
+        return checkpoint;
+}
+
+bool equal(const PaintPixelSum& a, const PaintPixelSum& b)
+{
+        return a.color_sum.data() == b.color_sum.data() && a.luminance_square_sum == b.luminance_square_sum &&
+               a.sample_count == b.sample_count;
+}
+
+template <size_t N>
+void compare(const PaintCheckpoint<N>& a, const PaintCheckpoint<N>& b)
+{
+        if (a.screen_size != b.screen_size || a.random_seed != b.random_seed || a.pass_begin != b.pass_begin ||
+            a.pass_end != b.pass_end || a.pixels.size() != b.pixels.size())
+        {
+                error("Paint checkpoints are different");
+        }
+        for (size_t i = 0; i < a.pixels.size(); ++i)
+        {
+                if (!equal(a.pixels[i], b.pixels[i]))
+                {
+                        error("Paint checkpoint pixels " + to_string(i) + " are different");
+                }
+        }
+}
+
+template <size_t N>
+void test_save_and_load(const PaintCheckpoint<N>& checkpoint)
+{
+        const std::string file_name = unique_file_name(temp_directory() + "/test_paint_checkpoint");
+
+        save_paint_checkpoint(file_name, checkpoint);
+        PaintCheckpoint<N> loaded = load_paint_checkpoint<N>(file_name);
+        std::remove(file_name.c_str());
+
+        compare(checkpoint, loaded);
+}
+
+template <size_t N>
+void test_merge(const std::vector<PaintCheckpoint<N>>& checkpoints)
+{
+        // Проходы во входных данных не по порядку
+        PaintCheckpoint<N> merged = merge_paint_checkpoints(std::vector{checkpoints[2], checkpoints[0], checkpoints[1]});
+
+        if (merged.pass_begin != checkpoints[0].pass_begin || merged.pass_end != checkpoints[2].pass_end)
+        {
+                error("Error merged paint checkpoint passes [" + to_string(merged.pass_begin) + ", " +
+                      to_string(merged.pass_end) + ")");
+        }
+
+        for (size_t i = 0; i < merged.pixels.size(); ++i)
+        {
+                PaintPixelSum sum = checkpoints[0].pixels[i];
+                for (unsigned c = 1; c < checkpoints.size(); ++c)
+                {
+                        sum.color_sum += checkpoints[c].pixels[i].color_sum;
+                        sum.luminance_square_sum += checkpoints[c].pixels[i].luminance_square_sum;
+                        sum.sample_count += checkpoints[c].pixels[i].sample_count;
+                }
+                if (!equal(sum, merged.pixels[i]))
+                {
+                        error("Error merged paint checkpoint pixel " + to_string(i));
+                }
+        }
+
+        bool exception = false;
+        try
+        {
+                merge_paint_checkpoints(std::vector{checkpoints[0], checkpoints[2]});
+        }
+        catch (...)
+        {
+                exception = true;
+        }
+        if (!exception)
+        {
+                error("No error merging paint checkpoints with not contiguous passes");
+        }
+}
+
+template <size_t N>
+void test_merge_regions(const PaintCheckpoint<N>& checkpoint)
+{
+        // Пиксели с чётными номерами в первой части, с нечётными во второй
+        std::vector<PaintCheckpoint<N>> regions(2, checkpoint);
+        for (size_t i = 0; i < checkpoint.pixels.size(); ++i)
+        {
+                regions[i % 2].pixels[i] = PaintPixelSum();
+        }
+
+        PaintCheckpoint<N> merged = merge_paint_checkpoint_regions(std::vector(regions));
+
+        compare(checkpoint, merged);
+
+        bool exception = false;
+        try
+        {
+                merge_paint_checkpoint_regions(std::vector{regions[0], checkpoint});
+        }
+        catch (...)
+        {
+                exception = true;
+        }
+        if (!exception)
+        {
+                error("No error merging overlapping paint checkpoint regions");
+        }
+}
+
+// Остановка рисования после заданного количества пикселей.
+// Для одного потока рисования.
+template <size_t N>
+class StopPaintbrush final : public Paintbrush<N>
+{
+        TilePaintbrush<N> m_paintbrush;
+        std::atomic_bool* m_stop;
+        long long m_stop_pixel_count;
+        long long m_pixel_count = 0;
+
+public:
+        StopPaintbrush(const std::array<int, N>& screen_size, int tile_size, int max_pass_count, std::atomic_bool* stop,
+                       long long stop_pixel_count)
+                : m_paintbrush(screen_size, tile_size, max_pass_count), m_stop(stop), m_stop_pixel_count(stop_pixel_count)
+        {
+        }
+
+        const std::array<int, N>& screen_size() const noexcept override
+        {
+                return m_paintbrush.screen_size();
+        }
+
+        void first_pass() noexcept override
+        {
+                m_paintbrush.first_pass();
+        }
+
+        bool next_pixel(int previous_pixel_ray_count, int previous_pixel_sample_count,
+                        std::array<int_least16_t, N>* pixel) noexcept override
+        {
+                if (++m_pixel_count == m_stop_pixel_count)
+                {
+                        *m_stop = true;
+                }
+                return m_paintbrush.next_pixel(previous_pixel_ray_count, previous_pixel_sample_count, pixel);
+        }
+
+        bool next_pass() noexcept override
+        {
+                return m_paintbrush.next_pass();
+        }
+
+        void pixel_converged(const std::array<int_least16_t, N>& pixel) noexcept override
+        {
+                m_paintbrush.pixel_converged(pixel);
+        }
+
+        void statistics(long long* pass_count, long long* pixel_count, long long* ray_count, long long* sample_count,
+                        long long* converged_pixel_count, double* previous_pass_duration) const noexcept override
+        {
+                m_paintbrush.statistics(pass_count, pixel_count, ray_count, sample_count, converged_pixel_count,
+                                        previous_pass_duration);
+        }
+};
+
+template <size_t N, typename T>
+PaintCheckpoint<N - 1> paint_to_checkpoint(const PaintObjects<N, T>& paint_objects, Paintbrush<N - 1>* paintbrush,
+                                           int thread_count, std::atomic_bool* stop, const std::string& resume_file_name,
+                                           const std::string& save_file_name)
+{
+        constexpr int samples_per_pixel = 4;
+        constexpr bool smooth_normal = true;
+        constexpr unsigned long long random_seed = 12345;
+
+        PaintCheckpointOptions checkpoint;
+        checkpoint.resume_file_name = resume_file_name;
+        checkpoint.save_file_name = save_file_name;
+
+        PainterImages<N - 1> images(paint_objects.projector().screen_size());
+
+        paint(&images, samples_per_pixel, paint_objects, paintbrush, thread_count, stop, smooth_normal, PaintTracing::Rays,
+              PaintSampler::Sobol, PaintSampling::Uniform, PaintLightSampling::OneLight, random_seed, checkpoint);
+
+        std::string error_message = images.error_message();
+        if (!error_message.empty())
+        {
+                error(error_message);
+        }
+
+        return load_paint_checkpoint<N - 1>(save_file_name);
+}
+
+// Рисование, остановленное в середине прохода и продолженное из файла,
+// должно давать такие же суммы пикселей, как рисование без остановки
+template <size_t N, typename T>
+void test_paint_resume()
+{
+        constexpr int point_count = 200;
+        constexpr int min_screen_size = 10;
+        constexpr int max_screen_size = 20;
+        constexpr int tile_size = 4;
+        constexpr int pass_count = 3;
+
+        const int thread_count = hardware_concurrency();
+
+        ProgressRatio progress(nullptr);
+
+        std::shared_ptr<const Mesh<N, T>> mesh = simplex_mesh_of_random_sphere<N, T>(
+                point_count, thread_count, &progress, default_mesh_acceleration<N>());
+
+        std::unique_ptr<const PaintObjects<N, T>> paint_objects = single_object_scene(
+                Color(0.2), Color(0.8), Color::DataType(1), min_screen_size, max_screen_size, mesh);
+
+        const std::array<int, N - 1>& screen_size = paint_objects->projector().screen_size();
+        const long long pixel_count = multiply_all<long long>(screen_size);
+
+        const std::string file_name = unique_file_name(temp_directory() + "/test_paint_checkpoint_resume");
+
+        std::atomic_bool stop = false;
+
+        VisibleTilePaintbrush<N - 1> full_paintbrush(screen_size, tile_size, pass_count);
+        PaintCheckpoint<N - 1> full =
+                paint_to_checkpoint(*paint_objects, &full_paintbrush, thread_count, &stop, "", file_name);
+
+        // Остановка в середине второго прохода
+        StopPaintbrush<N - 1> stop_paintbrush(screen_size, tile_size, pass_count, &stop, pixel_count + pixel_count / 2);
+        PaintCheckpoint<N - 1> stopped = paint_to_checkpoint(*paint_objects, &stop_paintbrush, 1, &stop, "", file_name);
+
+        if (!(stopped.pass_begin == 0 && stopped.pass_end == 1))
+        {
+                std::remove(file_name.c_str());
+                error("Error stopped paint checkpoint passes [" + to_string(stopped.pass_begin) + ", " +
+                      to_string(stopped.pass_end) + ")");
+        }
+
+        stop = false;
+
+        VisibleTilePaintbrush<N - 1> resume_paintbrush(screen_size, tile_size, pass_count - 1);
+        PaintCheckpoint<N - 1> resumed =
+                paint_to_checkpoint(*paint_objects, &resume_paintbrush, thread_count, &stop, file_name, file_name);
+
+        std::remove(file_name.c_str());
+
+        compare(full, resumed);
+}
+
+template <size_t N>
+void test_paint_checkpoint(const std::array<int, N>& screen_size)
+{
+        RandomEngineWithSeed<std::mt19937_64> engine;
+
+        constexpr unsigned long long random_seed = 12345;
+
+        std::vector<PaintCheckpoint<N>> checkpoints;
+        checkpoints.push_back(random_checkpoint(engine, screen_size, random_seed, 0, 3));
+        checkpoints.push_back(random_checkpoint(engine, screen_size, random_seed, 3, 4));
+        checkpoints.push_back(random_checkpoint(engine, screen_size, random_seed, 4, 10));
+
+        for (const PaintCheckpoint<N>& checkpoint : checkpoints)
+        {
+                test_save_and_load(checkpoint);
+        }
+
+        test_merge(checkpoints);
+
+        test_merge_regions(checkpoints[0]);
+}
+}
+
+void test_paint_checkpoint()
+{
+        LOG("Test paint checkpoint");
+
+        test_paint_checkpoint<2>({13, 7});
+        test_paint_checkpoint<3>({5, 9, 4});
+
+        test_paint_resume<3, double>();
+        test_paint_resume<4, float>();
+
+        LOG("Test paint checkpoint passed");
+}
@@ -29,7 +29,9 @@ class Image
 {
         std::vector<Color> m_data;
 
-        std::array<int, N> m_size;
+        // Нулевой размер до первого вызова resize, иначе resize может
+        // сравнить новый размер с неинициализированным значением
+        std::array<int, N> m_size = {};
         std::array<int, N> m_max;
         std::array<int, N> m_max_0;
 
@@ -0,0 +1,174 @@
+/*
+Copyright (C) 2017-2019 Topological Manifold
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "image.h"
+
+#include "com/error.h"
+#include "com/global_index.h"
+#include "com/log.h"
+#include "com/print.h"
+#include "painter/painter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Изображение экрана размерности N в виде двумерных изображений
+// по первым двум измерениям для всех координат остальных измерений.
+// Может использоваться без оконной системы.
+template <size_t N>
+class PainterImages final : public PainterNotifier<N>
+{
+        static_assert(N >= 2);
+
+        static constexpr const char beginning_of_file_name[] = "painter_";
+
+        static std::array<int, N - 2> slice_size(const std::array<int, N>& size)
+        {
+                std::array<int, N - 2> slice_size;
+                for (unsigned i = 2; i < N; ++i)
+                {
+                        slice_size[i - 2] = size[i];
+                }
+                return slice_size;
+        }
+
+        static std::array<int_least16_t, N - 2> slice_pixel(const std::array<int_least16_t, N>& pixel)
+        {
+                std::array<int_least16_t, N - 2> slice_pixel;
+                for (unsigned i = 2; i < N; ++i)
+                {
+                        slice_pixel[i - 2] = pixel[i];
+                }
+                return slice_pixel;
+        }
+
+        std::array<int, N> m_size;
+        std::vector<Image<2>> m_images;
+        std::conditional_t<(N > 2), GlobalIndex<N - 2, long long>, int> m_slice_index;
+
+        mutable std::mutex m_error_mutex;
+        std::string m_error_message;
+
+        long long slice_index(const std::array<int_least16_t, N>& pixel) const
+        {
+                if constexpr (N > 2)
+                {
+                        return m_slice_index.compute(slice_pixel(pixel));
+                }
+                else
+                {
+                        return 0;
+                }
+        }
+
+        static std::conditional_t<(N > 2), GlobalIndex<N - 2, long long>, int> create_slice_index(const std::array<int, N>& size)
+        {
+                if constexpr (N > 2)
+                {
+                        return GlobalIndex<N - 2, long long>(slice_size(size));
+                }
+                else
+                {
+                        return 0;
+                }
+        }
+
+public:
+        PainterImages(const std::array<int, N>& size) : m_size(size), m_slice_index(create_slice_index(size))
+        {
+                if (std::any_of(size.cbegin(), size.cend(), [](int v) { return v < 1; }))
+                {
+                        error("Error size " + to_string(size));
+                }
+
+                long long slice_count = 1;
+                for (unsigned i = 2; i < N; ++i)
+                {
+                        slice_count *= size[i];
+                }
+
+                for (long long i = 0; i < slice_count; ++i)
+                {
+                        m_images.emplace_back(std::array<int, 2>{size[0], size[1]});
+                }
+        }
+
+        void painter_pixel_before(const std::array<int_least16_t, N>&) noexcept override
+        {
+        }
+
+        void painter_pixel_after(const std::array<int_least16_t, N>& pixel, const Color& color) noexcept override
+        {
+                try
+                {
+                        m_images[slice_index(pixel)].set_pixel(std::array<int, 2>{pixel[0], m_size[1] - 1 - pixel[1]},
+                                                               color);
+                }
+                catch (...)
+                {
+                        error_fatal("Exception in painter pixel after");
+                }
+        }
+
+        void painter_error_message(const std::string& msg) noexcept override
+        {
+                LOG("Painter error message");
+                LOG(msg);
+
+                try
+                {
+                        std::lock_guard lg(m_error_mutex);
+                        if (m_error_message.empty())
+                        {
+                                m_error_message = msg;
+                        }
+                }
+                catch (...)
+                {
+                        error_fatal("Exception in painter error message");
+                }
+        }
+
+        // Первое сообщение об ошибке или пустая строка, если ошибок не было
+        std::string error_message() const
+        {
+                std::lock_guard lg(m_error_mutex);
+                return m_error_message;
+        }
+
+        void write_to_files(const std::string& dir) const
+        {
+                int w = std::floor(std::log10(m_images.size())) + 1;
+
+                std::ostringstream oss;
+                oss << std::setfill('0');
+
+                for (unsigned i = 0; i < m_images.size(); ++i)
+                {
+                        oss.str("");
+                        oss << beginning_of_file_name << std::setw(w) << i + 1;
+                        m_images[i].write_to_file(dir + "/" + oss.str());
+                }
+        }
+};
@@ -20,6 +20,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "com/color/color.h"
 #include "com/ray.h"
 #include "com/vec.h"
+#include "painter/space/ray_packet.h"
 
 #include <vector>
 
@@ -167,6 +168,18 @@ struct GenericObject
         virtual bool intersect_precise(const Ray<N, T>&, T approximate_t, T* t, const Surface<N, T>** surface,
                                        const void** intersection_data) const = 0;
 
+        // Ближайшие пересечения лучей пакета из маски с объектом на расстояниях меньше t[i].
+        // Для найденных пересечений изменяются t[i], surface[i] и intersection_data[i].
+        // Возвращается маска лучей, для которых найдены пересечения.
+        virtual typename RayPacket<N, T>::Mask intersect_packet(const RayPacket<N, T>& packet,
+                                                                typename RayPacket<N, T>::Mask mask, T* t,
+                                                                const Surface<N, T>** surface,
+                                                                const void** intersection_data) const = 0;
+
+        // Есть ли пересечение луча с объектом на расстоянии меньше max_distance.
+        // Ближайшее пересечение и свойства поверхности не находятся.
+        virtual bool occluded(const Ray<N, T>& r, T max_distance) const = 0;
+
         virtual void min_max(Vector<N, T>* min, Vector<N, T>* max) const = 0;
 };
 
@@ -202,10 +215,14 @@ struct Paintbrush
                                 std::array<int_least16_t, N>* pixel) noexcept = 0;
         virtual bool next_pass() noexcept = 0;
 
+        // Пиксель не нужно рисовать в следующих проходах.
+        // Если таких пикселей не остаётся, то next_pass возвращает false.
+        virtual void pixel_converged(const std::array<int_least16_t, N>& pixel) noexcept = 0;
+
         virtual const std::array<int, N>& screen_size() const noexcept = 0;
 
         virtual void statistics(long long* pass_count, long long* pixel_count, long long* ray_count, long long* sample_count,
-                                double* previous_pass_duration) const noexcept = 0;
+                                long long* converged_pixel_count, double* previous_pass_duration) const noexcept = 0;
 };
 
 // Объекты для рисования.
@@ -120,11 +120,34 @@ class BarPaintbrush
         long long m_ray_count = 0;
         long long m_sample_count = 0;
 
+        std::vector<Pixel> m_converged_pixels;
+        long long m_converged_pixel_count = 0;
+
         double m_previous_pass_duration = 0;
         double m_pass_start_time = -1;
 
         mutable SpinLock m_lock;
 
+        void remove_converged_pixels()
+        {
+                if (m_converged_pixels.empty())
+                {
+                        return;
+                }
+
+                std::sort(m_converged_pixels.begin(), m_converged_pixels.end());
+
+                m_pixels.erase(std::remove_if(m_pixels.begin(), m_pixels.end(),
+                                              [&](const Pixel& pixel) {
+                                                      return std::binary_search(m_converged_pixels.cbegin(),
+                                                                                m_converged_pixels.cend(), pixel);
+                                              }),
+                               m_pixels.end());
+
+                m_converged_pixel_count += m_converged_pixels.size();
+                m_converged_pixels.clear();
+        }
+
 public:
         BarPaintbrush(const std::array<int, N>& screen_size, int paint_height, int max_pass_count)
         {
@@ -209,7 +232,9 @@ public:
 
                 m_current_pixel = 0;
 
-                if (m_pass_count == m_max_pass_count)
+                remove_converged_pixels();
+
+                if (m_pass_count == m_max_pass_count || m_pixels.empty())
                 {
                         return false;
                 }
@@ -219,8 +244,15 @@ public:
                 return true;
         }
 
+        void pixel_converged(const Pixel& pixel) noexcept
+        {
+                std::lock_guard lg(m_lock);
+
+                m_converged_pixels.push_back(pixel);
+        }
+
         void statistics(long long* pass_count, long long* pixel_count, long long* ray_count, long long* sample_count,
-                        double* previous_pass_duration) const noexcept
+                        long long* converged_pixel_count, double* previous_pass_duration) const noexcept
         {
                 std::lock_guard lg(m_lock);
 
@@ -228,6 +260,7 @@ public:
                 *pixel_count = m_pixel_count;
                 *ray_count = m_ray_count;
                 *sample_count = m_sample_count;
+                *converged_pixel_count = m_converged_pixel_count;
                 *previous_pass_duration = m_previous_pass_duration;
         }
 };
@@ -0,0 +1,405 @@
+/*
+Copyright (C) 2017-2019 Topological Manifold
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "com/alg.h"
+#include "com/error.h"
+#include "com/print.h"
+#include "com/thread.h"
+#include "com/time.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+// Пиксели выдаются потокам плитками размером tile_size по каждому измерению.
+// Плитка берётся одним атомарным увеличением номера, а пиксели плитки
+// и статистика до перехода к следующей плитке хранятся в данных потока.
+// Плитки упорядочены по кривой Мортона для близости в памяти соседних плиток.
+template <size_t N>
+class TilePaintbrush
+{
+        static_assert(N >= 2);
+
+        using Pixel = std::array<int_least16_t, N>;
+
+        // Данные потока для одного прохода одной кисти
+        struct ThreadTile
+        {
+                unsigned long long paintbrush_id = 0;
+                long long pass = 0;
+
+                unsigned pixel = 0;
+                unsigned pixel_end = 0;
+
+                long long pixel_count = 0;
+                long long ray_count = 0;
+                long long sample_count = 0;
+        };
+
+        static ThreadTile& thread_tile() noexcept
+        {
+                thread_local ThreadTile tile;
+                return tile;
+        }
+
+        static unsigned long long new_paintbrush_id() noexcept
+        {
+                static std::atomic<unsigned long long> id = 0;
+                return ++id;
+        }
+
+        // Сравнение по кривой Мортона без вычисления чередования битов.
+        // Координаты сравниваются по тому измерению, в котором находится
+        // старший из различающихся битов.
+        static bool morton_less(const std::array<int, N>& a, const std::array<int, N>& b) noexcept
+        {
+                unsigned dimension = 0;
+                unsigned max_xor = 0;
+                for (unsigned i = 0; i < N; ++i)
+                {
+                        const unsigned x = static_cast<unsigned>(a[i]) ^ static_cast<unsigned>(b[i]);
+                        if (max_xor < x && max_xor < (max_xor ^ x))
+                        {
+                                dimension = i;
+                                max_xor = x;
+                        }
+                }
+                return a[dimension] < b[dimension];
+        }
+
+        static void generate_pixels(const std::array<int, N>& sizes, int tile_size, std::vector<Pixel>* pixels,
+                                    std::vector<unsigned>* tile_offsets)
+        {
+                std::array<int, N> tile_counts;
+                for (unsigned i = 0; i < N; ++i)
+                {
+                        tile_counts[i] = (sizes[i] + tile_size - 1) / tile_size;
+                }
+
+                std::vector<std::array<int, N>> tiles;
+                tiles.reserve(multiply_all<long long>(tile_counts));
+                std::array<int, N> tile{};
+                while (true)
+                {
+                        tiles.push_back(tile);
+                        unsigned i = 0;
+                        for (; i < N; ++i)
+                        {
+                                if (++tile[i] < tile_counts[i])
+                                {
+                                        break;
+                                }
+                                tile[i] = 0;
+                        }
+                        if (i == N)
+                        {
+                                break;
+                        }
+                }
+
+                std::sort(tiles.begin(), tiles.end(), morton_less);
+
+                pixels->clear();
+                pixels->reserve(multiply_all<long long>(sizes));
+                tile_offsets->clear();
+                tile_offsets->reserve(tiles.size() + 1);
+
+                for (const std::array<int, N>& t : tiles)
+                {
+                        tile_offsets->push_back(pixels->size());
+
+                        std::array<int, N> min;
+                        std::array<int, N> max;
+                        for (unsigned i = 0; i < N; ++i)
+                        {
+                                min[i] = t[i] * tile_size;
+                                max[i] = std::min(sizes[i], min[i] + tile_size);
+                        }
+
+                        // Внутри плитки первое измерение меняется быстрее всех
+                        Pixel pixel;
+                        for (unsigned i = 0; i < N; ++i)
+                        {
+                                pixel[i] = min[i];
+                        }
+                        while (true)
+                        {
+                                pixels->push_back(pixel);
+                                unsigned i = 0;
+                                for (; i < N; ++i)
+                                {
+                                        if (++pixel[i] < max[i])
+                                        {
+                                                break;
+                                        }
+                                        pixel[i] = min[i];
+                                }
+                                if (i == N)
+                                {
+                                        break;
+                                }
+                        }
+                }
+
+                tile_offsets->push_back(pixels->size());
+
+                ASSERT(static_cast<long long>(pixels->size()) == multiply_all<long long>(sizes));
+        }
+
+        const unsigned long long m_id = new_paintbrush_id();
+
+        std::array<int, N> m_screen_size;
+        std::vector<Pixel> m_pixels;
+        std::vector<unsigned> m_tile_offsets;
+        int m_max_pass_count;
+
+        std::atomic<unsigned> m_current_tile = 0;
+
+        AtomicCounter<long long> m_pass_count = 1;
+        AtomicCounter<long long> m_pixel_count = 0;
+        AtomicCounter<long long> m_ray_count = 0;
+        AtomicCounter<long long> m_sample_count = 0;
+
+        std::vector<Pixel> m_converged_pixels;
+        long long m_converged_pixel_count = 0;
+
+        double m_previous_pass_duration = 0;
+        double m_pass_start_time = -1;
+
+        mutable SpinLock m_lock;
+
+        // Удаление пикселей из плиток и удаление пустых плиток
+        template <typename Remove>
+        void remove_pixels(const Remove& remove)
+        {
+                std::vector<unsigned> tile_offsets;
+                tile_offsets.reserve(m_tile_offsets.size());
+                unsigned pixel = 0;
+                for (unsigned tile = 0; tile + 1 < m_tile_offsets.size(); ++tile)
+                {
+                        const unsigned begin = pixel;
+                        for (unsigned i = m_tile_offsets[tile]; i < m_tile_offsets[tile + 1]; ++i)
+                        {
+                                if (!remove(m_pixels[i]))
+                                {
+                                        m_pixels[pixel++] = m_pixels[i];
+                                }
+                        }
+                        if (pixel > begin)
+                        {
+                                tile_offsets.push_back(begin);
+                        }
+                }
+                tile_offsets.push_back(pixel);
+
+                m_pixels.resize(pixel);
+                m_tile_offsets = std::move(tile_offsets);
+        }
+
+        void remove_converged_pixels()
+        {
+                if (m_converged_pixels.empty())
+                {
+                        return;
+                }
+
+                std::sort(m_converged_pixels.begin(), m_converged_pixels.end());
+
+                remove_pixels([&](const Pixel& pixel) {
+                        return std::binary_search(m_converged_pixels.cbegin(), m_converged_pixels.cend(), pixel);
+                });
+
+                m_converged_pixel_count += m_converged_pixels.size();
+                m_converged_pixels.clear();
+        }
+
+        void add_statistics(ThreadTile* tile) noexcept
+        {
+                m_pixel_count += tile->pixel_count;
+                m_ray_count += tile->ray_count;
+                m_sample_count += tile->sample_count;
+
+                tile->pixel_count = 0;
+                tile->ray_count = 0;
+                tile->sample_count = 0;
+        }
+
+public:
+        TilePaintbrush(const std::array<int, N>& screen_size, int tile_size, int max_pass_count)
+                : TilePaintbrush(screen_size, std::array<int, N>{}, screen_size, tile_size, max_pass_count)
+        {
+        }
+
+        // Рисуются только пиксели с координатами от region_min до region_max,
+        // не включая region_max, например, для рисования частей экрана
+        // в разных процессах
+        TilePaintbrush(const std::array<int, N>& screen_size, const std::array<int, N>& region_min,
+                       const std::array<int, N>& region_max, int tile_size, int max_pass_count)
+        {
+                for (unsigned i = 0; i < screen_size.size(); ++i)
+                {
+                        if (screen_size[i] < 1)
+                        {
+                                error("Paintbrush size " + to_string(i) + " is not positive (" + to_string(screen_size[i]) + ")");
+                        }
+                }
+                for (unsigned i = 0; i < screen_size.size(); ++i)
+                {
+                        if (!(region_min[i] >= 0 && region_min[i] < region_max[i] && region_max[i] <= screen_size[i]))
+                        {
+                                error("Error paintbrush region " + to_string(region_min) + " - " + to_string(region_max) +
+                                      " for size " + to_string(screen_size));
+                        }
+                }
+                if (tile_size < 1)
+                {
+                        error("Error paintbrush tile size " + to_string(tile_size));
+                }
+                if (!(max_pass_count == -1 || max_pass_count > 0))
+                {
+                        error("Error paintbrush max pass count " + to_string(max_pass_count));
+                }
+
+                m_screen_size = screen_size;
+                m_max_pass_count = max_pass_count;
+
+                generate_pixels(m_screen_size, tile_size, &m_pixels, &m_tile_offsets);
+
+                // Как и в BarPaintbrush, рисование двумерного изображения начинается сверху
+                if (N == 2)
+                {
+                        for (Pixel& pixel : m_pixels)
+                        {
+                                pixel[1] = m_screen_size[1] - 1 - pixel[1];
+                        }
+                }
+
+                if (region_min != std::array<int, N>{} || region_max != screen_size)
+                {
+                        remove_pixels([&](const Pixel& pixel) {
+                                for (unsigned i = 0; i < N; ++i)
+                                {
+                                        if (pixel[i] < region_min[i] || pixel[i] >= region_max[i])
+                                        {
+                                                return true;
+                                        }
+                                }
+                                return false;
+                        });
+                }
+        }
+
+        const std::array<int, N>& screen_size() const noexcept
+        {
+                return m_screen_size;
+        }
+
+        void first_pass() noexcept
+        {
+                std::lock_guard lg(m_lock);
+
+                m_pass_start_time = time_in_seconds();
+        }
+
+        bool next_pixel(int previous_pixel_ray_count, int previous_pixel_sample_count, Pixel* pixel) noexcept
+        {
+                ThreadTile& tile = thread_tile();
+
+                // Данные потока от другой кисти или от другого прохода
+                if (tile.paintbrush_id != m_id || tile.pass != m_pass_count)
+                {
+                        tile = ThreadTile();
+                        tile.paintbrush_id = m_id;
+                        tile.pass = m_pass_count;
+                }
+
+                tile.ray_count += previous_pixel_ray_count;
+                tile.sample_count += previous_pixel_sample_count;
+
+                if (tile.pixel == tile.pixel_end)
+                {
+                        add_statistics(&tile);
+
+                        const unsigned tile_index = m_current_tile.fetch_add(1, std::memory_order_relaxed);
+                        if (tile_index >= m_tile_offsets.size() - 1)
+                        {
+                                return false;
+                        }
+
+                        tile.pixel = m_tile_offsets[tile_index];
+                        tile.pixel_end = m_tile_offsets[tile_index + 1];
+                }
+
+                *pixel = m_pixels[tile.pixel];
+
+                ++tile.pixel;
+                ++tile.pixel_count;
+
+                return true;
+        }
+
+        bool next_pass() noexcept
+        {
+                std::lock_guard lg(m_lock);
+
+                ASSERT(m_current_tile >= m_tile_offsets.size() - 1);
+                ASSERT(m_pass_start_time >= 0);
+
+                double time = time_in_seconds();
+                m_previous_pass_duration = time - m_pass_start_time;
+                m_pass_start_time = time;
+
+                m_current_tile = 0;
+
+                remove_converged_pixels();
+
+                if (m_pass_count == m_max_pass_count || m_pixels.empty())
+                {
+                        return false;
+                }
+
+                ++m_pass_count;
+
+                return true;
+        }
+
+        // Вызывается не больше одного раза для пикселя, поэтому блокировка
+        // не влияет на скорость, в отличие от блокировки для каждого пикселя.
+        void pixel_converged(const Pixel& pixel) noexcept
+        {
+                std::lock_guard lg(m_lock);
+
+                m_converged_pixels.push_back(pixel);
+        }
+
+        void statistics(long long* pass_count, long long* pixel_count, long long* ray_count, long long* sample_count,
+                        long long* converged_pixel_count, double* previous_pass_duration) const noexcept
+        {
+                std::lock_guard lg(m_lock);
+
+                *pass_count = m_pass_count;
+                *pixel_count = m_pixel_count;
+                *ray_count = m_ray_count;
+                *sample_count = m_sample_count;
+                *converged_pixel_count = m_converged_pixel_count;
+                *previous_pass_duration = m_previous_pass_duration;
+        }
+};
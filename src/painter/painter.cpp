@@ -21,14 +21,19 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "com/color/color.h"
 #include "com/error.h"
 #include "com/global_index.h"
-#include "com/random/engine.h"
+#include "com/random/xoshiro.h"
 #include "com/thread.h"
 #include "com/type/limit.h"
+#include "painter/checkpoint/checkpoint.h"
 #include "painter/coefficient/cosine_sphere.h"
 #include "painter/sampling/sampler.h"
 #include "painter/sampling/sphere.h"
-#include "painter/space/ray_intersection.h"
+#include "painter/space/object_hierarchy.h"
+#include "painter/space/ray_packet.h"
 
+#include <algorithm>
+#include <cmath>
+#include <optional>
 #include <thread>
 
 template <size_t N, typename T>
@@ -41,49 +46,177 @@ constexpr Color::DataType MIN_COLOR_LEVEL = 1e-4;
 
 constexpr int MAX_RECURSION_LEVEL = 100;
 
+// Начиная с этого уровня, продолжение пути определяется русской рулеткой
+constexpr int RUSSIAN_ROULETTE_RECURSION_LEVEL = 3;
+
+// На уровнях рекурсии меньше этого значения направления диффузного отражения
+// находятся по точкам выборки пикселя, а на остальных уровнях по случайным числам
+constexpr int SAMPLED_RECURSION_LEVEL_COUNT = RUSSIAN_ROULETTE_RECURSION_LEVEL;
+
 constexpr int RAY_OFFSET_IN_EPSILONS = 1000;
 
-template <typename T>
-using PainterRandomEngine = std::conditional_t<std::is_same_v<std::remove_cv<T>, float>, std::mt19937, std::mt19937_64>;
+// Количество пикселей, результаты которых передаются одним вызовом
+// painter_pixels_after. Соответствует плитке 16×16 двумерного экрана.
+constexpr unsigned NOTIFICATION_PIXEL_COUNT = 256;
+
+// Для адаптивного распределения точек. Пиксель больше не рисуется, если
+// половина 95% доверительного интервала средней яркости его точек не больше
+// ADAPTIVE_RELATIVE_ERROR * яркость + ADAPTIVE_ABSOLUTE_ERROR. При малом
+// количестве точек дисперсия пикселей с редкими яркими путями занижается,
+// поэтому нужно не меньше ADAPTIVE_MIN_SAMPLE_COUNT точек.
+constexpr int ADAPTIVE_MIN_SAMPLE_COUNT = 256;
+constexpr Color::DataType ADAPTIVE_CONFIDENCE_Z = 1.96;
+constexpr Color::DataType ADAPTIVE_RELATIVE_ERROR = 0.02;
+constexpr Color::DataType ADAPTIVE_ABSOLUTE_ERROR = 0.001;
+
+// Для float и для double один генератор, так как 64 бит
+// достаточно для одного числа std::uniform_real_distribution<double>.
+// Генератор задаётся заново для каждого пикселя в каждом проходе,
+// поэтому изображение не зависит от количества потоков.
+using PainterRandomEngine = Xoshiro256StarStar;
+
+static_assert(std::is_floating_point_v<Color::DataType>);
 
 template <size_t N, typename T>
-using PainterSampler = StratifiedJitteredSampler<N, T>;
-// using PainterSampler = LatinHypercubeSampler<N, T>;
+using SceneObjects = ObjectHierarchy<N, T, GenericObject<N, T>>;
 
-static_assert(std::is_floating_point_v<Color::DataType>);
+template <size_t N, typename T>
+using HemisphereSample = Vector<COSINE_WEIGHTED_ON_HEMISPHERE_SAMPLE_SIZE<N>, T>;
+
+// Точки для направлений диффузного отражения путей точек пикселя,
+// по набору точек для каждого уровня рекурсии. Пустые наборы,
+// если направления находятся по случайным числам.
+template <size_t N, typename T>
+using HemisphereSamples = std::array<std::vector<HemisphereSample<N, T>>, SAMPLED_RECURSION_LEVEL_COUNT>;
 
 namespace
 {
+// Точки направлений диффузного отражения находятся отдельно для каждого
+// уровня рекурсии и переставляются случайно, чтобы номера точек не связывали
+// точки экрана и точки разных уровней, как при дополнении выборок в PBRT.
+template <size_t N, typename T, template <size_t, typename> typename Sampler>
+class HemisphereSampler
+{
+        Sampler<COSINE_WEIGHTED_ON_HEMISPHERE_SAMPLE_SIZE<N>, T> m_sampler;
+
+public:
+        explicit HemisphereSampler(int sample_count) : m_sampler(sample_count)
+        {
+        }
+
+        void generate(PainterRandomEngine& random_engine, HemisphereSamples<N, T>* samples) const
+        {
+                for (std::vector<HemisphereSample<N, T>>& level_samples : *samples)
+                {
+                        m_sampler.generate(random_engine, &level_samples);
+                        std::shuffle(level_samples.begin(), level_samples.end(), random_engine);
+                }
+        }
+};
+
+// Направления диффузного отражения находятся по случайным числам
+template <size_t N, typename T>
+class RandomHemisphereSampler
+{
+public:
+        void generate(PainterRandomEngine& /*random_engine*/, HemisphereSamples<N, T>* samples) const
+        {
+                for (std::vector<HemisphereSample<N, T>>& level_samples : *samples)
+                {
+                        level_samples.clear();
+                }
+        }
+};
+
+// Сумма цветов точек и сумма квадратов яркостей точек
+struct SampleSum
+{
+        Color color{0};
+        Color::DataType luminance_square{0};
+
+        void add(const Color& c)
+        {
+                color += c;
+                Color::DataType luminance = c.luminance();
+                luminance_square += luminance * luminance;
+        }
+};
+
 template <size_t N>
 class Pixels
 {
-        class Pixel
+        static Color add_samples(PaintPixelSum* p, const SampleSum& sum, int samples)
         {
-                Color m_color_sum{0};
-                int m_sample_sum = 0;
+                p->color_sum += sum.color;
+                p->luminance_square_sum += sum.luminance_square;
+                p->sample_count += samples;
 
-        public:
-                Color add_color_and_samples(const Color& color, int samples)
-                {
-                        m_color_sum += color;
-                        m_sample_sum += samples;
+                return p->color_sum / p->sample_count;
+        }
 
-                        return m_color_sum / m_sample_sum;
+        // Яркость суммы цветов равна сумме яркостей цветов
+        static bool converged(const PaintPixelSum& p)
+        {
+                if (p.sample_count < ADAPTIVE_MIN_SAMPLE_COUNT)
+                {
+                        return false;
                 }
-        };
 
+                const Color::DataType n = p.sample_count;
+                const Color::DataType mean = p.color_sum.luminance() / n;
+                const Color::DataType variance =
+                        std::max<Color::DataType>(0, (p.luminance_square_sum / n - mean * mean) * (n / (n - 1)));
+                const Color::DataType error = ADAPTIVE_CONFIDENCE_Z * std::sqrt(variance / n);
+
+                return error <= ADAPTIVE_RELATIVE_ERROR * mean + ADAPTIVE_ABSOLUTE_ERROR;
+        }
+
+        const std::array<int, N> m_screen_size;
         const GlobalIndex<N, long long> m_global_index;
-        std::vector<Pixel> m_pixels;
+        std::vector<PaintPixelSum> m_pixels;
 
 public:
-        Pixels(const std::array<int, N>& screen_size) : m_global_index(screen_size)
+        Pixels(const std::array<int, N>& screen_size) : m_screen_size(screen_size), m_global_index(screen_size)
         {
                 m_pixels.resize(m_global_index.count());
         }
 
-        Color add_color_and_samples(const std::array<int_least16_t, N>& pixel, const Color& color, int samples)
+        Color add_samples(const std::array<int_least16_t, N>& pixel, const SampleSum& sum, int samples, bool* converged)
         {
-                return m_pixels[m_global_index.compute(pixel)].add_color_and_samples(color, samples);
+                PaintPixelSum& p = m_pixels[m_global_index.compute(pixel)];
+                Color color = add_samples(&p, sum, samples);
+                *converged = Pixels::converged(p);
+                return color;
+        }
+
+        // Копирование сумм без блокировки, поэтому другие потоки
+        // не должны в это время добавлять точки
+        void checkpoint(unsigned long long random_seed, long long pass_begin, long long pass_end,
+                        PaintCheckpoint<N>* checkpoint) const
+        {
+                checkpoint->screen_size = m_screen_size;
+                checkpoint->random_seed = random_seed;
+                checkpoint->pass_begin = pass_begin;
+                checkpoint->pass_end = pass_end;
+                checkpoint->pixels = m_pixels;
+        }
+
+        void set(PaintCheckpoint<N>&& checkpoint)
+        {
+                if (checkpoint.screen_size != m_screen_size)
+                {
+                        error("Paint checkpoint screen size " + to_string(checkpoint.screen_size) +
+                              " is not equal to the screen size " + to_string(m_screen_size));
+                }
+                ASSERT(checkpoint.pixels.size() == m_pixels.size());
+
+                m_pixels = std::move(checkpoint.pixels);
+        }
+
+        // Цвета пикселей, для которых есть точки
+        void painted_pixels(std::vector<PainterPixel<N>>* pixels) const
+        {
+                paint_checkpoint_colors(m_screen_size, m_pixels, pixels);
         }
 };
 
@@ -115,248 +248,341 @@ public:
 template <size_t N, typename T>
 struct PaintData
 {
-        const std::vector<const GenericObject<N, T>*>& objects;
+        const SceneObjects<N, T>& objects;
         const std::vector<const LightSource<N, T>*>& light_sources;
         const SurfaceProperties<N, T>& default_surface_properties;
         const T ray_offset;
         const bool smooth_normal;
+        const PaintTracing tracing;
+        const PaintSampling sampling;
+        const PaintLightSampling light_sampling;
+        const unsigned long long random_seed;
 
-        PaintData(const std::vector<const GenericObject<N, T>*>& objects_,
+        PaintData(const SceneObjects<N, T>& objects_,
                   const std::vector<const LightSource<N, T>*>& light_sources_,
-                  const SurfaceProperties<N, T>& default_surface_properties_, const T& ray_offset_, const bool smooth_normal_)
+                  const SurfaceProperties<N, T>& default_surface_properties_, const T& ray_offset_, const bool smooth_normal_,
+                  const PaintTracing tracing_, const PaintSampling sampling_, const PaintLightSampling light_sampling_,
+                  const unsigned long long random_seed_)
                 : objects(objects_),
                   light_sources(light_sources_),
                   default_surface_properties(default_surface_properties_),
                   ray_offset(ray_offset_),
-                  smooth_normal(smooth_normal_)
+                  smooth_normal(smooth_normal_),
+                  tracing(tracing_),
+                  sampling(sampling_),
+                  light_sampling(light_sampling_),
+                  random_seed(random_seed_)
         {
         }
 };
 
+// Первичные лучи точек пикселя и найденные для них пересечения
+template <size_t N, typename T>
+struct PrimaryRayPacket
+{
+        RayPacket<N, T> rays;
+        std::array<T, RayPacket<N, T>::MAX_SIZE> t{};
+        std::array<const Surface<N, T>*, RayPacket<N, T>::MAX_SIZE> surface{};
+        std::array<const void*, RayPacket<N, T>::MAX_SIZE> intersection_data{};
+};
+
 bool color_is_zero(const Color& c)
 {
         return c.max_element() < MIN_COLOR_LEVEL;
 }
 
-// все объекты считаются непрозрачными
 template <size_t N, typename T>
-bool object_is_obstacle_to_light(const GenericObject<N, T>* object, const Ray<N, T>& ray, T distance_to_light_source)
+bool light_source_is_visible(Counter& ray_count, const SceneObjects<N, T>& objects, const Ray<N, T>& ray,
+                             T distance_to_light_source)
 {
-        T distance_to_object;
-        const Surface<N, T>* surface;
+        ++ray_count;
+
+        // все объекты считаются непрозрачными
+        return !objects.occluded(ray, distance_to_light_source);
+}
+
+template <size_t N, typename T>
+bool ray_intersection_distance(const SceneObjects<N, T>& objects, const Ray<N, T>& ray, T* intersection_distance)
+{
+        const Surface<N, T>* intersection_surface;
         const void* intersection_data;
 
-        if (!object->intersect_approximate(ray, &distance_to_object))
-        {
-                return false;
-        }
+        return objects.intersect(ray, intersection_distance, &intersection_surface, &intersection_data);
+}
 
-        if (distance_to_object >= distance_to_light_source)
-        {
-                return false;
-        }
+// Освещение точки одним источником света с учётом видимости источника
+template <size_t N, typename T>
+Color direct_diffuse_lighting(Counter& ray_count, const SceneObjects<N, T>& objects, const Color& light_source_color,
+                              const Vector<N, T>& vector_to_light, const Vector<N, T>& p, const Vector<N, T>& geometric_normal,
+                              const Vector<N, T>& shading_normal, bool mesh, const T& ray_offset, bool smooth_normal)
+{
+        Ray<N, T> ray_to_light = Ray<N, T>(p, vector_to_light);
 
-        if (!object->intersect_precise(ray, distance_to_object, &distance_to_object, &surface, &intersection_data))
+        const T dot_light_and_normal = dot(ray_to_light.dir(), shading_normal);
+
+        if (dot_light_and_normal <= DOT_PRODUCT_EPSILON<T>)
         {
-                return false;
+                // Свет находится по другую сторону поверхности
+                return Color(0);
         }
 
-        if (distance_to_object >= distance_to_light_source)
+        if (!mesh || !smooth_normal || dot(ray_to_light.dir(), geometric_normal) >= 0)
         {
-                return false;
+                // Если объект не состоит из симплексов или геометрическая сторона обращена
+                // к источнику света, то напрямую рассчитать видимость источника света.
+
+                ray_to_light.move_along_dir(ray_offset);
+                if (!light_source_is_visible(ray_count, objects, ray_to_light, length(vector_to_light)))
+                {
+                        return Color(0);
+                }
         }
+        else
+        {
+                // Если объект состоит из симплексов и геометрическая сторона направлена
+                // от источника  света, то геометрически она не освещена, но из-за нормалей
+                // у вершин, дающих сглаживание, она может быть «освещена», и надо определить,
+                // находится ли она в тени без учёта тени от самой поверхности в окрестности
+                // точки. Это можно сделать направлением луча к источнику света с игнорированием
+                // самого первого пересечения в предположении, что оно произошло с этой самой
+                // окрестностью точки.
 
-        return true;
-}
+                ++ray_count;
+                ray_to_light.move_along_dir(ray_offset);
+                T t;
+                if (!ray_intersection_distance(objects, ray_to_light, &t))
+                {
+                        // Если луч к источнику света направлен внутрь поверхности, и нет повторного
+                        // пересечения с поверхностью, то нет освещения в точке.
+                        return Color(0);
+                }
+
+                T distance_to_light_source = length(vector_to_light);
+
+                if (t >= distance_to_light_source)
+                {
+                        // Источник света находится внутри поверхности
+                        return Color(0);
+                }
 
-template <size_t N, typename T>
-bool light_source_is_visible(Counter& ray_count, const std::vector<const GenericObject<N, T>*>& objects, const Ray<N, T>& ray,
-                             T distance_to_light_source)
-{
-        for (const GenericObject<N, T>* object : objects)
-        {
                 ++ray_count;
+                Ray<N, T> ray_from_light = ray_to_light.reverse_ray();
+                ray_from_light.move_along_dir(2 * ray_offset);
+                T t_reverse;
+                if (ray_intersection_distance(objects, ray_from_light, &t_reverse) && (t_reverse < t))
+                {
+                        // Если для луча, направленного от поверхности и от источника света,
+                        // имеется пересечение с поверхностью на расстоянии меньше, чем расстояние
+                        // до пересечения внутрь поверхности к источнику света, то предполагается,
+                        // что точка находится по другую сторону от источника света.
+                        return Color(0);
+                }
 
-                if (object_is_obstacle_to_light(object, ray, distance_to_light_source))
+                ray_to_light.move_along_dir(t + ray_offset);
+                if (!light_source_is_visible(ray_count, objects, ray_to_light, distance_to_light_source - t))
                 {
-                        return false;
+                        return Color(0);
                 }
         }
-        return true;
-}
 
-template <size_t N, typename T, typename Object>
-bool ray_intersection_distance(const std::vector<const Object*>& objects, const Ray<N, T>& ray, T* intersection_distance)
-{
-        const Surface<N, T>* intersection_surface;
-        const void* intersection_data;
+        T light_weight = DIFFUSE_LIGHT_COEFFICIENT<N, T> * dot_light_and_normal;
 
-        return ray_intersection(objects, ray, intersection_distance, &intersection_surface, &intersection_data);
+        return light_source_color * light_weight;
 }
 
+// Оценка освещения точки источником света без учёта видимости источника
 template <size_t N, typename T>
-Color direct_diffuse_lighting(Counter& ray_count, const std::vector<const GenericObject<N, T>*>& objects,
-                              const std::vector<const LightSource<N, T>*> light_sources, const Vector<N, T>& p,
-                              const Vector<N, T>& geometric_normal, const Vector<N, T>& shading_normal, bool mesh,
-                              const T& ray_offset, bool smooth_normal)
+Color::DataType light_source_importance(const Color& light_source_color, const Vector<N, T>& vector_to_light,
+                                        const Vector<N, T>& shading_normal)
 {
-        Color color(0);
-
-        for (const LightSource<N, T>* light_source : light_sources)
+        if (color_is_zero(light_source_color))
         {
-                Color light_source_color;
-                Vector<N, T> vector_to_light;
+                return 0;
+        }
 
-                light_source->properties(p, &light_source_color, &vector_to_light);
+        const T dot_light_and_normal = dot(vector_to_light, shading_normal) / length(vector_to_light);
 
-                if (color_is_zero(light_source_color))
-                {
-                        continue;
-                }
+        if (dot_light_and_normal <= DOT_PRODUCT_EPSILON<T>)
+        {
+                return 0;
+        }
 
-                Ray<N, T> ray_to_light = Ray<N, T>(p, vector_to_light);
+        return light_source_color.luminance() * dot_light_and_normal;
+}
 
-                const T dot_light_and_normal = dot(ray_to_light.dir(), shading_normal);
+template <size_t N, typename T>
+Color direct_diffuse_lighting(Counter& ray_count, PainterRandomEngine& random_engine, const SceneObjects<N, T>& objects,
+                              const std::vector<const LightSource<N, T>*>& light_sources, PaintLightSampling light_sampling,
+                              const Vector<N, T>& p, const Vector<N, T>& geometric_normal, const Vector<N, T>& shading_normal,
+                              bool mesh, const T& ray_offset, bool smooth_normal)
+{
+        if (light_sampling == PaintLightSampling::AllLights || light_sources.size() == 1)
+        {
+                Color color(0);
 
-                if (dot_light_and_normal <= DOT_PRODUCT_EPSILON<T>)
+                for (const LightSource<N, T>* light_source : light_sources)
                 {
-                        // Свет находится по другую сторону поверхности
-                        continue;
-                }
+                        Color light_source_color;
+                        Vector<N, T> vector_to_light;
 
-                if (!mesh || !smooth_normal || dot(ray_to_light.dir(), geometric_normal) >= 0)
-                {
-                        // Если объект не состоит из симплексов или геометрическая сторона обращена
-                        // к источнику света, то напрямую рассчитать видимость источника света.
+                        light_source->properties(p, &light_source_color, &vector_to_light);
 
-                        ray_to_light.move_along_dir(ray_offset);
-                        if (!light_source_is_visible(ray_count, objects, ray_to_light, length(vector_to_light)))
+                        if (color_is_zero(light_source_color))
                         {
                                 continue;
                         }
+
+                        color += direct_diffuse_lighting(ray_count, objects, light_source_color, vector_to_light, p,
+                                                         geometric_normal, shading_normal, mesh, ray_offset, smooth_normal);
                 }
-                else
-                {
-                        // Если объект состоит из симплексов и геометрическая сторона направлена
-                        // от источника  света, то геометрически она не освещена, но из-за нормалей
-                        // у вершин, дающих сглаживание, она может быть «освещена», и надо определить,
-                        // находится ли она в тени без учёта тени от самой поверхности в окрестности
-                        // точки. Это можно сделать направлением луча к источнику света с игнорированием
-                        // самого первого пересечения в предположении, что оно произошло с этой самой
-                        // окрестностью точки.
 
-                        ++ray_count;
-                        ray_to_light.move_along_dir(ray_offset);
-                        T t;
-                        if (!ray_intersection_distance(objects, ray_to_light, &t))
-                        {
-                                // Если луч к источнику света направлен внутрь поверхности, и нет повторного
-                                // пересечения с поверхностью, то нет освещения в точке.
-                                continue;
-                        }
+                return color;
+        }
 
-                        T distance_to_light_source = length(vector_to_light);
+        // Один источник света с вероятностью, пропорциональной оценке его освещения.
+        // Свойства источников вычисляются два раза, чтобы не хранить их.
 
-                        if (t >= distance_to_light_source)
-                        {
-                                // Источник света находится внутри поверхности
-                                continue;
-                        }
+        Color::DataType importance_sum = 0;
 
-                        ++ray_count;
-                        Ray<N, T> ray_from_light = ray_to_light.reverse_ray();
-                        ray_from_light.move_along_dir(2 * ray_offset);
-                        T t_reverse;
-                        if (ray_intersection_distance(objects, ray_from_light, &t_reverse) && (t_reverse < t))
-                        {
-                                // Если для луча, направленного от поверхности и от источника света,
-                                // имеется пересечение с поверхностью на расстоянии меньше, чем расстояние
-                                // до пересечения внутрь поверхности к источнику света, то предполагается,
-                                // что точка находится по другую сторону от источника света.
-                                continue;
-                        }
+        for (const LightSource<N, T>* light_source : light_sources)
+        {
+                Color light_source_color;
+                Vector<N, T> vector_to_light;
 
-                        ray_to_light.move_along_dir(t + ray_offset);
-                        if (!light_source_is_visible(ray_count, objects, ray_to_light, distance_to_light_source - t))
-                        {
-                                continue;
-                        }
-                }
+                light_source->properties(p, &light_source_color, &vector_to_light);
 
-                T light_weight = DIFFUSE_LIGHT_COEFFICIENT<N, T> * dot_light_and_normal;
+                importance_sum += light_source_importance(light_source_color, vector_to_light, shading_normal);
+        }
 
-                color += light_source_color * light_weight;
+        if (!(importance_sum > 0))
+        {
+                return Color(0);
         }
 
-        return color;
-}
+        Color::DataType importance_threshold =
+                std::uniform_real_distribution<Color::DataType>(0, importance_sum)(random_engine);
 
-template <size_t N, typename T>
-Color trace_path(const PaintData<N, T>& paint_data, Counter& ray_count, PainterRandomEngine<T>& random_engine,
-                 int recursion_level, Color::DataType color_level, const Ray<N, T>& ray, bool diffuse_reflection);
+        // Из-за ошибок округления порог может остаться больше важности
+        // последнего источника, тогда выбирается этот источник
+        const LightSource<N, T>* last_light_source = nullptr;
 
-template <size_t N, typename T>
-Color diffuse_lighting(const PaintData<N, T>& paint_data, Counter& ray_count, PainterRandomEngine<T>& random_engine,
-                       int recursion_level, Color::DataType color_level, const Vector<N, T>& point,
-                       const Vector<N, T>& shading_normal, const Vector<N, T>& geometric_normal, bool mesh)
-{
-        if (recursion_level < MAX_RECURSION_LEVEL)
+        for (const LightSource<N, T>* light_source : light_sources)
         {
-                // Распределение случайного луча с вероятностью по косинусу угла между нормалью и случайным вектором.
+                Color light_source_color;
+                Vector<N, T> vector_to_light;
 
-                // Случайный вектор диффузного освещения надо определять от видимой нормали.
-                Ray<N, T> diffuse_ray = Ray<N, T>(point, random_cosine_weighted_on_hemisphere(random_engine, shading_normal));
+                light_source->properties(p, &light_source_color, &vector_to_light);
+
+                Color::DataType importance = light_source_importance(light_source_color, vector_to_light, shading_normal);
 
-                if (mesh && dot(diffuse_ray.dir(), geometric_normal) <= DOT_PRODUCT_EPSILON<T>)
+                if (!(importance > 0))
                 {
-                        // Если получившийся случайный вектор диффузного отражения показывает
-                        // в другую сторону от поверхности, то диффузного освещения нет.
-                        return Color(0);
+                        continue;
                 }
 
-                diffuse_ray.move_along_dir(paint_data.ray_offset);
+                if (importance_threshold <= importance)
+                {
+                        Color color = direct_diffuse_lighting(ray_count, objects, light_source_color, vector_to_light, p,
+                                                              geometric_normal, shading_normal, mesh, ray_offset, smooth_normal);
+
+                        return color * (importance_sum / importance);
+                }
 
-                return trace_path(paint_data, ray_count, random_engine, recursion_level + 1, color_level, diffuse_ray, true);
+                importance_threshold -= importance;
+                last_light_source = light_source;
         }
 
-        return Color(0);
+        ASSERT(last_light_source);
+
+        Color light_source_color;
+        Vector<N, T> vector_to_light;
+
+        last_light_source->properties(p, &light_source_color, &vector_to_light);
+
+        Color::DataType importance = light_source_importance(light_source_color, vector_to_light, shading_normal);
+
+        Color color = direct_diffuse_lighting(ray_count, objects, light_source_color, vector_to_light, p, geometric_normal,
+                                              shading_normal, mesh, ray_offset, smooth_normal);
+
+        return color * (importance_sum / importance);
 }
 
+// Состояние пути. Цвет вершин пути умножается на throughput,
+// а color_level — наибольшая составляющая этого множителя.
 template <size_t N, typename T>
-Color trace_path(const PaintData<N, T>& paint_data, Counter& ray_count, PainterRandomEngine<T>& random_engine,
-                 int recursion_level, Color::DataType color_level, const Ray<N, T>& ray, bool diffuse_reflection)
+struct PathState
 {
-        ++ray_count;
-
-        const Surface<N, T>* surface;
-        T t;
-        const void* intersection_data;
-
-        if (!ray_intersection(paint_data.objects, ray, &t, &surface, &intersection_data))
+        Ray<N, T> ray;
+        Color color{0};
+        Color throughput{1};
+        Color::DataType color_level = 1;
+        int recursion_level = 0;
+        bool diffuse_reflection = false;
+        // Номер точки пикселя для точек направлений диффузного отражения
+        int sample_index;
+
+        PathState(const Ray<N, T>& ray_, int sample_index_) : ray(ray_), sample_index(sample_index_)
         {
-                return (paint_data.default_surface_properties.is_light_source() && diffuse_reflection) ?
-                               paint_data.default_surface_properties.get_light_source_color() :
-                               paint_data.default_surface_properties.get_color();
         }
+};
+
+// Точка пересечения пути с диффузной поверхностью
+template <size_t N, typename T>
+struct ShadingPoint
+{
+        Vector<N, T> point;
+        Vector<N, T> geometric_normal;
+        Vector<N, T> shading_normal;
+        bool mesh;
+        Color surface_color;
+        Color::DataType color_level;
+};
+
+// Данные путей точек пикселя для обработки путей по этапам
+template <size_t N, typename T>
+struct Wavefront
+{
+        std::vector<PathState<N, T>> paths;
+        std::vector<ShadingPoint<N, T>> points;
+        std::vector<unsigned char> active;
+        PrimaryRayPacket<N, T> packet;
+};
+
+template <size_t N, typename T>
+Color background_color(const PaintData<N, T>& paint_data, bool diffuse_reflection)
+{
+        return (paint_data.default_surface_properties.is_light_source() && diffuse_reflection) ?
+                       paint_data.default_surface_properties.get_light_source_color() :
+                       paint_data.default_surface_properties.get_color();
+}
 
-        Vector<N, T> point = ray.point(t);
+// Обработка найденной для пути точки пересечения. Если путь заканчивается
+// на этой точке, то к цвету пути добавляется цвет точки и возвращается false.
+// Иначе заполняется shading_point для прямого освещения и продолжения пути.
+template <size_t N, typename T>
+bool shading_point(const PaintData<N, T>& paint_data, const Surface<N, T>* surface, T t, const void* intersection_data,
+                   PathState<N, T>* path, ShadingPoint<N, T>* shading_point)
+{
+        Vector<N, T> point = path->ray.point(t);
 
         const SurfaceProperties surface_properties = surface->properties(point, intersection_data);
 
         Vector<N, T> geometric_normal = surface_properties.get_geometric_normal();
 
-        T dot_dir_and_geometric_normal = dot(ray.dir(), geometric_normal);
+        T dot_dir_and_geometric_normal = dot(path->ray.dir(), geometric_normal);
 
         bool mesh = surface_properties.is_mesh();
 
         if (std::abs(dot_dir_and_geometric_normal) <= DOT_PRODUCT_EPSILON<T>)
         {
-                return Color(0);
+                return false;
         }
 
         if (surface_properties.is_light_source())
         {
-                return (diffuse_reflection) ? surface_properties.get_light_source_color() : surface_properties.get_color();
+                path->color += path->throughput * ((path->diffuse_reflection) ? surface_properties.get_light_source_color() :
+                                                                                surface_properties.get_color());
+                return false;
         }
 
         Vector<N, T> shading_normal =
@@ -372,28 +598,159 @@ Color trace_path(const PaintData<N, T>& paint_data, Counter& ray_count, PainterR
                 shading_normal = -shading_normal;
         }
 
-        Color color(0);
+        if (!(surface_properties.get_diffuse() > 0))
+        {
+                return false;
+        }
+
+        Color surface_color = surface_properties.get_diffuse() * surface_properties.get_color();
+
+        Color::DataType color_level = path->color_level * surface_color.max_element();
+
+        if (color_level < MIN_COLOR_LEVEL)
+        {
+                return false;
+        }
+
+        shading_point->point = point;
+        shading_point->geometric_normal = geometric_normal;
+        shading_point->shading_normal = shading_normal;
+        shading_point->mesh = mesh;
+        shading_point->surface_color = surface_color;
+        shading_point->color_level = color_level;
+
+        return true;
+}
+
+template <size_t N, typename T>
+void add_direct_lighting(const PaintData<N, T>& paint_data, Counter& ray_count, PainterRandomEngine& random_engine,
+                         const ShadingPoint<N, T>& shading_point, PathState<N, T>* path)
+{
+        Color direct = direct_diffuse_lighting(ray_count, random_engine, paint_data.objects, paint_data.light_sources,
+                                               paint_data.light_sampling, shading_point.point, shading_point.geometric_normal,
+                                               shading_point.shading_normal, shading_point.mesh, paint_data.ray_offset,
+                                               paint_data.smooth_normal);
+
+        path->color += path->throughput * shading_point.surface_color * direct;
+}
+
+template <size_t N, typename T>
+Vector<N, T> diffuse_direction(PainterRandomEngine& random_engine, const HemisphereSamples<N, T>& hemisphere_samples,
+                               const PathState<N, T>& path, const Vector<N, T>& normal)
+{
+        if (path.recursion_level < SAMPLED_RECURSION_LEVEL_COUNT && !hemisphere_samples[path.recursion_level].empty())
+        {
+                return cosine_weighted_on_hemisphere(hemisphere_samples[path.recursion_level][path.sample_index], normal);
+        }
+        return random_cosine_weighted_on_hemisphere(random_engine, normal);
+}
+
+// Продолжение пути случайным лучом диффузного отражения.
+// Возвращается false, если путь заканчивается.
+template <size_t N, typename T>
+bool next_ray(const PaintData<N, T>& paint_data, PainterRandomEngine& random_engine,
+              const HemisphereSamples<N, T>& hemisphere_samples, const ShadingPoint<N, T>& shading_point,
+              PathState<N, T>* path)
+{
+        if (path->recursion_level >= MAX_RECURSION_LEVEL)
+        {
+                return false;
+        }
 
-        if (surface_properties.get_diffuse() > 0)
+        // Распределение случайного луча с вероятностью по косинусу угла между нормалью и случайным вектором.
+
+        // Случайный вектор диффузного освещения надо определять от видимой нормали.
+        Ray<N, T> diffuse_ray = Ray<N, T>(
+                shading_point.point, diffuse_direction(random_engine, hemisphere_samples, *path, shading_point.shading_normal));
+
+        if (shading_point.mesh && dot(diffuse_ray.dir(), shading_point.geometric_normal) <= DOT_PRODUCT_EPSILON<T>)
         {
-                Color surface_color = surface_properties.get_diffuse() * surface_properties.get_color();
+                // Если получившийся случайный вектор диффузного отражения показывает
+                // в другую сторону от поверхности, то диффузного освещения нет.
+                return false;
+        }
+
+        diffuse_ray.move_along_dir(paint_data.ray_offset);
 
-                Color::DataType new_color_level = color_level * surface_color.max_element();
+        Color throughput = path->throughput * shading_point.surface_color;
+        Color::DataType color_level = shading_point.color_level;
 
-                if (new_color_level >= MIN_COLOR_LEVEL)
+        if (path->recursion_level >= RUSSIAN_ROULETTE_RECURSION_LEVEL)
+        {
+                // Путь продолжается с вероятностью, равной вкладу пути в цвет пикселя,
+                // а цвет продолженного пути делится на эту вероятность.
+                Color::DataType probability = std::min<Color::DataType>(1, color_level);
+                if (std::uniform_real_distribution<Color::DataType>(0, 1)(random_engine) >= probability)
                 {
-                        Color direct = direct_diffuse_lighting(ray_count, paint_data.objects, paint_data.light_sources, point,
-                                                               geometric_normal, shading_normal, mesh, paint_data.ray_offset,
-                                                               paint_data.smooth_normal);
+                        return false;
+                }
+                throughput = throughput / probability;
+                color_level = color_level / probability;
+        }
+
+        path->ray = diffuse_ray;
+        path->throughput = throughput;
+        path->color_level = color_level;
+        path->diffuse_reflection = true;
+        ++path->recursion_level;
+
+        return true;
+}
 
-                        Color diffuse = diffuse_lighting(paint_data, ray_count, random_engine, recursion_level, new_color_level,
-                                                         point, shading_normal, geometric_normal, mesh);
+// Путь от найденного для луча пути пересечения или от отсутствия пересечения при surface == nullptr
+template <size_t N, typename T>
+Color trace_path(const PaintData<N, T>& paint_data, Counter& ray_count, PainterRandomEngine& random_engine,
+                 const HemisphereSamples<N, T>& hemisphere_samples, PathState<N, T> path, const Surface<N, T>* surface, T t,
+                 const void* intersection_data)
+{
+        ShadingPoint<N, T> point;
 
-                        color += surface_color * (direct + diffuse);
+        while (true)
+        {
+                if (!surface)
+                {
+                        path.color += path.throughput * background_color(paint_data, path.diffuse_reflection);
+                        return path.color;
+                }
+
+                if (!shading_point(paint_data, surface, t, intersection_data, &path, &point))
+                {
+                        return path.color;
+                }
+
+                add_direct_lighting(paint_data, ray_count, random_engine, point, &path);
+
+                if (!next_ray(paint_data, random_engine, hemisphere_samples, point, &path))
+                {
+                        return path.color;
+                }
+
+                ++ray_count;
+
+                if (!paint_data.objects.intersect(path.ray, &t, &surface, &intersection_data))
+                {
+                        surface = nullptr;
                 }
         }
+}
 
-        return color;
+template <size_t N, typename T>
+Color trace_path(const PaintData<N, T>& paint_data, Counter& ray_count, PainterRandomEngine& random_engine,
+                 const HemisphereSamples<N, T>& hemisphere_samples, const Ray<N, T>& ray, int sample_index)
+{
+        ++ray_count;
+
+        const Surface<N, T>* surface;
+        T t = 0;
+        const void* intersection_data = nullptr;
+
+        if (!paint_data.objects.intersect(ray, &t, &surface, &intersection_data))
+        {
+                surface = nullptr;
+        }
+
+        return trace_path(paint_data, ray_count, random_engine, hemisphere_samples, PathState<N, T>(ray, sample_index), surface,
+                          t, intersection_data);
 }
 
 template <typename VectorType, size_t N, typename ArrayType>
@@ -408,63 +765,259 @@ Vector<N, VectorType> array_to_vector(const std::array<ArrayType, N>& array)
 }
 
 template <size_t N, typename T>
-void paint_pixels(PainterRandomEngine<T>& random_engine, std::vector<Vector<N - 1, T>>* samples, std::atomic_bool& stop,
+SampleSum trace_samples(Counter& ray_count, PainterRandomEngine& random_engine,
+                        const HemisphereSamples<N, T>& hemisphere_samples, const Projector<N, T>& projector,
+                        const PaintData<N, T>& paint_data, const Vector<N - 1, T>& screen_point,
+                        const std::vector<Vector<N - 1, T>>& samples)
+{
+        SampleSum sum;
+
+        for (size_t i = 0; i < samples.size(); ++i)
+        {
+                Ray<N, T> ray = projector.ray(screen_point + samples[i]);
+
+                sum.add(trace_path(paint_data, ray_count, random_engine, hemisphere_samples, ray, i));
+        }
+
+        return sum;
+}
+
+// Пересечения первичных лучей находятся пакетами, а дальше пути трассируются по отдельности
+template <size_t N, typename T>
+SampleSum trace_samples_by_packets(Counter& ray_count, PainterRandomEngine& random_engine,
+                                   const HemisphereSamples<N, T>& hemisphere_samples, const Projector<N, T>& projector,
+                                   const PaintData<N, T>& paint_data, const Vector<N - 1, T>& screen_point,
+                                   const std::vector<Vector<N - 1, T>>& samples, PrimaryRayPacket<N, T>* packet)
+{
+        SampleSum sum;
+
+        for (size_t first = 0; first < samples.size(); first += RayPacket<N, T>::MAX_SIZE)
+        {
+                const size_t last = std::min(samples.size(), first + RayPacket<N, T>::MAX_SIZE);
+
+                packet->rays.clear();
+                for (size_t i = first; i < last; ++i)
+                {
+                        packet->rays.add(projector.ray(screen_point + samples[i]));
+                }
+
+                typename RayPacket<N, T>::Mask found = paint_data.objects.intersect_packet(
+                        packet->rays, packet->t.data(), packet->surface.data(), packet->intersection_data.data());
+
+                for (int i = 0; i < packet->rays.size(); ++i)
+                {
+                        ++ray_count;
+
+                        const Surface<N, T>* surface = RayPacket<N, T>::contains(found, i) ? packet->surface[i] : nullptr;
+
+                        sum.add(trace_path(paint_data, ray_count, random_engine, hemisphere_samples,
+                                           PathState<N, T>(packet->rays.ray(i), first + i), surface, packet->t[i],
+                                           packet->intersection_data[i]));
+                }
+        }
+
+        return sum;
+}
+
+// Все пути точек пикселя обрабатываются вместе по этапам: пересечения лучей
+// путей пакетами, обработка точек пересечения, прямое освещение с лучами теней,
+// продолжение путей. Законченные пути удаляются из набора путей.
+template <size_t N, typename T>
+SampleSum trace_samples_by_wavefront(Counter& ray_count, PainterRandomEngine& random_engine,
+                                     const HemisphereSamples<N, T>& hemisphere_samples, const Projector<N, T>& projector,
+                                     const PaintData<N, T>& paint_data, const Vector<N - 1, T>& screen_point,
+                                     const std::vector<Vector<N - 1, T>>& samples, Wavefront<N, T>* wavefront)
+{
+        std::vector<PathState<N, T>>& paths = wavefront->paths;
+        std::vector<ShadingPoint<N, T>>& points = wavefront->points;
+        std::vector<unsigned char>& active = wavefront->active;
+        PrimaryRayPacket<N, T>& packet = wavefront->packet;
+
+        SampleSum sum;
+
+        paths.clear();
+        for (size_t i = 0; i < samples.size(); ++i)
+        {
+                paths.emplace_back(projector.ray(screen_point + samples[i]), i);
+        }
+
+        while (!paths.empty())
+        {
+                points.resize(paths.size());
+                active.resize(paths.size());
+
+                // Пересечения и обработка точек пересечения
+                for (size_t first = 0; first < paths.size(); first += RayPacket<N, T>::MAX_SIZE)
+                {
+                        const size_t last = std::min(paths.size(), first + RayPacket<N, T>::MAX_SIZE);
+
+                        packet.rays.clear();
+                        for (size_t i = first; i < last; ++i)
+                        {
+                                packet.rays.add(paths[i].ray);
+                        }
+
+                        typename RayPacket<N, T>::Mask found = paint_data.objects.intersect_packet(
+                                packet.rays, packet.t.data(), packet.surface.data(), packet.intersection_data.data());
+
+                        for (size_t i = first; i < last; ++i)
+                        {
+                                ++ray_count;
+
+                                const int p = i - first;
+                                PathState<N, T>& path = paths[i];
+
+                                if (!RayPacket<N, T>::contains(found, p))
+                                {
+                                        path.color += path.throughput * background_color(paint_data, path.diffuse_reflection);
+                                        active[i] = false;
+                                        continue;
+                                }
+
+                                active[i] = shading_point(paint_data, packet.surface[p], packet.t[p], packet.intersection_data[p],
+                                                          &path, &points[i]);
+                        }
+                }
+
+                // Прямое освещение
+                for (size_t i = 0; i < paths.size(); ++i)
+                {
+                        if (active[i])
+                        {
+                                add_direct_lighting(paint_data, ray_count, random_engine, points[i], &paths[i]);
+                        }
+                }
+
+                // Продолжение путей и удаление законченных путей
+                size_t count = 0;
+                for (size_t i = 0; i < paths.size(); ++i)
+                {
+                        if (active[i] && next_ray(paint_data, random_engine, hemisphere_samples, points[i], &paths[i]))
+                        {
+                                if (count != i)
+                                {
+                                        paths[count] = paths[i];
+                                }
+                                ++count;
+                                continue;
+                        }
+                        sum.add(paths[i].color);
+                }
+                paths.erase(paths.begin() + count, paths.end());
+        }
+
+        return sum;
+}
+
+template <size_t N>
+uint64_t pixel_random_seed(unsigned long long random_seed, long long pass, const std::array<int_least16_t, N>& pixel)
+{
+        uint64_t seed = hash_combine_64(random_seed, pass);
+        for (int_least16_t coordinate : pixel)
+        {
+                seed = hash_combine_64(seed, static_cast<uint16_t>(coordinate));
+        }
+        return seed;
+}
+
+template <size_t N, typename T, typename Sampler, typename HemisphereSampler>
+void paint_pixels(long long pass, PainterRandomEngine& random_engine, std::vector<Vector<N - 1, T>>* samples,
+                  HemisphereSamples<N, T>* hemisphere_samples, Wavefront<N, T>* wavefront, std::atomic_bool& stop,
                   const Projector<N, T>& projector, const PaintData<N, T>& paint_data, PainterNotifier<N - 1>* painter_notifier,
-                  Paintbrush<N - 1>* paintbrush, const PainterSampler<N - 1, T>& sampler, Pixels<N - 1>* pixels)
+                  Paintbrush<N - 1>* paintbrush, const Sampler& sampler, const HemisphereSampler& hemisphere_sampler,
+                  Pixels<N - 1>* pixels, std::vector<PainterPixel<N - 1>>* notification_pixels)
 {
         std::array<int_least16_t, N - 1> pixel;
 
         Counter ray_count = 0, sample_count = 0;
 
+        notification_pixels->clear();
+
         while (!stop && paintbrush->next_pixel(ray_count, sample_count, &pixel))
         {
-                painter_notifier->painter_pixel_before(pixel);
+                if (notification_pixels->empty())
+                {
+                        painter_notifier->painter_pixel_before(pixel);
+                }
 
                 Vector<N - 1, T> screen_point = array_to_vector<T>(pixel);
 
+                random_engine.seed(pixel_random_seed(paint_data.random_seed, pass, pixel));
+
                 sampler.generate(random_engine, samples);
+                hemisphere_sampler.generate(random_engine, hemisphere_samples);
 
                 ray_count = 0;
                 sample_count = samples->size();
 
-                Color color(0);
-
-                for (const Vector<N - 1, T>& sample_point : *samples)
+                SampleSum sum;
+                switch (paint_data.tracing)
                 {
-                        constexpr int recursion_level = 0;
-                        constexpr Color::DataType color_level = 1;
-                        constexpr bool diffuse_reflection = false;
+                case PaintTracing::Rays:
+                        sum = trace_samples(ray_count, random_engine, *hemisphere_samples, projector, paint_data, screen_point,
+                                            *samples);
+                        break;
+                case PaintTracing::Packets:
+                        sum = trace_samples_by_packets(ray_count, random_engine, *hemisphere_samples, projector, paint_data,
+                                                       screen_point, *samples, &wavefront->packet);
+                        break;
+                case PaintTracing::Wavefront:
+                        sum = trace_samples_by_wavefront(ray_count, random_engine, *hemisphere_samples, projector, paint_data,
+                                                         screen_point, *samples, wavefront);
+                        break;
+                }
 
-                        Ray<N, T> ray = projector.ray(screen_point + sample_point);
+                bool converged;
+                Color pixel_color = pixels->add_samples(pixel, sum, samples->size(), &converged);
 
-                        color += trace_path(paint_data, ray_count, random_engine, recursion_level, color_level, ray,
-                                            diffuse_reflection);
+                if (converged && paint_data.sampling == PaintSampling::Adaptive)
+                {
+                        paintbrush->pixel_converged(pixel);
                 }
 
-                Color pixel_color = pixels->add_color_and_samples(pixel, color, samples->size());
+                notification_pixels->push_back({pixel, pixel_color});
 
-                painter_notifier->painter_pixel_after(pixel, pixel_color);
+                if (notification_pixels->size() >= NOTIFICATION_PIXEL_COUNT)
+                {
+                        painter_notifier->painter_pixels_after(*notification_pixels);
+                        notification_pixels->clear();
+                }
+        }
+
+        if (!notification_pixels->empty())
+        {
+                painter_notifier->painter_pixels_after(*notification_pixels);
+                notification_pixels->clear();
         }
 }
 
-template <size_t N, typename T>
+template <size_t N, typename T, typename Sampler, typename HemisphereSampler>
 void work_thread(unsigned thread_number, ThreadBarrier& barrier, std::atomic_bool& stop, std::atomic_bool& error_caught,
                  std::atomic_bool& stop_painting, const Projector<N, T>& projector, const PaintData<N, T>& paint_data,
-                 PainterNotifier<N - 1>* painter_notifier, Paintbrush<N - 1>* paintbrush, const PainterSampler<N - 1, T>& sampler,
-                 Pixels<N - 1>* pixels) noexcept
+                 PainterNotifier<N - 1>* painter_notifier, Paintbrush<N - 1>* paintbrush, const Sampler& sampler,
+                 const HemisphereSampler& hemisphere_sampler, Pixels<N - 1>* pixels, long long pass_begin, long long first_pass,
+                 PaintCheckpointWriter<N - 1>* checkpoint_writer) noexcept
 {
         try
         {
                 try
                 {
-                        RandomEngineWithSeed<PainterRandomEngine<T>> random_engine;
+                        PainterRandomEngine random_engine(paint_data.random_seed);
 
                         std::vector<Vector<N - 1, T>> samples;
+                        HemisphereSamples<N, T> hemisphere_samples;
+
+                        Wavefront<N, T> wavefront;
 
-                        while (true)
+                        std::vector<PainterPixel<N - 1>> notification_pixels;
+                        notification_pixels.reserve(NOTIFICATION_PIXEL_COUNT);
+
+                        // Все потоки выполняют одинаковое количество проходов
+                        for (long long pass = first_pass;; ++pass)
                         {
-                                paint_pixels(random_engine, &samples, stop, projector, paint_data, painter_notifier, paintbrush,
-                                             sampler, pixels);
+                                paint_pixels(pass, random_engine, &samples, &hemisphere_samples, &wavefront, stop, projector,
+                                             paint_data, painter_notifier, paintbrush, sampler, hemisphere_sampler, pixels,
+                                             &notification_pixels);
 
                                 barrier.wait();
 
@@ -480,10 +1033,26 @@ void work_thread(unsigned thread_number, ThreadBarrier& barrier, std::atomic_boo
 
                                 if (thread_number == 0)
                                 {
-                                        if (stop || !paintbrush->next_pass())
+                                        // Если не было остановки, то все потоки закончили проход
+                                        // из-за отсутствия пикселей и проход нарисован полностью.
+                                        // Суммы прерванного прохода не сохраняются, так как
+                                        // при продолжении рисования этот проход не повторяется.
+                                        const bool pass_completed = !stop;
+
+                                        if (!pass_completed || !paintbrush->next_pass())
                                         {
                                                 stop_painting = true;
                                         }
+
+                                        // Копирование сумм всех пикселей только для записи в файл,
+                                        // которая нужна после последнего прохода или по времени
+                                        if (checkpoint_writer && pass_completed &&
+                                            (stop_painting || checkpoint_writer->interval_elapsed()))
+                                        {
+                                                PaintCheckpoint<N - 1> checkpoint;
+                                                pixels->checkpoint(paint_data.random_seed, pass_begin, pass + 1, &checkpoint);
+                                                checkpoint_writer->write(std::move(checkpoint));
+                                        }
                                 }
 
                                 barrier.wait();
@@ -557,22 +1126,68 @@ T compute_ray_offset(const std::vector<const GenericObject<N, T>*>& objects)
         return dist;
 }
 
-template <size_t N, typename T>
-void paint_threads(PainterNotifier<N - 1>* painter_notifier, int samples_per_pixel, const PaintObjects<N, T>& paint_objects,
-                   Paintbrush<N - 1>* paintbrush, int thread_count, std::atomic_bool* stop, bool smooth_normal)
-
+// Суммы пикселей и диапазон проходов из файла. Цвета пикселей сразу
+// передаются painter_notifier, чтобы было видно продолжаемое изображение.
+template <size_t N>
+void resume_from_checkpoint(const std::string& file_name, unsigned long long random_seed,
+                            PainterNotifier<N>* painter_notifier, Pixels<N>* pixels, long long* pass_begin,
+                            long long* pass_end)
 {
-        check_thread_count(thread_count);
-        check_paintbrush_projector(*paintbrush, paint_objects.projector());
+        PaintCheckpoint<N> checkpoint = load_paint_checkpoint<N>(file_name);
+
+        if (checkpoint.random_seed != random_seed)
+        {
+                error("Paint checkpoint random seed " + to_string(checkpoint.random_seed) +
+                      " is not equal to the random seed " + to_string(random_seed));
+        }
+
+        *pass_begin = checkpoint.pass_begin;
+        *pass_end = checkpoint.pass_end;
 
-        const PainterSampler<N - 1, T> sampler(samples_per_pixel);
+        pixels->set(std::move(checkpoint));
 
-        const PaintData paint_data(paint_objects.objects(), paint_objects.light_sources(),
-                                   paint_objects.default_surface_properties(), compute_ray_offset(paint_objects.objects()),
-                                   smooth_normal);
+        std::vector<PainterPixel<N>> painted_pixels;
+        pixels->painted_pixels(&painted_pixels);
+
+        for (size_t i = 0; i < painted_pixels.size(); i += NOTIFICATION_PIXEL_COUNT)
+        {
+                const size_t count = std::min<size_t>(NOTIFICATION_PIXEL_COUNT, painted_pixels.size() - i);
+                painter_notifier->painter_pixel_before(painted_pixels[i].pixel);
+                painter_notifier->painter_pixels_after(Span<const PainterPixel<N>>(&painted_pixels[i], count));
+        }
+}
+
+template <size_t N, typename T, typename Sampler, typename HemisphereSampler>
+void paint_threads(PainterNotifier<N - 1>* painter_notifier, const Sampler& sampler, const HemisphereSampler& hemisphere_sampler,
+                   const PaintObjects<N, T>& paint_objects, Paintbrush<N - 1>* paintbrush, int thread_count,
+                   std::atomic_bool* stop, bool smooth_normal, PaintTracing tracing, PaintSampling sampling,
+                   PaintLightSampling light_sampling, unsigned long long random_seed, const PaintCheckpointOptions& checkpoint)
+{
+        const SceneObjects<N, T> objects(paint_objects.objects());
+
+        const PaintData paint_data(objects, paint_objects.light_sources(), paint_objects.default_surface_properties(),
+                                   compute_ray_offset(paint_objects.objects()), smooth_normal, tracing, sampling,
+                                   light_sampling, random_seed);
 
         Pixels pixels(paint_objects.projector().screen_size());
 
+        // Суммы пикселей содержат проходы от pass_begin до pass_end,
+        // не включая pass_end, а рисование начинается с прохода first_pass
+        long long pass_begin = 0;
+        long long pass_end = 0;
+        if (!checkpoint.resume_file_name.empty())
+        {
+                resume_from_checkpoint(checkpoint.resume_file_name, random_seed, painter_notifier, &pixels, &pass_begin,
+                                       &pass_end);
+        }
+        const long long first_pass = pass_end;
+
+        std::optional<PaintCheckpointWriter<N - 1>> checkpoint_writer;
+        if (!checkpoint.save_file_name.empty())
+        {
+                checkpoint_writer.emplace(checkpoint.save_file_name, checkpoint.save_interval);
+        }
+
         ThreadBarrier barrier(thread_count);
         std::vector<std::thread> threads(thread_count);
         std::atomic_bool error_caught = false;
@@ -584,7 +1199,8 @@ void paint_threads(PainterNotifier<N - 1>* painter_notifier, int samples_per_pix
         {
                 threads[i] = std::thread([&, i ]() noexcept {
                         work_thread(i, barrier, *stop, error_caught, stop_painting, paint_objects.projector(), paint_data,
-                                    painter_notifier, paintbrush, sampler, &pixels);
+                                    painter_notifier, paintbrush, sampler, hemisphere_sampler, &pixels, pass_begin, first_pass,
+                                    checkpoint_writer ? &*checkpoint_writer : nullptr);
                 });
         }
 
@@ -593,12 +1209,50 @@ void paint_threads(PainterNotifier<N - 1>* painter_notifier, int samples_per_pix
                 t.join();
         }
 }
+
+template <size_t N, typename T>
+void paint_threads(PainterNotifier<N - 1>* painter_notifier, int samples_per_pixel, const PaintObjects<N, T>& paint_objects,
+                   Paintbrush<N - 1>* paintbrush, int thread_count, std::atomic_bool* stop, bool smooth_normal,
+                   PaintTracing tracing, PaintSampler sampler, PaintSampling sampling, PaintLightSampling light_sampling,
+                   unsigned long long random_seed, const PaintCheckpointOptions& checkpoint)
+{
+        check_thread_count(thread_count);
+        check_paintbrush_projector(*paintbrush, paint_objects.projector());
+
+        switch (sampler)
+        {
+        case PaintSampler::StratifiedJittered:
+                paint_threads(painter_notifier, StratifiedJitteredSampler<N - 1, T>(samples_per_pixel),
+                              RandomHemisphereSampler<N, T>(), paint_objects, paintbrush, thread_count, stop, smooth_normal,
+                              tracing, sampling, light_sampling, random_seed, checkpoint);
+                return;
+        case PaintSampler::LatinHypercube:
+                paint_threads(painter_notifier, LatinHypercubeSampler<N - 1, T>(samples_per_pixel),
+                              RandomHemisphereSampler<N, T>(), paint_objects, paintbrush, thread_count, stop, smooth_normal,
+                              tracing, sampling, light_sampling, random_seed, checkpoint);
+                return;
+        case PaintSampler::Sobol:
+                paint_threads(painter_notifier, SobolSampler<N - 1, T>(samples_per_pixel),
+                              HemisphereSampler<N, T, SobolSampler>(samples_per_pixel), paint_objects, paintbrush, thread_count,
+                              stop, smooth_normal, tracing, sampling, light_sampling, random_seed, checkpoint);
+                return;
+        case PaintSampler::Halton:
+                paint_threads(painter_notifier, HaltonSampler<N - 1, T>(samples_per_pixel),
+                              HemisphereSampler<N, T, HaltonSampler>(samples_per_pixel), paint_objects, paintbrush, thread_count,
+                              stop, smooth_normal, tracing, sampling, light_sampling, random_seed, checkpoint);
+                return;
+        }
+
+        error("Unknown paint sampler");
+}
 }
 
 // Без выдачи исключений. Про проблемы сообщать через painter_notifier.
 template <size_t N, typename T>
 void paint(PainterNotifier<N - 1>* painter_notifier, int samples_per_pixel, const PaintObjects<N, T>& paint_objects,
-           Paintbrush<N - 1>* paintbrush, int thread_count, std::atomic_bool* stop, bool smooth_normal) noexcept
+           Paintbrush<N - 1>* paintbrush, int thread_count, std::atomic_bool* stop, bool smooth_normal,
+           PaintTracing tracing, PaintSampler sampler, PaintSampling sampling, PaintLightSampling light_sampling,
+           unsigned long long random_seed, const PaintCheckpointOptions& checkpoint) noexcept
 {
         try
         {
@@ -607,7 +1261,7 @@ void paint(PainterNotifier<N - 1>* painter_notifier, int samples_per_pixel, cons
                         ASSERT(painter_notifier && paintbrush && stop);
 
                         paint_threads(painter_notifier, samples_per_pixel, paint_objects, paintbrush, thread_count, stop,
-                                      smooth_normal);
+                                      smooth_normal, tracing, sampler, sampling, light_sampling, random_seed, checkpoint);
                 }
                 catch (std::exception& e)
                 {
@@ -625,19 +1279,43 @@ void paint(PainterNotifier<N - 1>* painter_notifier, int samples_per_pixel, cons
 }
 
 template void paint(PainterNotifier<2>* painter_notifier, int samples_per_pixel, const PaintObjects<3, float>& paint_objects,
-                    Paintbrush<2>* paintbrush, int thread_count, std::atomic_bool* stop, bool smooth_normal) noexcept;
+                    Paintbrush<2>* paintbrush, int thread_count, std::atomic_bool* stop, bool smooth_normal,
+                    PaintTracing tracing, PaintSampler sampler, PaintSampling sampling,
+                    PaintLightSampling light_sampling, unsigned long long random_seed,
+                    const PaintCheckpointOptions& checkpoint) noexcept;
 template void paint(PainterNotifier<3>* painter_notifier, int samples_per_pixel, const PaintObjects<4, float>& paint_objects,
-                    Paintbrush<3>* paintbrush, int thread_count, std::atomic_bool* stop, bool smooth_normal) noexcept;
+                    Paintbrush<3>* paintbrush, int thread_count, std::atomic_bool* stop, bool smooth_normal,
+                    PaintTracing tracing, PaintSampler sampler, PaintSampling sampling,
+                    PaintLightSampling light_sampling, unsigned long long random_seed,
+                    const PaintCheckpointOptions& checkpoint) noexcept;
 template void paint(PainterNotifier<4>* painter_notifier, int samples_per_pixel, const PaintObjects<5, float>& paint_objects,
-                    Paintbrush<4>* paintbrush, int thread_count, std::atomic_bool* stop, bool smooth_normal) noexcept;
+                    Paintbrush<4>* paintbrush, int thread_count, std::atomic_bool* stop, bool smooth_normal,
+                    PaintTracing tracing, PaintSampler sampler, PaintSampling sampling,
+                    PaintLightSampling light_sampling, unsigned long long random_seed,
+                    const PaintCheckpointOptions& checkpoint) noexcept;
 template void paint(PainterNotifier<5>* painter_notifier, int samples_per_pixel, const PaintObjects<6, float>& paint_objects,
-                    Paintbrush<5>* paintbrush, int thread_count, std::atomic_bool* stop, bool smooth_normal) noexcept;
+                    Paintbrush<5>* paintbrush, int thread_count, std::atomic_bool* stop, bool smooth_normal,
+                    PaintTracing tracing, PaintSampler sampler, PaintSampling sampling,
+                    PaintLightSampling light_sampling, unsigned long long random_seed,
+                    const PaintCheckpointOptions& checkpoint) noexcept;
 
 template void paint(PainterNotifier<2>* painter_notifier, int samples_per_pixel, const PaintObjects<3, double>& paint_objects,
-                    Paintbrush<2>* paintbrush, int thread_count, std::atomic_bool* stop, bool smooth_normal) noexcept;
+                    Paintbrush<2>* paintbrush, int thread_count, std::atomic_bool* stop, bool smooth_normal,
+                    PaintTracing tracing, PaintSampler sampler, PaintSampling sampling,
+                    PaintLightSampling light_sampling, unsigned long long random_seed,
+                    const PaintCheckpointOptions& checkpoint) noexcept;
 template void paint(PainterNotifier<3>* painter_notifier, int samples_per_pixel, const PaintObjects<4, double>& paint_objects,
-                    Paintbrush<3>* paintbrush, int thread_count, std::atomic_bool* stop, bool smooth_normal) noexcept;
+                    Paintbrush<3>* paintbrush, int thread_count, std::atomic_bool* stop, bool smooth_normal,
+                    PaintTracing tracing, PaintSampler sampler, PaintSampling sampling,
+                    PaintLightSampling light_sampling, unsigned long long random_seed,
+                    const PaintCheckpointOptions& checkpoint) noexcept;
 template void paint(PainterNotifier<4>* painter_notifier, int samples_per_pixel, const PaintObjects<5, double>& paint_objects,
-                    Paintbrush<4>* paintbrush, int thread_count, std::atomic_bool* stop, bool smooth_normal) noexcept;
+                    Paintbrush<4>* paintbrush, int thread_count, std::atomic_bool* stop, bool smooth_normal,
+                    PaintTracing tracing, PaintSampler sampler, PaintSampling sampling,
+                    PaintLightSampling light_sampling, unsigned long long random_seed,
+                    const PaintCheckpointOptions& checkpoint) noexcept;
 template void paint(PainterNotifier<5>* painter_notifier, int samples_per_pixel, const PaintObjects<6, double>& paint_objects,
-                    Paintbrush<5>* paintbrush, int thread_count, std::atomic_bool* stop, bool smooth_normal) noexcept;
+                    Paintbrush<5>* paintbrush, int thread_count, std::atomic_bool* stop, bool smooth_normal,
+                    PaintTracing tracing, PaintSampler sampler, PaintSampling sampling,
+                    PaintLightSampling light_sampling, unsigned long long random_seed,
+                    const PaintCheckpointOptions& checkpoint) noexcept;
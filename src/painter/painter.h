@@ -19,10 +19,19 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "objects.h"
 
+#include "com/span.h"
+
 #include <array>
 #include <atomic>
 #include <string>
 
+template <size_t N>
+struct PainterPixel
+{
+        std::array<int_least16_t, N> pixel;
+        Color color;
+};
+
 template <size_t N>
 struct PainterNotifier
 {
@@ -32,11 +41,85 @@ protected:
         }
 
 public:
+        // Вызывается для первого пикселя группы пикселей, результаты которой
+        // передаются потом одним вызовом painter_pixels_after.
         virtual void painter_pixel_before(const std::array<int_least16_t, N>& pixel) noexcept = 0;
         virtual void painter_pixel_after(const std::array<int_least16_t, N>& pixel, const Color& c) noexcept = 0;
         virtual void painter_error_message(const std::string& msg) noexcept = 0;
+
+        // Результаты группы пикселей. Без переопределения функции
+        // для каждого пикселя вызывается painter_pixel_after.
+        virtual void painter_pixels_after(const Span<const PainterPixel<N>>& pixels) noexcept
+        {
+                for (const PainterPixel<N>& p : pixels)
+                {
+                        painter_pixel_after(p.pixel, p.color);
+                }
+        }
+};
+
+// Способ трассировки путей точек пикселя
+enum class PaintTracing
+{
+        // Каждый луч отдельно
+        Rays,
+        // Лучи точек пикселя пакетами с общим обходом структур поиска пересечений,
+        // а после первого пересечения каждый луч отдельно
+        Packets,
+        // Все пути точек пикселя вместе по этапам, пересечения лучей
+        // путей на каждом этапе пакетами
+        Wavefront
+};
+
+// Точки внутри пикселя
+enum class PaintSampler
+{
+        StratifiedJittered,
+        LatinHypercube,
+        // Последовательность Соболя с перемешиванием Оуэна
+        Sobol,
+        // Последовательность Холтона с вложенными случайными сдвигами цифр
+        Halton
+};
+
+// Распределение точек по пикселям
+enum class PaintSampling
+{
+        // В каждом проходе одинаковое количество точек для всех пикселей
+        Uniform,
+        // Пиксели, для которых доверительный интервал яркости стал меньше
+        // допустимой ошибки, не рисуются в следующих проходах
+        Adaptive
+};
+
+// Освещение точек источниками света
+enum class PaintLightSampling
+{
+        // Все источники света
+        AllLights,
+        // Один источник света, выбранный с вероятностью, пропорциональной
+        // оценке его освещения без учёта видимости
+        OneLight
+};
+
+// Файлы сумм пикселей для продолжения рисования
+struct PaintCheckpointOptions
+{
+        // Если не пустая строка, то рисование продолжается с сумм пикселей
+        // и со следующего прохода после проходов из этого файла
+        std::string resume_file_name;
+        // Если не пустая строка, то в этот файл сохраняются суммы пикселей
+        // не чаще, чем через save_interval секунд, и после последнего прохода.
+        // Сохраняются только полностью нарисованные проходы, поэтому при остановке
+        // в середине прохода в файле остаются проходы последнего сохранения.
+        std::string save_file_name;
+        double save_interval = 0;
 };
 
+// Случайные числа пикселя в проходе определяются по random_seed, номеру
+// прохода и пикселю, поэтому изображение не зависит от количества потоков.
 template <size_t N, typename T>
 void paint(PainterNotifier<N - 1>* painter_notifier, int samples_per_pixel, const PaintObjects<N, T>& paint_objects,
-           Paintbrush<N - 1>* paintbrush, int thread_count, std::atomic_bool* stop, bool smooth_normal) noexcept;
+           Paintbrush<N - 1>* paintbrush, int thread_count, std::atomic_bool* stop, bool smooth_normal,
+           PaintTracing tracing, PaintSampler sampler, PaintSampling sampling, PaintLightSampling light_sampling,
+           unsigned long long random_seed, const PaintCheckpointOptions& checkpoint) noexcept;
@@ -0,0 +1,337 @@
+/*
+Copyright (C) 2017-2019 Topological Manifold
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ Matt Pharr, Wenzel Jakob, Greg Humphreys.
+ Physically Based Rendering. From theory to implementation. Third edition.
+ Elsevier, 2017.
+ 7.4 The Halton sampler.
+ 7.7 (0, 2)-sequence sampler.
+
+ Stephen Joe, Frances Y. Kuo.
+ Constructing Sobol sequences with better two-dimensional projections.
+ SIAM Journal on Scientific Computing, 30 (2008), 2635-2654.
+
+ Art B. Owen.
+ Randomly permuted (t,m,s)-nets and (t,s)-sequences.
+ Monte Carlo and Quasi-Monte Carlo Methods in Scientific Computing, 1995.
+
+ Brent Burley.
+ Practical Hash-based Owen Scrambling.
+ Journal of Computer Graphics Techniques, Vol. 9, No. 4, 2020.
+*/
+
+#pragma once
+
+#include "com/error.h"
+#include "com/print.h"
+#include "com/vec.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <type_traits>
+#include <vector>
+
+namespace low_discrepancy_implementation
+{
+inline uint32_t reverse_bits(uint32_t v)
+{
+        v = ((v >> 1) & 0x55555555u) | ((v & 0x55555555u) << 1);
+        v = ((v >> 2) & 0x33333333u) | ((v & 0x33333333u) << 2);
+        v = ((v >> 4) & 0x0f0f0f0fu) | ((v & 0x0f0f0f0fu) << 4);
+        v = ((v >> 8) & 0x00ff00ffu) | ((v & 0x00ff00ffu) << 8);
+        return (v >> 16) | (v << 16);
+}
+
+inline uint32_t hash(uint32_t v)
+{
+        v ^= v >> 16;
+        v *= 0x7feb352du;
+        v ^= v >> 15;
+        v *= 0x846ca68bu;
+        v ^= v >> 16;
+        return v;
+}
+
+// Перестановка Лейна-Карраса с константами Бёрли. Для каждого бита
+// изменения зависят только от этого бита и младших битов.
+inline uint32_t laine_karras_permutation(uint32_t v, uint32_t seed)
+{
+        v ^= v * 0x3d20adeau;
+        v += seed;
+        v *= (seed >> 16) | 1;
+        v ^= v * 0x05526c56u;
+        v ^= v * 0x53a22864u;
+        return v;
+}
+
+// Перемешивание Оуэна в основании 2. После обращения порядка битов
+// изменения каждого бита зависят только от этого бита и старших битов.
+inline uint32_t nested_uniform_scramble(uint32_t v, uint32_t seed)
+{
+        return reverse_bits(laine_karras_permutation(reverse_bits(v), seed));
+}
+
+template <typename T>
+T unit_interval(double v)
+{
+        static_assert(std::is_floating_point_v<T>);
+
+        // Округление до типа T может дать 1
+        constexpr T MAX = 1 - std::numeric_limits<T>::epsilon() / 2;
+
+        return std::min(static_cast<T>(v), MAX);
+}
+
+template <typename T>
+T unit_interval(uint32_t v)
+{
+        return unit_interval<T>(v * 0x1p-32);
+}
+
+template <size_t N, typename RandomEngine>
+std::array<uint32_t, N> random_seeds(RandomEngine& random_engine)
+{
+        std::uniform_int_distribution<uint32_t> uid;
+        std::array<uint32_t, N> seeds;
+        for (unsigned i = 0; i < N; ++i)
+        {
+                seeds[i] = uid(random_engine);
+        }
+        return seeds;
+}
+}
+
+// Последовательность Соболя с перемешиванием Оуэна.
+// Для каждого вызова generate новое перемешивание по каждому измерению.
+template <size_t N, typename T>
+class SobolSampleEngine
+{
+        static_assert(std::is_floating_point_v<T>);
+        static_assert(N >= 1);
+
+        static constexpr unsigned BIT_COUNT = 32;
+
+        // Направляющие числа Джо-Куо для измерений начиная со второго:
+        // степень s примитивного многочлена, его коэффициенты a и числа m.
+        struct DirectionNumbers
+        {
+                unsigned s;
+                unsigned a;
+                std::array<uint32_t, 5> m;
+        };
+        static constexpr std::array<DirectionNumbers, 12> DIRECTION_NUMBERS{{{1, 0, {1}},
+                                                                              {2, 1, {1, 3}},
+                                                                              {3, 1, {1, 3, 1}},
+                                                                              {3, 2, {1, 1, 1}},
+                                                                              {4, 1, {1, 1, 3, 3}},
+                                                                              {4, 4, {1, 3, 5, 13}},
+                                                                              {5, 2, {1, 1, 5, 5, 17}},
+                                                                              {5, 4, {1, 1, 5, 5, 5}},
+                                                                              {5, 7, {1, 1, 7, 11, 19}},
+                                                                              {5, 11, {1, 1, 5, 1, 1}},
+                                                                              {5, 13, {1, 1, 1, 3, 11}},
+                                                                              {5, 14, {1, 3, 5, 5, 31}}}};
+
+        static_assert(N <= DIRECTION_NUMBERS.size() + 1);
+
+        static std::array<uint32_t, BIT_COUNT> direction_vectors(unsigned dimension)
+        {
+                std::array<uint32_t, BIT_COUNT> v;
+
+                if (dimension == 0)
+                {
+                        for (unsigned k = 0; k < BIT_COUNT; ++k)
+                        {
+                                v[k] = uint32_t(1) << (BIT_COUNT - 1 - k);
+                        }
+                        return v;
+                }
+
+                const DirectionNumbers& d = DIRECTION_NUMBERS[dimension - 1];
+
+                for (unsigned k = 0; k < d.s; ++k)
+                {
+                        v[k] = d.m[k] << (BIT_COUNT - 1 - k);
+                }
+                for (unsigned k = d.s; k < BIT_COUNT; ++k)
+                {
+                        v[k] = v[k - d.s] ^ (v[k - d.s] >> d.s);
+                        for (unsigned l = 1; l < d.s; ++l)
+                        {
+                                if ((d.a >> (d.s - 1 - l)) & 1)
+                                {
+                                        v[k] ^= v[k - l];
+                                }
+                        }
+                }
+                return v;
+        }
+
+        const int m_sample_count;
+
+        // Точки без перемешивания, одинаковые для всех вызовов generate
+        std::vector<std::array<uint32_t, N>> m_points;
+
+public:
+        SobolSampleEngine(int sample_count) : m_sample_count(sample_count)
+        {
+                if (m_sample_count < 1)
+                {
+                        error("Sobol sample count (" + to_string(m_sample_count) + ") is not a positive integer");
+                }
+
+                std::array<std::array<uint32_t, BIT_COUNT>, N> directions;
+                for (unsigned i = 0; i < N; ++i)
+                {
+                        directions[i] = direction_vectors(i);
+                }
+
+                m_points.resize(m_sample_count);
+                for (int index = 0; index < m_sample_count; ++index)
+                {
+                        for (unsigned i = 0; i < N; ++i)
+                        {
+                                uint32_t v = 0;
+                                for (unsigned k = 0; (index >> k) != 0; ++k)
+                                {
+                                        if ((index >> k) & 1)
+                                        {
+                                                v ^= directions[i][k];
+                                        }
+                                }
+                                m_points[index][i] = v;
+                        }
+                }
+        }
+
+        template <typename RandomEngine>
+        void generate(RandomEngine& random_engine, std::vector<Vector<N, T>>* samples) const
+        {
+                namespace impl = low_discrepancy_implementation;
+
+                const std::array<uint32_t, N> seeds = impl::random_seeds<N>(random_engine);
+
+                samples->resize(m_sample_count);
+
+                for (int index = 0; index < m_sample_count; ++index)
+                {
+                        for (unsigned i = 0; i < N; ++i)
+                        {
+                                (*samples)[index][i] =
+                                        impl::unit_interval<T>(impl::nested_uniform_scramble(m_points[index][i], seeds[i]));
+                        }
+                }
+        }
+};
+
+// Последовательность Холтона с вложенными случайными сдвигами цифр.
+// Сдвиг цифры зависит от случайного числа и от всех предыдущих цифр,
+// как в перемешивании Оуэна, но вместо случайной перестановки цифр
+// используется случайный циклический сдвиг.
+// Для каждого вызова generate новое перемешивание по каждому измерению.
+template <size_t N, typename T>
+class HaltonSampleEngine
+{
+        static_assert(std::is_floating_point_v<T>);
+        static_assert(N >= 1);
+
+        static constexpr std::array<unsigned, 12> PRIMES{2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37};
+
+        static_assert(N <= PRIMES.size());
+
+        const int m_sample_count;
+        std::array<unsigned, N> m_digit_count;
+
+        // Количество цифр наибольшего номера точки
+        static unsigned digit_count(unsigned max_index, unsigned base)
+        {
+                unsigned count = 1;
+                while (max_index >= base)
+                {
+                        max_index /= base;
+                        ++count;
+                }
+                return count;
+        }
+
+        // Цифры после digit_count цифр номера нулевые у всех точек, а их
+        // сдвиги случайные, поэтому вместо них добавляется случайное число,
+        // зависящее от всех цифр номера.
+        static double scrambled_radical_inverse(uint32_t index, unsigned base, unsigned digit_count, uint32_t seed)
+        {
+                namespace impl = low_discrepancy_implementation;
+
+                const double reciprocal_base = 1.0 / base;
+
+                double factor = reciprocal_base;
+                double result = 0;
+                uint32_t prefix_hash = seed;
+
+                for (unsigned k = 0; k < digit_count; ++k)
+                {
+                        const uint32_t digit = index % base;
+                        index /= base;
+
+                        const uint32_t scrambled_digit = (digit + impl::hash(prefix_hash) % base) % base;
+
+                        result += scrambled_digit * factor;
+                        factor *= reciprocal_base;
+
+                        prefix_hash = impl::hash(prefix_hash ^ (digit + 1));
+                }
+
+                return result + factor * (impl::hash(prefix_hash) * 0x1p-32);
+        }
+
+public:
+        HaltonSampleEngine(int sample_count) : m_sample_count(sample_count)
+        {
+                if (m_sample_count < 1)
+                {
+                        error("Halton sample count (" + to_string(m_sample_count) + ") is not a positive integer");
+                }
+
+                for (unsigned i = 0; i < N; ++i)
+                {
+                        m_digit_count[i] = digit_count(m_sample_count - 1, PRIMES[i]);
+                }
+        }
+
+        template <typename RandomEngine>
+        void generate(RandomEngine& random_engine, std::vector<Vector<N, T>>* samples) const
+        {
+                namespace impl = low_discrepancy_implementation;
+
+                const std::array<uint32_t, N> seeds = impl::random_seeds<N>(random_engine);
+
+                samples->resize(m_sample_count);
+
+                for (int index = 0; index < m_sample_count; ++index)
+                {
+                        for (unsigned i = 0; i < N; ++i)
+                        {
+                                (*samples)[index][i] = impl::unit_interval<T>(
+                                        scrambled_radical_inverse(index, PRIMES[i], m_digit_count[i], seeds[i]));
+                        }
+                }
+        }
+};
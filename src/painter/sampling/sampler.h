@@ -18,6 +18,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #pragma once
 
 #include "engine.h"
+#include "low_discrepancy.h"
 
 #include "com/error.h"
 #include "com/math.h"
@@ -79,3 +80,37 @@ public:
                 m_engine.generate(random_engine, samples);
         }
 };
+
+template <size_t N, typename T>
+class SobolSampler
+{
+        SobolSampleEngine<N, T> m_engine;
+
+public:
+        SobolSampler(int sample_count) : m_engine(sample_count)
+        {
+        }
+
+        template <typename RandomEngine>
+        void generate(RandomEngine& random_engine, std::vector<Vector<N, T>>* samples) const
+        {
+                m_engine.generate(random_engine, samples);
+        }
+};
+
+template <size_t N, typename T>
+class HaltonSampler
+{
+        HaltonSampleEngine<N, T> m_engine;
+
+public:
+        HaltonSampler(int sample_count) : m_engine(sample_count)
+        {
+        }
+
+        template <typename RandomEngine>
+        void generate(RandomEngine& random_engine, std::vector<Vector<N, T>>* samples) const
+        {
+                m_engine.generate(random_engine, samples);
+        }
+};
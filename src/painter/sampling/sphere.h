@@ -32,10 +32,12 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #pragma once
 
+#include "com/math.h"
 #include "com/random/vector.h"
 #include "com/vec.h"
 #include "geometry/core/complement.h"
 
+#include <array>
 #include <cmath>
 #include <random>
 
@@ -84,6 +86,27 @@ void random_in_sphere(RandomEngine& random_engine, Vector<N, T>& v, T& v_length_
         }
 }
 
+namespace sphere_implementation
+{
+// Вектор по нормали и по точке v в перпендикулярной нормали гиперплоскости
+template <size_t N, typename T>
+Vector<N, T> hemisphere_vector(const Vector<N - 1, T>& v, T v_length_square, const Vector<N, T>& normal)
+{
+        T n = std::sqrt(1 - v_length_square);
+
+        std::array<Vector<N, T>, N - 1> basis = orthogonal_complement_of_unit_vector(normal);
+
+        Vector<N, T> res = n * normal;
+
+        for (unsigned i = 0; i < N - 1; ++i)
+        {
+                res += v[i] * basis[i];
+        }
+
+        return res;
+}
+}
+
 template <typename RandomEngine, size_t N, typename T>
 Vector<N, T> random_cosine_weighted_on_hemisphere(RandomEngine& random_engine, const Vector<N, T>& normal)
 {
@@ -101,18 +124,60 @@ Vector<N, T> random_cosine_weighted_on_hemisphere(RandomEngine& random_engine, c
                 v_length_square *= k * k;
         }
 
-        T n = std::sqrt(1 - v_length_square);
+        return sphere_implementation::hemisphere_vector(v, v_length_square, normal);
+}
 
-        std::array<Vector<N, T>, N - 1> basis = orthogonal_complement_of_unit_vector(normal);
+// Количество координат точки единичного куба для cosine_weighted_on_hemisphere
+template <size_t N>
+inline constexpr size_t COSINE_WEIGHTED_ON_HEMISPHERE_SAMPLE_SIZE = (N == 3) ? 2 : 1 + 2 * (N / 2);
+
+// Распределение как у random_cosine_weighted_on_hemisphere, но по точке
+// единичного куба, чтобы использовать точки последовательностей с низким
+// расхождением. Квадрат длины проекции вектора на перпендикулярную нормали
+// гиперплоскость распределён равномерно и равен sample[0]. Направление
+// проекции находится по остальным координатам: для 3 измерений по углу,
+// для других измерений по нормальному распределению с преобразованием
+// Бокса-Мюллера для пар координат.
+template <size_t N, typename T>
+Vector<N, T> cosine_weighted_on_hemisphere(const Vector<COSINE_WEIGHTED_ON_HEMISPHERE_SAMPLE_SIZE<N>, T>& sample,
+                                           const Vector<N, T>& normal)
+{
+        static_assert(N > 2);
 
-        Vector<N, T> res = n * normal;
+        Vector<N - 1, T> v;
 
-        for (unsigned i = 0; i < N - 1; ++i)
+        if constexpr (N == 3)
         {
-                res += v[i] * basis[i];
+                T angle = 2 * PI<T> * sample[1];
+                v[0] = std::cos(angle);
+                v[1] = std::sin(angle);
         }
+        else
+        {
+                for (unsigned i = 0; i < N - 1; i += 2)
+                {
+                        // Значения 1 - sample[i + 1] находятся в интервале (0, 1]
+                        T radius = std::sqrt(-2 * std::log(1 - sample[i + 1]));
+                        T angle = 2 * PI<T> * sample[i + 2];
+                        v[i] = radius * std::cos(angle);
+                        if (i + 1 < N - 1)
+                        {
+                                v[i + 1] = radius * std::sin(angle);
+                        }
+                }
 
-        return res;
+                T v_length = length(v);
+                if (!(v_length > 0))
+                {
+                        return normal;
+                }
+                v /= v_length;
+        }
+
+        T v_length_square = sample[0];
+        v *= std::sqrt(v_length_square);
+
+        return sphere_implementation::hemisphere_vector(v, v_length_square, normal);
 }
 
 #if 0
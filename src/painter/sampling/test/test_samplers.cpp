@@ -25,7 +25,9 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "com/type/name.h"
 #include "painter/sampling/sampler.h"
 
+#include <algorithm>
 #include <cctype>
+#include <cmath>
 #include <fstream>
 #include <random>
 #include <string_view>
@@ -68,6 +70,20 @@ const std::string_view& sampler_name(const LatinHypercubeSampler<N, T>&)
         return s;
 }
 
+template <size_t N, typename T>
+const std::string_view& sampler_name(const SobolSampler<N, T>&)
+{
+        static constexpr std::string_view s = "Sobol Sampler";
+        return s;
+}
+
+template <size_t N, typename T>
+const std::string_view& sampler_name(const HaltonSampler<N, T>&)
+{
+        static constexpr std::string_view s = "Halton Sampler";
+        return s;
+}
+
 template <size_t N, typename T>
 const std::string_view& short_sampler_name(const StratifiedJitteredSampler<N, T>&)
 {
@@ -82,6 +98,20 @@ const std::string_view& short_sampler_name(const LatinHypercubeSampler<N, T>&)
         return s;
 }
 
+template <size_t N, typename T>
+const std::string_view& short_sampler_name(const SobolSampler<N, T>&)
+{
+        static constexpr std::string_view s = "sobol";
+        return s;
+}
+
+template <size_t N, typename T>
+const std::string_view& short_sampler_name(const HaltonSampler<N, T>&)
+{
+        static constexpr std::string_view s = "halton";
+        return s;
+}
+
 template <template <size_t, typename> typename S, size_t N, typename T>
 const std::string& sampler_file_name(const S<N, T>& sampler)
 {
@@ -132,6 +162,42 @@ void write_samples_to_file(RandomEngine& random_engine, const Sampler& sampler,
         }
 }
 
+// Квадратичная звёздная дискрепанция по формуле Уорнока
+template <size_t N, typename T>
+double l2_star_discrepancy(const std::vector<Vector<N, T>>& data)
+{
+        const double size = data.size();
+
+        double sum_1 = 0;
+        for (const Vector<N, T>& v : data)
+        {
+                double p = 1;
+                for (unsigned n = 0; n < N; ++n)
+                {
+                        p *= 1 - static_cast<double>(v[n]) * v[n];
+                }
+                sum_1 += p;
+        }
+
+        double sum_2 = 0;
+        for (const Vector<N, T>& v1 : data)
+        {
+                for (const Vector<N, T>& v2 : data)
+                {
+                        double p = 1;
+                        for (unsigned n = 0; n < N; ++n)
+                        {
+                                p *= 1 - static_cast<double>(std::max(v1[n], v2[n]));
+                        }
+                        sum_2 += p;
+                }
+        }
+
+        double d = std::pow(3.0, -static_cast<double>(N)) - std::pow(2.0, 1.0 - N) / size * sum_1 + sum_2 / (size * size);
+
+        return std::sqrt(std::max(0.0, d));
+}
+
 template <size_t N, typename T, typename Sampler, typename RandomEngine>
 void test_performance(RandomEngine& random_engine, const Sampler& sampler, int iter_count)
 {
@@ -144,8 +210,29 @@ void test_performance(RandomEngine& random_engine, const Sampler& sampler, int i
                 sampler.generate(random_engine, &data);
         }
 
-        LOG(std::string(sampler_name(sampler)) + ": time = " + to_string_fixed(time_in_seconds() - t, 5) +
-            " seconds, size = " + to_string(data.size()));
+        t = time_in_seconds() - t;
+
+        LOG(std::string(sampler_name(sampler)) + ": time = " + to_string_fixed(t, 5) + " seconds, size = " +
+            to_string(data.size()) + ", time per sample = " +
+            to_string_fixed(1e9 * t / (static_cast<double>(iter_count) * data.size()), 2) + " ns");
+}
+
+template <size_t N, typename T, typename Sampler, typename RandomEngine>
+void test_discrepancy(RandomEngine& random_engine, const Sampler& sampler, int iter_count)
+{
+        std::vector<Vector<N, T>> data;
+
+        double sum = 0;
+
+        for (int i = 0; i < iter_count; ++i)
+        {
+                sampler.generate(random_engine, &data);
+
+                sum += l2_star_discrepancy(data);
+        }
+
+        LOG(std::string(sampler_name(sampler)) + ": L2 star discrepancy = " + to_string_fixed(sum / iter_count, 6) +
+            ", size = " + to_string(data.size()));
 }
 
 template <size_t N, typename T, typename RandomEngine>
@@ -160,6 +247,8 @@ void write_samples_to_files()
         LOG("Writing samples " + to_string(N) + "D");
         write_samples_to_file<N, T>(random_engine, StratifiedJitteredSampler<N, T>(sample_count<N>()), tmp_dir, pass_count);
         write_samples_to_file<N, T>(random_engine, LatinHypercubeSampler<N, T>(sample_count<N>()), tmp_dir, pass_count);
+        write_samples_to_file<N, T>(random_engine, SobolSampler<N, T>(sample_count<N>()), tmp_dir, pass_count);
+        write_samples_to_file<N, T>(random_engine, HaltonSampler<N, T>(sample_count<N>()), tmp_dir, pass_count);
 }
 
 template <size_t N, typename T, typename RandomEngine>
@@ -172,6 +261,22 @@ void test_performance()
         LOG("Testing performance " + to_string(N) + "D");
         test_performance<N, T>(random_engine, StratifiedJitteredSampler<N, T>(sample_count<N>()), iter_count);
         test_performance<N, T>(random_engine, LatinHypercubeSampler<N, T>(sample_count<N>()), iter_count);
+        test_performance<N, T>(random_engine, SobolSampler<N, T>(sample_count<N>()), iter_count);
+        test_performance<N, T>(random_engine, HaltonSampler<N, T>(sample_count<N>()), iter_count);
+}
+
+template <size_t N, typename T, typename RandomEngine>
+void test_discrepancy()
+{
+        RandomEngineWithSeed<RandomEngine> random_engine;
+
+        constexpr int iter_count = 100;
+
+        LOG("Testing discrepancy " + to_string(N) + "D");
+        test_discrepancy<N, T>(random_engine, StratifiedJitteredSampler<N, T>(sample_count<N>()), iter_count);
+        test_discrepancy<N, T>(random_engine, LatinHypercubeSampler<N, T>(sample_count<N>()), iter_count);
+        test_discrepancy<N, T>(random_engine, SobolSampler<N, T>(sample_count<N>()), iter_count);
+        test_discrepancy<N, T>(random_engine, HaltonSampler<N, T>(sample_count<N>()), iter_count);
 }
 
 template <typename T, typename RandomEngine>
@@ -200,6 +305,20 @@ void test_performance()
         test_performance<6, T, RandomEngine>();
 }
 
+template <typename T, typename RandomEngine>
+void test_discrepancy()
+{
+        static_assert(std::is_floating_point_v<T>);
+
+        LOG(std::string("Discrepancy <") + type_name<T>() + ", " + random_engine_name<RandomEngine>() + ">");
+
+        test_discrepancy<2, T, RandomEngine>();
+        test_discrepancy<3, T, RandomEngine>();
+        test_discrepancy<4, T, RandomEngine>();
+        test_discrepancy<5, T, RandomEngine>();
+        test_discrepancy<6, T, RandomEngine>();
+}
+
 template <typename RandomEngine>
 void write_samples_to_files()
 {
@@ -223,6 +342,9 @@ void write_samples_to_files_and_test_performance()
 {
         write_samples_to_files<std::mt19937_64>();
 
+        LOG("");
+        test_discrepancy<double, std::mt19937_64>();
+
         LOG("");
         test_performance<float>();
         LOG("");
@@ -66,8 +66,8 @@ void normalize(Map* map)
         }
 }
 
-template <size_t N, typename T, typename RandomEngine>
-void test_distribution(int count, T discrepancy_limit)
+template <size_t N, typename T, typename RandomEngine, typename RandomVector>
+void test_distribution(int count, T discrepancy_limit, const RandomVector& random_vector_on_hemisphere)
 {
         LOG("Test Distribution...");
 
@@ -82,7 +82,7 @@ void test_distribution(int count, T discrepancy_limit)
 
         for (int i = 0; i < count; ++i)
         {
-                Vector<N, T> random_vector = normalize(random_cosine_weighted_on_hemisphere(random_engine, normal));
+                Vector<N, T> random_vector = normalize(random_vector_on_hemisphere(random_engine, normal));
 
                 T cosine;
 
@@ -122,8 +122,8 @@ void test_distribution(int count, T discrepancy_limit)
         }
 }
 
-template <size_t N, typename T, typename RandomEngine>
-void test_speed(int count)
+template <size_t N, typename T, typename RandomEngine, typename RandomVector>
+void test_speed(int count, const RandomVector& random_vector_on_hemisphere)
 {
         LOG("Test Speed...");
 
@@ -143,7 +143,7 @@ void test_speed(int count)
         Vector<N, T> sum(0);
         for (const Vector<N, T>& n : data)
         {
-                sum += random_cosine_weighted_on_hemisphere(random_engine, n);
+                sum += random_vector_on_hemisphere(random_engine, n);
         }
 
         LOG("Time = " + to_string_fixed(time_in_seconds() - start_time, 5) + " seconds, sum = " + to_string(component_sum(sum)));
@@ -154,9 +154,24 @@ void test_cosine_hemisphere(int count, T discrepancy_limit)
 {
         LOG("Test in " + space_name(N) + ", " + to_string_digit_groups(count) + ", " + type_name<T>());
 
-        test_distribution<N, T, RandomEngine>(count, discrepancy_limit);
+        const auto random = [](RandomEngine& random_engine, const Vector<N, T>& normal) {
+                return random_cosine_weighted_on_hemisphere(random_engine, normal);
+        };
+
+        test_distribution<N, T, RandomEngine>(count, discrepancy_limit, random);
+        test_speed<N, T, RandomEngine>(count, random);
+
+        LOG("Unit cube points");
+
+        // Точки единичного куба как у выборок пикселей
+        const auto from_sample = [](RandomEngine& random_engine, const Vector<N, T>& normal) {
+                std::uniform_real_distribution<T> urd(0, 1);
+                return cosine_weighted_on_hemisphere(
+                        random_vector<COSINE_WEIGHTED_ON_HEMISPHERE_SAMPLE_SIZE<N>, T>(random_engine, urd), normal);
+        };
 
-        test_speed<N, T, RandomEngine>(count);
+        test_distribution<N, T, RandomEngine>(count, discrepancy_limit, from_sample);
+        test_speed<N, T, RandomEngine>(count, from_sample);
 }
 
 template <typename T, typename RandomEngine>
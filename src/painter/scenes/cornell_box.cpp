@@ -18,6 +18,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "cornell_box.h"
 
 #include "com/color/colors.h"
+#include "com/error.h"
 #include "obj/alg/alg.h"
 #include "obj/file/file_load.h"
 #include "painter/visible_lights.h"
@@ -33,6 +34,7 @@ class CornellBoxScene : public PaintObjects<3, double>
         std::unique_ptr<VisiblePerspectiveProjector<3, double>> m_perspective_projector;
         std::unique_ptr<VisibleParallelProjector<3, double>> m_parallel_projector;
         std::unique_ptr<VisibleSphericalProjector<3, double>> m_spherical_projector;
+        ProjectorType m_projector_type;
         SurfaceProperties<3, double> m_default_surface_properties;
 
         std::unique_ptr<VisibleHyperplaneParallelotope<3, double>> m_rectangle_back;
@@ -64,9 +66,16 @@ class CornellBoxScene : public PaintObjects<3, double>
 
         const Projector<3, double>& projector() const override
         {
-                return *m_perspective_projector;
-                // return *m_parallel_projector;
-                // return *m_spherical_projector;
+                switch (m_projector_type)
+                {
+                case ProjectorType::Parallel:
+                        return *m_parallel_projector;
+                case ProjectorType::Perspective:
+                        return *m_perspective_projector;
+                case ProjectorType::Spherical:
+                        return *m_spherical_projector;
+                }
+                error_fatal("Unknown projector type");
         }
 
         const SurfaceProperties<3, double>& default_surface_properties() const override
@@ -81,14 +90,17 @@ class CornellBoxScene : public PaintObjects<3, double>
 
 public:
         CornellBoxScene(int width, int height, const std::string& obj_file_name, double size, const Color& default_color,
-                        double diffuse, const vec3& camera_direction, const vec3& camera_up);
+                        double diffuse, const vec3& camera_direction, const vec3& camera_up, ProjectorType projector_type);
 
         CornellBoxScene(int width, int height, const std::shared_ptr<const Mesh<3, double>>& mesh, double size,
-                        const Color& default_color, double diffuse, const vec3& camera_direction, const vec3& camera_up);
+                        const Color& default_color, double diffuse, const vec3& camera_direction, const vec3& camera_up,
+                        ProjectorType projector_type);
 };
 
 CornellBoxScene::CornellBoxScene(int width, int height, const std::string& obj_file_name, double size, const Color& default_color,
-                                 double diffuse, const vec3& camera_direction, const vec3& camera_up)
+                                 double diffuse, const vec3& camera_direction, const vec3& camera_up,
+                                 ProjectorType projector_type)
+        : m_projector_type(projector_type)
 {
         ProgressRatio progress(nullptr);
 
@@ -96,7 +108,8 @@ CornellBoxScene::CornellBoxScene(int width, int height, const std::string& obj_f
 
         mat4 vertex_matrix = model_vertex_matrix(*obj, size, vec3(0));
 
-        std::shared_ptr mesh = std::make_shared<Mesh<3, double>>(obj.get(), vertex_matrix, hardware_concurrency(), &progress);
+        std::shared_ptr mesh = std::make_shared<Mesh<3, double>>(obj.get(), vertex_matrix, hardware_concurrency(), &progress,
+                                                                 MeshAcceleration::SpatialSubdivisionTree);
 
         m_mesh = std::make_unique<VisibleSharedMesh<3, double>>(mesh);
 
@@ -104,7 +117,9 @@ CornellBoxScene::CornellBoxScene(int width, int height, const std::string& obj_f
 }
 
 CornellBoxScene::CornellBoxScene(int width, int height, const std::shared_ptr<const Mesh<3, double>>& mesh, double size,
-                                 const Color& default_color, double diffuse, const vec3& camera_direction, const vec3& camera_up)
+                                 const Color& default_color, double diffuse, const vec3& camera_direction, const vec3& camera_up,
+                                 ProjectorType projector_type)
+        : m_projector_type(projector_type)
 {
         m_mesh = std::make_unique<VisibleSharedMesh<3, double>>(mesh);
 
@@ -213,16 +228,19 @@ void CornellBoxScene::create_scene(int width, int height, double size, const Col
 
 std::unique_ptr<const PaintObjects<3, double>> cornell_box_scene(int width, int height, const std::string& obj_file_name,
                                                                  double size, const Color& default_color, double diffuse,
-                                                                 const vec3& camera_direction, const vec3& camera_up)
+                                                                 const vec3& camera_direction, const vec3& camera_up,
+                                                                 ProjectorType projector_type)
 {
         return std::make_unique<CornellBoxScene>(width, height, obj_file_name, size, default_color, diffuse, camera_direction,
-                                                 camera_up);
+                                                 camera_up, projector_type);
 }
 
 std::unique_ptr<const PaintObjects<3, double>> cornell_box_scene(int width, int height,
                                                                  const std::shared_ptr<const Mesh<3, double>>& mesh, double size,
                                                                  const Color& default_color, double diffuse,
-                                                                 const vec3& camera_direction, const vec3& camera_up)
+                                                                 const vec3& camera_direction, const vec3& camera_up,
+                                                                 ProjectorType projector_type)
 {
-        return std::make_unique<CornellBoxScene>(width, height, mesh, size, default_color, diffuse, camera_direction, camera_up);
+        return std::make_unique<CornellBoxScene>(width, height, mesh, size, default_color, diffuse, camera_direction, camera_up,
+                                                 projector_type);
 }
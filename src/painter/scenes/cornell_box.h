@@ -20,14 +20,17 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "com/color/color.h"
 #include "painter/objects.h"
 #include "painter/shapes/mesh.h"
+#include "painter/visible_projectors.h"
 
 #include <memory>
 
 std::unique_ptr<const PaintObjects<3, double>> cornell_box_scene(int width, int height, const std::string& obj_file_name,
                                                                  double size, const Color& default_color, double diffuse,
-                                                                 const vec3& camera_direction, const vec3& camera_up);
+                                                                 const vec3& camera_direction, const vec3& camera_up,
+                                                                 ProjectorType projector_type);
 
 std::unique_ptr<const PaintObjects<3, double>> cornell_box_scene(int width, int height,
                                                                  const std::shared_ptr<const Mesh<3, double>>& mesh, double size,
                                                                  const Color& default_color, double diffuse,
-                                                                 const vec3& camera_direction, const vec3& camera_up);
+                                                                 const vec3& camera_direction, const vec3& camera_up,
+                                                                 ProjectorType projector_type);
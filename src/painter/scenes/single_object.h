@@ -18,6 +18,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #pragma once
 
 #include "com/color/color.h"
+#include "com/math.h"
 #include "com/type/limit.h"
 #include "painter/objects.h"
 #include "painter/shapes/mesh.h"
@@ -102,6 +103,7 @@ std::unique_ptr<const PaintObjects<N, T>> single_object_scene(const Color& backg
 template <size_t N, typename T>
 std::unique_ptr<const PaintObjects<N, T>> single_object_scene(const Color& background_color, const Color& default_color,
                                                               Color::DataType diffuse, int min_screen_size, int max_screen_size,
+                                                              ProjectorType projector_type,
                                                               std::shared_ptr<const Mesh<N, T>> mesh)
 {
         LOG("Creating single object scene...");
@@ -160,8 +162,28 @@ std::unique_ptr<const PaintObjects<N, T>> single_object_scene(const Color& backg
 
         T units_per_pixel = max_projected_object_size / max_screen_size;
 
-        std::unique_ptr<const Projector<N, T>> projector = std::make_unique<const VisibleParallelProjector<N, T>>(
-                camera_position, camera_direction, screen_axes, units_per_pixel, screen_size);
+        // Для перспективной и сферической проекций угол обзора такой, чтобы на ближней
+        // к камере стороне объекта ширина экрана была как при параллельной проекции
+        T view_angle_degrees =
+                2 * std::atan(screen_size[0] * units_per_pixel / (2 * length(object_size))) * 180 / PI<T>;
+
+        std::unique_ptr<const Projector<N, T>> projector;
+        switch (projector_type)
+        {
+        case ProjectorType::Parallel:
+                projector = std::make_unique<const VisibleParallelProjector<N, T>>(
+                        camera_position, camera_direction, screen_axes, units_per_pixel, screen_size);
+                break;
+        case ProjectorType::Perspective:
+                projector = std::make_unique<const VisiblePerspectiveProjector<N, T>>(
+                        camera_position, camera_direction, screen_axes, view_angle_degrees, screen_size);
+                break;
+        case ProjectorType::Spherical:
+                projector = std::make_unique<const VisibleSphericalProjector<N, T>>(
+                        camera_position, camera_direction, screen_axes, view_angle_degrees, screen_size);
+                break;
+        }
+        ASSERT(projector);
 
         //
 
@@ -177,3 +199,12 @@ std::unique_ptr<const PaintObjects<N, T>> single_object_scene(const Color& backg
         return std::make_unique<impl::SingleObjectScene<N, T>>(background_color, default_color, diffuse, std::move(projector),
                                                                std::move(light_source), std::move(mesh));
 }
+
+template <size_t N, typename T>
+std::unique_ptr<const PaintObjects<N, T>> single_object_scene(const Color& background_color, const Color& default_color,
+                                                              Color::DataType diffuse, int min_screen_size, int max_screen_size,
+                                                              std::shared_ptr<const Mesh<N, T>> mesh)
+{
+        return single_object_scene(background_color, default_color, diffuse, min_screen_size, max_screen_size,
+                                   ProjectorType::Parallel, std::move(mesh));
+}
@@ -19,11 +19,12 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "com/log.h"
 #include "com/matrix_alg.h"
+#include "com/thread.h"
 #include "com/time.h"
 #include "com/type/limit.h"
 #include "com/vec.h"
+#include "obj/alg/alg.h"
 #include "painter/space/hyperplane_simplex_wrapper.h"
-#include "painter/space/ray_intersection.h"
 
 #include <algorithm>
 #include <utility>
@@ -32,6 +33,15 @@ namespace
 {
 constexpr int TREE_MIN_OBJECTS_PER_BOX = 10;
 
+// Наибольшее количество граней в листе иерархии, но не меньше двух пакетов граней
+constexpr int BVH_MAX_OBJECTS_PER_LEAF = 8;
+
+// Количество граней, при котором лист k-d дерева не делится, но не меньше пакета граней
+constexpr int KD_TREE_MAX_OBJECTS_PER_LEAF = 4;
+
+// Максимальное количество прочитанных, но ещё не обработанных частей объекта
+constexpr int OBJ_CHUNK_QUEUE_SIZE = 4;
+
 template <size_t N>
 int tree_max_depth()
 {
@@ -56,6 +66,170 @@ int tree_max_depth()
                 return std::max(2.0, std::floor(n));
         }
 }
+
+template <size_t N>
+struct ObjChunk
+{
+        std::vector<Vector<N, float>> vertices;
+        std::vector<Vector<N, float>> normals;
+        std::vector<Vector<N - 1, float>> texcoords;
+        std::vector<typename Obj<N>::Facet> facets;
+        std::vector<typename Obj<N>::Material> materials;
+        std::vector<typename Obj<N>::Image> images;
+};
+
+template <size_t N>
+class ObjChunkQueue final : public ObjConsumer<N>
+{
+        ThreadBoundedQueue<ObjChunk<N>>* m_queue;
+
+        void push(ObjChunk<N>&& chunk)
+        {
+                if (!m_queue->push(std::move(chunk)))
+                {
+                        // Очередь закрыта при ошибке создания объекта
+                        throw_terminate_quietly_exception();
+                }
+        }
+
+public:
+        ObjChunkQueue(ThreadBoundedQueue<ObjChunk<N>>* queue) : m_queue(queue)
+        {
+        }
+
+        void obj_geometry(std::vector<Vector<N, float>>&& vertices, std::vector<Vector<N, float>>&& normals,
+                          std::vector<Vector<N - 1, float>>&& texcoords,
+                          std::vector<typename Obj<N>::Facet>&& facets) override
+        {
+                ObjChunk<N> chunk;
+                chunk.vertices = std::move(vertices);
+                chunk.normals = std::move(normals);
+                chunk.texcoords = std::move(texcoords);
+                chunk.facets = std::move(facets);
+                push(std::move(chunk));
+        }
+
+        void obj_materials(std::vector<typename Obj<N>::Material>&& materials,
+                           std::vector<typename Obj<N>::Image>&& images) override
+        {
+                ObjChunk<N> chunk;
+                chunk.materials = std::move(materials);
+                chunk.images = std::move(images);
+                push(std::move(chunk));
+        }
+};
+
+// Индексы могут ссылаться на ещё не полученные данные.
+// Отрицательные индексы проверяются функцией check_facet_indices.
+template <size_t N>
+bool facet_indices_are_available(const typename Obj<N>::Facet& facet, int vertex_count, int normal_count, int texcoord_count)
+{
+        for (unsigned i = 0; i < N; ++i)
+        {
+                if (facet.vertices[i] >= vertex_count || (facet.has_normal && facet.normals[i] >= normal_count) ||
+                    (facet.has_texcoord && facet.texcoords[i] >= texcoord_count))
+                {
+                        return false;
+                }
+        }
+        return true;
+}
+}
+
+template <size_t N, typename T>
+void Mesh<N, T>::add_facet(const typename Obj<N>::Facet& facet)
+{
+        m_facets.emplace_back(m_vertices, m_normals, m_texcoords, facet.vertices, facet.has_normal, facet.normals,
+                              facet.has_texcoord, facet.texcoords, facet.material);
+
+        for (int index : facet.vertices)
+        {
+                m_min = min_vector(m_min, m_vertices[index]);
+                m_max = max_vector(m_max, m_vertices[index]);
+        }
+}
+
+template <size_t N, typename T>
+void Mesh<N, T>::set_materials_and_images(const std::vector<typename Obj<N>::Material>& materials,
+                                          const std::vector<typename Obj<N>::Image>& images)
+{
+        m_materials.reserve(materials.size());
+        for (const typename Obj<N>::Material& m : materials)
+        {
+                m_materials.emplace_back(m.Kd, m.Ks, m.Ns, m.map_Kd, m.map_Ks);
+        }
+
+        m_images.reserve(images.size());
+        for (const typename Obj<N>::Image& image : images)
+        {
+                m_images.emplace_back(image.size, image.srgba_pixels);
+        }
+}
+
+template <size_t N, typename T>
+void Mesh<N, T>::create_tree(unsigned thread_count, ProgressRatio* progress)
+{
+        if (m_acceleration == MeshAcceleration::BoundingVolumeHierarchy)
+        {
+                progress->set_text("BVH: %v of %m");
+
+                // Указатель на объект иерархии
+                auto lambda_facet = [&f = std::as_const(m_facets)](int facet_index) { return &f[facet_index]; };
+
+                const int packet_size = m_facet_packets.packet_size();
+                m_bvh.decompose(std::max(BVH_MAX_OBJECTS_PER_LEAF, 2 * packet_size), packet_size, m_facets.size(), lambda_facet,
+                                thread_count, progress);
+
+                m_facet_packets.set_data(m_facets, m_bvh);
+
+                return;
+        }
+
+        if (m_acceleration == MeshAcceleration::KdTree)
+        {
+                progress->set_text("k-d tree: %v of %m");
+
+                std::vector<HyperplaneSimplexWrapperForShapeIntersection<Facet>> simplex_wrappers;
+                simplex_wrappers.reserve(m_facets.size());
+                for (const Facet& t : m_facets)
+                {
+                        simplex_wrappers.emplace_back(t);
+                }
+
+                // Указатель на объект дерева
+                auto lambda_simplex = [&w = std::as_const(simplex_wrappers)](int simplex_index) { return &w[simplex_index]; };
+
+                const int packet_size = m_facet_packets.packet_size();
+                m_kd_tree.decompose(std::max(KD_TREE_MAX_OBJECTS_PER_LEAF, packet_size), packet_size, m_facets.size(),
+                                    lambda_simplex, thread_count, progress);
+
+                LOG("k-d tree: " + to_string(m_kd_tree.node_count()) + " nodes, " +
+                    to_string(m_kd_tree.object_indices().size()) + " facet references for " + to_string(m_facets.size()) +
+                    " facets");
+
+                m_facet_packets.set_data(m_facets, m_kd_tree);
+
+                return;
+        }
+
+        progress->set_text(to_string(1 << N) + "-tree: %v of %m");
+
+        std::vector<HyperplaneSimplexWrapperForShapeIntersection<Facet>> simplex_wrappers;
+        simplex_wrappers.reserve(m_facets.size());
+        for (const Facet& t : m_facets)
+        {
+                simplex_wrappers.emplace_back(t);
+        }
+
+        // Указатель на объект дерева
+        auto lambda_simplex = [w = std::as_const(simplex_wrappers)](int simplex_index) { return &(w[simplex_index]); };
+
+        m_tree.decompose(tree_max_depth<N>(), TREE_MIN_OBJECTS_PER_BOX, m_facets.size(), lambda_simplex, thread_count, progress);
+
+        LOG(to_string(1 << N) + "-tree: " + to_string(m_tree.box_count()) + " boxes, " +
+            to_string(m_tree.box_memory_size()) + " bytes per box, " + to_string(m_tree.memory_size()) + " bytes");
+
+        m_facet_packets.set_data(m_facets, m_tree);
 }
 
 template <size_t N, typename T>
@@ -87,45 +261,156 @@ void Mesh<N, T>::create_mesh_object(const Obj<N>* obj, const Matrix<N + 1, N + 1
         m_facets.reserve(obj->facets().size());
         for (const typename Obj<N>::Facet& facet : obj->facets())
         {
-                m_facets.emplace_back(m_vertices, m_normals, m_texcoords, facet.vertices, facet.has_normal, facet.normals,
-                                      facet.has_texcoord, facet.texcoords, facet.material);
+                add_facet(facet);
+        }
+
+        set_materials_and_images(obj->materials(), obj->images());
+
+        create_tree(thread_count, progress);
+}
+
+// Грани создаются по мере получения частей объекта. Грани, ссылающиеся
+// на ещё не полученные вершины, нормали или текстурные координаты,
+// создаются после получения всех частей. Индексы граней проверяются
+// и трёхмерные грани с вершинами на одной прямой пропускаются так же,
+// как при чтении в объект Obj.
+template <size_t N, typename T>
+void Mesh<N, T>::create_mesh_object(const std::function<void(ObjConsumer<N>*)>& load,
+                                    const Matrix<N + 1, N + 1, T>& vertex_matrix, unsigned thread_count,
+                                    ProgressRatio* progress)
+{
+        const MatrixMulVector<N + 1, T> mul_vertex(vertex_matrix);
+
+        ThreadBoundedQueue<ObjChunk<N>> queue(OBJ_CHUNK_QUEUE_SIZE);
 
-                for (int index : facet.vertices)
+        ThreadsWithCatch threads(1);
+        threads.add([&]() {
+                ObjChunkQueue<N> consumer(&queue);
+                try
                 {
-                        m_min = min_vector(m_min, m_vertices[index]);
-                        m_max = max_vector(m_max, m_vertices[index]);
+                        load(&consumer);
+                }
+                catch (...)
+                {
+                        queue.close();
+                        throw;
+                }
+                queue.close();
+        });
+
+        m_min = Vector<N, T>(limits<T>::max());
+        m_max = Vector<N, T>(limits<T>::lowest());
+
+        std::vector<typename Obj<N>::Facet> deferred_facets;
+        std::vector<typename Obj<N>::Material> materials;
+        std::vector<typename Obj<N>::Image> images;
+        long long degenerate_facet_count = 0;
+
+        // Вершины до преобразования для проверки граней по тем же данным,
+        // что и при чтении в объект Obj
+        std::vector<Vector<N, float>> obj_vertices;
+
+        auto add = [&](const typename Obj<N>::Facet& facet) {
+                check_facet_indices<N>(facet, m_vertices.size(), m_normals.size(), m_texcoords.size());
+
+                if constexpr (N == 3)
+                {
+                        if (!facet_dimension_is_correct(obj_vertices, facet.vertices))
+                        {
+                                ++degenerate_facet_count;
+                                return;
+                        }
+                }
+
+                add_facet(facet);
+        };
+
+        try
+        {
+                while (std::optional<ObjChunk<N>> chunk = queue.pop())
+                {
+                        for (const Vector<N, float>& v : chunk->vertices)
+                        {
+                                m_vertices.push_back(mul_vertex(to_vector<T>(v)));
+                        }
+                        if constexpr (N == 3)
+                        {
+                                obj_vertices.insert(obj_vertices.end(), chunk->vertices.cbegin(), chunk->vertices.cend());
+                        }
+                        for (const Vector<N, float>& v : chunk->normals)
+                        {
+                                m_normals.push_back(to_vector<T>(v));
+                        }
+                        for (const Vector<N - 1, float>& v : chunk->texcoords)
+                        {
+                                m_texcoords.push_back(to_vector<T>(v));
+                        }
+
+                        for (const typename Obj<N>::Facet& facet : chunk->facets)
+                        {
+                                if (facet_indices_are_available<N>(facet, m_vertices.size(), m_normals.size(),
+                                                                   m_texcoords.size()))
+                                {
+                                        add(facet);
+                                }
+                                else
+                                {
+                                        deferred_facets.push_back(facet);
+                                }
+                        }
+
+                        if (!chunk->materials.empty() || !chunk->images.empty())
+                        {
+                                materials = std::move(chunk->materials);
+                                images = std::move(chunk->images);
+                        }
                 }
         }
+        catch (...)
+        {
+                queue.close();
+                threads.join();
+                throw;
+        }
+
+        threads.join();
 
-        m_materials.reserve(obj->materials().size());
-        for (const typename Obj<N>::Material& m : obj->materials())
+        for (const typename Obj<N>::Facet& facet : deferred_facets)
         {
-                m_materials.emplace_back(m.Kd, m.Ks, m.Ns, m.map_Kd, m.map_Ks);
+                add(facet);
         }
 
-        m_images.reserve(obj->images().size());
-        for (const typename Obj<N>::Image& image : obj->images())
+        obj_vertices = std::vector<Vector<N, float>>();
+
+        if (m_vertices.size() == 0)
         {
-                m_images.emplace_back(image.size, image.srgba_pixels);
+                error("No vertices found in obj");
         }
 
-        progress->set_text(to_string(1 << N) + "-tree: %v of %m");
+        if (m_facets.size() == 0)
+        {
+                error("No facets found in obj");
+        }
 
-        std::vector<HyperplaneSimplexWrapperForShapeIntersection<Facet>> simplex_wrappers;
-        simplex_wrappers.reserve(m_facets.size());
-        for (const Facet& t : m_facets)
+        if (degenerate_facet_count > 0)
         {
-                simplex_wrappers.emplace_back(t);
+                LOG("Degenerate facets skipped: " + to_string(degenerate_facet_count));
         }
 
-        // Указатель на объект дерева
-        auto lambda_simplex = [w = std::as_const(simplex_wrappers)](int simplex_index) { return &(w[simplex_index]); };
+        m_vertices.shrink_to_fit();
+        m_normals.shrink_to_fit();
+        m_texcoords.shrink_to_fit();
+        m_facets.shrink_to_fit();
 
-        m_tree.decompose(tree_max_depth<N>(), TREE_MIN_OBJECTS_PER_BOX, m_facets.size(), lambda_simplex, thread_count, progress);
+        set_materials_and_images(materials, images);
+
+        create_tree(thread_count, progress);
 }
 
 template <size_t N, typename T>
-Mesh<N, T>::Mesh(const Obj<N>* obj, const Matrix<N + 1, N + 1, T>& vertex_matrix, unsigned thread_count, ProgressRatio* progress)
+Mesh<N, T>::Mesh(const Obj<N>* obj, const Matrix<N + 1, N + 1, T>& vertex_matrix, unsigned thread_count, ProgressRatio* progress,
+                 MeshAcceleration acceleration)
+        : m_acceleration(acceleration)
 {
         double start_time = time_in_seconds();
 
@@ -134,9 +419,31 @@ Mesh<N, T>::Mesh(const Obj<N>* obj, const Matrix<N + 1, N + 1, T>& vertex_matrix
         LOG("Mesh object created, " + to_string_fixed(time_in_seconds() - start_time, 5) + " s");
 }
 
+template <size_t N, typename T>
+Mesh<N, T>::Mesh(const std::function<void(ObjConsumer<N>*)>& load, const Matrix<N + 1, N + 1, T>& vertex_matrix,
+                 unsigned thread_count, ProgressRatio* progress, MeshAcceleration acceleration)
+        : m_acceleration(acceleration)
+{
+        double start_time = time_in_seconds();
+
+        create_mesh_object(load, vertex_matrix, thread_count, progress);
+
+        LOG("Mesh object created, " + to_string_fixed(time_in_seconds() - start_time, 5) + " s");
+}
+
 template <size_t N, typename T>
 bool Mesh<N, T>::intersect_approximate(const Ray<N, T>& r, T* t) const
 {
+        if (m_acceleration == MeshAcceleration::BoundingVolumeHierarchy)
+        {
+                return m_bvh.intersect_root(r, t);
+        }
+
+        if (m_acceleration == MeshAcceleration::KdTree)
+        {
+                return m_kd_tree.intersect_root(r, t);
+        }
+
         return m_tree.intersect_root(r, t);
 }
 
@@ -145,11 +452,45 @@ bool Mesh<N, T>::intersect_precise(const Ray<N, T>& ray, T approximate_t, T* t,
 {
         const Facet* facet = nullptr;
 
+        // Ближайшее пересечение луча с гранями листа
+        const auto find_intersection = [&](const Span<const int>& facet_indices, T max_t, T* leaf_t) -> bool {
+                int facet_index;
+                if (m_facet_packets.intersect(facet_indices, ray, max_t, leaf_t, &facet_index))
+                {
+                        facet = &m_facets[facet_index];
+                        *t = *leaf_t;
+                        return true;
+                }
+                return false;
+        };
+
+        if (m_acceleration == MeshAcceleration::BoundingVolumeHierarchy)
+        {
+                if (m_bvh.trace_ray(ray, find_intersection))
+                {
+                        *intersection_data = facet;
+                        return true;
+                }
+                return false;
+        }
+
+        if (m_acceleration == MeshAcceleration::KdTree)
+        {
+                if (m_kd_tree.trace_ray(ray, find_intersection))
+                {
+                        *intersection_data = facet;
+                        return true;
+                }
+                return false;
+        }
+
         if (m_tree.trace_ray(ray, approximate_t,
                              // Пересечение луча с набором граней ячейки дерева
-                             [&](const std::vector<int>& facet_indices, Vector<N, T>* point) -> bool {
-                                     if (ray_intersection(m_facets, facet_indices, ray, t, &facet))
+                             [&](const Span<const int>& facet_indices, Vector<N, T>* point) -> bool {
+                                     int facet_index;
+                                     if (m_facet_packets.intersect(facet_indices, ray, limits<T>::max(), t, &facet_index))
                                      {
+                                             facet = &m_facets[facet_index];
                                              *point = ray.point(*t);
                                              return true;
                                      }
@@ -165,6 +506,71 @@ bool Mesh<N, T>::intersect_precise(const Ray<N, T>& ray, T approximate_t, T* t,
         }
 }
 
+template <size_t N, typename T>
+typename RayPacket<N, T>::Mask Mesh<N, T>::intersect_packet(const RayPacket<N, T>& packet, typename RayPacket<N, T>::Mask mask,
+                                                            T* t, const void** intersection_data) const
+{
+        using Packet = RayPacket<N, T>;
+
+        typename Packet::Mask found = 0;
+
+        // Ближайшие пересечения лучей пакета с гранями листа
+        const auto find_intersections = [&](const Span<const int>& facet_indices, typename Packet::Mask leaf_mask) {
+                for (int i = 0; i < packet.size(); ++i)
+                {
+                        int facet_index;
+                        if (Packet::contains(leaf_mask, i) &&
+                            m_facet_packets.intersect(facet_indices, packet.ray(i), t[i], &t[i], &facet_index))
+                        {
+                                intersection_data[i] = &m_facets[facet_index];
+                                found |= Packet::ray_mask(i);
+                        }
+                }
+        };
+
+        if (m_acceleration == MeshAcceleration::BoundingVolumeHierarchy)
+        {
+                m_bvh.trace_packet(packet, mask, t, find_intersections);
+        }
+        else if (m_acceleration == MeshAcceleration::KdTree)
+        {
+                m_kd_tree.trace_packet(packet, mask, t, find_intersections);
+        }
+        else
+        {
+                m_tree.trace_packet(packet, mask, t, find_intersections);
+        }
+
+        return found;
+}
+
+template <size_t N, typename T>
+bool Mesh<N, T>::occluded(const Ray<N, T>& ray, T max_distance) const
+{
+        // Есть ли пересечение с гранями ячейки на расстоянии меньше max_distance
+        const auto any_intersection = [&](const Span<const int>& facet_indices) -> bool {
+                return m_facet_packets.intersect_any(facet_indices, ray, max_distance);
+        };
+
+        if (m_acceleration == MeshAcceleration::BoundingVolumeHierarchy)
+        {
+                return m_bvh.occluded(ray, max_distance, any_intersection);
+        }
+
+        if (m_acceleration == MeshAcceleration::KdTree)
+        {
+                return m_kd_tree.occluded(ray, max_distance, any_intersection);
+        }
+
+        T root_t;
+        if (!m_tree.intersect_root(ray, &root_t))
+        {
+                return false;
+        }
+
+        return m_tree.occluded(ray, root_t, max_distance, any_intersection);
+}
+
 template <size_t N, typename T>
 Vector<N, T> Mesh<N, T>::geometric_normal(const void* intersection_data) const
 {
@@ -20,15 +20,54 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "mesh_hyperplane_simplex.h"
 
 #include "com/color/color.h"
+#include "com/error.h"
 #include "com/matrix.h"
 #include "obj/obj.h"
 #include "painter/image/image.h"
+#include "painter/space/bounding_volume_hierarchy.h"
+#include "painter/space/hyperplane_simplex_packets.h"
+#include "painter/space/kd_tree.h"
 #include "painter/space/parallelotope_ortho.h"
+#include "painter/space/ray_packet.h"
 #include "painter/space/tree.h"
 #include "progress/progress.h"
 
+#include <functional>
 #include <optional>
 
+// Структура для поиска пересечений лучей с гранями
+enum class MeshAcceleration
+{
+        // Дерево деления пространства на 2^N частей
+        SpatialSubdivisionTree,
+        // Иерархия ограничивающих параллелотопов, построенная с оценкой по площади поверхности
+        BoundingVolumeHierarchy,
+        // Двоичное дерево деления пространства плоскостями
+        KdTree
+};
+
+// При большом количестве измерений у вершин дерева деления пространства
+// на 2^N частей слишком много потомков, а глубина дерева сильно ограничена
+template <size_t N>
+constexpr MeshAcceleration default_mesh_acceleration()
+{
+        return (N >= 5) ? MeshAcceleration::KdTree : MeshAcceleration::SpatialSubdivisionTree;
+}
+
+inline const char* mesh_acceleration_name(MeshAcceleration acceleration)
+{
+        switch (acceleration)
+        {
+        case MeshAcceleration::SpatialSubdivisionTree:
+                return "spatial subdivision tree";
+        case MeshAcceleration::BoundingVolumeHierarchy:
+                return "bounding volume hierarchy";
+        case MeshAcceleration::KdTree:
+                return "k-d tree";
+        }
+        error_fatal("Unknown mesh acceleration");
+}
+
 template <size_t N, typename T>
 class Mesh
 {
@@ -55,15 +94,34 @@ class Mesh
 
         std::vector<Facet> m_facets;
 
+        MeshAcceleration m_acceleration;
         SpatialSubdivisionTree<TreeParallelotope> m_tree;
+        BoundingVolumeHierarchy<N, T> m_bvh;
+        KdTree<N, T> m_kd_tree;
+
+        // Копия граней в порядке листьев структуры поиска пересечений
+        HyperplaneSimplexPackets<N, T> m_facet_packets;
 
         Vector<N, T> m_min, m_max;
 
+        void add_facet(const typename Obj<N>::Facet& facet);
+        void set_materials_and_images(const std::vector<typename Obj<N>::Material>& materials,
+                                      const std::vector<typename Obj<N>::Image>& images);
+        void create_tree(unsigned thread_count, ProgressRatio* progress);
+
         void create_mesh_object(const Obj<N>* obj, const Matrix<N + 1, N + 1, T>& vertex_matrix, unsigned thread_count,
                                 ProgressRatio* progress);
+        void create_mesh_object(const std::function<void(ObjConsumer<N>*)>& load, const Matrix<N + 1, N + 1, T>& vertex_matrix,
+                                unsigned thread_count, ProgressRatio* progress);
 
 public:
-        Mesh(const Obj<N>* obj, const Matrix<N + 1, N + 1, T>& vertex_matrix, unsigned thread_count, ProgressRatio* progress);
+        Mesh(const Obj<N>* obj, const Matrix<N + 1, N + 1, T>& vertex_matrix, unsigned thread_count, ProgressRatio* progress,
+             MeshAcceleration acceleration);
+
+        // Функция load передаёт данные объекта частями, а грани создаются
+        // в этом потоке одновременно с чтением следующих частей
+        Mesh(const std::function<void(ObjConsumer<N>*)>& load, const Matrix<N + 1, N + 1, T>& vertex_matrix,
+             unsigned thread_count, ProgressRatio* progress, MeshAcceleration acceleration);
 
         ~Mesh() = default;
 
@@ -78,6 +136,16 @@ public:
         bool intersect_approximate(const Ray<N, T>& r, T* t) const;
         bool intersect_precise(const Ray<N, T>&, T approximate_t, T* t, const void** intersection_data) const;
 
+        // Ближайшие пересечения лучей пакета из маски с гранями на расстояниях меньше t[i].
+        // Для найденных пересечений изменяются t[i] и intersection_data[i].
+        // Возвращается маска лучей, для которых найдены пересечения.
+        typename RayPacket<N, T>::Mask intersect_packet(const RayPacket<N, T>& packet, typename RayPacket<N, T>::Mask mask,
+                                                        T* t, const void** intersection_data) const;
+
+        // Есть ли пересечение с гранями на расстоянии меньше max_distance.
+        // Поиск прекращается при первом найденном пересечении.
+        bool occluded(const Ray<N, T>& ray, T max_distance) const;
+
         Vector<N, T> geometric_normal(const void* intersection_data) const;
         Vector<N, T> shading_normal(const Vector<N, T>& p, const void* intersection_data) const;
 
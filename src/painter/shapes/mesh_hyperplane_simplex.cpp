@@ -218,6 +218,12 @@ std::array<Vector<N, T>, N> MeshHyperplaneSimplex<N, T>::vertices() const
         return vertices_to_array(m_vertices, m_v);
 }
 
+template <size_t N, typename T>
+const HyperplaneSimplexGeometry<N, T>& MeshHyperplaneSimplex<N, T>::geometry() const
+{
+        return m_geometry;
+}
+
 template <size_t N, typename T>
 void MeshHyperplaneSimplex<N, T>::constraints(std::array<Constraint<N, T>, N>* c, Constraint<N, T>* c_eq) const
 {
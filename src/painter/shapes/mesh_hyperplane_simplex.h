@@ -75,5 +75,7 @@ public:
 
         std::array<Vector<N, T>, N> vertices() const;
 
+        const HyperplaneSimplexGeometry<N, T>& geometry() const;
+
         void constraints(std::array<Constraint<N, T>, N>* c, Constraint<N, T>* c_eq) const;
 };
@@ -86,7 +86,7 @@ void create_spherical_convex_hull(const Vector<N, float>& center, float radius,
 
 template <size_t N, typename T>
 std::unique_ptr<const Mesh<N, T>> simplex_mesh_of_sphere(const Vector<N, float>& center, float radius, int point_count,
-                                                         int thread_count, ProgressRatio* progress)
+                                                         int thread_count, ProgressRatio* progress, MeshAcceleration acceleration)
 {
         std::vector<Vector<N, float>> points;
         std::vector<std::array<int, N>> facets;
@@ -105,12 +105,13 @@ std::unique_ptr<const Mesh<N, T>> simplex_mesh_of_sphere(const Vector<N, float>&
 
         constexpr Matrix<N + 1, N + 1, T> matrix(1);
 
-        return std::make_unique<const Mesh<N, T>>(obj.get(), matrix, thread_count, progress);
+        return std::make_unique<const Mesh<N, T>>(obj.get(), matrix, thread_count, progress, acceleration);
 }
 }
 
 template <size_t N, typename T>
-std::unique_ptr<const Mesh<N, T>> simplex_mesh_of_random_sphere(int point_count, int thread_count, ProgressRatio* progress)
+std::unique_ptr<const Mesh<N, T>> simplex_mesh_of_random_sphere(int point_count, int thread_count, ProgressRatio* progress,
+                                                                MeshAcceleration acceleration)
 {
         static_assert(N >= 3 && N <= 6);
         static_assert(std::is_same_v<T, float> || std::is_same_v<T, double>);
@@ -138,23 +139,31 @@ std::unique_ptr<const Mesh<N, T>> simplex_mesh_of_random_sphere(int point_count,
         LOG("mesh radius = " + to_string(radius));
         LOG("mesh center = " + to_string(center));
 
-        return simplex_mesh_of_sphere<N, T>(center, radius, point_count, thread_count, progress);
+        return simplex_mesh_of_sphere<N, T>(center, radius, point_count, thread_count, progress, acceleration);
 }
 
 template std::unique_ptr<const Mesh<3, float>> simplex_mesh_of_random_sphere(int point_count, int thread_count,
-                                                                             ProgressRatio* progress);
+                                                                              ProgressRatio* progress,
+                                                                              MeshAcceleration acceleration);
 template std::unique_ptr<const Mesh<4, float>> simplex_mesh_of_random_sphere(int point_count, int thread_count,
-                                                                             ProgressRatio* progress);
+                                                                              ProgressRatio* progress,
+                                                                              MeshAcceleration acceleration);
 template std::unique_ptr<const Mesh<5, float>> simplex_mesh_of_random_sphere(int point_count, int thread_count,
-                                                                             ProgressRatio* progress);
+                                                                              ProgressRatio* progress,
+                                                                              MeshAcceleration acceleration);
 template std::unique_ptr<const Mesh<6, float>> simplex_mesh_of_random_sphere(int point_count, int thread_count,
-                                                                             ProgressRatio* progress);
+                                                                              ProgressRatio* progress,
+                                                                              MeshAcceleration acceleration);
 
 template std::unique_ptr<const Mesh<3, double>> simplex_mesh_of_random_sphere(int point_count, int thread_count,
-                                                                              ProgressRatio* progress);
+                                                                               ProgressRatio* progress,
+                                                                               MeshAcceleration acceleration);
 template std::unique_ptr<const Mesh<4, double>> simplex_mesh_of_random_sphere(int point_count, int thread_count,
-                                                                              ProgressRatio* progress);
+                                                                               ProgressRatio* progress,
+                                                                               MeshAcceleration acceleration);
 template std::unique_ptr<const Mesh<5, double>> simplex_mesh_of_random_sphere(int point_count, int thread_count,
-                                                                              ProgressRatio* progress);
+                                                                               ProgressRatio* progress,
+                                                                               MeshAcceleration acceleration);
 template std::unique_ptr<const Mesh<6, double>> simplex_mesh_of_random_sphere(int point_count, int thread_count,
-                                                                              ProgressRatio* progress);
+                                                                               ProgressRatio* progress,
+                                                                               MeshAcceleration acceleration);
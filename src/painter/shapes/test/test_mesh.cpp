@@ -22,14 +22,24 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "com/names.h"
 #include "com/print.h"
 #include "com/random/engine.h"
+#include "com/span.h"
 #include "com/time.h"
 #include "com/type/limit.h"
 #include "com/type/name.h"
 #include "com/vec.h"
 #include "painter/sampling/sphere.h"
+#include "painter/shapes/mesh_hyperplane_simplex.h"
 #include "painter/shapes/test/sphere_mesh.h"
-
+#include "painter/space/hyperplane_simplex_packets.h"
+#include "painter/space/hyperplane_simplex_wrapper.h"
+#include "painter/space/parallelotope_ortho.h"
+#include "painter/space/ray_packet.h"
+#include "painter/space/tree.h"
+
+#include <algorithm>
+#include <array>
 #include <random>
+#include <utility>
 #include <vector>
 
 namespace
@@ -221,6 +231,350 @@ void test_sphere_mesh(const Mesh<N, T>& mesh, int ray_count, bool with_ray_log,
                 error("Too many errors");
         }
 }
+
+// Пересечения пакетов лучей должны совпадать с пересечениями отдельных лучей
+template <size_t N, typename T>
+void test_sphere_mesh_packets(const Mesh<N, T>& mesh, int ray_count)
+{
+        T ray_offset;
+        std::vector<Ray<N, T>> rays;
+
+        offset_and_rays_for_sphere_mesh(mesh, ray_count, &ray_offset, &rays);
+
+        LOG("packet intersections...");
+
+        const T precision = 100 * limits<T>::epsilon();
+
+        RayPacket<N, T> packet;
+        std::array<T, RayPacket<N, T>::MAX_SIZE> t;
+        std::array<const void*, RayPacket<N, T>::MAX_SIZE> intersection_data;
+
+        int error_count = 0;
+
+        for (size_t first = 0; first < rays.size(); first += RayPacket<N, T>::MAX_SIZE)
+        {
+                const size_t last = std::min(rays.size(), first + RayPacket<N, T>::MAX_SIZE);
+
+                packet.clear();
+                for (size_t i = first; i < last; ++i)
+                {
+                        packet.add(rays[i]);
+                        t[i - first] = limits<T>::max();
+                }
+
+                typename RayPacket<N, T>::Mask found =
+                        mesh.intersect_packet(packet, packet.mask(), t.data(), intersection_data.data());
+
+                for (int i = 0; i < packet.size(); ++i)
+                {
+                        T approximate, precise;
+                        const void* data;
+
+                        bool hit = mesh.intersect_approximate(packet.ray(i), &approximate) &&
+                                   mesh.intersect_precise(packet.ray(i), approximate, &precise, &data);
+
+                        if (hit != RayPacket<N, T>::contains(found, i) ||
+                            (hit && std::abs(precise - t[i]) > precision * std::max(T(1), std::abs(precise))))
+                        {
+                                ++error_count;
+                        }
+                }
+        }
+
+        // Пакеты обходят деревья не так, как отдельные лучи, поэтому допускаются
+        // расхождения в том же количестве, что и ошибки отдельных лучей
+        double error_percent = 100.0 * error_count / rays.size();
+
+        LOG(to_string(error_count) + " packet errors, " + to_string(rays.size()) + " rays, " +
+            to_string_fixed(error_percent, 5) + "%");
+        LOG("");
+
+        if (error_percent > 0.05)
+        {
+                error("Too many packet intersection errors");
+        }
+}
+
+// Случайные грани около поверхности единичной сферы
+template <size_t N, typename T>
+class RandomSimplices
+{
+        static constexpr T SIZE = 0.2;
+
+        std::vector<Vector<N, T>> m_vertices;
+        const std::vector<Vector<N, T>> m_normals;
+        const std::vector<Vector<N - 1, T>> m_texcoords;
+        std::vector<MeshHyperplaneSimplex<N, T>> m_simplices;
+
+        template <typename RandomEngine>
+        static Vector<N, T> random_vector_in_sphere(RandomEngine& random_engine)
+        {
+                Vector<N, T> v;
+                T length_square;
+                random_in_sphere(random_engine, v, length_square);
+                return v;
+        }
+
+public:
+        template <typename RandomEngine>
+        RandomSimplices(int count, RandomEngine& random_engine)
+        {
+                m_vertices.reserve(static_cast<size_t>(count) * N);
+                m_simplices.reserve(count);
+
+                for (int i = 0; i < count; ++i)
+                {
+                        const Vector<N, T> center = normalize(random_vector_in_sphere(random_engine));
+
+                        std::array<int, N> v;
+                        for (unsigned n = 0; n < N; ++n)
+                        {
+                                v[n] = m_vertices.size();
+                                m_vertices.push_back(center + SIZE * random_vector_in_sphere(random_engine));
+                        }
+
+                        m_simplices.emplace_back(m_vertices, m_normals, m_texcoords, v, false, v, false, v, 0);
+                }
+        }
+
+        const std::vector<MeshHyperplaneSimplex<N, T>>& simplices() const
+        {
+                return m_simplices;
+        }
+
+        RandomSimplices(const RandomSimplices&) = delete;
+        RandomSimplices& operator=(const RandomSimplices&) = delete;
+};
+
+// Листья для HyperplaneSimplexPackets со случайным количеством граней,
+// чтобы последние пакеты листьев заполнялись не полностью
+class RandomLeaves
+{
+        std::vector<int> m_object_indices;
+        std::vector<std::array<int, 2>> m_leaves;
+
+public:
+        template <typename RandomEngine>
+        RandomLeaves(int object_count, int max_leaf_size, RandomEngine& random_engine)
+        {
+                m_object_indices.resize(object_count);
+                for (int i = 0; i < object_count; ++i)
+                {
+                        m_object_indices[i] = i;
+                }
+                std::shuffle(m_object_indices.begin(), m_object_indices.end(), random_engine);
+
+                for (int offset = 0; offset < object_count;)
+                {
+                        int count = std::min(object_count - offset, random_integer(random_engine, 1, max_leaf_size));
+                        m_leaves.push_back({offset, count});
+                        offset += count;
+                }
+        }
+
+        const std::vector<int>& object_indices() const
+        {
+                return m_object_indices;
+        }
+
+        template <typename Functor>
+        void for_each_leaf(const Functor& functor) const
+        {
+                for (const std::array<int, 2>& leaf : m_leaves)
+                {
+                        functor(leaf[0], leaf[1]);
+                }
+        }
+
+        const std::vector<std::array<int, 2>>& leaves() const
+        {
+                return m_leaves;
+        }
+};
+
+// Пересечения граней в пакетах должны совпадать с пересечениями отдельных граней
+template <size_t N, typename T>
+void test_simplex_packets(int leaf_count, int ray_count)
+{
+        LOG("simplex packets, packet size " + to_string(HyperplaneSimplexPackets<N, T>::packet_size()) + "...");
+
+        std::mt19937_64 random_engine(leaf_count);
+
+        const int packet_size = HyperplaneSimplexPackets<N, T>::packet_size();
+        const int object_count = leaf_count * 2 * packet_size;
+
+        const RandomSimplices<N, T> random_simplices(object_count, random_engine);
+        const std::vector<MeshHyperplaneSimplex<N, T>>& simplices = random_simplices.simplices();
+
+        const RandomLeaves leaves(object_count, 3 * packet_size + 1, random_engine);
+
+        HyperplaneSimplexPackets<N, T> packets;
+        packets.set_data(simplices, leaves);
+
+        const T precision = 100 * limits<T>::epsilon();
+
+        int error_count = 0;
+
+        for (int r = 0; r < ray_count; ++r)
+        {
+                const std::array<int, 2>& leaf =
+                        leaves.leaves()[random_integer(random_engine, 0, static_cast<int>(leaves.leaves().size()) - 1)];
+                const Span<const int> leaf_indices(&leaves.object_indices()[leaf[0]], leaf[1]);
+
+                // Луч снаружи направлен на случайную точку внутри одной из граней листа
+                const MeshHyperplaneSimplex<N, T>& target =
+                        simplices[leaf_indices[random_integer(random_engine, 0, leaf[1] - 1)]];
+                Vector<N, T> point(0);
+                T weight_sum = 0;
+                for (const Vector<N, T>& vertex : target.vertices())
+                {
+                        T weight = std::uniform_real_distribution<T>(1, 2)(random_engine);
+                        point += weight * vertex;
+                        weight_sum += weight;
+                }
+                point /= weight_sum;
+                Vector<N, T> v;
+                T length_square;
+                random_in_sphere(random_engine, v, length_square);
+                v /= std::sqrt(length_square);
+                const Ray<N, T> ray(point + T(3) * v, -v);
+
+                const T max_distance = std::uniform_real_distribution<T>(2, 5)(random_engine);
+
+                T scalar_t = max_distance;
+                int scalar_index = -1;
+                for (int index : leaf_indices)
+                {
+                        T t;
+                        if (simplices[index].intersect(ray, &t) && t < scalar_t)
+                        {
+                                scalar_t = t;
+                                scalar_index = index;
+                        }
+                }
+                const bool scalar_hit = scalar_index >= 0;
+
+                T packet_t;
+                int object_index;
+                const bool packet_hit = packets.intersect(leaf_indices, ray, max_distance, &packet_t, &object_index);
+
+                if (packet_hit != scalar_hit || packet_hit != packets.intersect_any(leaf_indices, ray, max_distance))
+                {
+                        ++error_count;
+                        continue;
+                }
+                if (!packet_hit)
+                {
+                        continue;
+                }
+
+                // Вычисления в пакетах выполняются без fma, поэтому расстояния могут отличаться
+                // на величину, обратно пропорциональную косинусу угла между лучом и перпендикуляром
+                const T cosine = std::min(std::abs(dot(ray.dir(), simplices[object_index].geometric_normal())),
+                                          std::abs(dot(ray.dir(), simplices[scalar_index].geometric_normal())));
+                const T t_precision = precision * std::max(T(1), scalar_t) / cosine;
+
+                T object_t;
+                if (std::abs(packet_t - scalar_t) > t_precision || !simplices[object_index].intersect(ray, &object_t) ||
+                    std::abs(packet_t - object_t) > t_precision)
+                {
+                        ++error_count;
+                }
+        }
+
+        // Из-за вычислений без fma барицентрические координаты точек около рёбер граней
+        // могут иметь разные знаки, поэтому допускается очень малое количество ошибок
+        if (100.0 * error_count / ray_count > 0.01)
+        {
+                error("Simplex packet intersection errors " + to_string(error_count) + " for " + to_string(ray_count) + " rays");
+        }
+}
+
+// Обход дерева с переходами к соседям по граням должен давать такие же пересечения,
+// как обход с поиском каждой следующей коробки от корня
+template <size_t N, typename T>
+void test_tree_ropes(int object_count, int ray_count, int thread_count, ProgressRatio* progress)
+{
+        LOG("tree ropes...");
+
+        std::mt19937_64 random_engine(object_count);
+
+        const RandomSimplices<N, T> random_simplices(object_count, random_engine);
+        const std::vector<MeshHyperplaneSimplex<N, T>>& simplices = random_simplices.simplices();
+
+        std::vector<HyperplaneSimplexWrapperForShapeIntersection<MeshHyperplaneSimplex<N, T>>> simplex_wrappers;
+        simplex_wrappers.reserve(simplices.size());
+        for (const MeshHyperplaneSimplex<N, T>& simplex : simplices)
+        {
+                simplex_wrappers.emplace_back(simplex);
+        }
+
+        SpatialSubdivisionTree<ParallelotopeOrtho<N, T>> tree;
+        tree.decompose(
+                std::max(2, 24 / static_cast<int>(N)), 10, simplices.size(),
+                [&w = std::as_const(simplex_wrappers)](int simplex_index) { return &w[simplex_index]; }, thread_count,
+                progress);
+
+        // Лучи снаружи граней, направленные к центру сферы, а также эти же лучи
+        // с началами после первого пересечения внутри дерева
+        std::vector<Ray<N, T>> rays = generate_random_rays_for_sphere<N, T>(Vector<N, T>(0.01), T(3), ray_count);
+
+        int error_count = 0;
+
+        for (int pass = 0; pass < 2; ++pass)
+        {
+                for (Ray<N, T>& ray : rays)
+                {
+                        T root_t;
+                        if (!tree.intersect_root(ray, &root_t))
+                        {
+                                continue;
+                        }
+
+                        std::array<int, 2> index;
+                        std::array<T, 2> t;
+                        const auto find_intersection = [&](int traversal) {
+                                return [&, traversal](const Span<const int>& simplex_indices, Vector<N, T>* point) -> bool {
+                                        index[traversal] = -1;
+                                        for (int simplex_index : simplex_indices)
+                                        {
+                                                T simplex_t;
+                                                if (simplices[simplex_index].intersect(ray, &simplex_t) &&
+                                                    (index[traversal] < 0 || simplex_t < t[traversal]))
+                                                {
+                                                        index[traversal] = simplex_index;
+                                                        t[traversal] = simplex_t;
+                                                }
+                                        }
+                                        if (index[traversal] < 0)
+                                        {
+                                                return false;
+                                        }
+                                        *point = ray.point(t[traversal]);
+                                        return true;
+                                };
+                        };
+
+                        const bool hit_ropes = tree.trace_ray(ray, root_t, find_intersection(0));
+                        const bool hit_root = tree.trace_ray_from_root(ray, root_t, find_intersection(1));
+
+                        if (hit_ropes != hit_root || (hit_ropes && (index[0] != index[1] || t[0] != t[1])))
+                        {
+                                ++error_count;
+                        }
+
+                        if (hit_ropes)
+                        {
+                                ray.move_along_dir(t[0] + 100 * limits<T>::epsilon());
+                        }
+                }
+        }
+
+        if (error_count > 0)
+        {
+                error("Tree rope traversal errors " + to_string(error_count) + " for " + to_string(2 * rays.size()) + " rays");
+        }
+}
 }
 
 namespace
@@ -240,9 +594,21 @@ void test_mesh(int point_low, int point_high, int ray_low, int ray_high, int thr
                 ray_count = random_integer(random_engine, ray_low, ray_high);
         }
 
-        std::unique_ptr mesh = simplex_mesh_of_random_sphere<N, T>(point_count, thread_count, progress);
+        test_simplex_packets<N, T>(point_count / 10, ray_count);
 
-        test_sphere_mesh(*mesh, ray_count, with_ray_log, with_error_log, progress);
+        test_tree_ropes<N, T>(point_count, ray_count, thread_count, progress);
+
+        for (MeshAcceleration acceleration : {MeshAcceleration::SpatialSubdivisionTree,
+                                              MeshAcceleration::BoundingVolumeHierarchy, MeshAcceleration::KdTree})
+        {
+                LOG(mesh_acceleration_name(acceleration));
+
+                std::unique_ptr mesh = simplex_mesh_of_random_sphere<N, T>(point_count, thread_count, progress, acceleration);
+
+                test_sphere_mesh(*mesh, ray_count, with_ray_log, with_error_log, progress);
+
+                test_sphere_mesh_packets(*mesh, ray_count);
+        }
 }
 }
 
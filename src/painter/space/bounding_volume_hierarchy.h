@@ -0,0 +1,775 @@
+/*
+Copyright (C) 2017-2019 Topological Manifold
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/*
+ Matt Pharr, Wenzel Jakob, Greg Humphreys.
+ Physically Based Rendering. From theory to implementation. Third edition.
+ Elsevier, 2017.
+
+ 4.3 Bounding volume hierarchies.
+*/
+
+#pragma once
+
+#include "ray_packet.h"
+
+#include "com/error.h"
+#include "com/print.h"
+#include "com/ray.h"
+#include "com/span.h"
+#include "com/thread.h"
+#include "com/type/limit.h"
+#include "com/vec.h"
+#include "progress/progress.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <numeric>
+#include <vector>
+
+namespace bounding_volume_hierarchy_implementation
+{
+template <size_t N, typename T>
+struct BoundingBox
+{
+        Vector<N, T> min{limits<T>::max()};
+        Vector<N, T> max{limits<T>::lowest()};
+
+        void add(const Vector<N, T>& p)
+        {
+                min = min_vector(min, p);
+                max = max_vector(max, p);
+        }
+
+        void add(const BoundingBox& box)
+        {
+                min = min_vector(min, box.min);
+                max = max_vector(max, box.max);
+        }
+};
+
+// Мера границы параллелотопа без множителя 2 — сумма произведений
+// всех размеров, кроме одного. Для N = 3 это половина площади поверхности.
+template <size_t N, typename T>
+T surface(const BoundingBox<N, T>& box)
+{
+        Vector<N, T> d = box.max - box.min;
+        T sum = 0;
+        for (unsigned i = 0; i < N; ++i)
+        {
+                T product = 1;
+                for (unsigned j = 0; j < N; ++j)
+                {
+                        if (j != i)
+                        {
+                                product *= d[j];
+                        }
+                }
+                sum += product;
+        }
+        return sum;
+}
+
+// Пересечение луча с параллелотопом на отрезке [0, max_t].
+// Нулевые координаты направления обрабатываются отдельно, так как с -Ofast
+// нельзя рассчитывать на NaN и бесконечности при делении на 0.
+template <size_t N, typename T>
+bool intersect(const BoundingBox<N, T>& box, const Vector<N, T>& org, const Vector<N, T>& dir,
+               const Vector<N, T>& dir_reciprocal, T max_t, T* t)
+{
+        T near = 0;
+        T far = max_t;
+        for (unsigned i = 0; i < N; ++i)
+        {
+                if (dir[i] == 0)
+                {
+                        if (org[i] < box.min[i] || org[i] > box.max[i])
+                        {
+                                // параллельно плоскостям и снаружи
+                                return false;
+                        }
+                        // внутри плоскостей
+                        continue;
+                }
+                T t1 = (box.min[i] - org[i]) * dir_reciprocal[i];
+                T t2 = (box.max[i] - org[i]) * dir_reciprocal[i];
+                if (dir_reciprocal[i] < 0)
+                {
+                        std::swap(t1, t2);
+                }
+                near = std::max(near, t1);
+                far = std::min(far, t2);
+                if (near > far)
+                {
+                        return false;
+                }
+        }
+        *t = near;
+        return true;
+}
+
+// Пересечения лучей пакета из маски с параллелотопом на отрезках [0, max_t[i]].
+// Возвращается маска пересекающих лучей, а в min_t — наименьшее расстояние входа.
+template <size_t N, typename T>
+typename RayPacket<N, T>::Mask intersect(const BoundingBox<N, T>& box, const RayPacket<N, T>& packet,
+                                         typename RayPacket<N, T>::Mask mask, const T* max_t, T* min_t)
+{
+        std::array<T, RayPacket<N, T>::MAX_SIZE> near;
+        std::array<T, RayPacket<N, T>::MAX_SIZE> far;
+
+        const typename RayPacket<N, T>::Mask result =
+                intersect_box(box.min, box.max, packet, mask, max_t, near.data(), far.data());
+
+        *min_t = limits<T>::max();
+        for (int i = 0; i < packet.size(); ++i)
+        {
+                if (RayPacket<N, T>::contains(result, i))
+                {
+                        *min_t = std::min(*min_t, near[i]);
+                }
+        }
+        return result;
+}
+
+template <size_t N, typename T>
+struct Node
+{
+        BoundingBox<N, T> box;
+        // Для листа — начало индексов объектов, для внутренней
+        // вершины — индекс первого из двух соседних потомков.
+        int offset;
+        // Для листа — количество объектов, для внутренней вершины — 0.
+        int object_count;
+};
+
+// Поддерево, которое строится отдельно в одном из потоков
+struct Subtree
+{
+        int node_index;
+        int begin;
+        int end;
+        int depth;
+};
+
+template <size_t N, typename T>
+class Build
+{
+        static constexpr int BIN_COUNT = 16;
+        // Стоимость перехода через вершину относительно стоимости пересечения с пакетом объектов
+        static constexpr T TRAVERSAL_COST = 1;
+
+        const std::vector<BoundingBox<N, T>>& m_object_boxes;
+        const std::vector<Vector<N, T>>& m_object_centers;
+        std::vector<int>* const m_object_indices;
+        const int m_max_depth;
+        const int m_max_objects_per_leaf;
+        const int m_packet_size;
+
+        // Объекты листа пересекаются пакетами по m_packet_size объектов,
+        // поэтому стоимость пересечения определяется количеством пакетов
+        T intersection_cost(int count) const
+        {
+                return (count + m_packet_size - 1) / m_packet_size;
+        }
+
+        bool split(int begin, int end, const BoundingBox<N, T>& box, int* middle) const
+        {
+                const int count = end - begin;
+
+                if (count <= 1)
+                {
+                        return false;
+                }
+
+                BoundingBox<N, T> center_box;
+                for (int i = begin; i < end; ++i)
+                {
+                        center_box.add(m_object_centers[(*m_object_indices)[i]]);
+                }
+
+                T best_cost = limits<T>::max();
+                int best_axis = -1;
+                int best_bin = -1;
+
+                for (unsigned axis = 0; axis < N; ++axis)
+                {
+                        const T extent = center_box.max[axis] - center_box.min[axis];
+                        if (!(extent > 0))
+                        {
+                                continue;
+                        }
+
+                        const T k = BIN_COUNT / extent;
+
+                        std::array<int, BIN_COUNT> bin_counts{};
+                        std::array<BoundingBox<N, T>, BIN_COUNT> bin_boxes;
+                        for (int i = begin; i < end; ++i)
+                        {
+                                int object = (*m_object_indices)[i];
+                                int bin = std::min<int>(BIN_COUNT - 1, (m_object_centers[object][axis] - center_box.min[axis]) * k);
+                                ++bin_counts[bin];
+                                bin_boxes[bin].add(m_object_boxes[object]);
+                        }
+
+                        // Стоимости правых частей для разделения после каждой корзины
+                        std::array<T, BIN_COUNT> right_costs;
+                        BoundingBox<N, T> right_box;
+                        int right_count = 0;
+                        for (int bin = BIN_COUNT - 1; bin > 0; --bin)
+                        {
+                                right_box.add(bin_boxes[bin]);
+                                right_count += bin_counts[bin];
+                                right_costs[bin - 1] =
+                                        (right_count > 0) ? intersection_cost(right_count) * surface(right_box) : -1;
+                        }
+
+                        BoundingBox<N, T> left_box;
+                        int left_count = 0;
+                        for (int bin = 0; bin < BIN_COUNT - 1; ++bin)
+                        {
+                                left_box.add(bin_boxes[bin]);
+                                left_count += bin_counts[bin];
+                                if (left_count == 0 || right_costs[bin] < 0)
+                                {
+                                        continue;
+                                }
+                                T cost = intersection_cost(left_count) * surface(left_box) + right_costs[bin];
+                                if (cost < best_cost)
+                                {
+                                        best_cost = cost;
+                                        best_axis = axis;
+                                        best_bin = bin;
+                                }
+                        }
+                }
+
+                if (best_axis < 0)
+                {
+                        // Все центры объектов совпадают
+                        if (count <= m_max_objects_per_leaf)
+                        {
+                                return false;
+                        }
+                        *middle = begin + count / 2;
+                        return true;
+                }
+
+                const T box_surface = surface(box);
+                if (count <= m_max_objects_per_leaf &&
+                    TRAVERSAL_COST * box_surface + best_cost >= intersection_cost(count) * box_surface)
+                {
+                        return false;
+                }
+
+                const T k = BIN_COUNT / (center_box.max[best_axis] - center_box.min[best_axis]);
+                auto iter = std::partition(m_object_indices->begin() + begin, m_object_indices->begin() + end, [&](int object) {
+                        int bin = std::min<int>(BIN_COUNT - 1,
+                                                (m_object_centers[object][best_axis] - center_box.min[best_axis]) * k);
+                        return bin <= best_bin;
+                });
+                *middle = iter - m_object_indices->begin();
+
+                ASSERT(*middle > begin && *middle < end);
+
+                return true;
+        }
+
+public:
+        Build(const std::vector<BoundingBox<N, T>>& object_boxes, const std::vector<Vector<N, T>>& object_centers,
+              std::vector<int>* object_indices, int max_depth, int max_objects_per_leaf, int packet_size)
+                : m_object_boxes(object_boxes),
+                  m_object_centers(object_centers),
+                  m_object_indices(object_indices),
+                  m_max_depth(max_depth),
+                  m_max_objects_per_leaf(max_objects_per_leaf),
+                  m_packet_size(packet_size)
+        {
+        }
+
+        // Построение поддерева объектов [begin, end) с корнем в (*nodes)[node_index].
+        // Если subtrees не nullptr, то поддеревья с количеством объектов не более
+        // subtree_object_count не строятся, а добавляются в subtrees.
+        void build(int node_index, int begin, int end, int depth, std::vector<Node<N, T>>* nodes, int subtree_object_count,
+                   std::vector<Subtree>* subtrees) const
+        {
+                if (subtrees && end - begin <= subtree_object_count)
+                {
+                        subtrees->push_back({node_index, begin, end, depth});
+                        return;
+                }
+
+                BoundingBox<N, T> box;
+                for (int i = begin; i < end; ++i)
+                {
+                        box.add(m_object_boxes[(*m_object_indices)[i]]);
+                }
+                (*nodes)[node_index].box = box;
+
+                int middle;
+                if (depth >= m_max_depth || !split(begin, end, box, &middle))
+                {
+                        (*nodes)[node_index].offset = begin;
+                        (*nodes)[node_index].object_count = end - begin;
+                        return;
+                }
+
+                int child = nodes->size();
+                nodes->resize(child + 2);
+
+                (*nodes)[node_index].offset = child;
+                (*nodes)[node_index].object_count = 0;
+
+                build(child, begin, middle, depth + 1, nodes, subtree_object_count, subtrees);
+                build(child + 1, middle, end, depth + 1, nodes, subtree_object_count, subtrees);
+        }
+};
+}
+
+template <size_t N, typename T>
+class BoundingVolumeHierarchy
+{
+        static_assert(std::is_floating_point_v<T>);
+
+        using BoundingBox = bounding_volume_hierarchy_implementation::BoundingBox<N, T>;
+        using Node = bounding_volume_hierarchy_implementation::Node<N, T>;
+
+        // Расширение границ объектов в каждую сторону для плоских объектов
+        // и для учёта ошибок плавающей точки.
+        static constexpr int DISTANCE_FROM_FLAT_SHAPES_IN_EPSILONS = 10;
+
+        static constexpr int MAX_DEPTH = 64;
+
+        // Количество поддеревьев на поток при параллельном построении
+        static constexpr int SUBTREES_PER_THREAD = 8;
+
+        static constexpr int ROOT_NODE = 0;
+
+        std::vector<Node> m_nodes;
+        std::vector<int> m_object_indices;
+
+public:
+        // Параметр packet_size — количество объектов листа, пересекаемых лучом одновременно
+        template <typename FunctorObjectPointer>
+        void decompose(int max_objects_per_leaf, int packet_size, int object_index_count,
+                       const FunctorObjectPointer& functor_object_pointer, unsigned thread_count, ProgressRatio* progress)
+        {
+                static_assert(std::is_pointer_v<decltype(functor_object_pointer(0))>);
+                static_assert(std::is_const_v<std::remove_pointer_t<decltype(functor_object_pointer(0))>>);
+
+                namespace impl = bounding_volume_hierarchy_implementation;
+
+                if (object_index_count <= 0)
+                {
+                        error("No objects for bounding volume hierarchy");
+                }
+
+                if (max_objects_per_leaf <= 0)
+                {
+                        error("Bounding volume hierarchy maximum object count per leaf " + to_string(max_objects_per_leaf) +
+                              " is not positive");
+                }
+
+                if (packet_size <= 0)
+                {
+                        error("Bounding volume hierarchy packet size " + to_string(packet_size) + " is not positive");
+                }
+
+                std::vector<BoundingBox> object_boxes(object_index_count);
+                std::vector<Vector<N, T>> object_centers(object_index_count);
+                for (int i = 0; i < object_index_count; ++i)
+                {
+                        BoundingBox& box = object_boxes[i];
+                        for (const Vector<N, T>& v : functor_object_pointer(i)->vertices())
+                        {
+                                box.add(v);
+                        }
+                        for (unsigned n = 0; n < N; ++n)
+                        {
+                                T guard_region_size = std::max(std::abs(box.min[n]), std::abs(box.max[n])) *
+                                                      (DISTANCE_FROM_FLAT_SHAPES_IN_EPSILONS * limits<T>::epsilon());
+                                box.min[n] -= guard_region_size;
+                                box.max[n] += guard_region_size;
+                        }
+                        object_centers[i] = (box.min + box.max) / static_cast<T>(2);
+                }
+
+                std::vector<int> object_indices(object_index_count);
+                std::iota(object_indices.begin(), object_indices.end(), 0);
+
+                const impl::Build<N, T> build(object_boxes, object_centers, &object_indices, MAX_DEPTH, max_objects_per_leaf,
+                                              packet_size);
+
+                std::vector<Node> nodes(1);
+
+                if (thread_count <= 1)
+                {
+                        build.build(ROOT_NODE, 0, object_index_count, 0, &nodes, 0, nullptr);
+                }
+                else
+                {
+                        // Верхние уровни строятся последовательно, а поддеревья параллельно,
+                        // каждое в свой массив вершин с последующим объединением.
+
+                        const int subtree_object_count = std::max(1u, object_index_count / (thread_count * SUBTREES_PER_THREAD));
+
+                        std::vector<impl::Subtree> subtrees;
+                        build.build(ROOT_NODE, 0, object_index_count, 0, &nodes, subtree_object_count, &subtrees);
+
+                        std::vector<std::vector<Node>> subtree_nodes(subtrees.size());
+                        std::atomic_int next_subtree = 0;
+                        AtomicCounter<int> subtree_count = 0;
+
+                        ThreadsWithCatch threads(thread_count);
+                        for (unsigned i = 0; i < thread_count; ++i)
+                        {
+                                threads.add([&]() {
+                                        int s;
+                                        while ((s = next_subtree++) < static_cast<int>(subtrees.size()))
+                                        {
+                                                subtree_nodes[s].resize(1);
+                                                build.build(0, subtrees[s].begin, subtrees[s].end, subtrees[s].depth,
+                                                            &subtree_nodes[s], 0, nullptr);
+                                                ++subtree_count;
+                                                progress->set(subtree_count, subtrees.size());
+                                        }
+                                });
+                        }
+                        threads.join();
+
+                        for (size_t s = 0; s < subtrees.size(); ++s)
+                        {
+                                // Индексы потомков в поддереве начинаются с 1
+                                const int shift = static_cast<int>(nodes.size()) - 1;
+                                for (Node& node : subtree_nodes[s])
+                                {
+                                        if (node.object_count == 0)
+                                        {
+                                                node.offset += shift;
+                                        }
+                                }
+                                nodes[subtrees[s].node_index] = subtree_nodes[s][0];
+                                nodes.insert(nodes.end(), subtree_nodes[s].cbegin() + 1, subtree_nodes[s].cend());
+                                subtree_nodes[s].clear();
+                                subtree_nodes[s].shrink_to_fit();
+                        }
+                }
+
+                nodes.shrink_to_fit();
+
+                m_nodes = std::move(nodes);
+                m_object_indices = std::move(object_indices);
+        }
+
+        // Номера объектов всех листьев. Функторы поиска пересечений
+        // получают части этого массива.
+        const std::vector<int>& object_indices() const
+        {
+                return m_object_indices;
+        }
+
+        // Для каждого листа вызывается functor(offset, count),
+        // где offset и count задают часть массива object_indices()
+        template <typename Functor>
+        void for_each_leaf(const Functor& functor) const
+        {
+                for (const Node& node : m_nodes)
+                {
+                        if (node.object_count > 0)
+                        {
+                                functor(node.offset, node.object_count);
+                        }
+                }
+        }
+
+        bool intersect_root(const Ray<N, T>& ray, T* t) const
+        {
+                Vector<N, T> dir_reciprocal;
+                for (unsigned i = 0; i < N; ++i)
+                {
+                        dir_reciprocal[i] = 1 / ray.dir()[i];
+                }
+                return bounding_volume_hierarchy_implementation::intersect(m_nodes[ROOT_NODE].box, ray.org(), ray.dir(),
+                                                                           dir_reciprocal, limits<T>::max(), t);
+        }
+
+        // Функция functor_find_intersection(indices, max_t, &t) должна находить ближайшее
+        // пересечение с объектами indices на расстоянии меньше max_t.
+        template <typename FunctorFindIntersection>
+        bool trace_ray(const Ray<N, T>& ray, const FunctorFindIntersection& functor_find_intersection) const
+        {
+                namespace impl = bounding_volume_hierarchy_implementation;
+
+                struct StackEntry
+                {
+                        int node_index;
+                        T t;
+                };
+
+                Vector<N, T> dir_reciprocal;
+                for (unsigned i = 0; i < N; ++i)
+                {
+                        dir_reciprocal[i] = 1 / ray.dir()[i];
+                }
+
+                T max_t = limits<T>::max();
+                bool found = false;
+
+                T t;
+                if (!impl::intersect(m_nodes[ROOT_NODE].box, ray.org(), ray.dir(), dir_reciprocal, max_t, &t))
+                {
+                        return false;
+                }
+
+                // Глубина дерева не больше MAX_DEPTH, и на каждом уровне
+                // в стек добавляется не больше одной вершины.
+                std::array<StackEntry, MAX_DEPTH + 1> stack;
+                int stack_size = 0;
+
+                int node_index = ROOT_NODE;
+
+                while (true)
+                {
+                        const Node& node = m_nodes[node_index];
+
+                        if (node.object_count > 0)
+                        {
+                                T leaf_t;
+                                if (functor_find_intersection(Span<const int>(&m_object_indices[node.offset], node.object_count),
+                                                              max_t, &leaf_t))
+                                {
+                                        max_t = leaf_t;
+                                        found = true;
+                                }
+                        }
+                        else
+                        {
+                                T t_0;
+                                T t_1;
+                                bool hit_0 = impl::intersect(m_nodes[node.offset].box, ray.org(), ray.dir(), dir_reciprocal,
+                                                             max_t, &t_0);
+                                bool hit_1 = impl::intersect(m_nodes[node.offset + 1].box, ray.org(), ray.dir(), dir_reciprocal,
+                                                             max_t, &t_1);
+
+                                if (hit_0 && hit_1)
+                                {
+                                        if (t_0 <= t_1)
+                                        {
+                                                stack[stack_size++] = {node.offset + 1, t_1};
+                                                node_index = node.offset;
+                                        }
+                                        else
+                                        {
+                                                stack[stack_size++] = {node.offset, t_0};
+                                                node_index = node.offset + 1;
+                                        }
+                                        continue;
+                                }
+                                if (hit_0)
+                                {
+                                        node_index = node.offset;
+                                        continue;
+                                }
+                                if (hit_1)
+                                {
+                                        node_index = node.offset + 1;
+                                        continue;
+                                }
+                        }
+
+                        // Следующая вершина из стека, если её пересечение не дальше найденного
+                        do
+                        {
+                                if (stack_size == 0)
+                                {
+                                        return found;
+                                }
+                                --stack_size;
+                        } while (stack[stack_size].t > max_t);
+
+                        node_index = stack[stack_size].node_index;
+                }
+        }
+
+        // Совместный обход для лучей пакета из маски. Массив max_t содержит
+        // для всех лучей пакета расстояния до найденных пересечений.
+        // Функция functor_find_intersections(indices, leaf_mask) должна находить
+        // для лучей leaf_mask пересечения с объектами indices на расстояниях
+        // меньше max_t[i] и уменьшать max_t[i] для найденных пересечений.
+        template <typename FunctorFindIntersections>
+        void trace_packet(const RayPacket<N, T>& packet, typename RayPacket<N, T>::Mask mask, const T* max_t,
+                          const FunctorFindIntersections& functor_find_intersections) const
+        {
+                namespace impl = bounding_volume_hierarchy_implementation;
+
+                using Mask = typename RayPacket<N, T>::Mask;
+
+                struct StackEntry
+                {
+                        int node_index;
+                        Mask mask;
+                };
+
+                T t;
+                Mask node_mask = impl::intersect(m_nodes[ROOT_NODE].box, packet, mask, max_t, &t);
+                if (node_mask == 0)
+                {
+                        return;
+                }
+
+                // Глубина дерева не больше MAX_DEPTH, и на каждом уровне
+                // в стек добавляется не больше одной вершины.
+                std::array<StackEntry, MAX_DEPTH + 1> stack;
+                int stack_size = 0;
+
+                int node_index = ROOT_NODE;
+
+                while (true)
+                {
+                        const Node& node = m_nodes[node_index];
+
+                        if (node.object_count > 0)
+                        {
+                                functor_find_intersections(Span<const int>(&m_object_indices[node.offset], node.object_count),
+                                                           node_mask);
+                        }
+                        else
+                        {
+                                // Первой обходится вершина с ближайшим входом какого-либо луча
+                                T t_0;
+                                T t_1;
+                                Mask mask_0 = impl::intersect(m_nodes[node.offset].box, packet, node_mask, max_t, &t_0);
+                                Mask mask_1 = impl::intersect(m_nodes[node.offset + 1].box, packet, node_mask, max_t, &t_1);
+
+                                if (mask_0 != 0 && mask_1 != 0)
+                                {
+                                        if (t_0 <= t_1)
+                                        {
+                                                stack[stack_size++] = {node.offset + 1, mask_1};
+                                                node_index = node.offset;
+                                                node_mask = mask_0;
+                                        }
+                                        else
+                                        {
+                                                stack[stack_size++] = {node.offset, mask_0};
+                                                node_index = node.offset + 1;
+                                                node_mask = mask_1;
+                                        }
+                                        continue;
+                                }
+                                if (mask_0 != 0)
+                                {
+                                        node_index = node.offset;
+                                        node_mask = mask_0;
+                                        continue;
+                                }
+                                if (mask_1 != 0)
+                                {
+                                        node_index = node.offset + 1;
+                                        node_mask = mask_1;
+                                        continue;
+                                }
+                        }
+
+                        // Следующая вершина из стека. Пересечения с ней проверяются заново,
+                        // так как после добавления в стек значения max_t могли уменьшиться.
+                        do
+                        {
+                                if (stack_size == 0)
+                                {
+                                        return;
+                                }
+                                --stack_size;
+                                node_index = stack[stack_size].node_index;
+                                node_mask = impl::intersect(m_nodes[node_index].box, packet, stack[stack_size].mask, max_t, &t);
+                        } while (node_mask == 0);
+                }
+        }
+
+        // Функция functor_any_intersection(indices) должна определять, есть ли пересечение
+        // с объектами indices на расстоянии меньше max_distance. Обход прекращается
+        // при первом найденном пересечении.
+        template <typename FunctorAnyIntersection>
+        bool occluded(const Ray<N, T>& ray, T max_distance, const FunctorAnyIntersection& functor_any_intersection) const
+        {
+                namespace impl = bounding_volume_hierarchy_implementation;
+
+                Vector<N, T> dir_reciprocal;
+                for (unsigned i = 0; i < N; ++i)
+                {
+                        dir_reciprocal[i] = 1 / ray.dir()[i];
+                }
+
+                T t;
+                if (!impl::intersect(m_nodes[ROOT_NODE].box, ray.org(), ray.dir(), dir_reciprocal, max_distance, &t))
+                {
+                        return false;
+                }
+
+                // Порядок обхода не важен, на каждом уровне в стек
+                // добавляется не больше одной вершины.
+                std::array<int, MAX_DEPTH + 1> stack;
+                int stack_size = 0;
+
+                int node_index = ROOT_NODE;
+
+                while (true)
+                {
+                        const Node& node = m_nodes[node_index];
+
+                        if (node.object_count > 0)
+                        {
+                                if (functor_any_intersection(Span<const int>(&m_object_indices[node.offset], node.object_count)))
+                                {
+                                        return true;
+                                }
+                        }
+                        else
+                        {
+                                bool hit_0 = impl::intersect(m_nodes[node.offset].box, ray.org(), ray.dir(), dir_reciprocal,
+                                                             max_distance, &t);
+                                bool hit_1 = impl::intersect(m_nodes[node.offset + 1].box, ray.org(), ray.dir(), dir_reciprocal,
+                                                             max_distance, &t);
+
+                                if (hit_0 && hit_1)
+                                {
+                                        stack[stack_size++] = node.offset + 1;
+                                        node_index = node.offset;
+                                        continue;
+                                }
+                                if (hit_0)
+                                {
+                                        node_index = node.offset;
+                                        continue;
+                                }
+                                if (hit_1)
+                                {
+                                        node_index = node.offset + 1;
+                                        continue;
+                                }
+                        }
+
+                        if (stack_size == 0)
+                        {
+                                return false;
+                        }
+
+                        node_index = stack[--stack_size];
+                }
+        }
+};
@@ -0,0 +1,173 @@
+/*
+Copyright (C) 2017-2019 Topological Manifold
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ Tomas Akenine-Möller.
+ Fast 3D Triangle-Box Overlap Testing.
+ Journal of Graphics Tools, 2001.
+
+ Для N = 3 проверяются все оси разделения треугольника и коробки.
+ Для N > 3 проверяются оси коробки, перпендикуляр к гиперплоскости симплекса,
+ перпендикуляры к граням симплекса и перпендикуляры к проекциям рёбер симплекса
+ на все двухмерные координатные плоскости. Это не все возможные оси разделения, поэтому при N > 3 результат
+ может быть положительным для непересекающихся объектов, но не наоборот.
+*/
+
+#pragma once
+
+#include "com/type/limit.h"
+#include "com/vec.h"
+#include "painter/space/constraint.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <type_traits>
+
+namespace box_simplex_intersection_implementation
+{
+// Проекции точек на ось не пересекаются с отрезком [-radius, radius],
+// если точки расширить на thickness в обе стороны.
+template <size_t N, typename T, typename Projection>
+bool separated(const std::array<Vector<N, T>, N>& vertices, const Projection& projection, T radius, T thickness)
+{
+        T min = projection(vertices[0]);
+        T max = min;
+        for (unsigned i = 1; i < N; ++i)
+        {
+                T p = projection(vertices[i]);
+                min = std::min(min, p);
+                max = std::max(max, p);
+        }
+        return (min - thickness > radius) || (max + thickness < -radius);
+}
+}
+
+// Пересечение коробки с рёбрами, параллельными осям координат, и симплекса
+// размерности N - 1 в N-мерном пространстве. Симплекс имеет функции vertices()
+// и normal(), где normal() — единичный перпендикуляр к гиперплоскости симплекса,
+// а при N > 3 ещё и функцию constraints() с ограничениями граней симплекса.
+// Как и при решении системы неравенств в shape_intersection, симплекс расширяется
+// в обе стороны от гиперплоскости на расстояние, пропорциональное размеру объектов.
+template <size_t N, typename T, typename Simplex>
+bool box_simplex_intersection(const Vector<N, T>& box_min, const Vector<N, T>& box_max, const Simplex& simplex,
+                              T distance_from_flat_shapes_in_epsilons)
+{
+        static_assert(Simplex::SPACE_DIMENSION == N);
+        static_assert(Simplex::SHAPE_DIMENSION == N - 1);
+        static_assert(std::is_same_v<typename Simplex::DataType, T>);
+
+        namespace impl = box_simplex_intersection_implementation;
+
+        const Vector<N, T>& normal = simplex.normal();
+
+        Vector<N, T> simplex_min = simplex.vertices()[0];
+        Vector<N, T> simplex_max = simplex.vertices()[0];
+        for (unsigned v = 1; v < N; ++v)
+        {
+                simplex_min = min_vector(simplex_min, simplex.vertices()[v]);
+                simplex_max = max_vector(simplex_max, simplex.vertices()[v]);
+        }
+
+        const T max_value = max_element(max_vector(box_max, simplex_max) - min_vector(box_min, simplex_min));
+        const T distance = max_value * (distance_from_flat_shapes_in_epsilons * limits<T>::epsilon());
+
+        // Вычисления относительно центра коробки
+        const Vector<N, T> center = (box_min + box_max) / static_cast<T>(2);
+        const Vector<N, T> half_size = (box_max - box_min) / static_cast<T>(2);
+
+        std::array<Vector<N, T>, N> vertices;
+        for (unsigned v = 0; v < N; ++v)
+        {
+                vertices[v] = simplex.vertices()[v] - center;
+        }
+
+        // Оси коробки
+        for (unsigned i = 0; i < N; ++i)
+        {
+                if (impl::separated(vertices, [&](const Vector<N, T>& p) { return p[i]; }, half_size[i],
+                                    distance * std::abs(normal[i])))
+                {
+                        return false;
+                }
+        }
+
+        // Перпендикуляр к гиперплоскости симплекса
+        T box_radius = 0;
+        for (unsigned i = 0; i < N; ++i)
+        {
+                box_radius += half_size[i] * std::abs(normal[i]);
+        }
+        if (std::abs(dot(normal, vertices[0])) > box_radius + distance)
+        {
+                return false;
+        }
+
+        // Перпендикуляры к граням симплекса внутри его гиперплоскости.
+        // Грани перпендикулярны гиперплоскости, поэтому расширение симплекса
+        // не влияет на расстояние до них.
+        if constexpr (N >= 4)
+        {
+                for (const Constraint<N, T>& c : simplex.constraints())
+                {
+                        T max = dot(c.a, center) + c.b;
+                        for (unsigned i = 0; i < N; ++i)
+                        {
+                                max += half_size[i] * std::abs(c.a[i]);
+                        }
+                        if (max < 0)
+                        {
+                                return false;
+                        }
+                }
+        }
+
+        // Перпендикуляры к проекциям рёбер на координатные плоскости (i, j).
+        // Для N = 3 это векторные произведения осей коробки и рёбер треугольника.
+        for (unsigned v1 = 0; v1 < N - 1; ++v1)
+        {
+                for (unsigned v2 = v1 + 1; v2 < N; ++v2)
+                {
+                        const Vector<N, T> edge = vertices[v2] - vertices[v1];
+
+                        for (unsigned i = 0; i < N - 1; ++i)
+                        {
+                                for (unsigned j = i + 1; j < N; ++j)
+                                {
+                                        const T a_i = -edge[j];
+                                        const T a_j = edge[i];
+                                        if (a_i == 0 && a_j == 0)
+                                        {
+                                                continue;
+                                        }
+
+                                        const T radius = half_size[i] * std::abs(a_i) + half_size[j] * std::abs(a_j);
+                                        const T thickness = distance * std::abs(a_i * normal[i] + a_j * normal[j]);
+
+                                        const auto projection = [&](const Vector<N, T>& p) { return a_i * p[i] + a_j * p[j]; };
+
+                                        if (impl::separated(vertices, projection, radius, thickness))
+                                        {
+                                                return false;
+                                        }
+                                }
+                        }
+                }
+        }
+
+        return true;
+}
@@ -166,6 +166,18 @@ public:
                 return dot(point, m_planes[i].n) - m_planes[i].d;
         }
 
+        // Плоскость барицентрической координаты i в виде dot(point, n) - d
+        const Vector<N, T>& barycentric_plane_n(unsigned i) const
+        {
+                ASSERT(i < N - 1);
+                return m_planes[i].n;
+        }
+        T barycentric_plane_d(unsigned i) const
+        {
+                ASSERT(i < N - 1);
+                return m_planes[i].d;
+        }
+
         Vector<N, T> barycentric_coordinates(const Vector<N, T>& point) const
         {
                 Vector<N, T> coords;
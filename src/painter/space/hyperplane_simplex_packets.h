@@ -0,0 +1,333 @@
+/*
+Copyright (C) 2017-2019 Topological Manifold
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ Данные граней в виде пакетов для одновременного поиска пересечений
+ луча с несколькими гранями командами SIMD.
+
+ Грани каждого листа структуры поиска пересечений хранятся в пакетах
+ по packet_size() граней. В пакете для каждой составляющей данных граней
+ находится массив значений этой составляющей у всех граней пакета.
+ Для каждой грани хранится вершина, перпендикуляр и плоскости
+ барицентрических координат, как в HyperplaneSimplexGeometry,
+ и вычисления выполняются в том же порядке.
+*/
+
+#pragma once
+
+#include "com/error.h"
+#include "com/math.h"
+#include "com/ray.h"
+#include "com/span.h"
+#include "com/vec.h"
+#include "painter/space/hyperplane_geometry.h"
+
+#include <array>
+#include <type_traits>
+#include <vector>
+
+#if __has_include(<experimental/simd>)
+#include <experimental/simd>
+#define HYPERPLANE_SIMPLEX_PACKETS_SIMD
+#endif
+
+template <size_t N, typename T>
+class HyperplaneSimplexPackets
+{
+        static_assert(N >= 2);
+        static_assert(std::is_floating_point_v<T>);
+
+#if defined(HYPERPLANE_SIMPLEX_PACKETS_SIMD)
+        using Simd = std::experimental::native_simd<T>;
+        static constexpr int PACKET_SIZE = Simd::size();
+#else
+        static constexpr int PACKET_SIZE = 1;
+#endif
+
+        // Номера составляющих для вершины, перпендикуляра и плоскостей.
+        // Плоскость барицентрической координаты k занимает N + 1 составляющую,
+        // начиная с PLANES + k * (N + 1), последней из них является d.
+        static constexpr unsigned VERTEX = 0;
+        static constexpr unsigned NORMAL = N;
+        static constexpr unsigned PLANES = 2 * N;
+        static constexpr unsigned COMPONENT_COUNT = 2 * N + (N - 1) * (N + 1);
+
+        static constexpr int NO_PACKET = -1;
+
+        // Пакеты по COMPONENT_COUNT * PACKET_SIZE чисел. Незаполненные места
+        // в последнем пакете листа имеют нулевой перпендикуляр и не дают пересечений.
+        std::vector<T> m_data;
+
+        // Для начала каждого листа в массиве номеров объектов — номер его первого пакета
+        std::vector<int> m_leaf_packets;
+
+        const int* m_object_indices = nullptr;
+
+        const T* packet(int packet_index) const
+        {
+                return &m_data[static_cast<size_t>(packet_index) * (COMPONENT_COUNT * PACKET_SIZE)];
+        }
+
+#if defined(HYPERPLANE_SIMPLEX_PACKETS_SIMD)
+        // Номер в листе ближайшей грани с пересечением на расстоянии меньше max_distance
+        // или, если ANY_INTERSECTION, номер любой такой грани. Если пересечений нет, то -1.
+        template <bool ANY_INTERSECTION>
+        int find_intersection(int first_packet, int object_count, const Ray<N, T>& ray, T max_distance, T* t) const
+        {
+                namespace stdx = std::experimental;
+
+                std::array<Simd, N> org;
+                std::array<Simd, N> dir;
+                for (unsigned n = 0; n < N; ++n)
+                {
+                        org[n] = ray.org()[n];
+                        dir[n] = ray.dir()[n];
+                }
+
+                T min_t = max_distance;
+                int position = -1;
+
+                for (int first = 0, packet_index = first_packet; first < object_count; first += PACKET_SIZE, ++packet_index)
+                {
+                        const T* const data = packet(packet_index);
+                        const auto load = [&](unsigned c) {
+                                Simd v;
+                                v.copy_from(data + c * PACKET_SIZE, stdx::element_aligned);
+                                return v;
+                        };
+
+                        // Пересечение с плоскостью грани
+                        Simd normal = load(NORMAL);
+                        Simd s = normal * dir[0];
+                        Simd d = (load(VERTEX) - org[0]) * normal;
+                        for (unsigned n = 1; n < N; ++n)
+                        {
+                                normal = load(NORMAL + n);
+                                s += normal * dir[n];
+                                d += (load(VERTEX + n) - org[n]) * normal;
+                        }
+                        Simd packet_t = d / s;
+
+                        auto mask = (s != 0) && (packet_t > 0) && (packet_t < min_t);
+                        if (stdx::none_of(mask))
+                        {
+                                continue;
+                        }
+
+                        // Барицентрические координаты точки пересечения
+                        std::array<Simd, N> point;
+                        for (unsigned n = 0; n < N; ++n)
+                        {
+                                point[n] = org[n] + dir[n] * packet_t;
+                        }
+                        Simd last_coordinate = 1;
+                        for (unsigned k = 0; k < N - 1; ++k)
+                        {
+                                const unsigned plane = PLANES + k * (N + 1);
+                                Simd coordinate = point[0] * load(plane);
+                                for (unsigned n = 1; n < N; ++n)
+                                {
+                                        coordinate += point[n] * load(plane + n);
+                                }
+                                coordinate -= load(plane + N);
+                                mask = mask && (coordinate > 0) && (coordinate < 1);
+                                last_coordinate -= coordinate;
+                        }
+                        mask = mask && (last_coordinate > 0);
+                        if (stdx::none_of(mask))
+                        {
+                                continue;
+                        }
+
+                        if constexpr (ANY_INTERSECTION)
+                        {
+                                return first + stdx::find_first_set(mask);
+                        }
+
+                        stdx::where(!mask, packet_t) = max_distance;
+                        min_t = stdx::hmin(packet_t);
+                        position = first + stdx::find_first_set(mask && (packet_t == min_t));
+                }
+
+                *t = min_t;
+                return position;
+        }
+#else
+        template <bool ANY_INTERSECTION>
+        int find_intersection(int first_packet, int object_count, const Ray<N, T>& ray, T max_distance, T* t) const
+        {
+                T min_t = max_distance;
+                int position = -1;
+
+                for (int i = 0; i < object_count; ++i)
+                {
+                        const T* const data = packet(first_packet + i);
+
+                        T s = data[NORMAL] * ray.dir()[0];
+                        T d = (data[VERTEX] - ray.org()[0]) * data[NORMAL];
+                        for (unsigned n = 1; n < N; ++n)
+                        {
+                                s = any_fma(data[NORMAL + n], ray.dir()[n], s);
+                                d = any_fma(data[VERTEX + n] - ray.org()[n], data[NORMAL + n], d);
+                        }
+                        if (s == 0)
+                        {
+                                continue;
+                        }
+                        T object_t = d / s;
+                        if (!(object_t > 0 && object_t < min_t))
+                        {
+                                continue;
+                        }
+
+                        Vector<N, T> point = ray.point(object_t);
+                        T last_coordinate = 1;
+                        bool inside = true;
+                        for (unsigned k = 0; k < N - 1 && inside; ++k)
+                        {
+                                const unsigned plane = PLANES + k * (N + 1);
+                                T coordinate = point[0] * data[plane];
+                                for (unsigned n = 1; n < N; ++n)
+                                {
+                                        coordinate = any_fma(point[n], data[plane + n], coordinate);
+                                }
+                                coordinate -= data[plane + N];
+                                inside = coordinate > 0 && coordinate < 1;
+                                last_coordinate -= coordinate;
+                        }
+                        if (!inside || !(last_coordinate > 0))
+                        {
+                                continue;
+                        }
+
+                        if constexpr (ANY_INTERSECTION)
+                        {
+                                return i;
+                        }
+
+                        min_t = object_t;
+                        position = i;
+                }
+
+                *t = min_t;
+                return position;
+        }
+#endif
+
+        int leaf_offset(const Span<const int>& object_indices) const
+        {
+                const long long offset = object_indices.data() - m_object_indices;
+                ASSERT(offset >= 0 && static_cast<size_t>(offset) + object_indices.size() <= m_leaf_packets.size());
+                ASSERT(m_leaf_packets[offset] != NO_PACKET);
+                return offset;
+        }
+
+public:
+        static constexpr int packet_size()
+        {
+                return PACKET_SIZE;
+        }
+
+        // Грани objects в порядке листьев структуры поиска пересечений hierarchy.
+        // Функция hierarchy.object_indices() возвращает номера объектов всех листьев,
+        // функция hierarchy.for_each_leaf(f) вызывает f(offset, count) для каждого листа.
+        // Структура должна существовать и не изменяться всё время использования этого объекта.
+        template <typename Simplex, typename Hierarchy>
+        void set_data(const std::vector<Simplex>& objects, const Hierarchy& hierarchy)
+        {
+                const std::vector<int>& object_indices = hierarchy.object_indices();
+
+                m_object_indices = object_indices.data();
+                m_leaf_packets.clear();
+                m_leaf_packets.resize(object_indices.size(), NO_PACKET);
+                m_leaf_packets.shrink_to_fit();
+
+                int packet_count = 0;
+                hierarchy.for_each_leaf([&](int offset, int count) {
+                        if (count > 0)
+                        {
+                                m_leaf_packets[offset] = packet_count;
+                                packet_count += (count + PACKET_SIZE - 1) / PACKET_SIZE;
+                        }
+                });
+
+                m_data.clear();
+                m_data.resize(static_cast<size_t>(packet_count) * (COMPONENT_COUNT * PACKET_SIZE), 0);
+                m_data.shrink_to_fit();
+
+                hierarchy.for_each_leaf([&](int offset, int count) {
+                        for (int i = 0; i < count; ++i)
+                        {
+                                const Simplex& object = objects[object_indices[offset + i]];
+                                const Vector<N, T> vertex = object.vertices()[0];
+                                const Vector<N, T> normal = object.geometric_normal();
+                                const HyperplaneSimplexGeometry<N, T>& geometry = object.geometry();
+
+                                T* const data = &m_data[static_cast<size_t>(m_leaf_packets[offset] + i / PACKET_SIZE) *
+                                                        (COMPONENT_COUNT * PACKET_SIZE)];
+                                const int lane = i % PACKET_SIZE;
+
+                                for (unsigned n = 0; n < N; ++n)
+                                {
+                                        data[(VERTEX + n) * PACKET_SIZE + lane] = vertex[n];
+                                        data[(NORMAL + n) * PACKET_SIZE + lane] = normal[n];
+                                }
+                                for (unsigned k = 0; k < N - 1; ++k)
+                                {
+                                        const unsigned plane = PLANES + k * (N + 1);
+                                        for (unsigned n = 0; n < N; ++n)
+                                        {
+                                                data[(plane + n) * PACKET_SIZE + lane] = geometry.barycentric_plane_n(k)[n];
+                                        }
+                                        data[(plane + N) * PACKET_SIZE + lane] = geometry.barycentric_plane_d(k);
+                                }
+                        }
+                });
+        }
+
+        // Ближайшее пересечение с гранями листа object_indices на расстоянии меньше max_distance.
+        // Параметр object_indices должен быть номерами объектов листа структуры из set_data.
+        bool intersect(const Span<const int>& object_indices, const Ray<N, T>& ray, T max_distance, T* t,
+                       int* object_index) const
+        {
+                if (object_indices.empty())
+                {
+                        return false;
+                }
+                const int offset = leaf_offset(object_indices);
+                const int position =
+                        find_intersection<false>(m_leaf_packets[offset], object_indices.size(), ray, max_distance, t);
+                if (position < 0)
+                {
+                        return false;
+                }
+                *object_index = object_indices[position];
+                return true;
+        }
+
+        // Есть ли пересечение с гранями листа object_indices на расстоянии меньше max_distance
+        bool intersect_any(const Span<const int>& object_indices, const Ray<N, T>& ray, T max_distance) const
+        {
+                if (object_indices.empty())
+                {
+                        return false;
+                }
+                const int offset = leaf_offset(object_indices);
+                T t;
+                return find_intersection<true>(m_leaf_packets[offset], object_indices.size(), ray, max_distance, &t) >= 0;
+        }
+};
@@ -46,6 +46,7 @@ class HyperplaneSimplexWrapperForShapeIntersection
         const Simplex& m_simplex;
 
         Vertices m_vertices;
+        Vector<N, T> m_normal;
         Constraints m_constraints;
         ConstraintsEq m_constraints_eq;
         Vector<N, T> m_min, m_max;
@@ -55,7 +56,8 @@ public:
         static constexpr size_t SHAPE_DIMENSION = N - 1;
         using DataType = T;
 
-        HyperplaneSimplexWrapperForShapeIntersection(const Simplex& s) : m_simplex(s), m_vertices(s.vertices())
+        HyperplaneSimplexWrapperForShapeIntersection(const Simplex& s)
+                : m_simplex(s), m_vertices(s.vertices()), m_normal(s.geometric_normal())
         {
                 static_assert(std::remove_reference_t<decltype(s.vertices())>().size() == N);
 
@@ -74,6 +76,12 @@ public:
                 return m_vertices;
         }
 
+        // Единичный перпендикуляр к гиперплоскости симплекса
+        const Vector<N, T>& normal() const
+        {
+                return m_normal;
+        }
+
         const Constraints& constraints() const
         {
                 return m_constraints;
@@ -118,6 +126,7 @@ class HyperplaneSimplexWrapperForShapeIntersection<Simplex, std::enable_if_t<Sim
         const Simplex& m_simplex;
 
         Vertices m_vertices;
+        Vector<N, T> m_normal;
         VertexRidges m_vertex_ridges;
 
 public:
@@ -125,7 +134,8 @@ public:
         static constexpr size_t SHAPE_DIMENSION = N - 1;
         using DataType = T;
 
-        HyperplaneSimplexWrapperForShapeIntersection(const Simplex& s) : m_simplex(s), m_vertices(s.vertices())
+        HyperplaneSimplexWrapperForShapeIntersection(const Simplex& s)
+                : m_simplex(s), m_vertices(s.vertices()), m_normal(s.geometric_normal())
         {
                 static_assert(std::remove_reference_t<decltype(s.vertices())>().size() == N);
 
@@ -149,6 +159,12 @@ public:
                 return m_vertices;
         }
 
+        // Единичный перпендикуляр к гиперплоскости симплекса
+        const Vector<N, T>& normal() const
+        {
+                return m_normal;
+        }
+
         const VertexRidges& vertex_ridges() const
         {
                 return m_vertex_ridges;
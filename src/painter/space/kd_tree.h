@@ -0,0 +1,876 @@
+/*
+Copyright (C) 2017-2019 Topological Manifold
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ Matt Pharr, Wenzel Jakob, Greg Humphreys.
+ Physically Based Rendering. From theory to implementation. Third edition.
+ Elsevier, 2017.
+
+ 4.4 Kd-tree accelerator.
+*/
+
+/*
+ Ingo Wald, Vlastimil Havran.
+ On building fast kd-Trees for Ray Tracing, and on doing that in O(N log N).
+ IEEE Symposium on Interactive Ray Tracing, 2006.
+
+ Разделение объектов по частям вершины с проверкой пересечения
+ объектов с частями (perfect splits), а не только по их границам.
+*/
+
+#pragma once
+
+#include "box_simplex_intersection.h"
+#include "ray_packet.h"
+
+#include "com/error.h"
+#include "com/print.h"
+#include "com/ray.h"
+#include "com/span.h"
+#include "com/thread.h"
+#include "com/type/limit.h"
+#include "com/vec.h"
+#include "progress/progress.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+namespace kd_tree_implementation
+{
+template <size_t N, typename T>
+struct BoundingBox
+{
+        Vector<N, T> min{limits<T>::max()};
+        Vector<N, T> max{limits<T>::lowest()};
+
+        void add(const Vector<N, T>& p)
+        {
+                min = min_vector(min, p);
+                max = max_vector(max, p);
+        }
+
+        void add(const BoundingBox& box)
+        {
+                min = min_vector(min, box.min);
+                max = max_vector(max, box.max);
+        }
+};
+
+// Мера границы параллелотопа без множителя 2 — сумма произведений
+// всех размеров, кроме одного. Для N = 3 это половина площади поверхности.
+template <size_t N, typename T>
+T surface(const Vector<N, T>& sizes)
+{
+        T sum = 0;
+        for (unsigned i = 0; i < N; ++i)
+        {
+                T product = 1;
+                for (unsigned j = 0; j < N; ++j)
+                {
+                        if (j != i)
+                        {
+                                product *= sizes[j];
+                        }
+                }
+                sum += product;
+        }
+        return sum;
+}
+
+// Отрезок [near, far] луча внутри параллелотопа, пересечённый с отрезком [0, max_t].
+// Нулевые координаты направления обрабатываются отдельно, так как с -Ofast
+// нельзя рассчитывать на NaN и бесконечности при делении на 0.
+template <size_t N, typename T>
+bool intersect(const BoundingBox<N, T>& box, const Vector<N, T>& org, const Vector<N, T>& dir,
+               const Vector<N, T>& dir_reciprocal, T max_t, T* near, T* far)
+{
+        *near = 0;
+        *far = max_t;
+        for (unsigned i = 0; i < N; ++i)
+        {
+                if (dir[i] == 0)
+                {
+                        if (org[i] < box.min[i] || org[i] > box.max[i])
+                        {
+                                // параллельно плоскостям и снаружи
+                                return false;
+                        }
+                        // внутри плоскостей
+                        continue;
+                }
+                T t1 = (box.min[i] - org[i]) * dir_reciprocal[i];
+                T t2 = (box.max[i] - org[i]) * dir_reciprocal[i];
+                if (dir_reciprocal[i] < 0)
+                {
+                        std::swap(t1, t2);
+                }
+                *near = std::max(*near, t1);
+                *far = std::min(*far, t2);
+                if (*near > *far)
+                {
+                        return false;
+                }
+        }
+        return true;
+}
+
+template <typename T>
+struct Node
+{
+        static constexpr int LEAF = -1;
+
+        // Для внутренней вершины — положение плоскости деления
+        T split;
+        // Для внутренней вершины — номер оси, перпендикулярной плоскости деления,
+        // для листа — LEAF.
+        int axis;
+        // Для листа — начало индексов объектов, для внутренней вершины —
+        // индекс первого из двух соседних потомков, ниже и выше плоскости деления.
+        int offset;
+        // Для листа — количество объектов, которое может быть равно 0.
+        int object_count;
+};
+
+// Поддерево, которое строится отдельно в одном из потоков
+template <size_t N, typename T>
+struct Subtree
+{
+        int node_index;
+        std::vector<int> objects;
+        BoundingBox<N, T> box;
+        int depth;
+        int bad_refines;
+};
+
+template <size_t N, typename T, typename Object>
+class Build
+{
+        // Стоимости перехода через вершину и пересечения с пакетом объектов
+        static constexpr T TRAVERSAL_COST = 1;
+        static constexpr T INTERSECTION_COST = 2;
+        // Уменьшение стоимости деления, при котором одна из частей пустая
+        static constexpr T EMPTY_BONUS = 0.5;
+        // Количество делений, не уменьшающих стоимость, после которого создаётся лист
+        static constexpr int MAX_BAD_REFINES = 3;
+
+        struct Edge
+        {
+                T position;
+                int object;
+                // При равных положениях начала объектов раньше концов
+                bool end;
+
+                bool operator<(const Edge& e) const
+                {
+                        return (position < e.position) || (position == e.position && !end && e.end);
+                }
+        };
+
+        const std::vector<const Object*>& m_objects;
+        const std::vector<BoundingBox<N, T>>& m_object_boxes;
+        const int m_distance_from_flat_shapes_in_epsilons;
+        const int m_max_depth;
+        const int m_max_objects_per_leaf;
+        const int m_packet_size;
+
+        // Объекты листа пересекаются пакетами по m_packet_size объектов,
+        // поэтому стоимость пересечения определяется количеством пакетов
+        T intersection_cost(int count) const
+        {
+                return INTERSECTION_COST * ((count + m_packet_size - 1) / m_packet_size);
+        }
+
+        bool intersect(int object, const BoundingBox<N, T>& box) const
+        {
+                return box_simplex_intersection(box.min, box.max, *m_objects[object],
+                                                static_cast<T>(m_distance_from_flat_shapes_in_epsilons));
+        }
+
+        // Плоскость деления с наименьшей стоимостью по площадям поверхностей частей
+        bool split(const std::vector<int>& objects, const BoundingBox<N, T>& box, int* bad_refines, int* split_axis,
+                   T* split_position) const
+        {
+                const int count = objects.size();
+
+                const Vector<N, T> sizes = box.max - box.min;
+                const T box_surface = surface(sizes);
+                if (!(box_surface > 0))
+                {
+                        return false;
+                }
+
+                const T leaf_cost = intersection_cost(count);
+
+                T best_cost = limits<T>::max();
+                int best_axis = -1;
+                T best_position = 0;
+
+                std::vector<Edge> edges(2 * count);
+
+                for (unsigned axis = 0; axis < N; ++axis)
+                {
+                        if (!(sizes[axis] > 0))
+                        {
+                                continue;
+                        }
+
+                        // Границы объектов ограничиваются вершиной
+                        for (int i = 0; i < count; ++i)
+                        {
+                                const BoundingBox<N, T>& object_box = m_object_boxes[objects[i]];
+                                edges[2 * i] = {std::max(object_box.min[axis], box.min[axis]), objects[i], false};
+                                edges[2 * i + 1] = {std::min(object_box.max[axis], box.max[axis]), objects[i], true};
+                        }
+                        std::sort(edges.begin(), edges.end());
+
+                        // Размеры частей по оси деления меняются, а по остальным осям совпадают
+                        Vector<N, T> part_sizes = sizes;
+
+                        int count_below = 0;
+                        int count_above = count;
+                        for (const Edge& edge : edges)
+                        {
+                                if (edge.end)
+                                {
+                                        --count_above;
+                                }
+
+                                if (edge.position > box.min[axis] && edge.position < box.max[axis])
+                                {
+                                        part_sizes[axis] = edge.position - box.min[axis];
+                                        const T surface_below = surface(part_sizes);
+                                        part_sizes[axis] = box.max[axis] - edge.position;
+                                        const T surface_above = surface(part_sizes);
+
+                                        const T bonus = (count_below == 0 || count_above == 0) ? EMPTY_BONUS : 0;
+                                        const T cost = TRAVERSAL_COST + (1 - bonus) *
+                                                                                (surface_below * intersection_cost(count_below) +
+                                                                                 surface_above * intersection_cost(count_above)) /
+                                                                                box_surface;
+                                        if (cost < best_cost)
+                                        {
+                                                best_cost = cost;
+                                                best_axis = axis;
+                                                best_position = edge.position;
+                                        }
+                                }
+
+                                if (!edge.end)
+                                {
+                                        ++count_below;
+                                }
+                        }
+                }
+
+                if (best_axis < 0)
+                {
+                        return false;
+                }
+
+                if (best_cost > leaf_cost)
+                {
+                        ++(*bad_refines);
+                }
+
+                if ((best_cost > 4 * leaf_cost && count < 16) || *bad_refines == MAX_BAD_REFINES)
+                {
+                        return false;
+                }
+
+                *split_axis = best_axis;
+                *split_position = best_position;
+
+                return true;
+        }
+
+public:
+        Build(const std::vector<const Object*>& objects, const std::vector<BoundingBox<N, T>>& object_boxes,
+              int distance_from_flat_shapes_in_epsilons, int max_depth, int max_objects_per_leaf, int packet_size)
+                : m_objects(objects),
+                  m_object_boxes(object_boxes),
+                  m_distance_from_flat_shapes_in_epsilons(distance_from_flat_shapes_in_epsilons),
+                  m_max_depth(max_depth),
+                  m_max_objects_per_leaf(max_objects_per_leaf),
+                  m_packet_size(packet_size)
+        {
+        }
+
+        // Построение поддерева объектов objects с корнем в (*nodes)[node_index].
+        // Номера объектов листьев добавляются в object_indices. Если subtrees
+        // не nullptr, то поддеревья с количеством объектов не более
+        // subtree_object_count не строятся, а добавляются в subtrees.
+        void build(int node_index, std::vector<int>&& objects, const BoundingBox<N, T>& box, int depth, int bad_refines,
+                   std::vector<Node<T>>* nodes, std::vector<int>* object_indices, int subtree_object_count,
+                   std::vector<Subtree<N, T>>* subtrees) const
+        {
+                const int count = objects.size();
+
+                if (subtrees && count <= subtree_object_count)
+                {
+                        subtrees->push_back({node_index, std::move(objects), box, depth, bad_refines});
+                        return;
+                }
+
+                int axis;
+                T position;
+                if (count <= m_max_objects_per_leaf || depth >= m_max_depth ||
+                    !split(objects, box, &bad_refines, &axis, &position))
+                {
+                        (*nodes)[node_index].axis = Node<T>::LEAF;
+                        (*nodes)[node_index].offset = object_indices->size();
+                        (*nodes)[node_index].object_count = count;
+                        object_indices->insert(object_indices->end(), objects.cbegin(), objects.cend());
+                        return;
+                }
+
+                BoundingBox<N, T> box_below = box;
+                box_below.max[axis] = position;
+                BoundingBox<N, T> box_above = box;
+                box_above.min[axis] = position;
+
+                // Объекты, границы которых находятся по обе стороны плоскости деления,
+                // добавляются только в те части, с которыми они пересекаются. При N > 3
+                // проверка пересечения не точная, и объект может быть добавлен в часть,
+                // с которой он не пересекается, но не может быть пропущен.
+                std::vector<int> objects_below;
+                std::vector<int> objects_above;
+                for (int object : objects)
+                {
+                        const bool below = m_object_boxes[object].min[axis] <= position;
+                        const bool above = m_object_boxes[object].max[axis] >= position;
+                        if (below && above)
+                        {
+                                if (intersect(object, box_below))
+                                {
+                                        objects_below.push_back(object);
+                                }
+                                if (intersect(object, box_above))
+                                {
+                                        objects_above.push_back(object);
+                                }
+                        }
+                        else if (below)
+                        {
+                                objects_below.push_back(object);
+                        }
+                        else
+                        {
+                                objects_above.push_back(object);
+                        }
+                }
+                objects.clear();
+                objects.shrink_to_fit();
+
+                int child = nodes->size();
+                nodes->resize(child + 2);
+
+                (*nodes)[node_index].split = position;
+                (*nodes)[node_index].axis = axis;
+                (*nodes)[node_index].offset = child;
+                (*nodes)[node_index].object_count = 0;
+
+                build(child, std::move(objects_below), box_below, depth + 1, bad_refines, nodes, object_indices,
+                      subtree_object_count, subtrees);
+                build(child + 1, std::move(objects_above), box_above, depth + 1, bad_refines, nodes, object_indices,
+                      subtree_object_count, subtrees);
+        }
+};
+}
+
+// Двоичное дерево деления пространства плоскостями, перпендикулярными осям координат,
+// для симплексов размерности N - 1, пригодных для box_simplex_intersection.
+// В отличие от дерева деления на 2^N частей, количество потомков у вершин
+// не зависит от количества измерений.
+template <size_t N, typename T>
+class KdTree
+{
+        static_assert(std::is_floating_point_v<T>);
+
+        using BoundingBox = kd_tree_implementation::BoundingBox<N, T>;
+        using Node = kd_tree_implementation::Node<T>;
+
+        // Расширение границ объектов в каждую сторону для плоских объектов
+        // и для учёта ошибок плавающей точки.
+        static constexpr int DISTANCE_FROM_FLAT_SHAPES_IN_EPSILONS = 10;
+
+        static constexpr int MAX_DEPTH = 64;
+
+        // Количество поддеревьев на поток при параллельном построении
+        static constexpr int SUBTREES_PER_THREAD = 8;
+
+        static constexpr int ROOT_NODE = 0;
+
+        std::vector<Node> m_nodes;
+        std::vector<int> m_object_indices;
+        BoundingBox m_box;
+
+        static int max_depth(int object_count)
+        {
+                return std::min<int>(MAX_DEPTH, std::lround(8 + 1.3 * std::log2(object_count)));
+        }
+
+public:
+        // Параметр packet_size — количество объектов листа, пересекаемых лучом одновременно
+        template <typename FunctorObjectPointer>
+        void decompose(int max_objects_per_leaf, int packet_size, int object_index_count,
+                       const FunctorObjectPointer& functor_object_pointer, unsigned thread_count, ProgressRatio* progress)
+        {
+                static_assert(std::is_pointer_v<decltype(functor_object_pointer(0))>);
+                static_assert(std::is_const_v<std::remove_pointer_t<decltype(functor_object_pointer(0))>>);
+
+                namespace impl = kd_tree_implementation;
+
+                using Object = std::remove_const_t<std::remove_pointer_t<decltype(functor_object_pointer(0))>>;
+
+                if (object_index_count <= 0)
+                {
+                        error("No objects for k-d tree");
+                }
+
+                if (max_objects_per_leaf <= 0)
+                {
+                        error("K-d tree maximum object count per leaf " + to_string(max_objects_per_leaf) + " is not positive");
+                }
+
+                if (packet_size <= 0)
+                {
+                        error("K-d tree packet size " + to_string(packet_size) + " is not positive");
+                }
+
+                std::vector<const Object*> object_pointers(object_index_count);
+                std::vector<BoundingBox> object_boxes(object_index_count);
+                BoundingBox box;
+                for (int i = 0; i < object_index_count; ++i)
+                {
+                        object_pointers[i] = functor_object_pointer(i);
+                        BoundingBox& object_box = object_boxes[i];
+                        for (const Vector<N, T>& v : object_pointers[i]->vertices())
+                        {
+                                object_box.add(v);
+                        }
+                        for (unsigned n = 0; n < N; ++n)
+                        {
+                                T guard_region_size = std::max(std::abs(object_box.min[n]), std::abs(object_box.max[n])) *
+                                                      (DISTANCE_FROM_FLAT_SHAPES_IN_EPSILONS * limits<T>::epsilon());
+                                object_box.min[n] -= guard_region_size;
+                                object_box.max[n] += guard_region_size;
+                        }
+                        box.add(object_box);
+                }
+
+                std::vector<int> objects(object_index_count);
+                for (int i = 0; i < object_index_count; ++i)
+                {
+                        objects[i] = i;
+                }
+
+                const impl::Build<N, T, Object> build(object_pointers, object_boxes, DISTANCE_FROM_FLAT_SHAPES_IN_EPSILONS,
+                                                      max_depth(object_index_count), max_objects_per_leaf, packet_size);
+
+                std::vector<Node> nodes(1);
+                std::vector<int> object_indices;
+
+                if (thread_count <= 1)
+                {
+                        build.build(ROOT_NODE, std::move(objects), box, 0, 0, &nodes, &object_indices, 0, nullptr);
+                }
+                else
+                {
+                        // Верхние уровни строятся последовательно, а поддеревья параллельно,
+                        // каждое в свои массивы вершин и номеров объектов с последующим объединением.
+
+                        const int subtree_object_count = std::max(1u, object_index_count / (thread_count * SUBTREES_PER_THREAD));
+
+                        std::vector<impl::Subtree<N, T>> subtrees;
+                        build.build(ROOT_NODE, std::move(objects), box, 0, 0, &nodes, &object_indices, subtree_object_count,
+                                    &subtrees);
+
+                        std::vector<std::vector<Node>> subtree_nodes(subtrees.size());
+                        std::vector<std::vector<int>> subtree_object_indices(subtrees.size());
+                        std::atomic_int next_subtree = 0;
+                        AtomicCounter<int> subtree_count = 0;
+
+                        ThreadsWithCatch threads(thread_count);
+                        for (unsigned i = 0; i < thread_count; ++i)
+                        {
+                                threads.add([&]() {
+                                        int s;
+                                        while ((s = next_subtree++) < static_cast<int>(subtrees.size()))
+                                        {
+                                                subtree_nodes[s].resize(1);
+                                                build.build(0, std::move(subtrees[s].objects), subtrees[s].box, subtrees[s].depth,
+                                                            subtrees[s].bad_refines, &subtree_nodes[s],
+                                                            &subtree_object_indices[s], 0, nullptr);
+                                                ++subtree_count;
+                                                progress->set(subtree_count, subtrees.size());
+                                        }
+                                });
+                        }
+                        threads.join();
+
+                        for (size_t s = 0; s < subtrees.size(); ++s)
+                        {
+                                // Индексы потомков в поддереве начинаются с 1,
+                                // а номера объектов листьев начинаются с 0
+                                const int node_shift = static_cast<int>(nodes.size()) - 1;
+                                const int object_shift = object_indices.size();
+                                for (Node& node : subtree_nodes[s])
+                                {
+                                        node.offset += (node.axis == Node::LEAF) ? object_shift : node_shift;
+                                }
+                                nodes[subtrees[s].node_index] = subtree_nodes[s][0];
+                                nodes.insert(nodes.end(), subtree_nodes[s].cbegin() + 1, subtree_nodes[s].cend());
+                                object_indices.insert(object_indices.end(), subtree_object_indices[s].cbegin(),
+                                                      subtree_object_indices[s].cend());
+                                subtree_nodes[s].clear();
+                                subtree_nodes[s].shrink_to_fit();
+                                subtree_object_indices[s].clear();
+                                subtree_object_indices[s].shrink_to_fit();
+                        }
+                }
+
+                nodes.shrink_to_fit();
+                object_indices.shrink_to_fit();
+
+                m_nodes = std::move(nodes);
+                m_object_indices = std::move(object_indices);
+                m_box = box;
+        }
+
+        int node_count() const
+        {
+                return m_nodes.size();
+        }
+
+        // Номера объектов всех листьев. Объект может находиться в нескольких
+        // листьях. Функторы поиска пересечений получают части этого массива.
+        const std::vector<int>& object_indices() const
+        {
+                return m_object_indices;
+        }
+
+        // Для каждого непустого листа вызывается functor(offset, count),
+        // где offset и count задают часть массива object_indices()
+        template <typename Functor>
+        void for_each_leaf(const Functor& functor) const
+        {
+                for (const Node& node : m_nodes)
+                {
+                        if (node.axis == Node::LEAF && node.object_count > 0)
+                        {
+                                functor(node.offset, node.object_count);
+                        }
+                }
+        }
+
+        bool intersect_root(const Ray<N, T>& ray, T* t) const
+        {
+                Vector<N, T> dir_reciprocal;
+                for (unsigned i = 0; i < N; ++i)
+                {
+                        dir_reciprocal[i] = 1 / ray.dir()[i];
+                }
+                T far;
+                return kd_tree_implementation::intersect(m_box, ray.org(), ray.dir(), dir_reciprocal, limits<T>::max(), t,
+                                                         &far);
+        }
+
+        // Функция functor_find_intersection(indices, max_t, &t) должна находить ближайшее
+        // пересечение с объектами indices на расстоянии меньше max_t.
+        // Объекты находятся в нескольких листьях, поэтому найденное в листе
+        // пересечение может находиться за пределами листа.
+        template <typename FunctorFindIntersection>
+        bool trace_ray(const Ray<N, T>& ray, const FunctorFindIntersection& functor_find_intersection) const
+        {
+                return traverse(ray, limits<T>::max(), [&](const Span<const int>& object_indices, T* max_t) {
+                        T t;
+                        if (functor_find_intersection(object_indices, *max_t, &t))
+                        {
+                                *max_t = t;
+                                return true;
+                        }
+                        return false;
+                });
+        }
+
+        // Совместный обход для лучей пакета из маски. Массив max_t содержит
+        // для всех лучей пакета расстояния до найденных пересечений.
+        // Функция functor_find_intersections(indices, leaf_mask) должна находить
+        // для лучей leaf_mask пересечения с объектами indices на расстояниях
+        // меньше max_t[i] и уменьшать max_t[i] для найденных пересечений.
+        template <typename FunctorFindIntersections>
+        void trace_packet(const RayPacket<N, T>& packet, typename RayPacket<N, T>::Mask mask, const T* max_t,
+                          const FunctorFindIntersections& functor_find_intersections) const
+        {
+                using Packet = RayPacket<N, T>;
+                using Mask = typename Packet::Mask;
+
+                struct StackEntry
+                {
+                        int node_index;
+                        Mask mask;
+                        BoundingBox box;
+                };
+
+                const int size = packet.size();
+
+                // Отрезки лучей внутри текущей вершины и внутри её потомков
+                // ниже (0) и выше (1) плоскости деления
+                std::array<T, Packet::MAX_SIZE> near;
+                std::array<T, Packet::MAX_SIZE> far;
+                std::array<std::array<T, Packet::MAX_SIZE>, 2> child_near;
+                std::array<std::array<T, Packet::MAX_SIZE>, 2> child_far;
+
+                BoundingBox box = m_box;
+                Mask node_mask = intersect_box(box.min, box.max, packet, mask, max_t, near.data(), far.data());
+                if (node_mask == 0)
+                {
+                        return;
+                }
+
+                // Глубина дерева не больше MAX_DEPTH, и на каждом уровне
+                // в стек добавляется не больше одной вершины.
+                std::array<StackEntry, MAX_DEPTH + 1> stack;
+                int stack_size = 0;
+
+                int node_index = ROOT_NODE;
+
+                while (true)
+                {
+                        const Node& node = m_nodes[node_index];
+
+                        if (node.axis != Node::LEAF)
+                        {
+                                const int axis = node.axis;
+                                const T* org = packet.org(axis);
+                                const T* dir = packet.dir(axis);
+                                const T* dir_reciprocal = packet.dir_reciprocal(axis);
+
+                                std::array<Mask, 2> child_mask = {0, 0};
+                                std::array<T, 2> child_min_t = {limits<T>::max(), limits<T>::max()};
+
+                                for (int i = 0; i < size; ++i)
+                                {
+                                        if (!Packet::contains(node_mask, i))
+                                        {
+                                                continue;
+                                        }
+
+                                        if (dir[i] == 0)
+                                        {
+                                                // Луч параллелен плоскости деления и находится в части
+                                                // со своим началом или, если начало на плоскости, в обеих
+                                                const bool below = org[i] <= node.split;
+                                                const bool above = org[i] >= node.split;
+                                                child_near[0][i] = below ? near[i] : limits<T>::max();
+                                                child_far[0][i] = below ? far[i] : limits<T>::lowest();
+                                                child_near[1][i] = above ? near[i] : limits<T>::max();
+                                                child_far[1][i] = above ? far[i] : limits<T>::lowest();
+                                        }
+                                        else
+                                        {
+                                                // Часть, в которой находится начало луча, до плоскости
+                                                // деления, а другая часть после плоскости
+                                                const T t = (node.split - org[i]) * dir_reciprocal[i];
+                                                const int first = (dir[i] > 0) ? 0 : 1;
+                                                child_near[first][i] = near[i];
+                                                child_far[first][i] = std::min(far[i], t);
+                                                child_near[1 - first][i] = std::max(near[i], t);
+                                                child_far[1 - first][i] = far[i];
+                                        }
+
+                                        for (int c = 0; c < 2; ++c)
+                                        {
+                                                if (child_near[c][i] <= std::min(child_far[c][i], max_t[i]))
+                                                {
+                                                        child_mask[c] |= Packet::ray_mask(i);
+                                                        child_min_t[c] = std::min(child_min_t[c], child_near[c][i]);
+                                                }
+                                        }
+                                }
+
+                                std::array<BoundingBox, 2> child_box = {box, box};
+                                child_box[0].max[axis] = node.split;
+                                child_box[1].min[axis] = node.split;
+
+                                if (child_mask[0] != 0 || child_mask[1] != 0)
+                                {
+                                        // Первой обходится часть с ближайшим входом какого-либо луча
+                                        const int first = (child_mask[1] == 0 ||
+                                                           (child_mask[0] != 0 && child_min_t[0] <= child_min_t[1]))
+                                                                  ? 0
+                                                                  : 1;
+                                        const int second = 1 - first;
+
+                                        if (child_mask[second] != 0)
+                                        {
+                                                stack[stack_size++] = {node.offset + second, child_mask[second],
+                                                                       child_box[second]};
+                                        }
+
+                                        node_index = node.offset + first;
+                                        node_mask = child_mask[first];
+                                        near = child_near[first];
+                                        far = child_far[first];
+                                        box = child_box[first];
+                                        continue;
+                                }
+                        }
+                        else if (node.object_count > 0)
+                        {
+                                functor_find_intersections(Span<const int>(&m_object_indices[node.offset], node.object_count),
+                                                           node_mask);
+                        }
+
+                        // Следующая вершина из стека. Отрезки лучей находятся заново,
+                        // так как после добавления в стек значения max_t могли уменьшиться.
+                        do
+                        {
+                                if (stack_size == 0)
+                                {
+                                        return;
+                                }
+                                --stack_size;
+                                node_index = stack[stack_size].node_index;
+                                box = stack[stack_size].box;
+                                node_mask = intersect_box(box.min, box.max, packet, stack[stack_size].mask, max_t, near.data(),
+                                                          far.data());
+                        } while (node_mask == 0);
+                }
+        }
+
+        // Функция functor_any_intersection(indices) должна определять, есть ли пересечение
+        // с объектами indices на расстоянии меньше max_distance. Обход прекращается
+        // при первом найденном пересечении.
+        template <typename FunctorAnyIntersection>
+        bool occluded(const Ray<N, T>& ray, T max_distance, const FunctorAnyIntersection& functor_any_intersection) const
+        {
+                return traverse(ray, max_distance, [&](const Span<const int>& object_indices, T* max_t) {
+                        if (functor_any_intersection(object_indices))
+                        {
+                                *max_t = 0;
+                                return true;
+                        }
+                        return false;
+                });
+        }
+
+private:
+        // Обход листьев вдоль луча от ближних к дальним, пока входы в листья
+        // не дальше max_t. Функция functor_leaf(indices, &max_t) может уменьшать max_t.
+        template <typename FunctorLeaf>
+        bool traverse(const Ray<N, T>& ray, T max_t, const FunctorLeaf& functor_leaf) const
+        {
+                namespace impl = kd_tree_implementation;
+
+                struct StackEntry
+                {
+                        int node_index;
+                        T near;
+                        T far;
+                };
+
+                Vector<N, T> dir_reciprocal;
+                for (unsigned i = 0; i < N; ++i)
+                {
+                        dir_reciprocal[i] = 1 / ray.dir()[i];
+                }
+
+                T near;
+                T far;
+                if (!impl::intersect(m_box, ray.org(), ray.dir(), dir_reciprocal, max_t, &near, &far))
+                {
+                        return false;
+                }
+
+                // Глубина дерева не больше MAX_DEPTH, и на каждом уровне
+                // в стек добавляется не больше одной вершины.
+                std::array<StackEntry, MAX_DEPTH + 1> stack;
+                int stack_size = 0;
+
+                int node_index = ROOT_NODE;
+
+                bool found = false;
+
+                while (true)
+                {
+                        const Node& node = m_nodes[node_index];
+
+                        if (node.axis != Node::LEAF)
+                        {
+                                const int axis = node.axis;
+                                const T org = ray.org()[axis];
+
+                                // Первой обходится часть, в которой находится начало луча
+                                const bool below_first = (org < node.split) || (org == node.split && ray.dir()[axis] <= 0);
+                                const int first = below_first ? node.offset : node.offset + 1;
+                                const int second = below_first ? node.offset + 1 : node.offset;
+
+                                if (ray.dir()[axis] == 0)
+                                {
+                                        // Луч параллелен плоскости деления и не переходит в другую
+                                        // часть. Расстояние до плоскости здесь не вычисляется, так как
+                                        // при начале луча на плоскости получается 0 * бесконечность = NaN.
+                                        node_index = first;
+                                        continue;
+                                }
+
+                                const T t = (node.split - org) * dir_reciprocal[axis];
+
+                                if (t > far || t <= 0)
+                                {
+                                        node_index = first;
+                                }
+                                else if (t < near)
+                                {
+                                        node_index = second;
+                                }
+                                else
+                                {
+                                        stack[stack_size++] = {second, t, far};
+                                        node_index = first;
+                                        far = t;
+                                }
+                                continue;
+                        }
+
+                        if (node.object_count > 0 &&
+                            functor_leaf(Span<const int>(&m_object_indices[node.offset], node.object_count), &max_t))
+                        {
+                                found = true;
+                        }
+
+                        // Следующий лист из стека, если вход в него не дальше найденного пересечения
+                        do
+                        {
+                                if (stack_size == 0)
+                                {
+                                        return found;
+                                }
+                                --stack_size;
+                        } while (stack[stack_size].near > max_t);
+
+                        node_index = stack[stack_size].node_index;
+                        near = stack[stack_size].near;
+                        far = stack[stack_size].far;
+                }
+        }
+};
@@ -0,0 +1,192 @@
+/*
+Copyright (C) 2017-2019 Topological Manifold
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "bounding_volume_hierarchy.h"
+#include "ray_packet.h"
+
+#include "com/error.h"
+#include "com/ray.h"
+#include "com/span.h"
+#include "com/type/limit.h"
+#include "com/vec.h"
+#include "progress/progress.h"
+
+#include <array>
+#include <utility>
+#include <vector>
+
+namespace object_hierarchy_implementation
+{
+// Ограничивающий параллелотоп объекта в виде двух противоположных вершин,
+// по которым строится иерархия
+template <size_t N, typename T>
+class ObjectBox
+{
+        std::array<Vector<N, T>, 2> m_vertices;
+
+public:
+        template <typename Object>
+        explicit ObjectBox(const Object& object)
+        {
+                object.min_max(&m_vertices[0], &m_vertices[1]);
+        }
+
+        const std::array<Vector<N, T>, 2>& vertices() const
+        {
+                return m_vertices;
+        }
+};
+}
+
+// Иерархия ограничивающих параллелотопов объектов сцены.
+// Строится один раз, а при поиске пересечений память не выделяется.
+// Объекты должны иметь функции intersect_approximate, intersect_precise,
+// intersect_packet, occluded и min_max, как у GenericObject.
+template <size_t N, typename T, typename Object>
+class ObjectHierarchy
+{
+        // Пересечение с объектом может быть намного дороже перехода через вершину,
+        // поэтому в каждом листе один объект, и объекты за найденным пересечением
+        // отбрасываются по их ограничивающим параллелотопам
+        static constexpr int MAX_OBJECTS_PER_LEAF = 1;
+        static constexpr int PACKET_SIZE = 1;
+
+        std::vector<const Object*> m_objects;
+        BoundingVolumeHierarchy<N, T> m_bvh;
+
+public:
+        explicit ObjectHierarchy(const std::vector<const Object*>& objects) : m_objects(objects)
+        {
+                if (m_objects.empty())
+                {
+                        return;
+                }
+
+                std::vector<object_hierarchy_implementation::ObjectBox<N, T>> boxes;
+                boxes.reserve(m_objects.size());
+                for (const Object* object : m_objects)
+                {
+                        boxes.emplace_back(*object);
+                }
+
+                // Указатель на параллелотоп объекта
+                auto lambda_box = [&b = std::as_const(boxes)](int object_index) { return &b[object_index]; };
+
+                // Объектов мало, поэтому построение в одном потоке
+                ProgressRatio progress(nullptr);
+                m_bvh.decompose(MAX_OBJECTS_PER_LEAF, PACKET_SIZE, m_objects.size(), lambda_box, 1, &progress);
+        }
+
+        ObjectHierarchy(const ObjectHierarchy&) = delete;
+        ObjectHierarchy(ObjectHierarchy&&) = delete;
+        ObjectHierarchy& operator=(const ObjectHierarchy&) = delete;
+        ObjectHierarchy& operator=(ObjectHierarchy&&) = delete;
+
+        // Ближайшее пересечение луча с объектами
+        template <typename Surface, typename Data>
+        bool intersect(const Ray<N, T>& ray, T* t, const Surface** surface, const Data** data) const
+        {
+                if (m_objects.empty())
+                {
+                        return false;
+                }
+
+                return m_bvh.trace_ray(ray, [&](const Span<const int>& object_indices, T max_t, T* leaf_t) -> bool {
+                        // Примерное пересечение сложного объекта может находиться
+                        // дальше точного, поэтому по нему объекты не отбрасываются
+                        bool found = false;
+                        for (int object_index : object_indices)
+                        {
+                                const Object* object = m_objects[object_index];
+
+                                T approximate_t;
+                                T distance;
+                                const Surface* object_surface;
+                                const Data* object_data;
+
+                                if (object->intersect_approximate(ray, &approximate_t) &&
+                                    object->intersect_precise(ray, approximate_t, &distance, &object_surface, &object_data) &&
+                                    distance < max_t)
+                                {
+                                        max_t = distance;
+                                        *surface = object_surface;
+                                        *data = object_data;
+                                        found = true;
+                                }
+                        }
+                        if (found)
+                        {
+                                *leaf_t = max_t;
+                                *t = max_t;
+                        }
+                        return found;
+                });
+        }
+
+        // Ближайшие пересечения всех лучей пакета с объектами. Значения t задаются
+        // для всех лучей пакета, а значения surface и data — только для лучей
+        // из возвращаемой маски лучей с найденными пересечениями.
+        template <typename Surface, typename Data>
+        typename RayPacket<N, T>::Mask intersect_packet(const RayPacket<N, T>& packet, T* t, const Surface** surface,
+                                                        const Data** data) const
+        {
+                for (int i = 0; i < packet.size(); ++i)
+                {
+                        t[i] = limits<T>::max();
+                }
+
+                if (m_objects.empty())
+                {
+                        return 0;
+                }
+
+                typename RayPacket<N, T>::Mask found = 0;
+
+                m_bvh.trace_packet(packet, packet.mask(), t,
+                                   [&](const Span<const int>& object_indices, typename RayPacket<N, T>::Mask leaf_mask) {
+                                           for (int object_index : object_indices)
+                                           {
+                                                   found |= m_objects[object_index]->intersect_packet(packet, leaf_mask, t,
+                                                                                                      surface, data);
+                                           }
+                                   });
+
+                return found;
+        }
+
+        // Есть ли пересечение луча с объектами на расстоянии меньше max_distance
+        bool occluded(const Ray<N, T>& ray, T max_distance) const
+        {
+                if (m_objects.empty())
+                {
+                        return false;
+                }
+
+                return m_bvh.occluded(ray, max_distance, [&](const Span<const int>& object_indices) -> bool {
+                        for (int object_index : object_indices)
+                        {
+                                if (m_objects[object_index]->occluded(ray, max_distance))
+                                {
+                                        return true;
+                                }
+                        }
+                        return false;
+                });
+        }
+};
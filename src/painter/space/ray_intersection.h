@@ -20,89 +20,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "com/ray.h"
 #include "com/type/limit.h"
 
-#include <algorithm>
-#include <tuple>
-
-template <size_t N, typename T, typename Object, typename Surface, typename Data>
-bool ray_intersection(const std::vector<const Object*>& objects, const Ray<N, T>& ray, T* intersection_distance,
-                      const Surface** intersection_surface, const Data** intersection_data)
-{
-        if (objects.size() == 1)
-        {
-                T approximate_distance;
-                T distance;
-                const Surface* surface;
-                const Data* data;
-
-                if (objects[0]->intersect_approximate(ray, &approximate_distance) &&
-                    objects[0]->intersect_precise(ray, approximate_distance, &distance, &surface, &data))
-                {
-                        *intersection_distance = distance;
-                        *intersection_surface = surface;
-                        *intersection_data = data;
-
-                        return true;
-                }
-
-                return false;
-        }
-
-        // Объекты могут быть сложными, поэтому перед поиском точного пересечения
-        // их надо разместить по возрастанию примерного пересечения.
-
-        std::vector<std::tuple<T, const Object*>> approximate_intersections;
-        approximate_intersections.reserve(objects.size());
-
-        for (const Object* obj : objects)
-        {
-                T distance;
-                if (obj->intersect_approximate(ray, &distance))
-                {
-                        approximate_intersections.emplace_back(distance, obj);
-                }
-        }
-
-        if (approximate_intersections.size() == 0)
-        {
-                return false;
-        }
-
-        std::sort(approximate_intersections.begin(), approximate_intersections.end(),
-                  [](const std::tuple<T, const Object*>& a, const std::tuple<T, const Object*>& b) {
-                          return std::get<0>(a) < std::get<0>(b);
-                  });
-
-        T min_distance = limits<T>::max();
-        bool found = false;
-
-        for (const auto& [approximate_distance, object] : approximate_intersections)
-        {
-                if (min_distance < approximate_distance)
-                {
-                        break;
-                }
-
-                T distance;
-                const Surface* surface;
-                const Data* data;
-
-                if (object->intersect_precise(ray, approximate_distance, &distance, &surface, &data) && distance < min_distance)
-                {
-                        min_distance = distance;
-                        *intersection_surface = surface;
-                        *intersection_data = data;
-                        found = true;
-                }
-        }
-
-        if (found)
-        {
-                *intersection_distance = min_distance;
-                return true;
-        }
-
-        return false;
-}
+#include <vector>
 
 template <size_t N, typename T, typename Object>
 bool ray_intersection(const std::vector<const Object*>& objects, const Ray<N, T>& ray, T* intersection_distance,
@@ -131,11 +49,12 @@ bool ray_intersection(const std::vector<const Object*>& objects, const Ray<N, T>
         return false;
 }
 
-template <size_t N, typename T, typename Object>
-bool ray_intersection(const std::vector<Object>& objects, const std::vector<int>& object_indices, const Ray<N, T>& ray,
-                      T* intersection_distance, const Object** intersection_object)
+// Ближайшее пересечение на расстоянии меньше max_distance
+template <size_t N, typename T, typename Object, typename Indices>
+bool ray_intersection(const std::vector<Object>& objects, const Indices& object_indices, const Ray<N, T>& ray,
+                      T max_distance, T* intersection_distance, const Object** intersection_object)
 {
-        T min_distance = limits<T>::max();
+        T min_distance = max_distance;
         bool found = false;
 
         for (int object_index : object_indices)
@@ -157,3 +76,11 @@ bool ray_intersection(const std::vector<Object>& objects, const std::vector<int>
 
         return false;
 }
+
+// Индексы объектов object_indices в контейнере std::vector<int> или Span<const int>
+template <size_t N, typename T, typename Object, typename Indices>
+bool ray_intersection(const std::vector<Object>& objects, const Indices& object_indices, const Ray<N, T>& ray,
+                      T* intersection_distance, const Object** intersection_object)
+{
+        return ray_intersection(objects, object_indices, ray, limits<T>::max(), intersection_distance, intersection_object);
+}
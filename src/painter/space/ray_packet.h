@@ -0,0 +1,186 @@
+/*
+Copyright (C) 2017-2019 Topological Manifold
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "com/error.h"
+#include "com/ray.h"
+#include "com/type/limit.h"
+#include "com/vec.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <limits>
+
+// Пакет лучей для совместного обхода структур поиска пересечений.
+// Лучи пакета, для которых выполняется поиск, задаются битовой маской.
+// Для пересечений с параллелотопами начала лучей, направления и обратные
+// значения направлений хранятся по координатам для всех лучей пакета.
+template <size_t N, typename T>
+class RayPacket
+{
+public:
+        // Для экрана 2 измерений это 8×8 лучей
+        static constexpr int MAX_SIZE = 64;
+
+        using Mask = std::uint_least64_t;
+
+        static_assert(MAX_SIZE <= std::numeric_limits<Mask>::digits);
+
+private:
+        std::array<Ray<N, T>, MAX_SIZE> m_rays;
+        std::array<std::array<T, MAX_SIZE>, N> m_org;
+        std::array<std::array<T, MAX_SIZE>, N> m_dir;
+        std::array<std::array<T, MAX_SIZE>, N> m_dir_reciprocal;
+        std::array<bool, N> m_dir_zero;
+        int m_size = 0;
+
+public:
+        static Mask ray_mask(int index)
+        {
+                return Mask(1) << index;
+        }
+
+        static bool contains(Mask mask, int index)
+        {
+                return (mask >> index) & 1;
+        }
+
+        void clear()
+        {
+                m_dir_zero.fill(false);
+                m_size = 0;
+        }
+
+        void add(const Ray<N, T>& ray)
+        {
+                ASSERT(m_size < MAX_SIZE);
+
+                m_rays[m_size] = ray;
+                for (unsigned i = 0; i < N; ++i)
+                {
+                        m_org[i][m_size] = ray.org()[i];
+                        m_dir[i][m_size] = ray.dir()[i];
+                        m_dir_reciprocal[i][m_size] = 1 / ray.dir()[i];
+                        m_dir_zero[i] = m_dir_zero[i] || ray.dir()[i] == 0;
+                }
+                ++m_size;
+        }
+
+        int size() const
+        {
+                return m_size;
+        }
+
+        // Маска всех лучей пакета
+        Mask mask() const
+        {
+                return (m_size < MAX_SIZE) ? ray_mask(m_size) - 1 : ~Mask(0);
+        }
+
+        const Ray<N, T>& ray(int index) const
+        {
+                ASSERT(index >= 0 && index < m_size);
+
+                return m_rays[index];
+        }
+
+        // Координата n начал всех лучей пакета
+        const T* org(unsigned n) const
+        {
+                return m_org[n].data();
+        }
+
+        // Координата n направлений всех лучей пакета
+        const T* dir(unsigned n) const
+        {
+                return m_dir[n].data();
+        }
+
+        // Есть ли лучи пакета с нулевой координатой n направления
+        bool dir_zero(unsigned n) const
+        {
+                return m_dir_zero[n];
+        }
+
+        // Координата n обратных значений направлений всех лучей пакета
+        const T* dir_reciprocal(unsigned n) const
+        {
+                return m_dir_reciprocal[n].data();
+        }
+};
+
+// Отрезки [near[i], far[i]] лучей пакета внутри параллелотопа с рёбрами, параллельными
+// осям координат, пересечённые с отрезками [0, max_t[i]]. Возвращается маска лучей
+// из mask с непустыми отрезками. Вычисления выполняются для всех лучей пакета
+// без ветвлений, чтобы компилятор мог использовать векторные команды.
+// Нулевые координаты направления обрабатываются отдельно, так как с -Ofast
+// нельзя рассчитывать на NaN и бесконечности при делении на 0. Такая обработка
+// выполняется только для координат, в которых у лучей пакета есть нули.
+template <size_t N, typename T>
+typename RayPacket<N, T>::Mask intersect_box(const Vector<N, T>& min, const Vector<N, T>& max, const RayPacket<N, T>& packet,
+                                             typename RayPacket<N, T>::Mask mask, const T* max_t, T* near, T* far)
+{
+        const int size = packet.size();
+
+        for (int i = 0; i < size; ++i)
+        {
+                near[i] = 0;
+                far[i] = max_t[i];
+        }
+
+        for (unsigned n = 0; n < N; ++n)
+        {
+                const T* org = packet.org(n);
+                const T* dir_reciprocal = packet.dir_reciprocal(n);
+
+                if (!packet.dir_zero(n))
+                {
+                        for (int i = 0; i < size; ++i)
+                        {
+                                T t1 = (min[n] - org[i]) * dir_reciprocal[i];
+                                T t2 = (max[n] - org[i]) * dir_reciprocal[i];
+                                near[i] = std::max(near[i], std::min(t1, t2));
+                                far[i] = std::min(far[i], std::max(t1, t2));
+                        }
+                        continue;
+                }
+
+                const T* dir = packet.dir(n);
+                for (int i = 0; i < size; ++i)
+                {
+                        T t1 = (min[n] - org[i]) * dir_reciprocal[i];
+                        T t2 = (max[n] - org[i]) * dir_reciprocal[i];
+                        // Луч, параллельный плоскостям, внутри них не ограничивается,
+                        // а снаружи получает пустой отрезок
+                        const bool inside = org[i] >= min[n] && org[i] <= max[n];
+                        const T parallel_near = inside ? limits<T>::lowest() : limits<T>::max();
+                        const T parallel_far = inside ? limits<T>::max() : limits<T>::lowest();
+                        near[i] = std::max(near[i], (dir[i] != 0) ? std::min(t1, t2) : parallel_near);
+                        far[i] = std::min(far[i], (dir[i] != 0) ? std::max(t1, t2) : parallel_far);
+                }
+        }
+
+        typename RayPacket<N, T>::Mask result = 0;
+        for (int i = 0; i < size; ++i)
+        {
+                result |= typename RayPacket<N, T>::Mask(near[i] <= far[i]) << i;
+        }
+        result &= mask;
+        return result;
+}
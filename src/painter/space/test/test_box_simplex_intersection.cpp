@@ -0,0 +1,233 @@
+/*
+Copyright (C) 2017-2019 Topological Manifold
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "test_box_simplex_intersection.h"
+
+#include "com/error.h"
+#include "com/log.h"
+#include "com/print.h"
+#include "com/time.h"
+#include "com/type/name.h"
+#include "com/vec.h"
+#include "painter/shapes/mesh_hyperplane_simplex.h"
+#include "painter/space/box_simplex_intersection.h"
+#include "painter/space/constraint.h"
+#include "painter/space/hyperplane_simplex_wrapper.h"
+#include "painter/space/parallelotope_ortho.h"
+#include "painter/space/shape_intersection.h"
+
+#include <array>
+#include <random>
+#include <vector>
+
+constexpr int TEST_COUNT = 10000;
+
+// Как в дереве деления пространства
+constexpr int DISTANCE_FROM_FLAT_SHAPES_IN_EPSILONS = 10;
+
+namespace
+{
+// Объект для проверки пересечения через решение системы неравенств
+template <size_t N, typename T, size_t ShapeDimension, size_t ConstraintCount, size_t ConstraintEqCount>
+class ConstraintShape
+{
+        std::array<Constraint<N, T>, ConstraintCount> m_constraints;
+        std::array<Constraint<N, T>, ConstraintEqCount> m_constraints_eq;
+        Vector<N, T> m_min, m_max;
+
+public:
+        static constexpr size_t SPACE_DIMENSION = N;
+        static constexpr size_t SHAPE_DIMENSION = ShapeDimension;
+        using DataType = T;
+
+        ConstraintShape(const std::array<Constraint<N, T>, ConstraintCount>& constraints,
+                        const std::array<Constraint<N, T>, ConstraintEqCount>& constraints_eq, const Vector<N, T>& min,
+                        const Vector<N, T>& max)
+                : m_constraints(constraints), m_constraints_eq(constraints_eq), m_min(min), m_max(max)
+        {
+        }
+
+        const std::array<Constraint<N, T>, ConstraintCount>& constraints() const
+        {
+                return m_constraints;
+        }
+
+        const std::array<Constraint<N, T>, ConstraintEqCount>& constraints_eq() const
+        {
+                return m_constraints_eq;
+        }
+
+        const Vector<N, T>& min() const
+        {
+                return m_min;
+        }
+
+        const Vector<N, T>& max() const
+        {
+                return m_max;
+        }
+};
+
+template <size_t N, typename T, typename RandomEngine>
+Vector<N, T> random_vector(RandomEngine& random_engine, T low, T high)
+{
+        std::uniform_real_distribution<T> urd(low, high);
+        Vector<N, T> v;
+        for (unsigned i = 0; i < N; ++i)
+        {
+                v[i] = urd(random_engine);
+        }
+        return v;
+}
+
+template <size_t N, typename T>
+void test(int count)
+{
+        LOG("Box-simplex intersection in " + to_string(N) + "D, " + type_name<T>());
+
+        std::mt19937_64 random_engine(count);
+
+        const std::array<int, N> vertex_indices = [] {
+                std::array<int, N> v;
+                for (unsigned i = 0; i < N; ++i)
+                {
+                        v[i] = i;
+                }
+                return v;
+        }();
+
+        const std::vector<Vector<N, T>> normals;
+        const std::vector<Vector<N - 1, T>> texcoords;
+
+        int intersection_count = 0;
+        int false_positive_count = 0;
+        double lp_time = 0;
+        double box_simplex_time = 0;
+
+        for (int test_number = 0; test_number < count; ++test_number)
+        {
+                const Vector<N, T> box_min = random_vector<N, T>(random_engine, -1, 1);
+                const Vector<N, T> box_max = box_min + random_vector<N, T>(random_engine, 0.1, 1);
+
+                // Симплексы около коробки, чтобы примерно половина из них пересекала коробку
+                const T size = std::uniform_real_distribution<T>(0.05, 1)(random_engine);
+                Vector<N, T> center;
+                for (unsigned i = 0; i < N; ++i)
+                {
+                        std::uniform_real_distribution<T> urd(box_min[i] - size / 2, box_max[i] + size / 2);
+                        center[i] = urd(random_engine);
+                }
+                std::vector<Vector<N, T>> vertices(N);
+                for (unsigned i = 0; i < N; ++i)
+                {
+                        vertices[i] = center + size * random_vector<N, T>(random_engine, -1, 1);
+                }
+
+                const MeshHyperplaneSimplex<N, T> simplex(vertices, normals, texcoords, vertex_indices, false, {}, false, {},
+                                                          -1);
+                const HyperplaneSimplexWrapperForShapeIntersection simplex_wrapper(simplex);
+
+                std::array<T, N> box_sizes;
+                for (unsigned i = 0; i < N; ++i)
+                {
+                        box_sizes[i] = box_max[i] - box_min[i];
+                }
+                std::array<Constraint<N, T>, 2 * N> box_constraints;
+                ParallelotopeOrtho<N, T>(box_min, box_sizes).constraints(&box_constraints);
+                const ConstraintShape<N, T, N, 2 * N, 0> box_shape(box_constraints, {}, box_min, box_max);
+
+                std::array<Constraint<N, T>, N> simplex_constraints;
+                std::array<Constraint<N, T>, 1> simplex_constraints_eq;
+                simplex.constraints(&simplex_constraints, &simplex_constraints_eq[0]);
+                Vector<N, T> simplex_min = vertices[0];
+                Vector<N, T> simplex_max = vertices[0];
+                for (const Vector<N, T>& v : vertices)
+                {
+                        simplex_min = min_vector(simplex_min, v);
+                        simplex_max = max_vector(simplex_max, v);
+                }
+                const ConstraintShape<N, T, N - 1, N, 1> simplex_shape(simplex_constraints, simplex_constraints_eq,
+                                                                       simplex_min, simplex_max);
+
+                double start_time = time_in_seconds();
+                const bool lp = shape_intersection_implementation::shapes_intersect_by_spaces(
+                        box_shape, simplex_shape, static_cast<T>(DISTANCE_FROM_FLAT_SHAPES_IN_EPSILONS));
+                lp_time += time_in_seconds() - start_time;
+
+                start_time = time_in_seconds();
+                const bool box_simplex = box_simplex_intersection(box_min, box_max, simplex_wrapper,
+                                                                  static_cast<T>(DISTANCE_FROM_FLAT_SHAPES_IN_EPSILONS));
+                box_simplex_time += time_in_seconds() - start_time;
+
+                if (lp && !box_simplex)
+                {
+                        error("Box-simplex intersection not found\nbox min " + to_string(box_min) + "\nbox max " +
+                              to_string(box_max) + "\nsimplex vertices " + to_string(vertices));
+                }
+
+                if (!lp && box_simplex)
+                {
+                        // Для N = 3 проверяются все оси разделения
+                        if (N == 3)
+                        {
+                                error("Wrong box-simplex intersection\nbox min " + to_string(box_min) + "\nbox max " +
+                                      to_string(box_max) + "\nsimplex vertices " + to_string(vertices));
+                        }
+                        ++false_positive_count;
+                }
+
+                if (lp)
+                {
+                        ++intersection_count;
+                }
+        }
+
+        LOG("intersections " + to_string(intersection_count) + " of " + to_string(count) + ", false positives " +
+            to_string(false_positive_count));
+        LOG("time: linear programming " + to_string_fixed(lp_time, 5) + " s, box-simplex " +
+            to_string_fixed(box_simplex_time, 5) + " s");
+        LOG("check passed");
+}
+
+template <size_t N>
+void test()
+{
+        test<N, float>(TEST_COUNT);
+        test<N, double>(TEST_COUNT);
+}
+}
+
+void test_box_simplex_intersection(int number_of_dimensions)
+{
+        switch (number_of_dimensions)
+        {
+        case 3:
+                test<3>();
+                break;
+        case 4:
+                test<4>();
+                break;
+        case 5:
+                test<5>();
+                break;
+        case 6:
+                test<6>();
+                break;
+        default:
+                error("Error box-simplex intersection test number of dimensions " + to_string(number_of_dimensions));
+        }
+}
@@ -25,12 +25,16 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #pragma once
 
+#include "box_simplex_intersection.h"
+#include "parallelotope_ortho.h"
 #include "parallelotope_wrapper.h"
+#include "ray_packet.h"
 #include "shape_intersection.h"
 
 #include "com/arrays.h"
 #include "com/error.h"
 #include "com/ray.h"
+#include "com/span.h"
 #include "com/thread.h"
 #include "com/type/limit.h"
 #include "com/vec.h"
@@ -38,11 +42,13 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <cmath>
+#include <condition_variable>
 #include <deque>
-#include <list>
+#include <memory>
+#include <mutex>
 #include <numeric>
-#include <stack>
 #include <tuple>
 #include <vector>
 
@@ -56,13 +62,14 @@ class Box
 {
         static constexpr int EMPTY = -1;
 
-        static constexpr int CHILD_COUNT = BOX_COUNT<Parallelotope::DIMENSION>;
-
         Parallelotope m_parallelotope;
         std::vector<int> m_object_indices;
-        std::array<int, CHILD_COUNT> m_childs = make_array_value<int, CHILD_COUNT>(EMPTY);
+        // Все потомки находятся в контейнере подряд, начиная с этого номера
+        int m_first_child = EMPTY;
 
 public:
+        Box() = default;
+
         Box(Parallelotope&& parallelotope) : m_parallelotope(std::move(parallelotope))
         {
         }
@@ -77,20 +84,19 @@ public:
                 return m_parallelotope;
         }
 
-        void set_child(int child_number, int child_box_index)
+        void set_first_child(int first_child_box_index)
         {
-                m_childs[child_number] = child_box_index;
+                m_first_child = first_child_box_index;
         }
 
-        const std::array<int, CHILD_COUNT>& childs() const
+        int first_child() const
         {
-                return m_childs;
+                return m_first_child;
         }
 
         bool has_childs() const
         {
-                // Они или все заполнены, или все не заполнены
-                return m_childs[0] != EMPTY;
+                return m_first_child != EMPTY;
         }
 
         void add_object_index(int object_index)
@@ -98,11 +104,6 @@ public:
                 m_object_indices.push_back(object_index);
         }
 
-        void shrink_objects()
-        {
-                m_object_indices.shrink_to_fit();
-        }
-
         const std::vector<int>& object_indices() const
         {
                 return m_object_indices;
@@ -120,6 +121,82 @@ public:
         }
 };
 
+// Хранилище коробок с резервированием номеров без блокировок. Коробки находятся
+// в блоках постоянного размера, поэтому адреса коробок при добавлении не меняются.
+template <typename Box>
+class BoxStorage
+{
+        static constexpr int BLOCK_SIZE = 1 << 12;
+
+        const int m_max_box_count;
+        const int m_block_count;
+        std::unique_ptr<std::atomic<Box*>[]> m_blocks;
+        std::atomic<int> m_box_count = 0;
+
+        Box* block(int block_index)
+        {
+                std::atomic<Box*>& b = m_blocks[block_index];
+
+                Box* block = b.load(std::memory_order_acquire);
+                if (block)
+                {
+                        return block;
+                }
+
+                // Блок создаётся тем потоком, который первым к нему обратился
+                std::unique_ptr<Box[]> new_block = std::make_unique<Box[]>(BLOCK_SIZE);
+                if (b.compare_exchange_strong(block, new_block.get(), std::memory_order_acq_rel, std::memory_order_acquire))
+                {
+                        return new_block.release();
+                }
+                return block;
+        }
+
+public:
+        explicit BoxStorage(int max_box_count)
+                : m_max_box_count(max_box_count),
+                  m_block_count((max_box_count + BLOCK_SIZE - 1) / BLOCK_SIZE),
+                  m_blocks(std::make_unique<std::atomic<Box*>[]>(m_block_count))
+        {
+                for (int i = 0; i < m_block_count; ++i)
+                {
+                        m_blocks[i].store(nullptr, std::memory_order_relaxed);
+                }
+        }
+
+        ~BoxStorage()
+        {
+                for (int i = 0; i < m_block_count; ++i)
+                {
+                        delete[] m_blocks[i].load(std::memory_order_relaxed);
+                }
+        }
+
+        BoxStorage(const BoxStorage&) = delete;
+        BoxStorage& operator=(const BoxStorage&) = delete;
+
+        // Резервирование count номеров коробок подряд, возвращается первый номер
+        int reserve(int count)
+        {
+                int first_index = m_box_count.fetch_add(count, std::memory_order_relaxed);
+                if (first_index > m_max_box_count - count)
+                {
+                        error("Box storage overflow, maximum box count " + to_string(m_max_box_count));
+                }
+                return first_index;
+        }
+
+        Box& operator[](int index)
+        {
+                return block(index / BLOCK_SIZE)[index % BLOCK_SIZE];
+        }
+
+        int size() const
+        {
+                return std::min(m_box_count.load(std::memory_order_relaxed), m_max_box_count);
+        }
+};
+
 inline std::vector<int> iota_zero_based_indices(int object_index_count)
 {
         std::vector<int> object_indices(object_index_count);
@@ -127,24 +204,264 @@ inline std::vector<int> iota_zero_based_indices(int object_index_count)
         return object_indices;
 }
 
-template <template <typename...> typename Container, typename Parallelotope>
-std::vector<Box<Parallelotope>> move_boxes_to_vector(Container<Box<Parallelotope>>&& boxes)
+// Коробка дерева после его построения. Хранятся только минимальные и максимальные
+// координаты, а номера объектов всех коробок находятся в одном общем массиве.
+template <size_t N, typename T>
+class Node
 {
-        std::vector<Box<Parallelotope>> vector;
+        static constexpr int HAS_CHILDS = -1;
+
+        Vector<N, T> m_min;
+        Vector<N, T> m_max;
+        // Для коробки с потомками — номер первого потомка, для коробки
+        // без потомков — номер первого объекта в общем массиве объектов.
+        int m_offset;
+        // Для коробки без потомков — количество объектов.
+        int m_object_count;
+
+        // Вычисления как в ParallelotopeOrtho, чтобы результаты совпадали
+        bool intersect_impl(const Ray<N, T>& r, T* first, T* second) const
+        {
+                T f_max = limits<T>::lowest();
+                T b_min = limits<T>::max();
+
+                for (unsigned i = 0; i < N; ++i)
+                {
+                        T s = r.dir()[i];
+                        T d = r.org()[i];
+                        if (s == 0)
+                        {
+                                if (d - m_max[i] > 0 || m_min[i] - d > 0)
+                                {
+                                        // параллельно плоскостям и снаружи
+                                        return false;
+                                }
+                                // внутри плоскостей
+                                continue;
+                        }
+
+                        T alpha1 = (m_max[i] - d) / s;
+                        T alpha2 = (d - m_min[i]) / -s;
+
+                        if (s < 0)
+                        {
+                                f_max = std::max(alpha1, f_max);
+                                b_min = std::min(alpha2, b_min);
+                        }
+                        else
+                        {
+                                b_min = std::min(alpha1, b_min);
+                                f_max = std::max(alpha2, f_max);
+                        }
+
+                        if (b_min <= 0 || b_min < f_max)
+                        {
+                                return false;
+                        }
+                }
 
-        vector.reserve(boxes.size());
-        for (Box<Parallelotope>& v : boxes)
+                *first = f_max;
+                *second = b_min;
+
+                return true;
+        }
+
+public:
+        Node(const Vector<N, T>& min, const Vector<N, T>& max, int offset, int object_count)
+                : m_min(min), m_max(max), m_offset(offset), m_object_count(object_count)
         {
-                vector.emplace_back(std::move(v));
         }
-        vector.shrink_to_fit();
 
-        for (Box<Parallelotope>& box : vector)
+        static Node with_childs(const Vector<N, T>& min, const Vector<N, T>& max, int first_child)
         {
-                box.shrink_objects();
+                return Node(min, max, first_child, HAS_CHILDS);
+        }
+
+        bool has_childs() const
+        {
+                return m_object_count == HAS_CHILDS;
+        }
+
+        int first_child() const
+        {
+                ASSERT(has_childs());
+                return m_offset;
+        }
+
+        int object_offset() const
+        {
+                ASSERT(!has_childs());
+                return m_offset;
+        }
+
+        int object_count() const
+        {
+                ASSERT(!has_childs());
+                return m_object_count;
+        }
+
+        const Vector<N, T>& min() const
+        {
+                return m_min;
+        }
+
+        const Vector<N, T>& max() const
+        {
+                return m_max;
+        }
+
+        bool inside(const Vector<N, T>& p) const
+        {
+                for (unsigned i = 0; i < N; ++i)
+                {
+                        // Надо использовать <=, не <.
+                        if (!(p[i] <= m_max[i]) || !(p[i] >= m_min[i]))
+                        {
+                                return false;
+                        }
+                }
+                return true;
+        }
+
+        bool intersect(const Ray<N, T>& r, T* t) const
+        {
+                T first, second;
+                if (intersect_impl(r, &first, &second))
+                {
+                        *t = (first > 0) ? first : second;
+                        return true;
+                }
+                return false;
+        }
+
+        bool intersect_farthest(const Ray<N, T>& r, T* t) const
+        {
+                T first, second;
+                if (intersect_impl(r, &first, &second))
+                {
+                        *t = second;
+                        return true;
+                }
+                return false;
         }
 
-        return vector;
+        // Ближайшая к точке грань. Грань 2 * i находится в начале
+        // ребра i, грань 2 * i + 1 находится в конце ребра i.
+        int face(const Vector<N, T>& p) const
+        {
+                T min = limits<T>::max();
+
+                int face = -1;
+                for (unsigned i = 0; i < N; ++i)
+                {
+                        if (T l = std::abs(p[i] - m_max[i]); l < min)
+                        {
+                                min = l;
+                                face = 2 * i + 1;
+                        }
+
+                        if (T l = std::abs(p[i] - m_min[i]); l < min)
+                        {
+                                min = l;
+                                face = 2 * i;
+                        }
+                }
+
+                ASSERT(face >= 0);
+
+                return face;
+        }
+};
+
+// Минимальные и максимальные координаты параллелотопа с рёбрами, параллельными осям координат
+template <size_t N, typename T>
+void box_min_max(const ParallelotopeOrtho<N, T>& parallelotope, Vector<N, T>* min, Vector<N, T>* max)
+{
+        *min = parallelotope.org();
+        for (unsigned i = 0; i < N; ++i)
+        {
+                (*max)[i] = (*min)[i] + parallelotope.e(i)[i];
+        }
+}
+
+// Пересечение коробки с объектами в общем случае
+template <typename Parallelotope, typename Object, typename = void>
+class BoxObjectIntersection
+{
+        ParallelotopeWrapperForShapeIntersection<Parallelotope> m_parallelotope;
+
+public:
+        BoxObjectIntersection(const Parallelotope& parallelotope) : m_parallelotope(parallelotope)
+        {
+        }
+
+        bool intersect(const Object& object, const typename Parallelotope::DataType& distance_from_flat_shapes_in_epsilons) const
+        {
+                return shape_intersection(m_parallelotope, object, distance_from_flat_shapes_in_epsilons);
+        }
+};
+
+// Пересечение коробки с симплексами в гиперплоскостях без решения системы неравенств
+template <typename Parallelotope, typename Object>
+class BoxObjectIntersection<Parallelotope, Object, std::enable_if_t<Object::SHAPE_DIMENSION + 1 == Parallelotope::DIMENSION>>
+{
+        Vector<Parallelotope::DIMENSION, typename Parallelotope::DataType> m_min, m_max;
+
+public:
+        BoxObjectIntersection(const Parallelotope& parallelotope)
+        {
+                box_min_max(parallelotope, &m_min, &m_max);
+        }
+
+        bool intersect(const Object& object, const typename Parallelotope::DataType& distance_from_flat_shapes_in_epsilons) const
+        {
+                return box_simplex_intersection(m_min, m_max, object, distance_from_flat_shapes_in_epsilons);
+        }
+};
+
+template <typename Parallelotope>
+void move_boxes_to_nodes(BoxStorage<Box<Parallelotope>>* boxes,
+                         std::vector<Node<Parallelotope::DIMENSION, typename Parallelotope::DataType>>* nodes,
+                         std::vector<int>* object_indices)
+{
+        constexpr int N = Parallelotope::DIMENSION;
+        using T = typename Parallelotope::DataType;
+
+        const int box_count = boxes->size();
+
+        nodes->clear();
+        nodes->reserve(box_count);
+
+        size_t object_index_count = 0;
+        for (int i = 0; i < box_count; ++i)
+        {
+                object_index_count += (*boxes)[i].object_index_count();
+        }
+        if (object_index_count > static_cast<size_t>(limits<int>::max()))
+        {
+                error("Too many object indices in spatial subdivision tree " + to_string(object_index_count));
+        }
+
+        object_indices->clear();
+        object_indices->reserve(object_index_count);
+
+        for (int box_index = 0; box_index < box_count; ++box_index)
+        {
+                Box<Parallelotope>& box = (*boxes)[box_index];
+
+                Vector<N, T> min, max;
+                box_min_max(box.parallelotope(), &min, &max);
+
+                if (box.has_childs())
+                {
+                        nodes->push_back(Node<N, T>::with_childs(min, max, box.first_child()));
+                        continue;
+                }
+
+                nodes->emplace_back(min, max, object_indices->size(), box.object_index_count());
+                object_indices->insert(object_indices->end(), box.object_indices().cbegin(), box.object_indices().cend());
+                box.delete_all_objects();
+        }
 }
 
 template <typename Parallelotope, size_t... I>
@@ -237,147 +554,223 @@ Parallelotope root_parallelotope(const Vector<Parallelotope::DIMENSION, typename
                                                                std::make_integer_sequence<size_t, Parallelotope::DIMENSION>());
 }
 
+// Задачи потоков с перехватом задач у других потоков. Поток добавляет и берёт
+// задачи с конца своей очереди, а задачи других потоков берёт с их начала.
+// Потоки без задач ждут появления задач, а не проверяют их наличие в цикле.
 template <typename Box>
 class BoxJobs
 {
-        // Если задач нет, и все потоки с ними не работают, то всё сделано. Если задач нет,
-        // но хотя бы один поток с ними работает, то могут появиться новые задачи и надо подождать.
-        // Вместо учёта заданий для каждого потока, используется просто сумма задач по всем потокам:
-        //   поток пришёл за новой задачей, не имея предыдущей — сумма не меняется;
-        //   поток пришёл за новой задачей, имея предыдущую — уменьшили сумму на 1;
-        //   дали задачу потоку — увеличили сумму на 1.
-        int m_job_count = 0;
+        using Job = std::tuple<Box*, int>;
+
+        struct alignas(64) ThreadJobs
+        {
+                SpinLock lock;
+                std::deque<Job> jobs;
+        };
 
-        std::stack<std::tuple<Box*, int>, std::vector<std::tuple<Box*, int>>> m_jobs;
-        SpinLock m_lock;
+        std::vector<ThreadJobs> m_thread_jobs;
 
-        bool m_stop_all = false;
+        // Количество задач в очередях
+        std::atomic<int> m_queued_count = 0;
+        // Количество задач в очередях и в работе. Если оно равно 0, то всё сделано.
+        std::atomic<int> m_unfinished_count = 0;
+        // Количество ждущих потоков
+        std::atomic<int> m_waiting_count = 0;
 
-public:
-        BoxJobs(Box* box, int depth) : m_jobs({{box, depth}})
+        std::atomic<bool> m_stop_all = false;
+
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+
+        bool pop_own(unsigned thread_num, Job* job)
         {
+                ThreadJobs& t = m_thread_jobs[thread_num];
+                std::lock_guard lg(t.lock);
+                if (t.jobs.empty())
+                {
+                        return false;
+                }
+                *job = t.jobs.back();
+                t.jobs.pop_back();
+                --m_queued_count;
+                return true;
         }
 
-        void stop_all() noexcept
+        bool steal(unsigned thread_num, Job* job)
         {
-                std::lock_guard lg(m_lock);
-
-                m_stop_all = true;
+                for (unsigned i = 1; i < m_thread_jobs.size(); ++i)
+                {
+                        ThreadJobs& t = m_thread_jobs[(thread_num + i) % m_thread_jobs.size()];
+                        std::lock_guard lg(t.lock);
+                        if (!t.jobs.empty())
+                        {
+                                *job = t.jobs.front();
+                                t.jobs.pop_front();
+                                --m_queued_count;
+                                return true;
+                        }
+                }
+                return false;
         }
 
-        void push(Box* box, int depth) noexcept
+        void notify_all()
         {
-                std::lock_guard lg(m_lock);
-
-                m_jobs.emplace(box, depth);
+                {
+                        std::lock_guard lg(m_mutex);
+                }
+                m_cv.notify_all();
         }
 
-        bool pop(Box** box, int* depth) noexcept
+public:
+        BoxJobs(unsigned thread_count, Box* box, int depth) : m_thread_jobs(thread_count)
         {
-                std::lock_guard lg(m_lock);
+                m_thread_jobs[0].jobs.emplace_back(box, depth);
+                m_queued_count = 1;
+                m_unfinished_count = 1;
+        }
 
-                if (m_stop_all)
+        void stop_all() noexcept
+        {
+                try
                 {
-                        return false;
+                        m_stop_all = true;
+                        notify_all();
                 }
-
-                if (*box)
+                catch (...)
                 {
-                        --m_job_count;
+                        error_fatal("Error stopping box jobs");
                 }
+        }
 
-                if (!m_jobs.empty())
+        void push(unsigned thread_num, Box* box, int depth)
+        {
+                ++m_unfinished_count;
                 {
-                        std::tie(*box, *depth) = m_jobs.top();
-                        m_jobs.pop();
-                        ++m_job_count;
-                        return true;
+                        ThreadJobs& t = m_thread_jobs[thread_num];
+                        std::lock_guard lg(t.lock);
+                        t.jobs.emplace_back(box, depth);
+                        ++m_queued_count;
                 }
 
-                if (m_job_count > 0)
+                // Ждущий поток увеличивает m_waiting_count до проверки m_queued_count,
+                // поэтому или он увидит новую задачу, или здесь будет виден ждущий поток.
+                if (m_waiting_count > 0)
                 {
-                        // Заданий нет, но какие-то потоки ещё работают,
-                        // поэтому могут появиться новые задания.
-                        *box = nullptr;
-                        return true;
+                        {
+                                std::lock_guard lg(m_mutex);
+                        }
+                        m_cv.notify_one();
                 }
+        }
 
-                // Заданий нет и все потоки с ними не работают.
+        // Задача взята из очереди, но ещё не выполнена
+        bool pop(unsigned thread_num, Box** box, int* depth)
+        {
+                while (!m_stop_all)
+                {
+                        Job job;
+                        if (pop_own(thread_num, &job) || steal(thread_num, &job))
+                        {
+                                std::tie(*box, *depth) = job;
+                                return true;
+                        }
+
+                        std::unique_lock<std::mutex> lock(m_mutex);
+                        ++m_waiting_count;
+                        m_cv.wait(lock, [this] { return m_stop_all || m_unfinished_count == 0 || m_queued_count > 0; });
+                        --m_waiting_count;
+
+                        if (m_unfinished_count == 0)
+                        {
+                                return false;
+                        }
+                }
                 return false;
         }
+
+        // Задача, взятая функцией pop, выполнена
+        void finish()
+        {
+                if (--m_unfinished_count == 0)
+                {
+                        notify_all();
+                }
+        }
 };
 
-template <template <typename...> typename Container, typename Parallelotope, int... I>
-std::array<std::tuple<int, Box<Parallelotope>*, int>, BOX_COUNT<Parallelotope::DIMENSION>> create_child_boxes(
-        SpinLock* boxes_lock, Container<Box<Parallelotope>>* boxes, const Parallelotope& parallelotope,
-        std::integer_sequence<int, I...>)
+// Потомки добавляются в хранилище подряд, возвращается номер первого потомка
+template <typename Parallelotope, int... I>
+int create_child_boxes(BoxStorage<Box<Parallelotope>>* boxes, const Parallelotope& parallelotope,
+                       std::array<Box<Parallelotope>*, BOX_COUNT<Parallelotope::DIMENSION>>* child_boxes,
+                       std::integer_sequence<int, I...>)
 {
         static_assert(BOX_COUNT<Parallelotope::DIMENSION> == sizeof...(I));
         static_assert(((I >= 0 && I < sizeof...(I)) && ...));
 
         std::array<Parallelotope, sizeof...(I)> child_parallelotopes = parallelotope.binary_division();
 
-        std::lock_guard lg(*boxes_lock);
+        int first_index = boxes->reserve(sizeof...(I));
 
-        int index = boxes->size();
+        (((*child_boxes)[I] = &((*boxes)[first_index + I] = Box<Parallelotope>(std::move(child_parallelotopes[I])))), ...);
 
-        return {std::make_tuple(I, &(boxes->emplace_back(std::move(child_parallelotopes[I]))), index++)...};
+        return first_index;
 }
 
-template <template <typename...> typename Container, typename Parallelotope, typename FunctorObjectPointer>
+template <typename Parallelotope, typename FunctorObjectPointer>
 void extend(const int MAX_DEPTH, const int MIN_OBJECTS, const int MAX_BOXES,
-            const typename Parallelotope::DataType& DISTANCE_FROM_FLAT_SHAPES_IN_EPSILONS, SpinLock* boxes_lock,
-            Container<Box<Parallelotope>>* boxes, BoxJobs<Box<Parallelotope>>* box_jobs,
+            const typename Parallelotope::DataType& DISTANCE_FROM_FLAT_SHAPES_IN_EPSILONS,
+            BoxStorage<Box<Parallelotope>>* boxes, BoxJobs<Box<Parallelotope>>* box_jobs, unsigned thread_num,
             const FunctorObjectPointer& functor_object_pointer, ProgressRatio* progress) try
 {
-        // Адреса имеющихся элементов не должны меняться при вставке
-        // новых элементов, поэтому требуется std::deque или std::list.
-        static_assert(std::is_same_v<Container<Box<Parallelotope>>, std::deque<Box<Parallelotope>>> ||
-                      std::is_same_v<Container<Box<Parallelotope>>, std::list<Box<Parallelotope>>>);
-
         constexpr auto integer_sequence_n = std::make_integer_sequence<int, BOX_COUNT<Parallelotope::DIMENSION>>();
 
-        Box<Parallelotope>* box = nullptr; // nullptr — предыдущей задачи нет.
+        using Object = std::remove_cv_t<std::remove_pointer_t<decltype(functor_object_pointer(0))>>;
+
+        Box<Parallelotope>* box;
         int depth;
 
-        while (box_jobs->pop(&box, &depth))
+        while (box_jobs->pop(thread_num, &box, &depth))
         {
-                if (!box)
-                {
-                        // Новой задачи нет, но другие потоки работают над задачами.
-                        continue;
-                }
-
                 if (depth >= MAX_DEPTH || box->object_index_count() <= MIN_OBJECTS)
                 {
+                        box_jobs->finish();
                         continue;
                 }
 
-                for (const auto& [i, child_box, child_box_index] :
-                     create_child_boxes(boxes_lock, boxes, box->parallelotope(), integer_sequence_n))
+                std::array<Box<Parallelotope>*, BOX_COUNT<Parallelotope::DIMENSION>> child_boxes;
+
+                const int first_child_box_index =
+                        create_child_boxes(boxes, box->parallelotope(), &child_boxes, integer_sequence_n);
+
+                box->set_first_child(first_child_box_index);
+
+                for (int i = 0; i < BOX_COUNT<Parallelotope::DIMENSION>; ++i)
                 {
-                        box->set_child(i, child_box_index);
+                        Box<Parallelotope>* child_box = child_boxes[i];
+                        const int child_box_index = first_child_box_index + i;
 
                         if ((child_box_index & 0xfff) == 0xfff)
                         {
                                 progress->set(child_box_index, MAX_BOXES);
                         }
 
-                        ParallelotopeWrapperForShapeIntersection p(child_box->parallelotope());
+                        const BoxObjectIntersection<Parallelotope, Object> intersection(child_box->parallelotope());
 
                         for (int object_index : box->object_indices())
                         {
-                                if (shape_intersection(p, *functor_object_pointer(object_index),
-                                                       DISTANCE_FROM_FLAT_SHAPES_IN_EPSILONS))
+                                if (intersection.intersect(*functor_object_pointer(object_index),
+                                                           DISTANCE_FROM_FLAT_SHAPES_IN_EPSILONS))
                                 {
                                         child_box->add_object_index(object_index);
                                 }
                         }
 
-                        box_jobs->push(child_box, depth + 1);
+                        box_jobs->push(thread_num, child_box, depth + 1);
                 }
 
                 box->delete_all_objects();
+
+                box_jobs->finish();
         }
 }
 catch (...)
@@ -399,16 +792,17 @@ class SpatialSubdivisionTree
                 return (std::pow(box_count, max_depth) - 1) / (box_count - 1);
         }
 
-        using Box = spatial_subdivision_tree_implementation::Box<Parallelotope>;
-        using BoxJobs = spatial_subdivision_tree_implementation::BoxJobs<Box>;
-
         // Размерность задачи и тип данных
         static constexpr int N = Parallelotope::DIMENSION;
         using T = typename Parallelotope::DataType;
 
-        // Адреса имеющихся элементов не должны меняться при вставке
-        // новых элементов, поэтому требуется std::deque или std::list.
-        using BoxContainer = std::deque<Box>;
+        // Коробки после построения хранятся только в виде минимальных и максимальных координат
+        static_assert(std::is_same_v<Parallelotope, ParallelotopeOrtho<N, T>>);
+
+        using Box = spatial_subdivision_tree_implementation::Box<Parallelotope>;
+        using BoxJobs = spatial_subdivision_tree_implementation::BoxJobs<Box>;
+        using BoxStorage = spatial_subdivision_tree_implementation::BoxStorage<Box>;
+        using Node = spatial_subdivision_tree_implementation::Node<N, T>;
 
         // Расстояние от грани, при котором точка считается внутри коробки.
         static constexpr int DISTANCE_FROM_FACET_IN_EPSILONS = 20;
@@ -433,27 +827,141 @@ class SpatialSubdivisionTree
         // Количество коробок при одном делении.
         static constexpr int BOX_COUNT = spatial_subdivision_tree_implementation::BOX_COUNT<N>;
 
-        // Все коробки хранятся в одном векторе.
-        std::vector<Box> m_boxes;
+        // Нет соседней коробки.
+        static constexpr int NO_BOX = -1;
+
+        // Количество граней коробки.
+        static constexpr int FACE_COUNT = 2 * N;
+
+        // Все коробки хранятся в одном векторе. Потомки коробки находятся в нём подряд.
+        std::vector<Node> m_boxes;
+
+        // Номера объектов всех коробок без потомков.
+        std::vector<int> m_object_indices;
+
+        // Для каждой коробки и каждой её грани — соседняя коробка того же или
+        // большего размера, полностью покрывающая эту грань. Грань 2 * i находится
+        // в начале ребра i, грань 2 * i + 1 находится в конце ребра i.
+        std::vector<std::array<int, FACE_COUNT>> m_ropes;
 
         T m_distance_from_facet;
 
-        bool find_box_for_point(const Box& box, const Vector<N, T>& p, const Box** found_box) const
+        void create_ropes()
         {
-                if (!box.parallelotope().inside(p))
+                std::vector<int> depths(m_boxes.size());
+                std::vector<int> stack;
+
+                depths[ROOT_BOX] = 0;
+                stack.push_back(ROOT_BOX);
+                while (!stack.empty())
+                {
+                        int box_index = stack.back();
+                        stack.pop_back();
+                        if (m_boxes[box_index].has_childs())
+                        {
+                                for (int child_number = 0; child_number < BOX_COUNT; ++child_number)
+                                {
+                                        int child_box = m_boxes[box_index].first_child() + child_number;
+                                        depths[child_box] = depths[box_index] + 1;
+                                        stack.push_back(child_box);
+                                }
+                        }
+                }
+
+                m_ropes.resize(m_boxes.size());
+                m_ropes[ROOT_BOX] = make_array_value<int, FACE_COUNT>(NO_BOX);
+
+                // Соседи коробки определяются по соседям её родителя,
+                // поэтому обработка идёт от корня к листьям.
+                stack.push_back(ROOT_BOX);
+                while (!stack.empty())
+                {
+                        int box_index = stack.back();
+                        stack.pop_back();
+
+                        const Node& box = m_boxes[box_index];
+                        if (!box.has_childs())
+                        {
+                                continue;
+                        }
+
+                        for (int child_number = 0; child_number < BOX_COUNT; ++child_number)
+                        {
+                                int child_box = box.first_child() + child_number;
+
+                                for (unsigned i = 0; i < N; ++i)
+                                {
+                                        // Разряд i номера потомка равен 1, если потомок находится в конце ребра i
+                                        const bool at_end = (child_number & (1u << i)) != 0;
+                                        const int adjacent_child_number = child_number ^ (1u << i);
+
+                                        // Грань внутри родителя — соседом является другой потомок
+                                        m_ropes[child_box][2 * i + (at_end ? 0 : 1)] = box.first_child() + adjacent_child_number;
+
+                                        // Грань на границе родителя — сосед родителя или,
+                                        // если сосед того же размера, его прилегающий потомок
+                                        const int outer_face = 2 * i + (at_end ? 1 : 0);
+                                        int neighbor = m_ropes[box_index][outer_face];
+                                        if (neighbor != NO_BOX && depths[neighbor] == depths[box_index] &&
+                                            m_boxes[neighbor].has_childs())
+                                        {
+                                                neighbor = m_boxes[neighbor].first_child() + adjacent_child_number;
+                                        }
+                                        m_ropes[child_box][outer_face] = neighbor;
+                                }
+
+                                stack.push_back(child_box);
+                        }
+                }
+        }
+
+        // Смещение точки по перпендикуляру к грани наружу коробки
+        static Vector<N, T> move_outside(const Vector<N, T>& p, int face, T distance)
+        {
+                Vector<N, T> res = p;
+                res[face / 2] += (face & 1) ? distance : -distance;
+                return res;
+        }
+
+        bool find_box_for_point(int box_index, const Vector<N, T>& p, int* found_box) const
+        {
+                const Node& box = m_boxes[box_index];
+
+                if (!box.inside(p))
                 {
                         return false;
                 }
 
                 if (!box.has_childs())
                 {
-                        *found_box = &box;
+                        *found_box = box_index;
                         return true;
                 }
 
-                for (int child_box : box.childs())
+                const int first_child = box.first_child();
+
+                // Потомок, в котором находится точка, определяется сравнением с серединой
+                // коробки, равной максимуму первого потомка. Точка на общей границе потомков
+                // относится к потомку с меньшим номером, как и при переборе потомков.
+                const Vector<N, T>& middle = m_boxes[first_child].max();
+                int child_number = 0;
+                for (unsigned i = 0; i < N; ++i)
+                {
+                        if (p[i] > middle[i])
+                        {
+                                child_number |= 1u << i;
+                        }
+                }
+
+                if (find_box_for_point(first_child + child_number, p, found_box))
+                {
+                        return true;
+                }
+
+                // Из-за ошибок округления точка может находиться в другом потомке
+                for (int i = 0; i < BOX_COUNT; ++i)
                 {
-                        if (find_box_for_point(m_boxes[child_box], p, found_box))
+                        if (i != child_number && find_box_for_point(first_child + i, p, found_box))
                         {
                                 return true;
                         }
@@ -462,6 +970,83 @@ class SpatialSubdivisionTree
                 return false;
         }
 
+        template <bool USE_ROPES, typename FunctorFindIntersection>
+        bool trace_ray_impl(Ray<N, T> ray, T root_t, const FunctorFindIntersection& functor_find_intersection) const
+        {
+                bool first = true;
+
+                Vector<N, T> interior_point = ray.org();
+
+                int neighbor_box = NO_BOX;
+
+                while (true)
+                {
+                        T t;
+                        int box_index;
+
+                        const bool found_in_neighbor = USE_ROPES && neighbor_box != NO_BOX &&
+                                                       find_box_for_point(neighbor_box, interior_point, &box_index);
+
+                        if (found_in_neighbor || find_box_for_point(ROOT_BOX, interior_point, &box_index))
+                        {
+                                const Node& box = m_boxes[box_index];
+
+                                Vector<N, T> point;
+                                if (box.object_count() > 0 &&
+                                    functor_find_intersection(Span<const int>(&m_object_indices[box.object_offset()],
+                                                                              box.object_count()),
+                                                              &point) &&
+                                    box.inside(point))
+                                {
+                                        return true;
+                                }
+
+                                // Поиск пересечения с дальней границей текущей коробки
+                                // для перехода в соседнюю коробку.
+                                if (!box.intersect_farthest(ray, &t))
+                                {
+                                        if (found_in_neighbor)
+                                        {
+                                                // Точка на общей границе нескольких коробок может оказаться
+                                                // в соседе, которого луч уже покидает. Тогда поиск от корня.
+                                                neighbor_box = NO_BOX;
+                                                continue;
+                                        }
+                                        return false;
+                                }
+
+                                Vector<N, T> intersection_point = ray.point(t);
+                                ray.set_org(intersection_point);
+                                int face = box.face(intersection_point);
+                                interior_point = move_outside(intersection_point, face, m_distance_from_facet);
+
+                                neighbor_box = m_ropes[box_index][face];
+                        }
+                        else
+                        {
+                                // Начало луча не находится в пределах дерева.
+
+                                if (!first)
+                                {
+                                        // Не первый проход — процесс вышел за пределы дерева.
+                                        return false;
+                                }
+                                else
+                                {
+                                        // Первый проход — начало луча находится снаружи и надо искать
+                                        // пересечение с самим деревом. Это пересечение уже должно
+                                        // быть найдено ранее при вызове intersect_root.
+                                        Vector<N, T> intersection_point = ray.point(root_t);
+                                        ray.set_org(intersection_point);
+                                        int face = m_boxes[ROOT_BOX].face(intersection_point);
+                                        interior_point = move_outside(intersection_point, face, -m_distance_from_facet);
+                                }
+                        }
+
+                        first = false;
+                }
+        }
+
 public:
         template <typename FunctorObjectPointer>
         void decompose(int max_depth, int min_objects_per_box, int object_index_count,
@@ -503,89 +1088,276 @@ public:
                 impl::min_max_and_distance(max_divisions, DISTANCE_FROM_FACET_IN_EPSILONS, object_index_count,
                                            functor_object_pointer, &min, &max, &distance_from_facet);
 
-                BoxContainer boxes({Box(impl::root_parallelotope<Parallelotope>(min, max),
-                                        impl::iota_zero_based_indices(object_index_count))});
+                BoxStorage boxes(max_box_count);
 
-                BoxJobs jobs(&boxes.front(), MAX_DEPTH_LEFT_BOUND);
+                boxes[boxes.reserve(1)] =
+                        Box(impl::root_parallelotope<Parallelotope>(min, max), impl::iota_zero_based_indices(object_index_count));
 
-                SpinLock boxes_lock;
+                BoxJobs jobs(thread_count, &boxes[ROOT_BOX], MAX_DEPTH_LEFT_BOUND);
 
                 ThreadsWithCatch threads(thread_count);
                 for (unsigned i = 0; i < thread_count; ++i)
                 {
-                        threads.add([&]() {
+                        threads.add([&, i]() {
                                 extend(max_depth, min_objects_per_box, max_box_count, DISTANCE_FROM_FLAT_SHAPES_IN_EPSILONS,
-                                       &boxes_lock, &boxes, &jobs, functor_object_pointer, progress);
+                                       &boxes, &jobs, i, functor_object_pointer, progress);
                         });
                 }
                 threads.join();
 
-                m_boxes = move_boxes_to_vector(std::move(boxes));
+                move_boxes_to_nodes(&boxes, &m_boxes, &m_object_indices);
                 m_distance_from_facet = distance_from_facet;
+
+                create_ropes();
         }
 
         bool intersect_root(const Ray<N, T>& ray, T* t) const
         {
-                return m_boxes[ROOT_BOX].parallelotope().intersect(ray, t);
+                return m_boxes[ROOT_BOX].intersect(ray, t);
+        }
+
+        int box_count() const
+        {
+                return m_boxes.size();
+        }
+
+        // Объём памяти одной коробки без номеров объектов
+        static constexpr size_t box_memory_size()
+        {
+                return sizeof(Node) + sizeof(typename decltype(m_ropes)::value_type);
+        }
+
+        // Объём памяти всего дерева
+        size_t memory_size() const
+        {
+                return m_boxes.size() * box_memory_size() + m_object_indices.size() * sizeof(int);
+        }
+
+        // Номера объектов всех коробок без потомков. Функторы поиска пересечений
+        // получают части этого массива.
+        const std::vector<int>& object_indices() const
+        {
+                return m_object_indices;
+        }
+
+        // Для каждой коробки без потомков вызывается functor(offset, count),
+        // где offset и count задают часть массива object_indices()
+        template <typename Functor>
+        void for_each_leaf(const Functor& functor) const
+        {
+                for (const Node& box : m_boxes)
+                {
+                        if (!box.has_childs())
+                        {
+                                functor(box.object_offset(), box.object_count());
+                        }
+                }
         }
 
         // Вызывается после intersect_root. Если в intersect_root пересечение было найдено,
         // то сюда передаётся результат пересечения в параметре root_t.
+        // Переход в соседнюю коробку выполняется поиском от соседа по грани,
+        // а если точка не находится в этом соседе, то поиском от корня.
         template <typename FunctorFindIntersection>
-        bool trace_ray(Ray<N, T> ray, T root_t, const FunctorFindIntersection& functor_find_intersection) const
+        bool trace_ray(const Ray<N, T>& ray, T root_t, const FunctorFindIntersection& functor_find_intersection) const
         {
-                bool first = true;
+                return trace_ray_impl<true>(ray, root_t, functor_find_intersection);
+        }
 
-                Vector<N, T> interior_point = ray.org();
+        // Как trace_ray, но каждая следующая коробка ищется от корня без переходов
+        // к соседям по граням. Используется для проверки trace_ray.
+        template <typename FunctorFindIntersection>
+        bool trace_ray_from_root(const Ray<N, T>& ray, T root_t, const FunctorFindIntersection& functor_find_intersection) const
+        {
+                return trace_ray_impl<false>(ray, root_t, functor_find_intersection);
+        }
 
-                while (true)
+        // Совместный обход для лучей пакета из маски от корня по потомкам коробок
+        // в порядке ближайшего входа лучей. Массив max_t содержит для всех лучей
+        // пакета расстояния до найденных пересечений. Функция
+        // functor_find_intersections(indices, box_mask) должна находить для лучей
+        // box_mask пересечения с объектами indices на расстояниях меньше max_t[i]
+        // и уменьшать max_t[i] для найденных пересечений. Объекты находятся
+        // в нескольких коробках, и пересечения за пределами коробки тоже
+        // принимаются, так как коробки с более дальним входом пропускаются.
+        template <typename FunctorFindIntersections>
+        void trace_packet(const RayPacket<N, T>& packet, typename RayPacket<N, T>::Mask mask, const T* max_t,
+                          const FunctorFindIntersections& functor_find_intersections) const
+        {
+                using Packet = RayPacket<N, T>;
+                using Mask = typename Packet::Mask;
+
+                struct StackEntry
                 {
-                        T t;
-                        const Box* box;
+                        int box_index;
+                        Mask mask;
+                };
 
-                        if (find_box_for_point(m_boxes[ROOT_BOX], interior_point, &box))
+                struct Child
+                {
+                        T min_t;
+                        int box_index;
+                        Mask mask;
+                };
+
+                std::array<T, Packet::MAX_SIZE> near;
+                std::array<T, Packet::MAX_SIZE> far;
+
+                // Лучи из box_mask, пересекающие коробку, и наименьшее расстояние входа
+                const auto intersect = [&](int box_index, Mask box_mask, T* min_t) {
+                        const Node& box = m_boxes[box_index];
+                        Mask result = intersect_box(box.min(), box.max(), packet, box_mask, max_t, near.data(), far.data());
+                        *min_t = limits<T>::max();
+                        for (int i = 0; i < packet.size(); ++i)
                         {
-                                Vector<N, T> point;
-                                if (box->object_index_count() > 0 && functor_find_intersection(box->object_indices(), &point) &&
-                                    box->parallelotope().inside(point))
+                                if (Packet::contains(result, i))
                                 {
-                                        return true;
+                                        *min_t = std::min(*min_t, near[i]);
                                 }
+                        }
+                        return result;
+                };
 
-                                // Поиск пересечения с дальней границей текущей коробки
-                                // для перехода в соседнюю коробку.
-                                if (!box->parallelotope().intersect_farthest(ray, &t))
+                T t;
+                Mask box_mask = intersect(ROOT_BOX, mask, &t);
+                if (box_mask == 0)
+                {
+                        return;
+                }
+
+                // Глубина дерева не больше MAX_DEPTH_RIGHT_BOUND, и на каждом
+                // уровне в стек добавляется не больше BOX_COUNT - 1 коробок.
+                std::array<StackEntry, MAX_DEPTH_RIGHT_BOUND * (BOX_COUNT - 1) + 1> stack;
+                int stack_size = 0;
+
+                int box_index = ROOT_BOX;
+
+                while (true)
+                {
+                        const Node& box = m_boxes[box_index];
+
+                        if (box.has_childs())
+                        {
+                                std::array<Child, BOX_COUNT> childs;
+                                int child_count = 0;
+                                for (int i = 0; i < BOX_COUNT; ++i)
                                 {
-                                        return false;
+                                        const int child_box = box.first_child() + i;
+                                        if (Mask child_mask = intersect(child_box, box_mask, &t); child_mask != 0)
+                                        {
+                                                childs[child_count++] = {t, child_box, child_mask};
+                                        }
                                 }
 
-                                Vector<N, T> intersection_point = ray.point(t);
-                                ray.set_org(intersection_point);
-                                Vector<N, T> normal = box->parallelotope().normal(intersection_point);
-                                interior_point = intersection_point + m_distance_from_facet * normal;
+                                if (child_count > 0)
+                                {
+                                        std::sort(childs.begin(), childs.begin() + child_count,
+                                                  [](const Child& a, const Child& b) { return a.min_t < b.min_t; });
+
+                                        for (int i = child_count - 1; i > 0; --i)
+                                        {
+                                                stack[stack_size++] = {childs[i].box_index, childs[i].mask};
+                                        }
+
+                                        box_index = childs[0].box_index;
+                                        box_mask = childs[0].mask;
+                                        continue;
+                                }
                         }
-                        else
+                        else if (box.object_count() > 0)
                         {
-                                // Начало луча не находится в пределах дерева.
+                                functor_find_intersections(
+                                        Span<const int>(&m_object_indices[box.object_offset()], box.object_count()), box_mask);
+                        }
 
-                                if (!first)
+                        // Следующая коробка из стека. Пересечения с ней проверяются заново,
+                        // так как после добавления в стек значения max_t могли уменьшиться.
+                        do
+                        {
+                                if (stack_size == 0)
                                 {
-                                        // Не первый проход — процесс вышел за пределы дерева.
-                                        return false;
+                                        return;
                                 }
-                                else
+                                --stack_size;
+                                box_index = stack[stack_size].box_index;
+                                box_mask = intersect(box_index, stack[stack_size].mask, &t);
+                        } while (box_mask == 0);
+                }
+        }
+
+        // Есть ли пересечение на расстоянии меньше max_distance. Функция functor_any_intersection(indices)
+        // должна определять, есть ли пересечение с объектами indices на этом расстоянии. Обход прекращается
+        // при первом найденном пересечении или при выходе за расстояние max_distance.
+        // Вызывается после intersect_root, результат которого передаётся в параметре root_t.
+        template <typename FunctorAnyIntersection>
+        bool occluded(Ray<N, T> ray, T root_t, T max_distance, const FunctorAnyIntersection& functor_any_intersection) const
+        {
+                // Расстояние от начала луча до начала текущей части луча
+                T distance = 0;
+
+                int box_index;
+
+                if (!find_box_for_point(ROOT_BOX, ray.org(), &box_index))
+                {
+                        // Начало луча находится снаружи дерева
+                        if (root_t >= max_distance)
+                        {
+                                return false;
+                        }
+                        Vector<N, T> intersection_point = ray.point(root_t);
+                        ray.set_org(intersection_point);
+                        int face = m_boxes[ROOT_BOX].face(intersection_point);
+                        Vector<N, T> interior_point = move_outside(intersection_point, face, -m_distance_from_facet);
+                        if (!find_box_for_point(ROOT_BOX, interior_point, &box_index))
+                        {
+                                return false;
+                        }
+                        distance = root_t;
+                }
+
+                Vector<N, T> interior_point;
+                bool found_in_neighbor = false;
+
+                while (true)
+                {
+                        const Node& box = m_boxes[box_index];
+
+                        if (box.object_count() > 0 &&
+                            functor_any_intersection(Span<const int>(&m_object_indices[box.object_offset()], box.object_count())))
+                        {
+                                return true;
+                        }
+
+                        T t;
+                        if (!box.intersect_farthest(ray, &t))
+                        {
+                                // Сосед, которого луч уже покидает, как в trace_ray
+                                if (found_in_neighbor && find_box_for_point(ROOT_BOX, interior_point, &box_index))
                                 {
-                                        // Первый проход — начало луча находится снаружи и надо искать
-                                        // пересечение с самим деревом. Это пересечение уже должно
-                                        // быть найдено ранее при вызове intersect_root.
-                                        Vector<N, T> intersection_point = ray.point(root_t);
-                                        ray.set_org(intersection_point);
-                                        Vector<N, T> normal = m_boxes[ROOT_BOX].parallelotope().normal(intersection_point);
-                                        interior_point = intersection_point - m_distance_from_facet * normal;
+                                        found_in_neighbor = false;
+                                        continue;
                                 }
+                                return false;
                         }
 
-                        first = false;
+                        distance += t;
+                        if (distance >= max_distance)
+                        {
+                                return false;
+                        }
+
+                        Vector<N, T> intersection_point = ray.point(t);
+                        ray.set_org(intersection_point);
+                        int face = box.face(intersection_point);
+                        interior_point = move_outside(intersection_point, face, m_distance_from_facet);
+
+                        int neighbor_box = m_ropes[box_index][face];
+                        found_in_neighbor =
+                                neighbor_box != NO_BOX && find_box_for_point(neighbor_box, interior_point, &box_index);
+                        if (!found_in_neighbor && !find_box_for_point(ROOT_BOX, interior_point, &box_index))
+                        {
+                                return false;
+                        }
                 }
         }
 };
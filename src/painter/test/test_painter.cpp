@@ -22,7 +22,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "com/string/str.h"
 #include "com/time.h"
 #include "obj/file/file_load.h"
-#include "painter/image/image.h"
+#include "painter/image/painter_images.h"
 #include "painter/painter.h"
 #include "painter/scenes/single_object.h"
 #include "painter/shapes/mesh.h"
@@ -38,65 +38,6 @@ constexpr Srgb8 DEFAULT_COLOR(150, 170, 150);
 
 namespace
 {
-class Images : public PainterNotifier<3>
-{
-        static constexpr const char beginning_of_file_name[] = "painter_";
-
-        std::vector<Image<2>> m_images;
-        std::array<int, 3> m_size;
-
-public:
-        Images(const std::array<int, 3>& size) : m_size(size)
-        {
-                if (std::any_of(size.cbegin(), size.cend(), [](int v) { return v < 1; }))
-                {
-                        error("Error size " + to_string(size));
-                }
-
-                for (int i = 0; i < size[2]; ++i)
-                {
-                        m_images.emplace_back(std::array<int, 2>{size[0], size[1]});
-                }
-        }
-
-        void painter_pixel_before(const std::array<int_least16_t, 3>&) noexcept override
-        {
-        }
-
-        void painter_pixel_after(const std::array<int_least16_t, 3>& pixel, const Color& color) noexcept override
-        {
-                try
-                {
-                        m_images[pixel[2]].set_pixel(std::array<int, 2>{pixel[0], m_size[1] - 1 - pixel[1]}, color);
-                }
-                catch (...)
-                {
-                        error_fatal("Exception in painter pixel after");
-                }
-        }
-
-        void painter_error_message(const std::string& msg) noexcept override
-        {
-                LOG("Painter error message");
-                LOG(msg);
-        }
-
-        void write_to_files(const std::string& dir) const
-        {
-                int w = std::floor(std::log10(m_images.size())) + 1;
-
-                std::ostringstream oss;
-                oss << std::setfill('0');
-
-                for (unsigned i = 0; i < m_images.size(); ++i)
-                {
-                        oss.str("");
-                        oss << beginning_of_file_name << std::setw(w) << i + 1;
-                        m_images[i].write_to_file(dir + "/" + oss.str());
-                }
-        }
-};
-
 void check_application_instance()
 {
         if (!QApplication::instance())
@@ -116,42 +57,55 @@ template <size_t N, typename T>
 std::shared_ptr<const Mesh<N, T>> sphere_mesh(int point_count, int thread_count, ProgressRatio* progress)
 {
         LOG("Creating mesh...");
-        std::shared_ptr<const Mesh<N, T>> mesh = simplex_mesh_of_random_sphere<N, T>(point_count, thread_count, progress);
+        std::shared_ptr<const Mesh<N, T>> mesh = simplex_mesh_of_random_sphere<N, T>(point_count, thread_count, progress,
+                                                                                     default_mesh_acceleration<N>());
 
         return mesh;
 }
 
 template <size_t N, typename T>
-std::shared_ptr<const Mesh<N, T>> file_mesh(const std::string& file_name, int thread_count, ProgressRatio* progress)
+std::shared_ptr<const Mesh<N, T>> file_mesh(const std::string& file_name, int thread_count, ProgressRatio* progress,
+                                            MeshAcceleration acceleration)
 {
         constexpr Matrix<N + 1, N + 1, T> matrix(1);
 
-        LOG("Loading obj from file...");
-        std::unique_ptr<const Obj<N>> obj = load_obj_from_file<N>(file_name, progress);
-
-        LOG("Creating mesh...");
-        std::shared_ptr<const Mesh<N, T>> mesh = std::make_shared<const Mesh<N, T>>(obj.get(), matrix, thread_count, progress);
+        LOG("Loading obj from file and creating mesh...");
+        std::shared_ptr<const Mesh<N, T>> mesh = std::make_shared<const Mesh<N, T>>(
+                [&](ObjConsumer<N>* consumer) { load_obj_from_file<N>(file_name, progress, consumer); }, matrix, thread_count,
+                progress, acceleration);
 
         return mesh;
 }
 
 template <size_t N, typename T>
-void test_painter_file(int samples_per_pixel, int thread_count, std::unique_ptr<const PaintObjects<N, T>>&& paint_objects)
+void test_painter_file(int samples_per_pixel, int thread_count, std::unique_ptr<const PaintObjects<N, T>>&& paint_objects,
+                       PaintTracing tracing)
 {
-        constexpr int paint_height = 2;
+        constexpr int tile_size = 16;
         constexpr int max_pass_count = 1;
         constexpr bool smooth_normal = true;
+        constexpr unsigned long long random_seed = 0;
 
-        Images images(paint_objects->projector().screen_size());
+        PainterImages<N - 1> images(paint_objects->projector().screen_size());
 
-        VisibleBarPaintbrush<N - 1> paintbrush(paint_objects->projector().screen_size(), paint_height, max_pass_count);
+        VisibleTilePaintbrush<N - 1> paintbrush(paint_objects->projector().screen_size(), tile_size, max_pass_count);
 
         std::atomic_bool stop = false;
 
         LOG("Painting...");
         double start_time = time_in_seconds();
-        paint(&images, samples_per_pixel, *paint_objects, &paintbrush, thread_count, &stop, smooth_normal);
-        LOG("Painted, " + to_string_fixed(time_in_seconds() - start_time, 5) + " s");
+        paint(&images, samples_per_pixel, *paint_objects, &paintbrush, thread_count, &stop, smooth_normal, tracing,
+              PaintSampler::StratifiedJittered, PaintSampling::Uniform, PaintLightSampling::AllLights, random_seed,
+              PaintCheckpointOptions());
+        double duration = time_in_seconds() - start_time;
+        LOG("Painted, " + to_string_fixed(duration, 5) + " s");
+
+        long long pass_count, pixel_count, ray_count, sample_count, converged_pixel_count;
+        double previous_pass_duration;
+        paintbrush.statistics(&pass_count, &pixel_count, &ray_count, &sample_count, &converged_pixel_count,
+                              &previous_pass_duration);
+        LOG("Rays " + to_string_digit_groups(ray_count) + ", " + to_string_digit_groups(std::llround(ray_count / duration)) +
+            " rays/s");
 
         LOG("Writing screen images to files...");
         images.write_to_files(temp_directory());
@@ -182,7 +136,7 @@ enum class PainterTestOutputType
 
 template <PainterTestOutputType type, size_t N, typename T>
 void test_painter(const std::shared_ptr<const Mesh<N, T>>& mesh, int min_screen_size, int max_screen_size, int samples_per_pixel,
-                  int thread_count)
+                  int thread_count, PaintTracing tracing)
 {
         Color::DataType diffuse = 1;
 
@@ -193,7 +147,7 @@ void test_painter(const std::shared_ptr<const Mesh<N, T>>& mesh, int min_screen_
 
         if constexpr (type == PainterTestOutputType::File)
         {
-                test_painter_file(samples_per_pixel, thread_count, std::move(paint_objects));
+                test_painter_file(samples_per_pixel, thread_count, std::move(paint_objects), tracing);
         }
 
         if constexpr (type == PainterTestOutputType::Window)
@@ -210,7 +164,7 @@ void test_painter(int samples_per_pixel, int point_count, int min_screen_size, i
 
         std::shared_ptr<const Mesh<N, T>> mesh = sphere_mesh<N, T>(point_count, thread_count, &progress);
 
-        test_painter<type>(mesh, min_screen_size, max_screen_size, samples_per_pixel, thread_count);
+        test_painter<type>(mesh, min_screen_size, max_screen_size, samples_per_pixel, thread_count, PaintTracing::Packets);
 }
 
 template <size_t N, typename T, PainterTestOutputType type>
@@ -219,9 +173,49 @@ void test_painter(int samples_per_pixel, const std::string& file_name, int min_s
         const int thread_count = hardware_concurrency();
         ProgressRatio progress(nullptr);
 
-        std::shared_ptr<const Mesh<N, T>> mesh = file_mesh<N, T>(file_name, thread_count, &progress);
+        std::shared_ptr<const Mesh<N, T>> mesh =
+                file_mesh<N, T>(file_name, thread_count, &progress, default_mesh_acceleration<N>());
 
-        test_painter<type>(mesh, min_screen_size, max_screen_size, samples_per_pixel, thread_count);
+        test_painter<type>(mesh, min_screen_size, max_screen_size, samples_per_pixel, thread_count, PaintTracing::Packets);
+}
+
+const char* paint_tracing_name(PaintTracing tracing)
+{
+        switch (tracing)
+        {
+        case PaintTracing::Rays:
+                return "Ray tracing";
+        case PaintTracing::Packets:
+                return "Packet tracing";
+        case PaintTracing::Wavefront:
+                return "Wavefront tracing";
+        }
+        error_fatal("Unknown paint tracing");
+}
+
+// Сравнение структур поиска пересечений по времени построения и по количеству лучей
+// в секунду при трассировке путей по отдельности, с пакетами первичных лучей и по этапам
+template <size_t N, typename T>
+void test_painter_acceleration(int samples_per_pixel, const std::string& file_name, int min_screen_size, int max_screen_size)
+{
+        const int thread_count = hardware_concurrency();
+        ProgressRatio progress(nullptr);
+
+        for (MeshAcceleration acceleration : {MeshAcceleration::SpatialSubdivisionTree,
+                                              MeshAcceleration::BoundingVolumeHierarchy, MeshAcceleration::KdTree})
+        {
+                LOG(mesh_acceleration_name(acceleration));
+
+                std::shared_ptr<const Mesh<N, T>> mesh = file_mesh<N, T>(file_name, thread_count, &progress, acceleration);
+
+                for (PaintTracing tracing : {PaintTracing::Rays, PaintTracing::Packets, PaintTracing::Wavefront})
+                {
+                        LOG(paint_tracing_name(tracing));
+
+                        test_painter<PainterTestOutputType::File>(mesh, min_screen_size, max_screen_size, samples_per_pixel,
+                                                                  thread_count, tracing);
+                }
+        }
 }
 }
 
@@ -239,6 +233,13 @@ void test_painter_file(const std::string& file_name)
         test_painter<N, double, PainterTestOutputType::File>(samples_per_pixel, file_name, 10, 100);
 }
 
+void test_painter_acceleration(const std::string& file_name)
+{
+        constexpr unsigned N = 4;
+        int samples_per_pixel = 25;
+        test_painter_acceleration<N, double>(samples_per_pixel, file_name, 10, 100);
+}
+
 void test_painter_window()
 {
         constexpr unsigned N = 4;
@@ -20,6 +20,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "objects.h"
 
 #include "painter/paintbrushes/paintbrush.h"
+#include "painter/paintbrushes/tile_paintbrush.h"
 
 template <size_t N>
 class VisibleBarPaintbrush final : public Paintbrush<N>
@@ -53,9 +54,60 @@ public:
                 return m_paintbrush.next_pass();
         }
 
+        void pixel_converged(const std::array<int_least16_t, N>& pixel) noexcept override
+        {
+                m_paintbrush.pixel_converged(pixel);
+        }
+
+        void statistics(long long* pass_count, long long* pixel_count, long long* ray_count, long long* sample_count,
+                        long long* converged_pixel_count, double* previous_pass_duration) const noexcept override
+        {
+                m_paintbrush.statistics(pass_count, pixel_count, ray_count, sample_count, converged_pixel_count,
+                                        previous_pass_duration);
+        }
+};
+
+template <size_t N>
+class VisibleTilePaintbrush final : public Paintbrush<N>
+{
+        TilePaintbrush<N> m_paintbrush;
+
+public:
+        VisibleTilePaintbrush(const std::array<int, N>& screen_size, int tile_size, int max_pass_count)
+                : m_paintbrush(screen_size, tile_size, max_pass_count)
+        {
+        }
+
+        const std::array<int, N>& screen_size() const noexcept override
+        {
+                return m_paintbrush.screen_size();
+        }
+
+        void first_pass() noexcept override
+        {
+                m_paintbrush.first_pass();
+        }
+
+        bool next_pixel(int previous_pixel_ray_count, int previous_pixel_sample_count,
+                        std::array<int_least16_t, N>* pixel) noexcept override
+        {
+                return m_paintbrush.next_pixel(previous_pixel_ray_count, previous_pixel_sample_count, pixel);
+        }
+
+        bool next_pass() noexcept override
+        {
+                return m_paintbrush.next_pass();
+        }
+
+        void pixel_converged(const std::array<int_least16_t, N>& pixel) noexcept override
+        {
+                m_paintbrush.pixel_converged(pixel);
+        }
+
         void statistics(long long* pass_count, long long* pixel_count, long long* ray_count, long long* sample_count,
-                        double* previous_pass_duration) const noexcept override
+                        long long* converged_pixel_count, double* previous_pass_duration) const noexcept override
         {
-                m_paintbrush.statistics(pass_count, pixel_count, ray_count, sample_count, previous_pass_duration);
+                m_paintbrush.statistics(pass_count, pixel_count, ray_count, sample_count, converged_pixel_count,
+                                        previous_pass_duration);
         }
 };
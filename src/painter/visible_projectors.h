@@ -21,6 +21,13 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "painter/projectors/projector.h"
 
+enum class ProjectorType
+{
+        Parallel,
+        Perspective,
+        Spherical
+};
+
 template <size_t N, typename T>
 class VisiblePerspectiveProjector final : public Projector<N, T>
 {
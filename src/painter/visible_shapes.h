@@ -57,6 +57,31 @@ public:
                 return true;
         }
 
+        typename RayPacket<N, T>::Mask intersect_packet(const RayPacket<N, T>& packet, typename RayPacket<N, T>::Mask mask,
+                                                        T* t, const Surface<N, T>** surface,
+                                                        const void** /*intersection_data*/) const override
+        {
+                typename RayPacket<N, T>::Mask found = 0;
+                for (int i = 0; i < packet.size(); ++i)
+                {
+                        T distance;
+                        if (RayPacket<N, T>::contains(mask, i) &&
+                            m_hyperplane_parallelotope.intersect(packet.ray(i), &distance) && distance < t[i])
+                        {
+                                t[i] = distance;
+                                surface[i] = this;
+                                found |= RayPacket<N, T>::ray_mask(i);
+                        }
+                }
+                return found;
+        }
+
+        bool occluded(const Ray<N, T>& r, T max_distance) const override
+        {
+                T t;
+                return m_hyperplane_parallelotope.intersect(r, &t) && t < max_distance;
+        }
+
         SurfaceProperties<N, T> properties(const Vector<N, T>& p, const void* /*intersection_data*/) const override
         {
                 SurfaceProperties<N, T> s = *this;
@@ -101,6 +126,31 @@ public:
                 return true;
         }
 
+        typename RayPacket<N, T>::Mask intersect_packet(const RayPacket<N, T>& packet, typename RayPacket<N, T>::Mask mask,
+                                                        T* t, const Surface<N, T>** surface,
+                                                        const void** /*intersection_data*/) const override
+        {
+                typename RayPacket<N, T>::Mask found = 0;
+                for (int i = 0; i < packet.size(); ++i)
+                {
+                        T distance;
+                        if (RayPacket<N, T>::contains(mask, i) && m_parallelotope.intersect(packet.ray(i), &distance) &&
+                            distance < t[i])
+                        {
+                                t[i] = distance;
+                                surface[i] = this;
+                                found |= RayPacket<N, T>::ray_mask(i);
+                        }
+                }
+                return found;
+        }
+
+        bool occluded(const Ray<N, T>& r, T max_distance) const override
+        {
+                T t;
+                return m_parallelotope.intersect(r, &t) && t < max_distance;
+        }
+
         SurfaceProperties<N, T> properties(const Vector<N, T>& p, const void* /*intersection_data*/) const override
         {
                 SurfaceProperties<N, T> s = *this;
@@ -145,6 +195,26 @@ public:
                 }
         }
 
+        typename RayPacket<N, T>::Mask intersect_packet(const RayPacket<N, T>& packet, typename RayPacket<N, T>::Mask mask,
+                                                        T* t, const Surface<N, T>** surface,
+                                                        const void** intersection_data) const override
+        {
+                typename RayPacket<N, T>::Mask found = m_mesh->intersect_packet(packet, mask, t, intersection_data);
+                for (int i = 0; i < packet.size(); ++i)
+                {
+                        if (RayPacket<N, T>::contains(found, i))
+                        {
+                                surface[i] = this;
+                        }
+                }
+                return found;
+        }
+
+        bool occluded(const Ray<N, T>& r, T max_distance) const override
+        {
+                return m_mesh->occluded(r, max_distance);
+        }
+
         SurfaceProperties<N, T> properties(const Vector<N, T>& p, const void* intersection_data) const override
         {
                 SurfaceProperties<N, T> s = *this;
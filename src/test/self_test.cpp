@@ -22,7 +22,10 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "geometry/test/test_convex_hull.h"
 #include "geometry/test/test_reconstruction.h"
 #include "gpgpu/dft/test/test_dft.h"
+#include "painter/batch/test/test_batch_render.h"
+#include "painter/checkpoint/test/test_checkpoint.h"
 #include "painter/shapes/test/test_mesh.h"
+#include "painter/space/test/test_box_simplex_intersection.h"
 #include "painter/space/test/test_parallelotope.h"
 
 namespace
@@ -66,6 +69,22 @@ void self_test_essential(ProgressRatios* progress_ratios, const T& catch_all)
                 test_parallelotope(4);
         });
 
+        catch_all([&](std::string* test_name) {
+                *test_name = "Self-Test, Box-Simplex Intersection in " + space_name_upper(3);
+
+                ProgressRatio progress(progress_ratios, *test_name);
+                progress.set(0);
+                test_box_simplex_intersection(3);
+        });
+
+        catch_all([&](std::string* test_name) {
+                *test_name = "Self-Test, Box-Simplex Intersection in " + space_name_upper(4);
+
+                ProgressRatio progress(progress_ratios, *test_name);
+                progress.set(0);
+                test_box_simplex_intersection(4);
+        });
+
         catch_all([&](std::string* test_name) {
                 *test_name = "Self-Test, Mesh in " + space_name_upper(3);
 
@@ -119,6 +138,25 @@ void self_test_essential(ProgressRatios* progress_ratios, const T& catch_all)
 template <typename T>
 void self_test_extended(ProgressRatios* progress_ratios, const T& catch_all)
 {
+        catch_all([&](std::string* test_name) {
+                *test_name = "Self-Test, Paint Checkpoint";
+
+                ProgressRatio progress(progress_ratios, *test_name);
+                progress.set(0);
+                test_paint_checkpoint();
+        });
+
+#if defined(__linux__)
+        // Запуск копий программы в отдельных процессах есть только в Linux
+        catch_all([&](std::string* test_name) {
+                *test_name = "Self-Test, Batch Render Workers";
+
+                ProgressRatio progress(progress_ratios, *test_name);
+                progress.set(0);
+                test_batch_render_workers();
+        });
+#endif
+
         catch_all([&](std::string* test_name) {
                 *test_name = "Self-Test, Convex Hull in " + space_name_upper(5);
 
@@ -126,6 +164,22 @@ void self_test_extended(ProgressRatios* progress_ratios, const T& catch_all)
                 test_convex_hull(5, &progress);
         });
 
+        catch_all([&](std::string* test_name) {
+                *test_name = "Self-Test, Box-Simplex Intersection in " + space_name_upper(5);
+
+                ProgressRatio progress(progress_ratios, *test_name);
+                progress.set(0);
+                test_box_simplex_intersection(5);
+        });
+
+        catch_all([&](std::string* test_name) {
+                *test_name = "Self-Test, Box-Simplex Intersection in " + space_name_upper(6);
+
+                ProgressRatio progress(progress_ratios, *test_name);
+                progress.set(0);
+                test_box_simplex_intersection(6);
+        });
+
         catch_all([&](std::string* test_name) {
                 *test_name = "Self-Test, Mesh in " + space_name_upper(5);
 
@@ -86,7 +86,7 @@ void painting(const std::shared_ptr<const Mesh<3, double>>& mesh, const Painting
                 title = info_all.window_title + " (" + info_all.object_name + " in Cornell Box)";
 
                 scene = cornell_box_scene(width, height, mesh, info_3d.object_size, info_all.default_color, info_all.diffuse,
-                                          info_3d.camera_direction, info_3d.camera_up);
+                                          info_3d.camera_direction, info_3d.camera_up, ProjectorType::Perspective);
         }
 
         create_and_show_delete_on_close_window<PainterWindow<3, double>>(title, thread_count, samples_per_pixel, !flat_facets,
@@ -23,7 +23,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <algorithm>
 
-constexpr int PANTBRUSH_WIDTH = 20;
+constexpr int PANTBRUSH_WIDTH = 16;
+constexpr unsigned long long PAINT_RANDOM_SEED = 0;
 
 constexpr QRgb DEFAULT_COLOR_LIGHT = qRgb(100, 150, 200);
 constexpr QRgb DEFAULT_COLOR_DARK = qRgb(0, 0, 0);
@@ -95,9 +96,10 @@ long long PainterWindow<N, T>::offset_for_slider_positions(const std::vector<int
 
 template <size_t N, typename T>
 void PainterWindow<N, T>::painter_statistics(long long* pass_count, long long* pixel_count, long long* ray_count,
-                                             long long* sample_count, double* previous_pass_duration) const noexcept
+                                             long long* sample_count, long long* converged_pixel_count,
+                                             double* previous_pass_duration) const noexcept
 {
-        m_paintbrush.statistics(pass_count, pixel_count, ray_count, sample_count, previous_pass_duration);
+        m_paintbrush.statistics(pass_count, pixel_count, ray_count, sample_count, converged_pixel_count, previous_pass_duration);
 }
 
 template <size_t N, typename T>
@@ -130,6 +132,18 @@ void PainterWindow<N, T>::painter_pixel_after(const std::array<int_least16_t, N_
         set_pixel(pixel_index(p), color);
 }
 
+template <size_t N, typename T>
+void PainterWindow<N, T>::painter_pixels_after(const Span<const PainterPixel<N_IMAGE>>& pixels) noexcept
+{
+        for (const PainterPixel<N_IMAGE>& pixel : pixels)
+        {
+                std::array<int_least16_t, N_IMAGE> p = pixel.pixel;
+                p[1] = m_height - 1 - p[1];
+
+                set_pixel(pixel_index(p), pixel.color);
+        }
+}
+
 template <size_t N, typename T>
 void PainterWindow<N, T>::painter_error_message(const std::string& msg) noexcept
 {
@@ -182,7 +196,9 @@ PainterWindow<N, T>::PainterWindow(const std::string& title, unsigned thread_cou
         m_stop = false;
         m_thread_working = true;
         m_thread = std::thread([=]() noexcept {
-                paint(this, samples_per_pixel, *m_paint_objects, &m_paintbrush, thread_count, &m_stop, smooth_normal);
+                paint(this, samples_per_pixel, *m_paint_objects, &m_paintbrush, thread_count, &m_stop, smooth_normal,
+                      PaintTracing::Packets, PaintSampler::Sobol, PaintSampling::Adaptive, PaintLightSampling::OneLight,
+                      PAINT_RANDOM_SEED, PaintCheckpointOptions());
                 m_thread_working = false;
         });
 }
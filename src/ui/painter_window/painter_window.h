@@ -44,7 +44,7 @@ class PainterWindow final : public PainterWindow2d, public PainterNotifier<N - 1
         long long m_slice_offset;
         std::vector<quint32> m_data, m_data_clean;
 
-        VisibleBarPaintbrush<N_IMAGE> m_paintbrush;
+        VisibleTilePaintbrush<N_IMAGE> m_paintbrush;
         std::atomic_bool m_stop;
         std::atomic_bool m_thread_working;
 
@@ -59,13 +59,14 @@ class PainterWindow final : public PainterWindow2d, public PainterNotifier<N - 1
 
         // PainterWindow2d
         void painter_statistics(long long* pass_count, long long* pixel_count, long long* ray_count, long long* sample_count,
-                                double* previous_pass_duration) const noexcept override;
+                                long long* converged_pixel_count, double* previous_pass_duration) const noexcept override;
         void slider_positions_change_event(const std::vector<int>& slider_positions) override;
         const quint32* pixel_pointer(bool show_threads) const noexcept override;
 
         // IPainterNotifier
         void painter_pixel_before(const std::array<int_least16_t, N_IMAGE>& pixel) noexcept override;
         void painter_pixel_after(const std::array<int_least16_t, N_IMAGE>& pixel, const Color& color) noexcept override;
+        void painter_pixels_after(const Span<const PainterPixel<N_IMAGE>>& pixels) noexcept override;
         void painter_error_message(const std::string& msg) noexcept override;
 
 public:
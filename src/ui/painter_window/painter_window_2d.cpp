@@ -190,6 +190,7 @@ void PainterWindow2d::init_interface(const std::vector<int>& initial_slider_posi
         ui.label_ray_count->setText("");
         ui.label_pass_count->setText("");
         ui.label_samples_per_pixel->setText("");
+        ui.label_converged_pixel_count->setText("");
 
         ui.scrollAreaWidgetContents->layout()->setContentsMargins(0, 0, 0, 0);
         ui.scrollAreaWidgetContents->layout()->setSpacing(0);
@@ -301,10 +302,11 @@ void PainterWindow2d::first_shown()
 
 void PainterWindow2d::update_statistics()
 {
-        long long pass_count, pixel_count, ray_count, sample_count;
+        long long pass_count, pixel_count, ray_count, sample_count, converged_pixel_count;
         double previous_pass_duration;
 
-        painter_statistics(&pass_count, &pixel_count, &ray_count, &sample_count, &previous_pass_duration);
+        painter_statistics(&pass_count, &pixel_count, &ray_count, &sample_count, &converged_pixel_count,
+                           &previous_pass_duration);
 
         auto [ray_diff, sample_diff, pixel_diff, time_diff] = m_difference->compute({ray_count, sample_count, pixel_count});
 
@@ -318,6 +320,7 @@ void PainterWindow2d::update_statistics()
         set_text_and_minimum_width(ui.label_pass_count, to_string_digit_groups(pass_count));
         set_text_and_minimum_width(ui.label_samples_per_pixel, to_string_digit_groups(samples_per_pixel));
         set_text_and_minimum_width(ui.label_milliseconds_per_frame, to_string_digit_groups(milliseconds_per_frame));
+        set_text_and_minimum_width(ui.label_converged_pixel_count, to_string_digit_groups(converged_pixel_count));
 }
 
 void PainterWindow2d::update_points()
@@ -71,7 +71,8 @@ private:
         void update_statistics();
 
         virtual void painter_statistics(long long* pass_count, long long* pixel_count, long long* ray_count,
-                                        long long* sample_count, double* previous_pass_duration) const noexcept = 0;
+                                        long long* sample_count, long long* converged_pixel_count,
+                                        double* previous_pass_duration) const noexcept = 0;
         virtual void slider_positions_change_event(const std::vector<int>& slider_positions) = 0;
         virtual const quint32* pixel_pointer(bool show_threads) const noexcept = 0;
 